@@ -1867,6 +1867,114 @@ je_malloc_usable_size(JEMALLOC_USABLE_SIZE_CONST void *ptr)
  * End non-standard functions.
  */
 /******************************************************************************/
+/*
+ * Begin Redis specific functions.
+ */
+
+/*
+ * Allocate and free bypassing the thread cache.  Used when moving allocations
+ * to defragment memory: the new region comes from the lowest non-full run of
+ * its bin, and the old region is returned to its run immediately instead of
+ * being recycled by the next allocation of the same size.
+ */
+void *
+je_malloc_no_tcache(size_t size)
+{
+	void *p;
+	size_t usize;
+
+	assert(size != 0);
+
+	if (malloc_init())
+		return (NULL);
+	usize = s2u(size);
+	p = imalloct(usize, false, NULL);
+	if (p == NULL)
+		return (NULL);
+	if (config_stats)
+		thread_allocated_tsd_get()->allocated += usize;
+	UTRACE(0, size, p);
+	JEMALLOC_VALGRIND_MALLOC(true, p, usize, false);
+	return (p);
+}
+
+void
+je_free_no_tcache(void *ptr)
+{
+	size_t usize;
+	UNUSED size_t rzsize JEMALLOC_CC_SILENCE_INIT(0);
+
+	assert(ptr != NULL);
+	assert(malloc_initialized || IS_INITIALIZER);
+
+	UTRACE(ptr, 0, 0);
+	if (config_stats || config_valgrind || (config_prof && opt_prof))
+		usize = isalloc(ptr, config_prof);
+	if (config_prof && opt_prof)
+		prof_free(ptr, usize);
+	if (config_stats)
+		thread_allocated_tsd_get()->deallocated += usize;
+	if (config_valgrind && opt_valgrind)
+		rzsize = p2rz(ptr);
+	iqalloct(ptr, false);
+	JEMALLOC_VALGRIND_FREE(ptr, rzsize);
+}
+
+/*
+ * Return 1 if the small region 'ptr' is worth moving to defragment memory,
+ * filling 'bin_util' and 'run_util' with the utilization of its bin and of
+ * its run (fixed point, 1<<16 meaning full).  The caller should move the
+ * region only when its run is less utilized than the bin on average: the
+ * run is then likely to be emptied and released.  Large and huge regions,
+ * and the regions in the chunk of the run currently used for allocations
+ * (likely to be filled next), are never moved.  Requires statistics.
+ */
+int
+je_get_defrag_hint(void *ptr, int *bin_util, int *run_util)
+{
+	arena_chunk_t *chunk;
+	arena_run_t *run;
+	arena_bin_t *bin;
+	arena_bin_info_t *bin_info;
+	size_t pageind, mapbits, binind;
+	int defrag = 0;
+
+	assert(ptr != NULL);
+
+	if (config_stats == false)
+		return (0);
+	chunk = (arena_chunk_t *)CHUNK_ADDR2BASE(ptr);
+	if (chunk == ptr)
+		return (0);
+	pageind = ((uintptr_t)ptr - (uintptr_t)chunk) >> LG_PAGE;
+	mapbits = arena_mapbits_get(chunk, pageind);
+	if ((mapbits & CHUNK_MAP_LARGE) != 0)
+		return (0);
+	run = (arena_run_t *)((uintptr_t)chunk + (uintptr_t)((pageind -
+	    arena_mapbits_small_runind_get(chunk, pageind)) << LG_PAGE));
+	bin = run->bin;
+	binind = arena_ptr_small_binind_get(ptr, mapbits);
+	bin_info = &arena_bin_info[binind];
+
+	malloc_mutex_lock(&bin->lock);
+	if (chunk != (arena_chunk_t *)CHUNK_ADDR2BASE(bin->runcur)) {
+		size_t availregs = bin_info->nregs * bin->stats.curruns;
+		size_t curregs = bin->stats.allocated / bin_info->reg_size;
+
+		*bin_util = (int)((curregs << 16) / availregs);
+		*run_util = (int)(((bin_info->nregs - run->nfree) << 16) /
+		    bin_info->nregs);
+		defrag = 1;
+	}
+	malloc_mutex_unlock(&bin->lock);
+
+	return (defrag);
+}
+
+/*
+ * End Redis specific functions.
+ */
+/******************************************************************************/
 /*
  * Begin experimental functions.
  */
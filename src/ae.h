@@ -74,7 +74,7 @@ typedef struct aeTimeEvent {
     aeTimeProc *timeProc;
     aeEventFinalizerProc *finalizerProc;
     void *clientData;
-    struct aeTimeEvent *next;
+    int heapIndex; /* Position in the timers heap of the event loop. */
 } aeTimeEvent;
 
 /* A fired event */
@@ -91,7 +91,11 @@ typedef struct aeEventLoop {
     time_t lastTime;     /* Used to detect system clock skew */
     aeFileEvent *events; /* Registered events */
     aeFiredEvent *fired; /* Fired events */
-    aeTimeEvent *timeEventHead;
+    aeTimeEvent **timeEventHeap; /* Time events, binary min-heap by time */
+    int timeEventCount;          /* Number of time events registered */
+    int timeEventHeapSize;       /* Allocated slots in timeEventHeap */
+    aeTimeEvent **timeEventTable; /* Time events by ID (open addressing) */
+    int timeEventTableSize;      /* Allocated slots, always a power of two */
     int stop;
     void *apidata; /* This is used for polling API specific data */
     aeBeforeSleepProc *beforesleep;
@@ -117,8 +117,11 @@ void processUnblockedClients(void) {
         listDelNode(server.unblocked_clients,ln);
         c->flags &= ~REDIS_UNBLOCKED;
 
-        /* Process remaining data in the input buffer. */
-        if (c->querybuf && sdslen(c->querybuf) > 0) {
+        /* Process remaining data in the input buffer, or the command
+         * already parsed by an I/O thread. */
+        if (c->querybuf && (sdslen(c->querybuf) > c->qb_pos ||
+                            c->flags & REDIS_PENDING_COMMAND))
+        {
             server.current_client = c;
             processInputBuffer(c);
             server.current_client = NULL;
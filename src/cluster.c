@@ -452,7 +452,7 @@ void clusterInit(void) {
     }
 
     if (listenToPort(server.port+REDIS_CLUSTER_PORT_INCR,
-        server.cfd,&server.cfd_count) == REDIS_ERR)
+        server.cfd,&server.cfd_count,0) == REDIS_ERR)
     {
         exit(1);
     } else {
@@ -495,7 +495,7 @@ void clusterReset(int hard) {
     if (nodeIsSlave(myself)) {
         clusterSetNodeAsMaster(myself);
         replicationUnsetMaster();
-        emptyDb(NULL);
+        emptyDb(REDIS_EMPTYDB_NO_FLAGS,NULL);
     }
 
     /* Close slots, reset manual failover state. */
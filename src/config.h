@@ -71,6 +71,12 @@
 #define HAVE_EPOLL 1
 #endif
 
+/* The io_uring backend is opt-in at build time (make USE_IOURING=yes), and
+ * falls back to epoll at runtime if the kernel does not support it. */
+#if defined(__linux__) && defined(USE_IOURING)
+#define HAVE_IOURING 1
+#endif
+
 #if (defined(__APPLE__) && defined(MAC_OS_X_VERSION_10_6)) || defined(__FreeBSD__) || defined(__OpenBSD__) || defined (__NetBSD__)
 #define HAVE_KQUEUE 1
 #endif
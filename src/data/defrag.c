@@ -0,0 +1,530 @@
+/* Active memory defragmentation.
+ *
+ * After a change of workload the allocator may be left with many pages
+ * holding just a few live allocations: the memory is not returned to the
+ * system, and the fragmentation ratio stays high until a restart. When the
+ * 'activedefrag' option is enabled, serverCron() incrementally scans the
+ * keyspace and moves the allocations composing the keys and their values
+ * out of the sparse pages, so that these pages become empty and can be
+ * released.
+ *
+ * Only jemalloc can tell us which allocations are worth moving: our copy
+ * exports je_get_defrag_hint(), that reports the utilization of the run
+ * (the pages of a given size class) holding an allocation, compared with
+ * the average utilization of the runs of the same size. Allocations are
+ * moved with the thread cache bypassed, so that the new copy lands in the
+ * lowest non full run, and the freed region is not reused at once.
+ *
+ * An allocation can be moved only if every pointer to it can be updated:
+ * objects with more than one reference, and the elements of sorted sets
+ * (shared by the dictionary and the skiplist or B+tree) are never moved.
+ *
+ * Most values are defragged at once when the scan finds their key. Values
+ * with more than active-defrag-max-scan-fields elements could take far
+ * longer than the time limit of a cycle, so their key names are queued
+ * instead, and their elements are walked from a saved cursor across as
+ * many cron calls as needed, before the scan of the keyspace goes on.
+ *
+ * ----------------------------------------------------------------------------
+ *
+ * Copyright (c) 2009-2012, Salvatore Sanfilippo <antirez at gmail dot com>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *   * Redistributions of source code must retain the above copyright notice,
+ *     this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *   * Neither the name of Redis nor the names of its contributors may be used
+ *     to endorse or promote products derived from this software without
+ *     specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "redis.h"
+
+/* Return the fragmentation of the allocator as a percentage of the memory
+ * allocated, setting '*out_frag_bytes' to the bytes wasted, if not NULL.
+ * This is the fragmentation that active defrag can fix, see
+ * zmalloc_get_allocator_info(). */
+float getAllocatorFragmentation(size_t *out_frag_bytes) {
+    size_t allocated, active;
+
+    if (!zmalloc_get_allocator_info(&allocated,&active) ||
+        allocated == 0 || active < allocated)
+    {
+        if (out_frag_bytes) *out_frag_bytes = 0;
+        return 0;
+    }
+    if (out_frag_bytes) *out_frag_bytes = active-allocated;
+    return ((float)active/allocated)*100-100;
+}
+
+#ifdef HAVE_DEFRAG
+
+/* Move the allocation 'ptr' if it lives in a run that is less utilized than
+ * the average of its size class. Returns the new pointer, the old one being
+ * no longer valid, or NULL if the allocation was not moved. */
+static void *activeDefragAlloc(void *ptr) {
+    int bin_util, run_util;
+    size_t size;
+    void *newptr;
+
+    if (!je_get_defrag_hint(ptr,&bin_util,&run_util) ||
+        run_util > bin_util || run_util == 1<<16)
+    {
+        server.stat_active_defrag_misses++;
+        return NULL;
+    }
+    size = zmalloc_size(ptr);
+    newptr = zmalloc_no_tcache(size);
+    memcpy(newptr,ptr,size);
+    zfree_no_tcache(ptr);
+    server.stat_active_defrag_hits++;
+    return newptr;
+}
+
+/* Like activeDefragAlloc() but for an sds string, that does not point to
+ * the start of its allocation. */
+static sds activeDefragSds(sds s) {
+    void *ptr = sdsAllocPtr(s), *newptr;
+    size_t offset = s-(char*)ptr;
+
+    if ((newptr = activeDefragAlloc(ptr)) == NULL) return NULL;
+    return (char*)newptr+offset;
+}
+
+/* Like activeDefragAlloc() but for a dictionary entry, that may hold its
+ * key in the same allocation (see the keyEmbed method of dictType). */
+static dictEntry *activeDefragDictEntry(dictEntry *de) {
+    char *key = dictGetKey(de), *base = (char*)de;
+    int embedded = key >= base && key < base+zmalloc_size(de);
+    dictEntry *newde;
+
+    if ((newde = activeDefragAlloc(de)) == NULL) return NULL;
+    if (embedded) newde->key = (char*)newde+(key-base);
+    return newde;
+}
+
+/* Defrag the string object 'o' and its string. Returns the new object, or
+ * NULL if the object itself was not moved. */
+static robj *activeDefragStringOb(robj *o) {
+    robj *newo;
+
+    if (o->refcount != 1) return NULL;
+    if (o->encoding == REDIS_ENCODING_EMBSTR) {
+        /* The string is in the same allocation of the object. */
+        size_t offset = (char*)o->ptr-(char*)o;
+
+        if ((newo = activeDefragAlloc(o)) == NULL) return NULL;
+        newo->ptr = (char*)newo+offset;
+        return newo;
+    }
+    if (o->encoding == REDIS_ENCODING_RAW) {
+        sds news = activeDefragSds(o->ptr);
+
+        if (news) o->ptr = news;
+    }
+    return activeDefragAlloc(o);
+}
+
+/* dictScanDefrag() callback for the dictionaries of sets and hashes: the
+ * elements of the set, or the fields and values of the hash, are string
+ * objects that are moved as well. */
+static dictEntry *defragObjectsDictCallback(void *privdata, dictEntry *de) {
+    robj *newo;
+
+    REDIS_NOTUSED(privdata);
+    if ((newo = activeDefragStringOb(dictGetKey(de))) != NULL)
+        de->key = newo;
+    if (dictGetVal(de) && (newo = activeDefragStringOb(dictGetVal(de))))
+        de->v.val = newo;
+    return activeDefragDictEntry(de);
+}
+
+/* dictScanDefrag() callback only moving the entries, used for sorted sets,
+ * whose elements are also referenced by the skiplist or B+tree. */
+static dictEntry *defragEntriesDictCallback(void *privdata, dictEntry *de) {
+    REDIS_NOTUSED(privdata);
+    return activeDefragDictEntry(de);
+}
+
+/* Defrag the dictionary 'd' and its entries with 'fn'. Returns the new
+ * dictionary or NULL if the dictionary structure was not moved. */
+static dict *activeDefragDict(dict *d, dictDefragFunction *fn) {
+    unsigned long cursor = 0;
+
+    do {
+        cursor = dictScanDefrag(d,cursor,fn,NULL);
+    } while(cursor);
+    return activeDefragAlloc(d);
+}
+
+/* Defrag the quicklist 'ql', its nodes and their listpacks. Returns the new
+ * quicklist or NULL if the quicklist structure was not moved. */
+static quicklist *activeDefragQuicklist(quicklist *ql) {
+    quicklist *newql = activeDefragAlloc(ql);
+    quicklistNode *node, *newnode;
+    unsigned char *newentry;
+
+    if (newql) ql = newql;
+    for (node = ql->head; node; node = node->next) {
+        if ((newnode = activeDefragAlloc(node)) != NULL) {
+            node = newnode;
+            if (node->prev) node->prev->next = node; else ql->head = node;
+            if (node->next) node->next->prev = node; else ql->tail = node;
+        }
+        if ((newentry = activeDefragAlloc(node->entry)) != NULL)
+            node->entry = newentry;
+    }
+    return newql;
+}
+
+/* Defrag the value 'o' and everything it is composed of. Returns the new
+ * object, or NULL if the object itself was not moved. */
+static robj *activeDefragObject(robj *o) {
+    void *newptr;
+
+    if (o->refcount != 1) return NULL;
+    if (o->type == REDIS_STRING) return activeDefragStringOb(o);
+
+    if (o->type == REDIS_LIST) {
+        newptr = activeDefragQuicklist(o->ptr);
+    } else if (o->type == REDIS_SET && o->encoding == REDIS_ENCODING_HT) {
+        newptr = activeDefragDict(o->ptr,defragObjectsDictCallback);
+    } else if (o->type == REDIS_HASH && o->encoding == REDIS_ENCODING_HT) {
+        newptr = activeDefragDict(o->ptr,defragObjectsDictCallback);
+    } else if (o->type == REDIS_ZSET &&
+               (o->encoding == REDIS_ENCODING_SKIPLIST ||
+                o->encoding == REDIS_ENCODING_BTREE))
+    {
+        zset *zs = o->ptr;
+        dict *newd = activeDefragDict(zs->dict,defragEntriesDictCallback);
+
+        if (newd) zs->dict = newd;
+        newptr = activeDefragAlloc(zs);
+    } else {
+        /* Intsets and listpacks are a single allocation. */
+        newptr = activeDefragAlloc(o->ptr);
+    }
+    if (newptr) o->ptr = newptr;
+    return activeDefragAlloc(o);
+}
+
+/* Keys of the database being scanned whose values are too big to be
+ * defragged at once, and the position reached in the value at the head of
+ * the queue: a dict scan cursor, or the index of a quicklist node. */
+static list *defrag_later = NULL;
+static unsigned long defrag_later_cursor = 0;
+
+/* dictScanDefrag() callback for the keyspace: defrag the entry, holding the
+ * key, and the value. The expires dictionary references the key stored in
+ * the entry, so it is updated when the entry moves. */
+static dictEntry *defragKeyCallback(void *privdata, dictEntry *de) {
+    redisDb *db = privdata;
+    long long hits = server.stat_active_defrag_hits;
+    dictEntry *newde, *exde = NULL;
+    robj *val = dictGetVal(de), *newo;
+
+    if (val->refcount == 1 &&
+        lazyfreeGetFreeEffort(val) > server.active_defrag_max_scan_fields)
+    {
+        /* Just the object now, the elements later: see defragLaterItem(). */
+        listAddNodeTail(defrag_later,sdsdup(dictGetKey(de)));
+        newo = activeDefragAlloc(val);
+    } else {
+        newo = activeDefragObject(val);
+    }
+    if (newo) dictSetVal(db->dict,de,newo);
+    if (dictSize(db->expires)) exde = dictFind(db->expires,dictGetKey(de));
+    if ((newde = activeDefragDictEntry(de)) != NULL && exde)
+        exde->key = dictGetKey(newde);
+
+    if (server.stat_active_defrag_hits != hits)
+        server.stat_active_defrag_key_hits++;
+    else
+        server.stat_active_defrag_key_misses++;
+    return newde;
+}
+
+/* Return 1 if the time limit of the cycle, 'endtime' in microseconds, was
+ * reached. The clock is only read every 16 steps, or every 1000 moved
+ * allocations since a single step may move a lot: 'iterations' and 'hits'
+ * hold the state of the caller between calls. */
+static int defragTimeLimitReached(long long endtime, unsigned int *iterations,
+                                  long long *hits)
+{
+    if (++(*iterations) <= 16 && server.stat_active_defrag_hits-*hits <= 1000)
+        return 0;
+    *iterations = 0;
+    *hits = server.stat_active_defrag_hits;
+    return ustime() > endtime;
+}
+
+/* Defrag the quicklist 'ql' starting from the node at index 'cursor', until
+ * the end of the list or of the time limit 'endtime'. Returns the index of the next
+ * node to defrag, or 0 if the end of the list was reached.
+ *
+ * Nodes may be added and removed between two calls, so a pointer to the
+ * next node can't be saved: the list is walked again from the nearest end
+ * at every call, that is at most once per cycle. */
+static unsigned long defragLaterQuicklist(quicklist *ql, unsigned long cursor,
+                                          long long endtime)
+{
+    quicklistNode *node, *newnode;
+    unsigned char *newentry;
+    unsigned long j, len = ql->len;
+    unsigned int iterations = 0;
+    long long hits = server.stat_active_defrag_hits;
+
+    if (cursor >= len) return 0;
+    if (cursor < len/2) {
+        for (node = ql->head, j = 0; j < cursor; j++) node = node->next;
+    } else {
+        for (node = ql->tail, j = len-1; j > cursor; j--) node = node->prev;
+    }
+    while (node) {
+        if ((newnode = activeDefragAlloc(node)) != NULL) {
+            node = newnode;
+            if (node->prev) node->prev->next = node; else ql->head = node;
+            if (node->next) node->next->prev = node; else ql->tail = node;
+        }
+        if ((newentry = activeDefragAlloc(node->entry)) != NULL)
+            node->entry = newentry;
+        node = node->next;
+        cursor++;
+        if (node && defragTimeLimitReached(endtime,&iterations,&hits))
+            return cursor;
+    }
+    return 0;
+}
+
+/* Defrag the elements of the value of 'key' in 'db', resuming from
+ * defrag_later_cursor. Returns 1 if the value is done, 0 if the time limit
+ * was reached first.
+ *
+ * The key may be deleted, or its value replaced, before the work is
+ * complete, so the value is looked up again at every call. A cursor that
+ * belongs to the old value is still valid for the new one: at worst some
+ * of its elements are skipped or visited twice. */
+static int defragLaterItem(redisDb *db, sds key, long long endtime) {
+    dictEntry *de = dictFind(db->dict,key);
+    unsigned int iterations = 0;
+    long long hits = server.stat_active_defrag_hits;
+    robj *o;
+
+    if (de == NULL) return 1;
+    o = dictGetVal(de);
+    if (o->refcount != 1) return 1;
+
+    if (o->type == REDIS_LIST && o->encoding == REDIS_ENCODING_QUICKLIST) {
+        quicklist *ql = o->ptr;
+
+        if (defrag_later_cursor == 0 && (ql = activeDefragAlloc(ql)) != NULL)
+            o->ptr = ql;
+        defrag_later_cursor = defragLaterQuicklist(o->ptr,
+            defrag_later_cursor,endtime);
+        return defrag_later_cursor == 0;
+    } else if ((o->type == REDIS_SET || o->type == REDIS_HASH) &&
+               o->encoding == REDIS_ENCODING_HT)
+    {
+        dict *d = o->ptr;
+
+        if (defrag_later_cursor == 0 && (d = activeDefragAlloc(d)) != NULL)
+            o->ptr = d;
+        do {
+            defrag_later_cursor = dictScanDefrag(o->ptr,defrag_later_cursor,
+                defragObjectsDictCallback,NULL);
+            if (defrag_later_cursor &&
+                defragTimeLimitReached(endtime,&iterations,&hits)) return 0;
+        } while(defrag_later_cursor);
+    } else if (o->type == REDIS_ZSET &&
+               (o->encoding == REDIS_ENCODING_SKIPLIST ||
+                o->encoding == REDIS_ENCODING_BTREE))
+    {
+        zset *zs = o->ptr, *newzs;
+        dict *d;
+
+        if (defrag_later_cursor == 0) {
+            if ((newzs = activeDefragAlloc(zs)) != NULL) o->ptr = zs = newzs;
+            if ((d = activeDefragAlloc(zs->dict)) != NULL) zs->dict = d;
+        }
+        do {
+            defrag_later_cursor = dictScanDefrag(zs->dict,defrag_later_cursor,
+                defragEntriesDictCallback,NULL);
+            if (defrag_later_cursor &&
+                defragTimeLimitReached(endtime,&iterations,&hits)) return 0;
+        } while(defrag_later_cursor);
+    }
+    /* Other encodings: the value shrank to a single allocation, that
+     * was already moved with the object. */
+    return 1;
+}
+
+/* Defrag the values queued in defrag_later by the scan of 'db'. Returns 1
+ * if the queue is empty, 0 if the time limit was reached first. */
+static int defragLater(redisDb *db, long long endtime) {
+    listNode *ln;
+
+    while ((ln = listFirst(defrag_later)) != NULL) {
+        if (!defragLaterItem(db,listNodeValue(ln),endtime)) return 0;
+        listDelNode(defrag_later,ln);
+        defrag_later_cursor = 0;
+    }
+    return 1;
+}
+
+/* Linear interpolation of 'x' from the range [x1,x2] to [y1,y2], with the
+ * result clamped to the destination range. */
+static int defragInterpolate(float x, float x1, float x2, int y1, int y2) {
+    int y = y1+(x-x1)*(y2-y1)/(x2-x1);
+
+    if (y < y1) y = y1;
+    if (y > y2) y = y2;
+    return y;
+}
+
+/* Database and keyspace cursor of the scan in progress. */
+static int defrag_db = -1;
+static unsigned long defrag_cursor = 0;
+static long long defrag_start_scan, defrag_start_hits;
+
+/* Reset the state of the scan, either complete or interrupted. */
+static void defragResetScan(void) {
+    defrag_db = -1;
+    defrag_cursor = 0;
+    listEmpty(defrag_later);
+    defrag_later_cursor = 0;
+    server.active_defrag_running = 0;
+}
+
+/* Go on with the scan of the keyspace until it is complete, or until the
+ * time limit 'endtime' is reached. */
+static void activeDefragScan(long long endtime) {
+    unsigned int iterations = 0;
+    long long hits = server.stat_active_defrag_hits;
+    redisDb *db;
+
+    while(1) {
+        /* The big values found so far must be completed before moving to
+         * the next database, since they are queued by name. */
+        if (listLength(defrag_later)) {
+            if (!defragLater(server.db+defrag_db,endtime)) return;
+            iterations = 0;
+            hits = server.stat_active_defrag_hits;
+        }
+
+        if (!defrag_cursor) {
+            /* Move to the next database, or stop if the scan is complete. */
+            if (++defrag_db >= server.dbnum) {
+                size_t frag_bytes;
+                float frag_pct = getAllocatorFragmentation(&frag_bytes);
+
+                redisLog(REDIS_VERBOSE,
+                    "Active defrag done in %lldms, reallocated=%lld, "
+                    "frag=%.0f%%, frag_bytes=%zu",
+                    (ustime()-defrag_start_scan)/1000,
+                    server.stat_active_defrag_hits-defrag_start_hits,
+                    frag_pct, frag_bytes);
+                defragResetScan();
+                return;
+            } else if (defrag_db == 0) {
+                defrag_start_scan = ustime();
+                defrag_start_hits = server.stat_active_defrag_hits;
+            }
+        }
+
+        db = server.db+defrag_db;
+        do {
+            defrag_cursor = dictScanDefrag(db->dict,defrag_cursor,
+                defragKeyCallback,db);
+            if (listLength(defrag_later)) break;
+            if (defrag_cursor &&
+                defragTimeLimitReached(endtime,&iterations,&hits)) return;
+        } while(defrag_cursor);
+    }
+}
+
+/* Perform incremental defragmentation work from serverCron().
+ *
+ * Once per second the fragmentation of the allocator is checked: a scan of
+ * all the databases starts when it is over both active-defrag-ignore-bytes
+ * and active-defrag-threshold-lower. The CPU time spent at every call grows
+ * with the fragmentation, from active-defrag-cycle-min percent of the time
+ * at the lower threshold to active-defrag-cycle-max percent at the upper
+ * one, the same way as activeExpireCycle() time limits. Once the scan is
+ * complete the fragmentation is checked again. */
+void activeDefragCycle(void) {
+    long long start, timelimit, latency;
+
+    if (defrag_later == NULL) {
+        defrag_later = listCreate();
+        listSetFreeMethod(defrag_later,(void (*)(void*))sdsfree);
+    }
+
+    if (!server.active_defrag_enabled) {
+        /* Defrag may be disabled in the middle of a scan. */
+        if (server.active_defrag_running) defragResetScan();
+        return;
+    }
+
+    /* Moving memory while a child shares our pages would just trigger
+     * copy on write of the moved data. */
+    if (server.rdb_child_pid != -1 || server.aof_child_pid != -1) return;
+
+    run_with_period(1000) {
+        size_t frag_bytes;
+        float frag_pct = getAllocatorFragmentation(&frag_bytes);
+        int cpu_pct;
+
+        if (!server.active_defrag_running &&
+            (frag_pct < server.active_defrag_threshold_lower ||
+             frag_bytes < server.active_defrag_ignore_bytes)) return;
+
+        cpu_pct = defragInterpolate(frag_pct,
+                server.active_defrag_threshold_lower,
+                server.active_defrag_threshold_upper,
+                server.active_defrag_cycle_min,
+                server.active_defrag_cycle_max);
+        /* The effort may grow during a scan, but never decreases. */
+        if (cpu_pct > server.active_defrag_running) {
+            if (!server.active_defrag_running)
+                redisLog(REDIS_VERBOSE,
+                    "Starting active defrag, frag=%.0f%%, frag_bytes=%zu, "
+                    "cpu=%d%%", frag_pct, frag_bytes, cpu_pct);
+            server.active_defrag_running = cpu_pct;
+        }
+    }
+    if (!server.active_defrag_running) return;
+
+    start = ustime();
+    timelimit = 1000000*server.active_defrag_running/server.hz/100;
+    if (timelimit <= 0) timelimit = 1;
+
+    latencyStartMonitor(latency);
+    activeDefragScan(start+timelimit);
+    latencyEndMonitor(latency);
+    latencyAddSampleIfNeeded("active-defrag-cycle",latency);
+}
+
+#else /* HAVE_DEFRAG */
+
+void activeDefragCycle(void) {
+    /* Not supported by the allocator, see HAVE_DEFRAG in zmalloc.h. */
+}
+
+#endif
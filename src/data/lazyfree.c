@@ -0,0 +1,197 @@
+/* Lazy freeing of keys and databases.
+ *
+ * Freeing a big aggregate value (a set, hash, sorted set or list with
+ * millions of elements) means visiting and releasing every element, which
+ * can block the server for seconds. UNLINK and FLUSHDB / FLUSHALL ASYNC
+ * only remove the values from the keyspace, an O(1) operation, and hand
+ * them to a background thread (see the REDIS_BIO_LAZY_FREE job in bio.c)
+ * that releases the memory. When lazyfree-lazy-eviction and
+ * lazyfree-lazy-expire are enabled, the keys evicted because of maxmemory
+ * and the expired keys are deleted the same way.
+ *
+ * Values handed to the background thread are no longer reachable from the
+ * keyspace, however the objects composing them may still be referenced by
+ * the main thread, for instance by the elements of other keys created with
+ * SUNIONSTORE, or by the reply list of a client: this is why reference
+ * counting is atomic when lazy freeing is supported, see incrRefCount().
+ *
+ * ----------------------------------------------------------------------------
+ *
+ * Copyright (c) 2009-2012, Salvatore Sanfilippo <antirez at gmail dot com>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *   * Redistributions of source code must retain the above copyright notice,
+ *     this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *   * Neither the name of Redis nor the names of its contributors may be used
+ *     to endorse or promote products derived from this software without
+ *     specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "redis.h"
+#include "bio.h"
+
+/* Number of objects (values or keys of a flushed database) queued for
+ * freeing and not yet released by the background thread, and estimate of
+ * the memory they use. They are updated by both threads, so they are always
+ * accessed with atomic operations. */
+static unsigned long lazyfree_objects = 0;
+static size_t lazyfree_memory = 0;
+
+/* Number of objects released by the background thread since the last
+ * CONFIG RESETSTAT, also updated with atomic operations. */
+static unsigned long lazyfreed_objects = 0;
+
+#if defined(__ATOMIC_RELAXED)
+#define lazyfreeAtomicIncr(var,n) __atomic_add_fetch(&(var),(n),__ATOMIC_RELAXED)
+#define lazyfreeAtomicDecr(var,n) __atomic_sub_fetch(&(var),(n),__ATOMIC_RELAXED)
+#define lazyfreeAtomicSet(var,n) __atomic_store_n(&(var),(n),__ATOMIC_RELAXED)
+#elif defined(HAVE_ATOMIC)
+#define lazyfreeAtomicIncr(var,n) __sync_add_and_fetch(&(var),(n))
+#define lazyfreeAtomicDecr(var,n) __sync_sub_and_fetch(&(var),(n))
+#define lazyfreeAtomicSet(var,n) __sync_lock_test_and_set(&(var),(n))
+#else
+/* No background freeing happens at all, see LAZYFREE_UNSUPPORTED. */
+#define lazyfreeAtomicIncr(var,n) ((var) += (n))
+#define lazyfreeAtomicDecr(var,n) ((var) -= (n))
+#define lazyfreeAtomicSet(var,n) ((var) = (n))
+#endif
+
+/* Return the number of objects queued for freeing, reported by INFO. */
+unsigned long lazyfreeGetPendingObjectsCount(void) {
+    return lazyfreeAtomicIncr(lazyfree_objects,0);
+}
+
+/* Return the number of objects released by the background thread, reported
+ * by INFO. */
+unsigned long lazyfreeGetFreedObjectsCount(void) {
+    return lazyfreeAtomicIncr(lazyfreed_objects,0);
+}
+
+/* Called by CONFIG RESETSTAT. */
+void lazyfreeResetStats(void) {
+    lazyfreeAtomicSet(lazyfreed_objects,0);
+}
+
+/* Return the estimate of the memory used by the values queued for freeing
+ * with dbAsyncDelete(). This memory is still accounted by
+ * zmalloc_used_memory() but will be released soon without any other action,
+ * so freeMemoryIfNeeded() does not count it. The databases flushed with
+ * FLUSHDB / FLUSHALL ASYNC are not included, measuring them would be as
+ * slow as freeing them. */
+size_t lazyfreeGetPendingMemory(void) {
+    return lazyfreeAtomicIncr(lazyfree_memory,0);
+}
+
+/* Return the amount of work needed to free the object 'obj', that is about
+ * the number of allocations to release. Strings and the small encodings are
+ * a single allocation, while for the other encodings the number of elements
+ * (or of quicklist nodes) is returned. */
+size_t lazyfreeGetFreeEffort(robj *obj) {
+    if (obj->type == REDIS_LIST && obj->encoding == REDIS_ENCODING_QUICKLIST) {
+        quicklist *ql = obj->ptr;
+        return ql->len;
+    } else if (obj->type == REDIS_SET && obj->encoding == REDIS_ENCODING_HT) {
+        dict *ht = obj->ptr;
+        return dictSize(ht);
+    } else if (obj->type == REDIS_ZSET && obj->encoding == REDIS_ENCODING_SKIPLIST) {
+        zset *zs = obj->ptr;
+        return zs->zsl->length;
+    } else if (obj->type == REDIS_ZSET && obj->encoding == REDIS_ENCODING_BTREE) {
+        zset *zs = obj->ptr;
+        return zs->zbt->length;
+    } else if (obj->type == REDIS_HASH && obj->encoding == REDIS_ENCODING_HT) {
+        dict *ht = obj->ptr;
+        return dictSize(ht);
+    } else {
+        return 1; /* Everything else is a single allocation. */
+    }
+}
+
+/* Delete a key, value, and associated expiration entry if any, from the DB.
+ * Like dbDelete() but, if the value is composed of more than
+ * REDIS_LAZYFREE_THRESHOLD allocations and is not shared, it is released
+ * by the background thread instead of being freed synchronously. */
+int dbAsyncDelete(redisDb *db, robj *key) {
+#ifndef LAZYFREE_UNSUPPORTED
+    dictEntry *de = dictFind(db->dict,key->ptr);
+
+    if (de) {
+        robj *val = dictGetVal(de);
+        size_t free_effort = lazyfreeGetFreeEffort(val);
+
+        /* A shared value may still be in use once the key is deleted,
+         * since it is referenced elsewhere: it is released synchronously
+         * by dbDelete() as usually, just decrementing its refcount. */
+        if (free_effort > REDIS_LAZYFREE_THRESHOLD && val->refcount == 1) {
+            size_t size = objectComputeSize(val,REDIS_LAZYFREE_SIZE_SAMPLES);
+
+            lazyfreeAtomicIncr(lazyfree_objects,1);
+            lazyfreeAtomicIncr(lazyfree_memory,size);
+            bioCreateBackgroundJob(REDIS_BIO_LAZY_FREE,val,
+                (void*)(uintptr_t)size,NULL);
+            /* The NULL value is ignored by the destructor of the keyspace
+             * dictionary, see dictRedisObjectDestructor(). */
+            dictSetVal(db->dict,de,NULL);
+        }
+    }
+#endif
+    return dbDelete(db,key);
+}
+
+/* Empty the specified database, replacing its dictionaries with new empty
+ * ones and handing the old ones to the background thread. The caller is
+ * in charge of the rest, like flushing the cluster slots-to-keys map. */
+void emptyDbAsync(redisDb *db) {
+#ifdef LAZYFREE_UNSUPPORTED
+    dictEmpty(db->dict,NULL);
+    dictEmpty(db->expires,NULL);
+#else
+    dict *oldkeys = db->dict, *oldexpires = db->expires;
+
+    db->dict = dictCreate(&dbDictType,NULL);
+    db->expires = dictCreate(&keyptrDictType,NULL);
+    lazyfreeAtomicIncr(lazyfree_objects,dictSize(oldkeys));
+    bioCreateBackgroundJob(REDIS_BIO_LAZY_FREE,NULL,oldkeys,oldexpires);
+#endif
+}
+
+/* Release an object queued with dbAsyncDelete(), 'size' being the estimate
+ * of its memory usage accounted when it was queued. Called by the
+ * background thread. */
+void lazyfreeFreeObjectFromBioThread(robj *o, size_t size) {
+    decrRefCount(o);
+    lazyfreeAtomicDecr(lazyfree_memory,size);
+    lazyfreeAtomicDecr(lazyfree_objects,1);
+    lazyfreeAtomicIncr(lazyfreed_objects,1);
+}
+
+/* Release the dictionaries of a database queued with emptyDbAsync().
+ * Called by the background thread. The expires dictionary only references
+ * the keys stored inside the entries of the main one, so it is released
+ * first. */
+void lazyfreeFreeDatabaseFromBioThread(dict *keys, dict *expires) {
+    size_t numkeys = dictSize(keys);
+
+    dictRelease(expires);
+    dictRelease(keys);
+    lazyfreeAtomicDecr(lazyfree_objects,numkeys);
+    lazyfreeAtomicIncr(lazyfreed_objects,numkeys);
+}
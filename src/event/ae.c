@@ -30,6 +30,9 @@
  * POSSIBILITY OF SUCH DAMAGE.
  */
 
+#ifdef USE_IOURING
+#include "fmacros.h" /* syscall(2) and MAP_POPULATE, used by ae_iouring.c */
+#endif
 #include <stdio.h>
 #include <sys/time.h>
 #include <sys/types.h>
@@ -49,13 +52,17 @@
 #ifdef HAVE_EVPORT
 #include "ae_evport.c"
 #else
-    #ifdef HAVE_EPOLL
-    #include "ae_epoll.c"
+    #ifdef HAVE_IOURING
+    #include "ae_iouring.c"
     #else
-        #ifdef HAVE_KQUEUE
-        #include "ae_kqueue.c"
+        #ifdef HAVE_EPOLL
+        #include "ae_epoll.c"
         #else
-        #include "ae_select.c"
+            #ifdef HAVE_KQUEUE
+            #include "ae_kqueue.c"
+            #else
+            #include "ae_select.c"
+            #endif
         #endif
     #endif
 #endif
@@ -70,7 +77,11 @@ aeEventLoop *aeCreateEventLoop(int setsize) {
     if (eventLoop->events == NULL || eventLoop->fired == NULL) goto err;
     eventLoop->setsize = setsize;
     eventLoop->lastTime = time(NULL);
-    eventLoop->timeEventHead = NULL;
+    eventLoop->timeEventHeap = NULL;
+    eventLoop->timeEventCount = 0;
+    eventLoop->timeEventHeapSize = 0;
+    eventLoop->timeEventTable = NULL;
+    eventLoop->timeEventTableSize = 0;
     eventLoop->timeEventNextId = 0;
     eventLoop->stop = 0;
     eventLoop->maxfd = -1;
@@ -122,7 +133,13 @@ int aeResizeSetSize(aeEventLoop *eventLoop, int setsize) {
 }
 
 void aeDeleteEventLoop(aeEventLoop *eventLoop) {
+    int j;
+
     aeApiFree(eventLoop);
+    for (j = 0; j < eventLoop->timeEventCount; j++)
+        zfree(eventLoop->timeEventHeap[j]);
+    zfree(eventLoop->timeEventHeap);
+    zfree(eventLoop->timeEventTable);
     zfree(eventLoop->events);
     zfree(eventLoop->fired);
     zfree(eventLoop);
@@ -200,6 +217,144 @@ static void aeAddMillisecondsToNow(long long milliseconds, long *sec, long *ms)
     *ms = when_ms;
 }
 
+/* ----------------------------------------------------------------------------
+ * Time events
+ *
+ * Time events are stored in a binary min-heap ordered by the time they are
+ * going to fire, so that the nearest timer is always at index zero, and
+ * adding, rescheduling or removing a timer is O(log(N)). In order to delete
+ * timers by ID in O(1) as well, time events are also indexed by ID in a
+ * small open addressing hash table with linear probing.
+ * ------------------------------------------------------------------------- */
+
+/* Return non zero if time event 'a' fires before 'b'. */
+static int aeTimeEventBefore(aeTimeEvent *a, aeTimeEvent *b) {
+    return a->when_sec < b->when_sec ||
+           (a->when_sec == b->when_sec && a->when_ms < b->when_ms);
+}
+
+static void aeHeapSet(aeEventLoop *eventLoop, int idx, aeTimeEvent *te) {
+    eventLoop->timeEventHeap[idx] = te;
+    te->heapIndex = idx;
+}
+
+/* Move the event at 'idx' towards the root as long as it fires before
+ * its parent. */
+static void aeHeapSiftUp(aeEventLoop *eventLoop, int idx) {
+    aeTimeEvent **heap = eventLoop->timeEventHeap;
+    aeTimeEvent *te = heap[idx];
+
+    while (idx > 0) {
+        int parent = (idx-1)/2;
+        if (!aeTimeEventBefore(te,heap[parent])) break;
+        aeHeapSet(eventLoop,idx,heap[parent]);
+        idx = parent;
+    }
+    aeHeapSet(eventLoop,idx,te);
+}
+
+/* Move the event at 'idx' towards the leaves as long as one of its
+ * children fires before it. */
+static void aeHeapSiftDown(aeEventLoop *eventLoop, int idx) {
+    aeTimeEvent **heap = eventLoop->timeEventHeap;
+    aeTimeEvent *te = heap[idx];
+    int count = eventLoop->timeEventCount;
+
+    while (1) {
+        int child = idx*2+1;
+
+        if (child >= count) break;
+        if (child+1 < count && aeTimeEventBefore(heap[child+1],heap[child]))
+            child++;
+        if (!aeTimeEventBefore(heap[child],te)) break;
+        aeHeapSet(eventLoop,idx,heap[child]);
+        idx = child;
+    }
+    aeHeapSet(eventLoop,idx,te);
+}
+
+/* Restore the heap property for an event whose time changed. */
+static void aeHeapFix(aeEventLoop *eventLoop, aeTimeEvent *te) {
+    int idx = te->heapIndex;
+
+    aeHeapSiftUp(eventLoop,idx);
+    if (te->heapIndex == idx) aeHeapSiftDown(eventLoop,idx);
+}
+
+static unsigned int aeTimeEventTableSlot(aeEventLoop *eventLoop, long long id) {
+    unsigned long long h = (unsigned long long)id * 0x9E3779B97F4A7C15ULL;
+    return (unsigned int)(h >> 32) & (eventLoop->timeEventTableSize-1);
+}
+
+static void aeTimeEventTableAdd(aeEventLoop *eventLoop, aeTimeEvent *te) {
+    unsigned int j = aeTimeEventTableSlot(eventLoop,te->id);
+    unsigned int mask = eventLoop->timeEventTableSize-1;
+
+    while (eventLoop->timeEventTable[j]) j = (j+1) & mask;
+    eventLoop->timeEventTable[j] = te;
+}
+
+/* Return the table slot of the event with the specified ID, or -1. */
+static int aeTimeEventTableFind(aeEventLoop *eventLoop, long long id) {
+    unsigned int j, mask = eventLoop->timeEventTableSize-1;
+
+    if (eventLoop->timeEventTableSize == 0) return -1;
+    j = aeTimeEventTableSlot(eventLoop,id);
+    while (eventLoop->timeEventTable[j]) {
+        if (eventLoop->timeEventTable[j]->id == id) return j;
+        j = (j+1) & mask;
+    }
+    return -1;
+}
+
+/* Remove the entry at 'slot', shifting back the following entries of the
+ * same cluster so that lookups never need tombstones. */
+static void aeTimeEventTableDel(aeEventLoop *eventLoop, unsigned int slot) {
+    aeTimeEvent **table = eventLoop->timeEventTable;
+    unsigned int mask = eventLoop->timeEventTableSize-1;
+    unsigned int j = slot;
+
+    table[slot] = NULL;
+    while (1) {
+        unsigned int home;
+
+        j = (j+1) & mask;
+        if (table[j] == NULL) break;
+        home = aeTimeEventTableSlot(eventLoop,table[j]->id);
+        /* Move the entry in the hole if its home slot is not in the
+         * (cyclic) range (slot, j]. */
+        if ((slot < j) ? (home <= slot || home > j)
+                       : (home <= slot && home > j))
+        {
+            table[slot] = table[j];
+            table[j] = NULL;
+            slot = j;
+        }
+    }
+}
+
+/* Make room for one more time event, growing the heap and the table. */
+static void aeTimeEventsMakeRoom(aeEventLoop *eventLoop) {
+    int j;
+
+    if (eventLoop->timeEventCount == eventLoop->timeEventHeapSize) {
+        eventLoop->timeEventHeapSize = eventLoop->timeEventHeapSize ?
+                                       eventLoop->timeEventHeapSize*2 : 16;
+        eventLoop->timeEventHeap = zrealloc(eventLoop->timeEventHeap,
+            sizeof(aeTimeEvent*)*eventLoop->timeEventHeapSize);
+    }
+    /* Keep the table load factor <= 50%. */
+    if ((eventLoop->timeEventCount+1)*2 > eventLoop->timeEventTableSize) {
+        eventLoop->timeEventTableSize = eventLoop->timeEventTableSize ?
+                                        eventLoop->timeEventTableSize*2 : 32;
+        zfree(eventLoop->timeEventTable);
+        eventLoop->timeEventTable = zcalloc(sizeof(aeTimeEvent*)*
+                                            eventLoop->timeEventTableSize);
+        for (j = 0; j < eventLoop->timeEventCount; j++)
+            aeTimeEventTableAdd(eventLoop,eventLoop->timeEventHeap[j]);
+    }
+}
+
 long long aeCreateTimeEvent(aeEventLoop *eventLoop, long long milliseconds,
         aeTimeProc *proc, void *clientData,
         aeEventFinalizerProc *finalizerProc)
@@ -214,31 +369,32 @@ long long aeCreateTimeEvent(aeEventLoop *eventLoop, long long milliseconds,
     te->timeProc = proc;
     te->finalizerProc = finalizerProc;
     te->clientData = clientData;
-    te->next = eventLoop->timeEventHead;
-    eventLoop->timeEventHead = te;
+    aeTimeEventsMakeRoom(eventLoop);
+    aeTimeEventTableAdd(eventLoop,te);
+    aeHeapSet(eventLoop,eventLoop->timeEventCount++,te);
+    aeHeapSiftUp(eventLoop,te->heapIndex);
     return id;
 }
 
 int aeDeleteTimeEvent(aeEventLoop *eventLoop, long long id)
 {
-    aeTimeEvent *te, *prev = NULL;
-
-    te = eventLoop->timeEventHead;
-    while(te) {
-        if (te->id == id) {
-            if (prev == NULL)
-                eventLoop->timeEventHead = te->next;
-            else
-                prev->next = te->next;
-            if (te->finalizerProc)
-                te->finalizerProc(eventLoop, te->clientData);
-            zfree(te);
-            return AE_OK;
-        }
-        prev = te;
-        te = te->next;
+    aeTimeEvent *te, *last;
+    int slot = aeTimeEventTableFind(eventLoop,id);
+
+    if (slot == -1) return AE_ERR; /* NO event with the specified ID found */
+    te = eventLoop->timeEventTable[slot];
+    aeTimeEventTableDel(eventLoop,slot);
+
+    /* Replace the event with the last one of the heap, and fix it. */
+    last = eventLoop->timeEventHeap[--eventLoop->timeEventCount];
+    if (last != te) {
+        aeHeapSet(eventLoop,te->heapIndex,last);
+        aeHeapFix(eventLoop,last);
     }
-    return AE_ERR; /* NO event with the specified ID found */
+    if (te->finalizerProc)
+        te->finalizerProc(eventLoop, te->clientData);
+    zfree(te);
+    return AE_OK;
 }
 
 /* Search the first timer to fire.
@@ -246,32 +402,17 @@ int aeDeleteTimeEvent(aeEventLoop *eventLoop, long long id)
  * put in sleep without to delay any event.
  * If there are no timers NULL is returned.
  *
- * Note that's O(N) since time events are unsorted.
- * Possible optimizations (not needed by Redis so far, but...):
- * 1) Insert the event in order, so that the nearest is just the head.
- *    Much better but still insertion or deletion of timers is O(N).
- * 2) Use a skiplist to have this operation as O(1) and insertion as O(log(N)).
- */
+ * This is O(1) since the nearest timer is the root of the heap. */
 static aeTimeEvent *aeSearchNearestTimer(aeEventLoop *eventLoop)
 {
-    aeTimeEvent *te = eventLoop->timeEventHead;
-    aeTimeEvent *nearest = NULL;
-
-    while(te) {
-        if (!nearest || te->when_sec < nearest->when_sec ||
-                (te->when_sec == nearest->when_sec &&
-                 te->when_ms < nearest->when_ms))
-            nearest = te;
-        te = te->next;
-    }
-    return nearest;
+    return eventLoop->timeEventCount ? eventLoop->timeEventHeap[0] : NULL;
 }
 
 /* Process time events */
+#define AE_TIME_EVENTS_STATIC 16
 static int processTimeEvents(aeEventLoop *eventLoop) {
-    int processed = 0;
+    int processed = 0, j;
     aeTimeEvent *te;
-    long long maxId;
     time_t now = time(NULL);
 
     /* If the system clock is moved to the future, and then set back to the
@@ -283,55 +424,67 @@ static int processTimeEvents(aeEventLoop *eventLoop) {
      * processing events earlier is less dangerous than delaying them
      * indefinitely, and practice suggests it is. */
     if (now < eventLoop->lastTime) {
-        te = eventLoop->timeEventHead;
-        while(te) {
-            te->when_sec = 0;
-            te = te->next;
-        }
+        for (j = 0; j < eventLoop->timeEventCount; j++)
+            eventLoop->timeEventHeap[j]->when_sec = 0;
+        /* The order among events is now given by when_ms alone. */
+        for (j = eventLoop->timeEventCount/2-1; j >= 0; j--)
+            aeHeapSiftDown(eventLoop,j);
     }
     eventLoop->lastTime = now;
 
-    te = eventLoop->timeEventHead;
-    maxId = eventLoop->timeEventNextId-1;
-    while(te) {
+    /* Collect the IDs of the expired timers before firing them: they are
+     * the root of the heap and the subtree of expired events below it.
+     * This way events registered by the handlers themselves are never
+     * processed in this iteration, so we can't loop forever, while the
+     * older expired events are not delayed when a new one is at the root.
+     * We work with IDs since handlers may delete any event. */
+    if (eventLoop->timeEventCount) {
+        aeTimeEvent **heap = eventLoop->timeEventHeap;
+        long long _ids[AE_TIME_EVENTS_STATIC], *ids = _ids;
+        int _queue[AE_TIME_EVENTS_STATIC], *queue = _queue;
+        int head = 0, tail = 0, numids = 0;
         long now_sec, now_ms;
-        long long id;
 
-        if (te->id > maxId) {
-            te = te->next;
-            continue;
+        /* Use static buffers for the common case of a few timers. */
+        if (eventLoop->timeEventCount > AE_TIME_EVENTS_STATIC) {
+            ids = zmalloc(sizeof(long long)*eventLoop->timeEventCount);
+            queue = zmalloc(sizeof(int)*eventLoop->timeEventCount);
         }
         aeGetTime(&now_sec, &now_ms);
-        if (now_sec > te->when_sec ||
-            (now_sec == te->when_sec && now_ms >= te->when_ms))
-        {
-            int retval;
+        queue[tail++] = 0;
+        while (head < tail) {
+            int idx = queue[head++];
+
+            te = heap[idx];
+            if (now_sec < te->when_sec ||
+                (now_sec == te->when_sec && now_ms < te->when_ms)) continue;
+            ids[numids++] = te->id;
+            if (idx*2+1 < eventLoop->timeEventCount) queue[tail++] = idx*2+1;
+            if (idx*2+2 < eventLoop->timeEventCount) queue[tail++] = idx*2+2;
+        }
+        if (queue != _queue) zfree(queue);
+
+        for (j = 0; j < numids; j++) {
+            long long id = ids[j];
+            int slot, retval;
 
-            id = te->id;
+            /* Deleted by the handler of a previous event? */
+            if ((slot = aeTimeEventTableFind(eventLoop,id)) == -1) continue;
+            te = eventLoop->timeEventTable[slot];
             retval = te->timeProc(eventLoop, id, te->clientData);
             processed++;
-            /* After an event is processed our time event list may
-             * no longer be the same, so we restart from head.
-             * Still we make sure to don't process events registered
-             * by event handlers itself in order to don't loop forever.
-             * To do so we saved the max ID we want to handle.
-             *
-             * FUTURE OPTIMIZATIONS:
-             * Note that this is NOT great algorithmically. Redis uses
-             * a single time event so it's not a problem but the right
-             * way to do this is to add the new elements on head, and
-             * to flag deleted elements in a special way for later
-             * deletion (putting references to the nodes to delete into
-             * another linked list). */
+            /* The handler may have deleted the event itself: look it up
+             * again by ID before touching it. */
+            if ((slot = aeTimeEventTableFind(eventLoop,id)) == -1) continue;
+            te = eventLoop->timeEventTable[slot];
             if (retval != AE_NOMORE) {
                 aeAddMillisecondsToNow(retval,&te->when_sec,&te->when_ms);
+                aeHeapFix(eventLoop,te);
             } else {
                 aeDeleteTimeEvent(eventLoop, id);
             }
-            te = eventLoop->timeEventHead;
-        } else {
-            te = te->next;
         }
+        if (ids != _ids) zfree(ids);
     }
     return processed;
 }
@@ -463,3 +616,70 @@ char *aeGetApiName(void) {
 void aeSetBeforeSleepProc(aeEventLoop *eventLoop, aeBeforeSleepProc *beforesleep) {
     eventLoop->beforesleep = beforesleep;
 }
+
+#ifdef AE_BENCHMARK_MAIN
+/* Time events micro benchmark. Build it with:
+ *
+ *   gcc -O2 -DAE_BENCHMARK_MAIN -I. -Icompatible -Iwrapper event/ae.c \
+ *       wrapper/zmalloc.c -o ae-benchmark
+ *
+ * With N idle timers registered, every run measures the cost of firing one
+ * short timer and of deleting a random idle timer by ID. */
+static int benchFired;
+
+static int benchTimerProc(aeEventLoop *eventLoop, long long id, void *clientData) {
+    AE_NOTUSED(eventLoop);
+    AE_NOTUSED(id);
+    AE_NOTUSED(clientData);
+    benchFired++;
+    return AE_NOMORE;
+}
+
+static long long benchUstime(void) {
+    struct timeval tv;
+
+    gettimeofday(&tv,NULL);
+    return ((long long)tv.tv_sec)*1000000+tv.tv_usec;
+}
+
+static void benchTimers(int numtimers, int iterations) {
+    aeEventLoop *el = aeCreateEventLoop(1024);
+    long long *ids = zmalloc(sizeof(long long)*numtimers);
+    long long start, fire_us, del_us;
+    int j;
+
+    for (j = 0; j < numtimers; j++)
+        ids[j] = aeCreateTimeEvent(el,1000000+j,benchTimerProc,NULL,NULL);
+
+    benchFired = 0;
+    start = benchUstime();
+    for (j = 0; j < iterations; j++) {
+        aeCreateTimeEvent(el,0,benchTimerProc,NULL,NULL);
+        while (benchFired == j)
+            aeProcessEvents(el,AE_TIME_EVENTS|AE_DONT_WAIT);
+    }
+    fire_us = benchUstime()-start;
+
+    start = benchUstime();
+    for (j = 0; j < iterations; j++) {
+        int idx = rand() % numtimers;
+
+        aeDeleteTimeEvent(el,ids[idx]);
+        ids[idx] = aeCreateTimeEvent(el,1000000+j,benchTimerProc,NULL,NULL);
+    }
+    del_us = benchUstime()-start;
+
+    printf("%6d timers: fire %8.1f ns/op, delete+create %8.1f ns/op\n",
+        numtimers, (double)fire_us*1000/iterations,
+        (double)del_us*1000/iterations);
+    zfree(ids);
+    aeDeleteEventLoop(el);
+}
+
+int main(void) {
+    benchTimers(10,100000);
+    benchTimers(1000,100000);
+    benchTimers(10000,100000);
+    return 0;
+}
+#endif
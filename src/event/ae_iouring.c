@@ -0,0 +1,469 @@
+/* Linux io_uring(7) based ae.c module
+ *
+ * Readiness is detected submitting one-shot IORING_OP_POLL_ADD requests,
+ * so that all the (re)armed descriptors of an event loop iteration and the
+ * wait for new events are performed with a single io_uring_enter(2) call,
+ * instead of one epoll_ctl(2) call for every change of the interest set.
+ * Since a one-shot poll request is immediately completed if the file
+ * descriptor is already ready, re-arming the fired descriptors at every
+ * iteration gives us the same level triggered semantics of the other
+ * backends, that ae.c and its users rely on.
+ *
+ * When the running kernel does not support io_uring (or it is not allowed,
+ * for instance by a seccomp policy), the epoll backend is used instead.
+ *
+ * Copyright (c) 2009-2012, Salvatore Sanfilippo <antirez at gmail dot com>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *   * Redistributions of source code must retain the above copyright notice,
+ *     this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *   * Neither the name of Redis nor the names of its contributors may be used
+ *     to endorse or promote products derived from this software without
+ *     specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <linux/io_uring.h>
+
+/* The epoll backend is used as a fallback when io_uring is not available
+ * at runtime: include it renaming its API so that it does not clash with
+ * the functions of this file. */
+#define aeApiState aeEpollApiState
+#define aeApiCreate aeEpollApiCreate
+#define aeApiResize aeEpollApiResize
+#define aeApiFree aeEpollApiFree
+#define aeApiAddEvent aeEpollApiAddEvent
+#define aeApiDelEvent aeEpollApiDelEvent
+#define aeApiPoll aeEpollApiPoll
+#define aeApiName aeEpollApiName
+#include "ae_epoll.c"
+#undef aeApiState
+#undef aeApiCreate
+#undef aeApiResize
+#undef aeApiFree
+#undef aeApiAddEvent
+#undef aeApiDelEvent
+#undef aeApiPoll
+#undef aeApiName
+
+#ifndef __NR_io_uring_setup
+#define __NR_io_uring_setup 425
+#endif
+#ifndef __NR_io_uring_enter
+#define __NR_io_uring_enter 426
+#endif
+
+#define AE_IOURING_ENTRIES 1024     /* Submission queue size. */
+#define AE_IOURING_IGNORE_UDATA ((unsigned long long)-1)
+
+/* Poll requests are tagged with the file descriptor and a generation
+ * number, that is incremented every time the request is canceled, so that
+ * completions of requests no longer relevant can be recognized. */
+#define AE_IOURING_UDATA(fd,gen) \
+    (((unsigned long long)(fd) << 32) | (unsigned int)(gen))
+
+typedef struct aeIouringFd {
+    unsigned int gen;   /* Generation of the poll request of this fd. */
+    int armed;          /* AE_(READABLE|WRITABLE) mask polled right now. */
+    int queued;         /* True if the fd is in the list of fds to arm. */
+} aeIouringFd;
+
+typedef struct aeApiState {
+    aeEpollApiState *epoll;     /* Not NULL if we fell back to epoll. */
+    int ringfd;
+    /* Submission queue, mapped from the kernel. */
+    void *sqring;
+    size_t sqring_size;
+    unsigned *sq_head, *sq_tail, *sq_mask, *sq_array;
+    struct io_uring_sqe *sqes;
+    size_t sqes_size;
+    unsigned sq_local_tail;     /* Tail of the SQEs filled but not submitted. */
+    unsigned sq_pending;        /* Number of SQEs filled but not submitted. */
+    /* Completion queue, mapped from the kernel. */
+    void *cqring;
+    size_t cqring_size;
+    unsigned *cq_head, *cq_tail, *cq_mask;
+    struct io_uring_cqe *cqes;
+    /* Per fd state and list of the fds that need a new poll request. */
+    aeIouringFd *fds;
+    int *toarm;
+    int toarm_len;
+    struct __kernel_timespec timeout;
+} aeApiState;
+
+/* Set to true when the io_uring setup fails and we fall back to epoll. This
+ * is global since aeApiName() has no access to the event loop. */
+static int aeIouringUsingEpoll = 0;
+
+static int aeIouringSetup(unsigned entries, struct io_uring_params *p) {
+    return (int) syscall(__NR_io_uring_setup, entries, p);
+}
+
+static int aeIouringEnter(int ringfd, unsigned to_submit,
+                          unsigned min_complete, unsigned flags)
+{
+    return (int) syscall(__NR_io_uring_enter, ringfd, to_submit,
+                         min_complete, flags, NULL, 0);
+}
+
+static void aeIouringUnmap(aeApiState *state) {
+    if (state->sqes) munmap(state->sqes,state->sqes_size);
+    if (state->cqring && state->cqring != state->sqring)
+        munmap(state->cqring,state->cqring_size);
+    if (state->sqring) munmap(state->sqring,state->sqring_size);
+    if (state->ringfd != -1) close(state->ringfd);
+}
+
+/* Create the ring and map the submission and completion queues. Returns
+ * -1 if io_uring is not usable, so that the caller can fall back to epoll. */
+static int aeIouringInit(aeApiState *state, int setsize) {
+    struct io_uring_params p;
+    unsigned cq_entries = AE_IOURING_ENTRIES*2;
+    char *sq, *cq;
+
+    /* Every registered fd may have one poll request in flight, so size the
+     * completion queue after the set size. Kernels without the NODROP
+     * feature would lose completions on overflow: don't use them. */
+    while (cq_entries < (unsigned)setsize*2 && cq_entries < 65536)
+        cq_entries *= 2;
+    memset(&p,0,sizeof(p));
+    p.flags = IORING_SETUP_CQSIZE;
+    p.cq_entries = cq_entries;
+    state->ringfd = aeIouringSetup(AE_IOURING_ENTRIES,&p);
+    if (state->ringfd == -1) return -1;
+    if (!(p.features & IORING_FEAT_NODROP)) goto err;
+
+    state->sqring_size = p.sq_off.array + p.sq_entries*sizeof(unsigned);
+    state->cqring_size = p.cq_off.cqes +
+                         p.cq_entries*sizeof(struct io_uring_cqe);
+    if (p.features & IORING_FEAT_SINGLE_MMAP) {
+        if (state->cqring_size > state->sqring_size)
+            state->sqring_size = state->cqring_size;
+        state->cqring_size = state->sqring_size;
+    }
+    state->sqring = mmap(NULL,state->sqring_size,PROT_READ|PROT_WRITE,
+                         MAP_SHARED|MAP_POPULATE,state->ringfd,
+                         IORING_OFF_SQ_RING);
+    if (state->sqring == MAP_FAILED) {
+        state->sqring = NULL;
+        goto err;
+    }
+    if (p.features & IORING_FEAT_SINGLE_MMAP) {
+        state->cqring = state->sqring;
+    } else {
+        state->cqring = mmap(NULL,state->cqring_size,PROT_READ|PROT_WRITE,
+                             MAP_SHARED|MAP_POPULATE,state->ringfd,
+                             IORING_OFF_CQ_RING);
+        if (state->cqring == MAP_FAILED) {
+            state->cqring = NULL;
+            goto err;
+        }
+    }
+    state->sqes_size = p.sq_entries*sizeof(struct io_uring_sqe);
+    state->sqes = mmap(NULL,state->sqes_size,PROT_READ|PROT_WRITE,
+                       MAP_SHARED|MAP_POPULATE,state->ringfd,
+                       IORING_OFF_SQES);
+    if (state->sqes == MAP_FAILED) {
+        state->sqes = NULL;
+        goto err;
+    }
+
+    sq = state->sqring;
+    state->sq_head = (unsigned*)(sq+p.sq_off.head);
+    state->sq_tail = (unsigned*)(sq+p.sq_off.tail);
+    state->sq_mask = (unsigned*)(sq+p.sq_off.ring_mask);
+    state->sq_array = (unsigned*)(sq+p.sq_off.array);
+    state->sq_local_tail = *state->sq_tail;
+    state->sq_pending = 0;
+    cq = state->cqring;
+    state->cq_head = (unsigned*)(cq+p.cq_off.head);
+    state->cq_tail = (unsigned*)(cq+p.cq_off.tail);
+    state->cq_mask = (unsigned*)(cq+p.cq_off.ring_mask);
+    state->cqes = (struct io_uring_cqe*)(cq+p.cq_off.cqes);
+    return 0;
+
+err:
+    aeIouringUnmap(state);
+    state->ringfd = -1;
+    return -1;
+}
+
+/* Hand the filled SQEs to the kernel, optionally waiting for 'wait'
+ * completions. Returns -1 on error. */
+static int aeIouringSubmit(aeApiState *state, unsigned wait) {
+    int retval;
+
+    __atomic_store_n(state->sq_tail,state->sq_local_tail,__ATOMIC_RELEASE);
+    retval = aeIouringEnter(state->ringfd,state->sq_pending,wait,
+                            wait ? IORING_ENTER_GETEVENTS : 0);
+    if (retval == -1) return -1;
+    state->sq_pending -= retval;
+    return 0;
+}
+
+/* Return a cleared SQE to fill, submitting what is queued if the
+ * submission queue is full. */
+static struct io_uring_sqe *aeIouringGetSqe(aeApiState *state) {
+    struct io_uring_sqe *sqe;
+    unsigned idx;
+
+    while (state->sq_local_tail -
+           __atomic_load_n(state->sq_head,__ATOMIC_ACQUIRE) >=
+           *state->sq_mask+1)
+    {
+        if (aeIouringSubmit(state,0) == -1 && errno != EINTR &&
+            errno != EAGAIN && errno != EBUSY) return NULL;
+    }
+    idx = state->sq_local_tail & *state->sq_mask;
+    sqe = &state->sqes[idx];
+    memset(sqe,0,sizeof(*sqe));
+    state->sq_array[idx] = idx;
+    state->sq_local_tail++;
+    state->sq_pending++;
+    return sqe;
+}
+
+static int aeApiCreate(aeEventLoop *eventLoop) {
+    aeApiState *state = zmalloc(sizeof(aeApiState));
+    int j;
+
+    if (!state) return -1;
+    memset(state,0,sizeof(*state));
+    if (aeIouringInit(state,eventLoop->setsize) == -1) {
+        /* No io_uring support: use epoll via the original event loop
+         * apidata pointer, then wrap it. */
+        aeIouringUsingEpoll = 1;
+        if (aeEpollApiCreate(eventLoop) == -1) {
+            zfree(state);
+            return -1;
+        }
+        state->epoll = eventLoop->apidata;
+        eventLoop->apidata = state;
+        return 0;
+    }
+    aeIouringUsingEpoll = 0;
+    state->fds = zmalloc(sizeof(aeIouringFd)*eventLoop->setsize);
+    state->toarm = zmalloc(sizeof(int)*eventLoop->setsize);
+    for (j = 0; j < eventLoop->setsize; j++) {
+        state->fds[j].gen = 0;
+        state->fds[j].armed = AE_NONE;
+        state->fds[j].queued = 0;
+    }
+    state->toarm_len = 0;
+    eventLoop->apidata = state;
+    return 0;
+}
+
+/* Call the epoll backend function 'call' with the epoll state as apidata. */
+#define aeIouringEpollCall(eventLoop,state,call) do { \
+    (eventLoop)->apidata = (state)->epoll; \
+    call; \
+    (eventLoop)->apidata = (state); \
+} while(0)
+
+static int aeApiResize(aeEventLoop *eventLoop, int setsize) {
+    aeApiState *state = eventLoop->apidata;
+    int j, retval;
+
+    if (state->epoll) {
+        aeIouringEpollCall(eventLoop,state,
+            retval = aeEpollApiResize(eventLoop,setsize));
+        return retval;
+    }
+    state->fds = zrealloc(state->fds,sizeof(aeIouringFd)*setsize);
+    state->toarm = zrealloc(state->toarm,sizeof(int)*setsize);
+    for (j = eventLoop->setsize; j < setsize; j++) {
+        state->fds[j].gen = 0;
+        state->fds[j].armed = AE_NONE;
+        state->fds[j].queued = 0;
+    }
+    /* Drop from the list of fds to arm the ones out of the new range. */
+    for (j = 0; j < state->toarm_len; j++) {
+        if (state->toarm[j] >= setsize)
+            state->toarm[j--] = state->toarm[--state->toarm_len];
+    }
+    return 0;
+}
+
+static void aeApiFree(aeEventLoop *eventLoop) {
+    aeApiState *state = eventLoop->apidata;
+
+    if (state->epoll) {
+        eventLoop->apidata = state->epoll;
+        aeEpollApiFree(eventLoop);
+    } else {
+        aeIouringUnmap(state);
+        zfree(state->fds);
+        zfree(state->toarm);
+    }
+    zfree(state);
+}
+
+/* Cancel the poll request in flight for 'fd', if any. */
+static void aeIouringDisarm(aeApiState *state, int fd) {
+    struct io_uring_sqe *sqe;
+    aeIouringFd *f = &state->fds[fd];
+
+    if (f->armed == AE_NONE) return;
+    if ((sqe = aeIouringGetSqe(state)) != NULL) {
+        sqe->opcode = IORING_OP_POLL_REMOVE;
+        sqe->fd = -1;
+        sqe->addr = AE_IOURING_UDATA(fd,f->gen);
+        sqe->user_data = AE_IOURING_IGNORE_UDATA;
+    }
+    f->gen++;
+    f->armed = AE_NONE;
+}
+
+/* Schedule a new poll request for 'fd', submitted by the next aeApiPoll(). */
+static void aeIouringQueueArm(aeApiState *state, int fd) {
+    if (state->fds[fd].queued) return;
+    state->fds[fd].queued = 1;
+    state->toarm[state->toarm_len++] = fd;
+}
+
+static int aeApiAddEvent(aeEventLoop *eventLoop, int fd, int mask) {
+    aeApiState *state = eventLoop->apidata;
+    int retval;
+
+    if (state->epoll) {
+        aeIouringEpollCall(eventLoop,state,
+            retval = aeEpollApiAddEvent(eventLoop,fd,mask));
+        return retval;
+    }
+    mask |= eventLoop->events[fd].mask; /* Merge old events */
+    if (state->fds[fd].armed == mask) return 0;
+    aeIouringDisarm(state,fd);
+    aeIouringQueueArm(state,fd);
+    return 0;
+}
+
+static void aeApiDelEvent(aeEventLoop *eventLoop, int fd, int delmask) {
+    aeApiState *state = eventLoop->apidata;
+    int mask = eventLoop->events[fd].mask & (~delmask);
+
+    if (state->epoll) {
+        aeIouringEpollCall(eventLoop,state,
+            aeEpollApiDelEvent(eventLoop,fd,delmask));
+        return;
+    }
+    aeIouringDisarm(state,fd);
+    if (mask != AE_NONE) {
+        aeIouringQueueArm(state,fd);
+    } else if (state->sq_pending) {
+        /* The poll request holds a reference to the file: submit the
+         * cancellation ASAP, as the caller is likely going to close the
+         * fd and expects the connection to be actually closed. */
+        aeIouringSubmit(state,0);
+    }
+}
+
+static int aeApiPoll(aeEventLoop *eventLoop, struct timeval *tvp) {
+    aeApiState *state = eventLoop->apidata;
+    struct io_uring_sqe *sqe;
+    unsigned head, tail, wait = 1;
+    int j, numevents = 0;
+
+    if (state->epoll) {
+        aeIouringEpollCall(eventLoop,state,
+            numevents = aeEpollApiPoll(eventLoop,tvp));
+        return numevents;
+    }
+
+    /* Arm the fds that were added, modified or that fired in the previous
+     * iteration. */
+    for (j = 0; j < state->toarm_len; j++) {
+        int fd = state->toarm[j];
+        aeIouringFd *f = &state->fds[fd];
+        int mask = eventLoop->events[fd].mask;
+
+        f->queued = 0;
+        if (mask == AE_NONE || f->armed != AE_NONE) continue;
+        if ((sqe = aeIouringGetSqe(state)) == NULL) break;
+        sqe->opcode = IORING_OP_POLL_ADD;
+        sqe->fd = fd;
+        if (mask & AE_READABLE) sqe->poll_events |= POLLIN;
+        if (mask & AE_WRITABLE) sqe->poll_events |= POLLOUT;
+        sqe->user_data = AE_IOURING_UDATA(fd,f->gen);
+        f->armed = mask;
+    }
+    for (; j < state->toarm_len; j++) state->fds[state->toarm[j]].queued = 0;
+    state->toarm_len = 0;
+
+    /* Wait for the first completion, but not more than the specified
+     * time: a timeout request with a completion count of one is completed
+     * by the first completion, or when the time elapses. */
+    if (tvp) {
+        if (tvp->tv_sec == 0 && tvp->tv_usec == 0) {
+            wait = 0;
+        } else if ((sqe = aeIouringGetSqe(state)) != NULL) {
+            state->timeout.tv_sec = tvp->tv_sec;
+            state->timeout.tv_nsec = tvp->tv_usec*1000;
+            sqe->opcode = IORING_OP_TIMEOUT;
+            sqe->fd = -1;
+            sqe->addr = (unsigned long) &state->timeout;
+            sqe->len = 1;
+            sqe->off = 1;
+            sqe->user_data = AE_IOURING_IGNORE_UDATA;
+        }
+    }
+    /* On errors (EINTR, or EBUSY if the kernel has completions it could
+     * not yet post) just reap what is available. */
+    aeIouringSubmit(state,wait);
+
+    head = *state->cq_head;
+    tail = __atomic_load_n(state->cq_tail,__ATOMIC_ACQUIRE);
+    while (head != tail && numevents < eventLoop->setsize) {
+        struct io_uring_cqe *cqe = &state->cqes[head & *state->cq_mask];
+        unsigned long long udata = cqe->user_data;
+        int fd = (int)(udata >> 32), mask = 0;
+        aeIouringFd *f;
+
+        head++;
+        if (udata == AE_IOURING_IGNORE_UDATA) continue;
+        if (fd >= eventLoop->setsize) continue;
+        f = &state->fds[fd];
+        if ((unsigned int)udata != f->gen) continue; /* Canceled request. */
+        f->armed = AE_NONE;
+        if (cqe->res < 0) {
+            /* Let the handlers discover the error. */
+            mask = eventLoop->events[fd].mask;
+        } else {
+            if (cqe->res & POLLIN) mask |= AE_READABLE;
+            if (cqe->res & POLLOUT) mask |= AE_WRITABLE;
+            if (cqe->res & POLLERR) mask |= AE_WRITABLE;
+            if (cqe->res & POLLHUP) mask |= AE_WRITABLE;
+        }
+        /* Poll requests are one-shot: poll this fd again the next time. */
+        aeIouringQueueArm(state,fd);
+        eventLoop->fired[numevents].fd = fd;
+        eventLoop->fired[numevents].mask = mask;
+        numevents++;
+    }
+    __atomic_store_n(state->cq_head,head,__ATOMIC_RELEASE);
+    return numevents;
+}
+
+static char *aeApiName(void) {
+    return aeIouringUsingEpoll ? aeEpollApiName() : "iouring";
+}
@@ -129,6 +129,7 @@ struct redisCommand redisCommandTable[] = {
     {"append",appendCommand,3,"wm",0,NULL,1,1,1,0,0},
     {"strlen",strlenCommand,2,"rF",0,NULL,1,1,1,0,0},
     {"del",delCommand,-2,"w",0,NULL,1,-1,1,0,0},
+    {"unlink",unlinkCommand,-2,"wF",0,NULL,1,-1,1,0,0},
     {"exists",existsCommand,-2,"rF",0,NULL,1,-1,1,0,0},
     {"setbit",setbitCommand,4,"wm",0,NULL,1,1,1,0,0},
     {"getbit",getbitCommand,3,"rF",0,NULL,1,1,1,0,0},
@@ -164,6 +165,7 @@ struct redisCommand redisCommandTable[] = {
     {"srandmember",srandmemberCommand,-2,"rR",0,NULL,1,1,1,0,0},
     {"sinter",sinterCommand,-2,"rS",0,NULL,1,-1,1,0,0},
     {"sinterstore",sinterstoreCommand,-3,"wm",0,NULL,1,-1,1,0,0},
+    {"sintercard",sintercardCommand,-3,"r",0,sintercardGetKeys,0,0,0,0,0},
     {"sunion",sunionCommand,-2,"rS",0,NULL,1,-1,1,0,0},
     {"sunionstore",sunionstoreCommand,-3,"wm",0,NULL,1,-1,1,0,0},
     {"sdiff",sdiffCommand,-2,"rS",0,NULL,1,-1,1,0,0},
@@ -238,8 +240,8 @@ struct redisCommand redisCommandTable[] = {
     {"sync",syncCommand,1,"ars",0,NULL,0,0,0,0,0},
     {"psync",syncCommand,3,"ars",0,NULL,0,0,0,0,0},
     {"replconf",replconfCommand,-1,"arslt",0,NULL,0,0,0,0,0},
-    {"flushdb",flushdbCommand,1,"w",0,NULL,0,0,0,0,0},
-    {"flushall",flushallCommand,1,"w",0,NULL,0,0,0,0,0},
+    {"flushdb",flushdbCommand,-1,"w",0,NULL,0,0,0,0,0},
+    {"flushall",flushallCommand,-1,"w",0,NULL,0,0,0,0,0},
     {"sort",sortCommand,-2,"wm",0,sortGetKeys,1,1,1,0,0},
     {"info",infoCommand,-1,"rlt",0,NULL,0,0,0,0,0},
     {"monitor",monitorCommand,1,"ars",0,NULL,0,0,0,0,0},
@@ -480,6 +482,19 @@ unsigned int dictSdsCaseHash(const void *key) {
     return dictGenCaseHashFunction((unsigned char*)key, sdslen((char*)key));
 }
 
+/* Keys of the keyspace are copied inside their dictEntry, as a complete
+ * sds string with its header, like createEmbeddedStringObject() does with
+ * the robj. */
+size_t dictSdsEmbedLen(const void *key) {
+    size_t len = sdslen((sds)key);
+    return sdsHdrSize(sdsReqType(len))+len+1;
+}
+
+void *dictSdsEmbed(void *buf, const void *key) {
+    size_t len = sdslen((sds)key);
+    return sdsnewat(buf,sdsReqType(len),key,len);
+}
+
 int dictEncObjKeyCompare(void *privdata, const void *key1,
         const void *key2)
 {
@@ -528,7 +543,10 @@ dictType setDictType = {
     NULL,                      /* val dup */
     dictEncObjKeyCompare,      /* key compare */
     dictRedisObjectDestructor, /* key destructor */
-    NULL                       /* val destructor */
+    NULL,                      /* val destructor */
+    0,                         /* open addressing */
+    NULL,                      /* key embed len */
+    NULL                       /* key embed */
 };
 
 /* Sorted sets hash (note: a skiplist is used in addition to the hash table) */
@@ -538,17 +556,24 @@ dictType zsetDictType = {
     NULL,                      /* val dup */
     dictEncObjKeyCompare,      /* key compare */
     dictRedisObjectDestructor, /* key destructor */
-    NULL                       /* val destructor */
+    NULL,                      /* val destructor */
+    0,                         /* open addressing */
+    NULL,                      /* key embed len */
+    NULL                       /* key embed */
 };
 
-/* Db->dict, keys are sds strings, vals are Redis objects. */
+/* Db->dict, keys are sds strings embedded in the entries, vals are Redis
+ * objects. */
 dictType dbDictType = {
     dictSdsHash,                /* hash function */
     NULL,                       /* key dup */
     NULL,                       /* val dup */
     dictSdsKeyCompare,          /* key compare */
-    dictSdsDestructor,          /* key destructor */
-    dictRedisObjectDestructor   /* val destructor */
+    NULL,                       /* key destructor */
+    dictRedisObjectDestructor,  /* val destructor */
+    1,                          /* open addressing */
+    dictSdsEmbedLen,            /* key embed len */
+    dictSdsEmbed                /* key embed */
 };
 
 /* server.lua_scripts sha (as sds string) -> scripts (as robj) cache. */
@@ -558,7 +583,10 @@ dictType shaScriptObjectDictType = {
     NULL,                       /* val dup */
     dictSdsKeyCaseCompare,      /* key compare */
     dictSdsDestructor,          /* key destructor */
-    dictRedisObjectDestructor   /* val destructor */
+    dictRedisObjectDestructor,  /* val destructor */
+    0,                          /* open addressing */
+    NULL,                       /* key embed len */
+    NULL                        /* key embed */
 };
 
 /* Db->expires */
@@ -568,7 +596,10 @@ dictType keyptrDictType = {
     NULL,                      /* val dup */
     dictSdsKeyCompare,         /* key compare */
     NULL,                      /* key destructor */
-    NULL                       /* val destructor */
+    NULL,                      /* val destructor */
+    1,                         /* open addressing */
+    NULL,                      /* key embed len */
+    NULL                       /* key embed */
 };
 
 /* Command table. sds string -> command struct pointer. */
@@ -578,17 +609,23 @@ dictType commandTableDictType = {
     NULL,                      /* val dup */
     dictSdsKeyCaseCompare,     /* key compare */
     dictSdsDestructor,         /* key destructor */
-    NULL                       /* val destructor */
+    NULL,                      /* val destructor */
+    0,                         /* open addressing */
+    NULL,                      /* key embed len */
+    NULL                       /* key embed */
 };
 
-/* Hash type hash table (note that small hashes are represented with ziplists) */
+/* Hash type hash table (note that small hashes are represented with listpacks) */
 dictType hashDictType = {
     dictEncObjHash,             /* hash function */
     NULL,                       /* key dup */
     NULL,                       /* val dup */
     dictEncObjKeyCompare,       /* key compare */
     dictRedisObjectDestructor,  /* key destructor */
-    dictRedisObjectDestructor   /* val destructor */
+    dictRedisObjectDestructor,  /* val destructor */
+    0,                          /* open addressing */
+    NULL,                       /* key embed len */
+    NULL                        /* key embed */
 };
 
 /* Keylist hash table type has unencoded redis objects as keys and
@@ -600,7 +637,10 @@ dictType keylistDictType = {
     NULL,                       /* val dup */
     dictObjKeyCompare,          /* key compare */
     dictRedisObjectDestructor,  /* key destructor */
-    dictListDestructor          /* val destructor */
+    dictListDestructor,         /* val destructor */
+    0,                          /* open addressing */
+    NULL,                       /* key embed len */
+    NULL                        /* key embed */
 };
 
 /* Cluster nodes hash table, mapping nodes addresses 1.2.3.4:6379 to
@@ -611,7 +651,10 @@ dictType clusterNodesDictType = {
     NULL,                       /* val dup */
     dictSdsKeyCompare,          /* key compare */
     dictSdsDestructor,          /* key destructor */
-    NULL                        /* val destructor */
+    NULL,                       /* val destructor */
+    0,                          /* open addressing */
+    NULL,                       /* key embed len */
+    NULL                        /* key embed */
 };
 
 /* Cluster re-addition blacklist. This maps node IDs to the time
@@ -623,7 +666,10 @@ dictType clusterNodesBlackListDictType = {
     NULL,                       /* val dup */
     dictSdsKeyCaseCompare,      /* key compare */
     dictSdsDestructor,          /* key destructor */
-    NULL                        /* val destructor */
+    NULL,                       /* val destructor */
+    0,                          /* open addressing */
+    NULL,                       /* key embed len */
+    NULL                        /* key embed */
 };
 
 /* Migrate cache dict type. */
@@ -633,7 +679,10 @@ dictType migrateCacheDictType = {
     NULL,                       /* val dup */
     dictSdsKeyCompare,          /* key compare */
     dictSdsDestructor,          /* key destructor */
-    NULL                        /* val destructor */
+    NULL,                       /* val destructor */
+    0,                          /* open addressing */
+    NULL,                       /* key embed len */
+    NULL                        /* key embed */
 };
 
 /* Replication cached script dict (server.repl_scriptcache_dict).
@@ -645,7 +694,10 @@ dictType replScriptCacheDictType = {
     NULL,                       /* val dup */
     dictSdsKeyCaseCompare,      /* key compare */
     dictSdsDestructor,          /* key destructor */
-    NULL                        /* val destructor */
+    NULL,                       /* val destructor */
+    0,                          /* open addressing */
+    NULL,                       /* key embed len */
+    NULL                        /* key embed */
 };
 
 int htNeedsResize(dict *dict) {
@@ -720,7 +772,10 @@ int activeExpireCycleTryExpire(redisDb *db, dictEntry *de, long long now) {
         robj *keyobj = createStringObject(key,sdslen(key));
 
         propagateExpire(db,keyobj);
-        dbDelete(db,keyobj);
+        if (server.lazyfree_lazy_expire)
+            dbAsyncDelete(db,keyobj);
+        else
+            dbDelete(db,keyobj);
         notifyKeyspaceEvent(REDIS_NOTIFY_EXPIRED,
             "expired",keyobj,db->id);
         decrRefCount(keyobj);
@@ -964,6 +1019,64 @@ int clientsCronResizeQueryBuffer(redisClient *c) {
     return 0;
 }
 
+/* The static reply buffer of the client is resized according to the peak
+ * of bytes the client wanted to buffer recently:
+ *
+ * 1) If the peak did not fit in the buffer, the buffer size is doubled, so
+ *    that clients that constantly get big replies avoid the reply list.
+ * 2) Every REDIS_REPLY_BUF_PEAK_PERIOD seconds, if the peak of the period
+ *    is less than half the buffer, the buffer is shrunk to the smallest
+ *    power of two that still holds the peak. This way idle clients end with
+ *    a REDIS_REPLY_BUF_MIN_BYTES buffer.
+ *
+ * The buffer is only resized when it is empty.
+ *
+ * The function always returns 0 as it never terminates the client. */
+int clientsCronResizeOutputBuffer(redisClient *c) {
+    int newsize = c->buf_size;
+
+    if (c->buf_peak > c->buf_size) {
+        if (c->buf_size < REDIS_REPLY_BUF_MAX_BYTES) newsize = c->buf_size*2;
+    } else if (server.unixtime - c->buf_peak_time >=
+               REDIS_REPLY_BUF_PEAK_PERIOD)
+    {
+        while (newsize > REDIS_REPLY_BUF_MIN_BYTES &&
+               c->buf_peak < newsize/2) newsize /= 2;
+    } else {
+        return 0;
+    }
+
+    if (c->bufpos != 0) return 0;
+    if (newsize != c->buf_size) {
+        zfree(c->buf);
+        c->buf = zmalloc(newsize);
+        c->buf_size = newsize;
+    }
+    /* Reset the peak again to capture the usage in the next period. */
+    c->buf_peak = 0;
+    c->buf_peak_time = server.unixtime;
+    return 0;
+}
+
+/* The client keeps the argument objects of its last command to recycle them
+ * for the next one (see freeClientArgv() in networking.c). Release them if
+ * the client is idle, together with an argv array bigger than needed.
+ *
+ * The function always returns 0 as it never terminates the client. */
+int clientsCronTrimArgv(redisClient *c) {
+    time_t idletime = server.unixtime - c->lastinteraction;
+
+    if (idletime > 2 && c->argc == 0) {
+        freeClientArgvCache(c);
+        if (c->argv_len > REDIS_ARGV_CACHE_SIZE) {
+            zfree(c->argv);
+            c->argv = NULL;
+            c->argv_len = 0;
+        }
+    }
+    return 0;
+}
+
 #define CLIENTS_CRON_MIN_ITERATIONS 5
 void clientsCron(void) {
     /* Make sure to process at least numclients/server.hz of clients
@@ -996,6 +1109,8 @@ void clientsCron(void) {
          * terminated. */
         if (clientsCronHandleTimeout(c,now)) continue;
         if (clientsCronResizeQueryBuffer(c)) continue;
+        if (clientsCronResizeOutputBuffer(c)) continue;
+        if (clientsCronTrimArgv(c)) continue;
     }
 }
 
@@ -1008,6 +1123,9 @@ void databasesCron(void) {
     if (server.active_expire_enabled && server.masterhost == NULL)
         activeExpireCycle(ACTIVE_EXPIRE_CYCLE_SLOW);
 
+    /* Defrag keys gradually. */
+    activeDefragCycle();
+
     /* Perform hash tables rehashing if needed, but only if there are no
      * other processes saving the DB on disk. Otherwise rehashing is bad
      * as will cause a lot of copy-on-write of memory pages. */
@@ -1271,6 +1389,10 @@ int serverCron(struct aeEventLoop *eventLoop, long long id, void *clientData) {
 void beforeSleep(struct aeEventLoop *eventLoop) {
     REDIS_NOTUSED(eventLoop);
 
+    /* Handle the reads postponed to the I/O threads, if any. This will
+     * also execute the commands parsed by the threads. */
+    handleClientsWithPendingReadsUsingThreads();
+
     /* Call the Redis Cluster before sleep function. Note that this function
      * may change the state of Redis Cluster (from ok to fail or vice versa),
      * so it's a good idea to call it before serving the unblocked clients
@@ -1308,6 +1430,11 @@ void beforeSleep(struct aeEventLoop *eventLoop) {
 
     /* Write the AOF buffer on disk */
     flushAppendOnlyFile(0);
+
+    /* Handle writes with pending output buffers. This is done after the
+     * AOF flush so that with appendfsync always we never reply to clients
+     * before the write is on disk. */
+    handleClientsWithPendingWritesUsingThreads();
 }
 
 /* =========================== Server initialization ======================== */
@@ -1408,6 +1535,8 @@ void initServerConfig(void) {
     getRandomHexChars(server.runid,REDIS_RUN_ID_SIZE);
     server.configfile = NULL;
     server.hz = REDIS_DEFAULT_HZ;
+    server.io_threads_num = REDIS_DEFAULT_IO_THREADS;
+    server.accept_threads_num = REDIS_DEFAULT_ACCEPT_THREADS;
     server.runid[REDIS_RUN_ID_SIZE] = '\0';
     server.arch_bits = (sizeof(long) == 8) ? 64 : 32;
     server.port = REDIS_SERVERPORT;
@@ -1423,6 +1552,9 @@ void initServerConfig(void) {
     server.tcpkeepalive = REDIS_DEFAULT_TCP_KEEPALIVE;
     server.active_expire_enabled = 1;
     server.client_max_querybuf_len = REDIS_MAX_QUERYBUF_LEN;
+    server.proto_max_bulk_len = REDIS_DEFAULT_PROTO_MAX_BULK_LEN;
+    server.reply_zero_copy_threshold = REDIS_DEFAULT_REPLY_ZERO_COPY_THRESHOLD;
+    server.client_pool_size = REDIS_DEFAULT_CLIENT_POOL_SIZE;
     server.saveparams = NULL;
     server.loading = 0;
     server.logfile = zstrdup(REDIS_DEFAULT_LOGFILE);
@@ -1455,19 +1587,31 @@ void initServerConfig(void) {
     server.rdb_checksum = REDIS_DEFAULT_RDB_CHECKSUM;
     server.stop_writes_on_bgsave_err = REDIS_DEFAULT_STOP_WRITES_ON_BGSAVE_ERROR;
     server.activerehashing = REDIS_DEFAULT_ACTIVE_REHASHING;
+    server.active_defrag_enabled = REDIS_DEFAULT_ACTIVE_DEFRAG;
+    server.active_defrag_ignore_bytes = REDIS_DEFAULT_ACTIVE_DEFRAG_IGNORE_BYTES;
+    server.active_defrag_threshold_lower = REDIS_DEFAULT_ACTIVE_DEFRAG_THRESHOLD_LOWER;
+    server.active_defrag_threshold_upper = REDIS_DEFAULT_ACTIVE_DEFRAG_THRESHOLD_UPPER;
+    server.active_defrag_cycle_min = REDIS_DEFAULT_ACTIVE_DEFRAG_CYCLE_MIN;
+    server.active_defrag_cycle_max = REDIS_DEFAULT_ACTIVE_DEFRAG_CYCLE_MAX;
+    server.active_defrag_max_scan_fields = REDIS_DEFAULT_ACTIVE_DEFRAG_MAX_SCAN_FIELDS;
     server.notify_keyspace_events = 0;
     server.maxclients = REDIS_MAX_CLIENTS;
     server.bpop_blocked_clients = 0;
     server.maxmemory = REDIS_DEFAULT_MAXMEMORY;
     server.maxmemory_policy = REDIS_DEFAULT_MAXMEMORY_POLICY;
     server.maxmemory_samples = REDIS_DEFAULT_MAXMEMORY_SAMPLES;
+    server.lfu_log_factor = REDIS_DEFAULT_LFU_LOG_FACTOR;
+    server.lfu_decay_time = REDIS_DEFAULT_LFU_DECAY_TIME;
+    server.lazyfree_lazy_eviction = REDIS_DEFAULT_LAZYFREE_LAZY_EVICTION;
+    server.lazyfree_lazy_expire = REDIS_DEFAULT_LAZYFREE_LAZY_EXPIRE;
     server.hash_max_ziplist_entries = REDIS_HASH_MAX_ZIPLIST_ENTRIES;
     server.hash_max_ziplist_value = REDIS_HASH_MAX_ZIPLIST_VALUE;
-    server.list_max_ziplist_entries = REDIS_LIST_MAX_ZIPLIST_ENTRIES;
-    server.list_max_ziplist_value = REDIS_LIST_MAX_ZIPLIST_VALUE;
+    server.list_max_ziplist_size = REDIS_LIST_MAX_ZIPLIST_SIZE;
+    server.list_compress_depth = REDIS_LIST_COMPRESS_DEPTH;
     server.set_max_intset_entries = REDIS_SET_MAX_INTSET_ENTRIES;
     server.zset_max_ziplist_entries = REDIS_ZSET_MAX_ZIPLIST_ENTRIES;
     server.zset_max_ziplist_value = REDIS_ZSET_MAX_ZIPLIST_VALUE;
+    server.zset_use_btree = REDIS_DEFAULT_ZSET_USE_BTREE;
     server.hll_sparse_max_bytes = REDIS_DEFAULT_HLL_SPARSE_MAX_BYTES;
     server.shutdown_asap = 0;
     server.repl_ping_slave_period = REDIS_REPL_PING_SLAVE_PERIOD;
@@ -1666,6 +1810,9 @@ void checkTcpBacklogSettings(void) {
  * contains no specific addresses to bind, this function will try to
  * bind * (all addresses) for both the IPv4 and IPv6 protocols.
  *
+ * If 'reuseport' is true the sockets are created with SO_REUSEPORT, so that
+ * the same addresses can be bound again by the accept threads.
+ *
  * On success the function returns REDIS_OK.
  *
  * On error the function returns REDIS_ERR. For the function to be on
@@ -1673,7 +1820,11 @@ void checkTcpBacklogSettings(void) {
  * impossible to bind, or no bind addresses were specified in the server
  * configuration but the function is not able to bind * for at least
  * one of the IPv4 or IPv6 protocols. */
-int listenToPort(int port, int *fds, int *count) {
+int listenToPort(int port, int *fds, int *count, int reuseport) {
+    int (*tcpserver)(char*,int,char*,int) =
+        reuseport ? anetTcpServerReusePort : anetTcpServer;
+    int (*tcp6server)(char*,int,char*,int) =
+        reuseport ? anetTcp6ServerReusePort : anetTcp6Server;
     int j;
 
     /* Force binding of 0.0.0.0 if no bind address is specified, always
@@ -1683,13 +1834,13 @@ int listenToPort(int port, int *fds, int *count) {
         if (server.bindaddr[j] == NULL) {
             /* Bind * for both IPv6 and IPv4, we enter here only if
              * server.bindaddr_count == 0. */
-            fds[*count] = anetTcp6Server(server.neterr,port,NULL,
+            fds[*count] = tcp6server(server.neterr,port,NULL,
                 server.tcp_backlog);
             if (fds[*count] != ANET_ERR) {
                 anetNonBlock(NULL,fds[*count]);
                 (*count)++;
             }
-            fds[*count] = anetTcpServer(server.neterr,port,NULL,
+            fds[*count] = tcpserver(server.neterr,port,NULL,
                 server.tcp_backlog);
             if (fds[*count] != ANET_ERR) {
                 anetNonBlock(NULL,fds[*count]);
@@ -1701,11 +1852,11 @@ int listenToPort(int port, int *fds, int *count) {
             if (*count) break;
         } else if (strchr(server.bindaddr[j],':')) {
             /* Bind IPv6 address. */
-            fds[*count] = anetTcp6Server(server.neterr,port,server.bindaddr[j],
+            fds[*count] = tcp6server(server.neterr,port,server.bindaddr[j],
                 server.tcp_backlog);
         } else {
             /* Bind IPv4 address. */
-            fds[*count] = anetTcpServer(server.neterr,port,server.bindaddr[j],
+            fds[*count] = tcpserver(server.neterr,port,server.bindaddr[j],
                 server.tcp_backlog);
         }
         if (fds[*count] == ANET_ERR) {
@@ -1731,6 +1882,10 @@ void resetServerStats(void) {
     server.stat_numconnections = 0;
     server.stat_expiredkeys = 0;
     server.stat_evictedkeys = 0;
+    server.stat_evicted_idle = 0;
+    server.stat_evicted_freq = 0;
+    server.stat_evicted_lfu_keys = 0;
+    server.stat_eviction_samples = 0;
     server.stat_keyspace_misses = 0;
     server.stat_keyspace_hits = 0;
     server.stat_fork_time = 0;
@@ -1748,7 +1903,18 @@ void resetServerStats(void) {
     }
     server.stat_net_input_bytes = 0;
     server.stat_net_output_bytes = 0;
+    server.stat_io_reads_processed = 0;
+    server.stat_io_writes_processed = 0;
+    server.stat_zero_copy_reply_bytes = 0;
+    server.stat_threaded_accepts = 0;
+    server.stat_client_pool_hits = 0;
+    server.stat_client_pool_misses = 0;
+    server.stat_active_defrag_hits = 0;
+    server.stat_active_defrag_misses = 0;
+    server.stat_active_defrag_key_hits = 0;
+    server.stat_active_defrag_key_misses = 0;
     server.aof_delayed_fsync = 0;
+    lazyfreeResetStats();
 }
 
 void initServer(void) {
@@ -1767,6 +1933,8 @@ void initServer(void) {
     server.current_client = NULL;
     server.clients = listCreate();
     server.clients_to_close = listCreate();
+    server.clients_pending_write = listCreate();
+    server.clients_pending_read = listCreate();
     server.slaves = listCreate();
     server.monitors = listCreate();
     server.slaveseldb = -1; /* Force to emit the first SELECT command. */
@@ -1783,7 +1951,8 @@ void initServer(void) {
 
     /* Open the TCP listening socket for the user commands. */
     if (server.port != 0 &&
-        listenToPort(server.port,server.ipfd,&server.ipfd_count) == REDIS_ERR)
+        listenToPort(server.port,server.ipfd,&server.ipfd_count,
+                     server.accept_threads_num > 0) == REDIS_ERR)
         exit(1);
 
     /* Open the listening Unix domain socket. */
@@ -1811,10 +1980,10 @@ void initServer(void) {
         server.db[j].blocking_keys = dictCreate(&keylistDictType,NULL);
         server.db[j].ready_keys = dictCreate(&setDictType,NULL);
         server.db[j].watched_keys = dictCreate(&keylistDictType,NULL);
-        server.db[j].eviction_pool = evictionPoolAlloc();
         server.db[j].id = j;
         server.db[j].avg_ttl = 0;
     }
+    server.eviction_pool = evictionPoolAlloc();
     server.pubsub_channels = dictCreate(&keylistDictType,NULL);
     server.pubsub_patterns = listCreate();
     listSetFreeMethod(server.pubsub_patterns,freePubsubPattern);
@@ -1835,6 +2004,7 @@ void initServer(void) {
     server.stat_starttime = time(NULL);
     server.stat_peak_memory = 0;
     server.resident_set_size = 0;
+    server.active_defrag_running = 0;
     server.lastbgsave_status = REDIS_OK;
     server.aof_last_write_status = REDIS_OK;
     server.aof_last_write_errno = 0;
@@ -1888,6 +2058,8 @@ void initServer(void) {
     slowlogInit();
     latencyMonitorInit();
     bioInit();
+    initThreadedIO();
+    initAcceptThreads();
 }
 
 /* Populates the Redis Command Table starting from the hard coded list
@@ -2321,6 +2493,7 @@ void closeListeningSockets(int unlink_unix_socket) {
     int j;
 
     for (j = 0; j < server.ipfd_count; j++) close(server.ipfd[j]);
+    closeAcceptThreadsSockets();
     if (server.sofd != -1) close(server.sofd);
     if (server.cluster_enabled)
         for (j = 0; j < server.cfd_count; j++) close(server.cfd[j]);
@@ -2331,6 +2504,7 @@ void closeListeningSockets(int unlink_unix_socket) {
 }
 
 int prepareForShutdown(int flags) {
+    int j;
     int save = flags & REDIS_SHUTDOWN_SAVE;
     int nosave = flags & REDIS_SHUTDOWN_NOSAVE;
 
@@ -2378,7 +2552,16 @@ int prepareForShutdown(int flags) {
         redisLog(REDIS_NOTICE,"Removing the pid file.");
         unlink(server.pidfile);
     }
-    /* Close the listening sockets. Apparently this allows faster restarts. */
+    /* Close the listening sockets. Apparently this allows faster restarts.
+     * Unregister them from the event loop first, as some multiplexing
+     * backends (io_uring) hold a reference to the registered sockets that
+     * would keep them accepting connections until the process is gone.
+     * Note that this can't be done in closeListeningSockets() itself, that
+     * is also called by children sharing the event loop with the parent. */
+    for (j = 0; j < server.ipfd_count; j++)
+        aeDeleteFileEvent(server.el,server.ipfd[j],AE_READABLE);
+    if (server.sofd != -1) aeDeleteFileEvent(server.el,server.sofd,AE_READABLE);
+    stopAcceptThreads();
     closeListeningSockets(1);
     redisLog(REDIS_WARNING,"%s is now ready to exit, bye bye...",
         server.sentinel_mode ? "Sentinel" : "Redis");
@@ -2657,6 +2840,8 @@ sds genRedisInfoString(char *section) {
             "uptime_in_seconds:%jd\r\n"
             "uptime_in_days:%jd\r\n"
             "hz:%d\r\n"
+            "io_threads:%d\r\n"
+            "accept_threads:%d\r\n"
             "lru_clock:%ld\r\n"
             "config_file:%s\r\n",
             REDIS_VERSION,
@@ -2678,6 +2863,8 @@ sds genRedisInfoString(char *section) {
             (intmax_t)uptime,
             (intmax_t)(uptime/(3600*24)),
             server.hz,
+            server.io_threads_num,
+            server.accept_threads_num,
             (unsigned long) server.lruclock,
             server.configfile ? server.configfile : "");
     }
@@ -2690,10 +2877,12 @@ sds genRedisInfoString(char *section) {
             "connected_clients:%lu\r\n"
             "client_longest_output_list:%lu\r\n"
             "client_biggest_input_buf:%lu\r\n"
-            "blocked_clients:%d\r\n",
+            "blocked_clients:%d\r\n"
+            "pooled_clients:%d\r\n",
             listLength(server.clients)-listLength(server.slaves),
             lol, bib,
-            server.bpop_blocked_clients);
+            server.bpop_blocked_clients,
+            pooledClientsCount());
     }
 
     /* Memory */
@@ -2701,6 +2890,7 @@ sds genRedisInfoString(char *section) {
         char hmem[64];
         char peak_hmem[64];
         size_t zmalloc_used = zmalloc_used_memory();
+        size_t allocator_allocated, allocator_active;
 
         /* Peak memory is updated from time to time by serverCron() so it
          * may happen that the instantaneous value is slightly bigger than
@@ -2711,6 +2901,7 @@ sds genRedisInfoString(char *section) {
 
         bytesToHuman(hmem,zmalloc_used);
         bytesToHuman(peak_hmem,server.stat_peak_memory);
+        zmalloc_get_allocator_info(&allocator_allocated,&allocator_active);
         if (sections++) info = sdscat(info,"\r\n");
         info = sdscatprintf(info,
             "# Memory\r\n"
@@ -2721,7 +2912,14 @@ sds genRedisInfoString(char *section) {
             "used_memory_peak_human:%s\r\n"
             "used_memory_lua:%lld\r\n"
             "mem_fragmentation_ratio:%.2f\r\n"
-            "mem_allocator:%s\r\n",
+            "mem_allocator:%s\r\n"
+            "lazyfree_pending_objects:%lu\r\n"
+            "lazyfree_pending_memory:%zu\r\n"
+            "allocator_allocated:%zu\r\n"
+            "allocator_active:%zu\r\n"
+            "allocator_frag_ratio:%.2f\r\n"
+            "allocator_frag_bytes:%zu\r\n"
+            "active_defrag_running:%d\r\n",
             zmalloc_used,
             hmem,
             server.resident_set_size,
@@ -2729,7 +2927,16 @@ sds genRedisInfoString(char *section) {
             peak_hmem,
             ((long long)lua_gc(server.lua,LUA_GCCOUNT,0))*1024LL,
             zmalloc_get_fragmentation_ratio(server.resident_set_size),
-            ZMALLOC_LIB
+            ZMALLOC_LIB,
+            lazyfreeGetPendingObjectsCount(),
+            lazyfreeGetPendingMemory(),
+            allocator_allocated,
+            allocator_active,
+            allocator_allocated ?
+                (float)allocator_active/allocator_allocated : 0,
+            allocator_active > allocator_allocated ?
+                allocator_active-allocator_allocated : 0,
+            server.active_defrag_running
             );
     }
 
@@ -2837,12 +3044,27 @@ sds genRedisInfoString(char *section) {
             "sync_partial_err:%lld\r\n"
             "expired_keys:%lld\r\n"
             "evicted_keys:%lld\r\n"
+            "evicted_keys_avg_idle:%lld\r\n"
+            "evicted_keys_avg_freq:%lld\r\n"
+            "eviction_samples:%d\r\n"
             "keyspace_hits:%lld\r\n"
             "keyspace_misses:%lld\r\n"
             "pubsub_channels:%ld\r\n"
             "pubsub_patterns:%lu\r\n"
             "latest_fork_usec:%lld\r\n"
-            "migrate_cached_sockets:%ld\r\n",
+            "migrate_cached_sockets:%ld\r\n"
+            "io_threads_active:%d\r\n"
+            "io_threaded_reads_processed:%lld\r\n"
+            "io_threaded_writes_processed:%lld\r\n"
+            "zero_copy_reply_bytes:%lld\r\n"
+            "threaded_accepts:%lld\r\n"
+            "client_pool_hits:%lld\r\n"
+            "client_pool_misses:%lld\r\n"
+            "active_defrag_hits:%lld\r\n"
+            "active_defrag_misses:%lld\r\n"
+            "active_defrag_key_hits:%lld\r\n"
+            "active_defrag_key_misses:%lld\r\n"
+            "lazyfreed_objects:%lu\r\n",
             server.stat_numconnections,
             server.stat_numcommands,
             getInstantaneousMetric(REDIS_METRIC_COMMAND),
@@ -2856,12 +3078,30 @@ sds genRedisInfoString(char *section) {
             server.stat_sync_partial_err,
             server.stat_expiredkeys,
             server.stat_evictedkeys,
+            (server.stat_evictedkeys - server.stat_evicted_lfu_keys) ?
+                server.stat_evicted_idle /
+                (server.stat_evictedkeys - server.stat_evicted_lfu_keys) : 0,
+            server.stat_evicted_lfu_keys ?
+                server.stat_evicted_freq / server.stat_evicted_lfu_keys : 0,
+            server.stat_eviction_samples,
             server.stat_keyspace_hits,
             server.stat_keyspace_misses,
             dictSize(server.pubsub_channels),
             listLength(server.pubsub_patterns),
             server.stat_fork_time,
-            dictSize(server.migrate_cached_sockets));
+            dictSize(server.migrate_cached_sockets),
+            server.io_threads_active,
+            server.stat_io_reads_processed,
+            server.stat_io_writes_processed,
+            server.stat_zero_copy_reply_bytes,
+            server.stat_threaded_accepts,
+            server.stat_client_pool_hits,
+            server.stat_client_pool_misses,
+            server.stat_active_defrag_hits,
+            server.stat_active_defrag_misses,
+            server.stat_active_defrag_key_hits,
+            server.stat_active_defrag_key_misses,
+            lazyfreeGetFreedObjectsCount());
     }
 
     /* Replication */
@@ -3093,7 +3333,11 @@ void monitorCommand(redisClient *c) {
  *
  * The N keys sampled are added in the pool of good keys to expire (the one
  * with an old access time) if they are better than one of the current keys
- * in the pool.
+ * in the pool. A single pool is used for all the databases: N keys are
+ * sampled from every non empty database, and every entry remembers the DB
+ * its key belongs to, so the best key is evicted regardless of how the keys
+ * are distributed among the databases. N grows when we are well over the
+ * memory limit, see evictionSamplesCount().
  *
  * After the pool is populated, the best key we have in the pool is expired.
  * However note that we don't remove keys from the pool when they are deleted
@@ -3113,6 +3357,7 @@ struct evictionPoolEntry *evictionPoolAlloc(void) {
     for (j = 0; j < REDIS_EVICTION_POOL_SIZE; j++) {
         ep[j].idle = 0;
         ep[j].key = NULL;
+        ep[j].dbid = 0;
     }
     return ep;
 }
@@ -3127,20 +3372,20 @@ struct evictionPoolEntry *evictionPoolAlloc(void) {
  * right. */
 
 #define EVICTION_SAMPLES_ARRAY_SIZE 16
-void evictionPoolPopulate(dict *sampledict, dict *keydict, struct evictionPoolEntry *pool) {
+void evictionPoolPopulate(int dbid, dict *sampledict, dict *keydict, struct evictionPoolEntry *pool, int numsamples) {
     int j, k, count;
     dictEntry *_samples[EVICTION_SAMPLES_ARRAY_SIZE];
     dictEntry **samples;
 
     /* Try to use a static buffer: this function is a big hit...
      * Note: it was actually measured that this helps. */
-    if (server.maxmemory_samples <= EVICTION_SAMPLES_ARRAY_SIZE) {
+    if (numsamples <= EVICTION_SAMPLES_ARRAY_SIZE) {
         samples = _samples;
     } else {
-        samples = zmalloc(sizeof(samples[0])*server.maxmemory_samples);
+        samples = zmalloc(sizeof(samples[0])*numsamples);
     }
 
-    count = dictGetSomeKeys(sampledict,samples,server.maxmemory_samples);
+    count = dictGetSomeKeys(sampledict,samples,numsamples);
     for (j = 0; j < count; j++) {
         unsigned long long idle;
         sds key;
@@ -3149,12 +3394,25 @@ void evictionPoolPopulate(dict *sampledict, dict *keydict, struct evictionPoolEn
 
         de = samples[j];
         key = dictGetKey(de);
-        /* If the dictionary we are sampling from is not the main
-         * dictionary (but the expires one) we need to lookup the key
-         * again in the key dictionary to obtain the value object. */
-        if (sampledict != keydict) de = dictFind(keydict, key);
-        o = dictGetVal(de);
-        idle = estimateObjectIdleTime(o);
+
+        /* The pool is sorted by idle time. With an LFU policy we use the
+         * inverse of the access frequency instead, so that the keys with
+         * the smaller counter are the best candidates for eviction, and
+         * with volatile-ttl the inverse of the expire time, so that the
+         * keys expiring sooner are evicted first. */
+        if (server.maxmemory_policy == REDIS_MAXMEMORY_VOLATILE_TTL) {
+            idle = ULLONG_MAX - (long long) dictGetSignedIntegerVal(de);
+        } else {
+            /* If the dictionary we are sampling from is not the main
+             * dictionary (but the expires one) we need to lookup the key
+             * again in the key dictionary to obtain the value object. */
+            if (sampledict != keydict) de = dictFind(keydict, key);
+            o = dictGetVal(de);
+            if (REDIS_MAXMEMORY_IS_LFU(server.maxmemory_policy))
+                idle = 255-LFUDecrAndReturn(o);
+            else
+                idle = estimateObjectIdleTime(o);
+        }
 
         /* Insert the element inside the pool.
          * First, find the first empty bucket or the first populated
@@ -3188,12 +3446,31 @@ void evictionPoolPopulate(dict *sampledict, dict *keydict, struct evictionPoolEn
         }
         pool[k].key = sdsdup(key);
         pool[k].idle = idle;
+        pool[k].dbid = dbid;
     }
     if (samples != _samples) zfree(samples);
 }
 
+/* Return the number of keys to sample from every database when populating
+ * the eviction pool. The more we are over the maxmemory limit, the more keys
+ * we are going to evict in a row, so it is worth to sample more keys in
+ * order to evict better candidates: the configured maxmemory-samples is
+ * used as it is when just above the limit, and increased by the same amount
+ * for every 10% of memory over the limit, up to REDIS_EVICTION_MAX_SAMPLES. */
+int evictionSamplesCount(size_t mem_tofree) {
+    unsigned long long overage = (unsigned long long)mem_tofree*100 /
+                                 server.maxmemory;
+    unsigned long long samples = server.maxmemory_samples;
+
+    if (samples >= REDIS_EVICTION_MAX_SAMPLES) return samples;
+    samples += samples*(overage/10);
+    if (samples > REDIS_EVICTION_MAX_SAMPLES)
+        samples = REDIS_EVICTION_MAX_SAMPLES;
+    return samples;
+}
+
 int freeMemoryIfNeeded(void) {
-    size_t mem_used, mem_tofree, mem_freed;
+    size_t mem_used, mem_tofree, mem_freed, pending;
     int slaves = listLength(server.slaves);
     mstime_t latency, eviction_latency;
 
@@ -3219,6 +3496,15 @@ int freeMemoryIfNeeded(void) {
         mem_used -= aofRewriteBufferSize();
     }
 
+    /* Values queued for lazy freeing are going to be released soon by the
+     * background thread: evicting more keys in the meantime would free more
+     * memory than needed. */
+    pending = lazyfreeGetPendingMemory();
+    if (pending > mem_used)
+        mem_used = 0;
+    else
+        mem_used -= pending;
+
     /* Check if we are over the memory limit. */
     if (mem_used <= server.maxmemory) return REDIS_OK;
 
@@ -3228,125 +3514,147 @@ int freeMemoryIfNeeded(void) {
     /* Compute how much memory we need to free. */
     mem_tofree = mem_used - server.maxmemory;
     mem_freed = 0;
+    server.stat_eviction_samples = evictionSamplesCount(mem_tofree);
     latencyStartMonitor(latency);
     while (mem_freed < mem_tofree) {
-        int j, k, keys_freed = 0;
-
-        for (j = 0; j < server.dbnum; j++) {
-            long bestval = 0; /* just to prevent warning */
-            sds bestkey = NULL;
-            dictEntry *de;
-            redisDb *db = server.db+j;
-            dict *dict;
-
-            if (server.maxmemory_policy == REDIS_MAXMEMORY_ALLKEYS_LRU ||
-                server.maxmemory_policy == REDIS_MAXMEMORY_ALLKEYS_RANDOM)
-            {
-                dict = server.db[j].dict;
-            } else {
-                dict = server.db[j].expires;
-            }
-            if (dictSize(dict) == 0) continue;
-
-            /* volatile-random and allkeys-random policy */
-            if (server.maxmemory_policy == REDIS_MAXMEMORY_ALLKEYS_RANDOM ||
-                server.maxmemory_policy == REDIS_MAXMEMORY_VOLATILE_RANDOM)
-            {
-                de = dictGetRandomKey(dict);
-                bestkey = dictGetKey(de);
+        int j, k, i;
+        static int next_db = 0;
+        sds bestkey = NULL;
+        int bestdbid = 0;
+        redisDb *db;
+        dict *dict;
+        dictEntry *de;
+        int allkeys =
+            server.maxmemory_policy == REDIS_MAXMEMORY_ALLKEYS_LRU ||
+            server.maxmemory_policy == REDIS_MAXMEMORY_ALLKEYS_LFU ||
+            server.maxmemory_policy == REDIS_MAXMEMORY_ALLKEYS_RANDOM;
+
+        /* volatile-random and allkeys-random policy: visit the databases
+         * in a round robin fashion, evicting a random key from the first
+         * non empty one. */
+        if (server.maxmemory_policy == REDIS_MAXMEMORY_ALLKEYS_RANDOM ||
+            server.maxmemory_policy == REDIS_MAXMEMORY_VOLATILE_RANDOM)
+        {
+            for (i = 0; i < server.dbnum; i++) {
+                j = (++next_db) % server.dbnum;
+                db = server.db+j;
+                dict = allkeys ? db->dict : db->expires;
+                if (dictSize(dict) != 0) {
+                    de = dictGetRandomKey(dict);
+                    bestkey = dictGetKey(de);
+                    bestdbid = j;
+                    break;
+                }
             }
+        }
 
-            /* volatile-lru and allkeys-lru policy */
-            else if (server.maxmemory_policy == REDIS_MAXMEMORY_ALLKEYS_LRU ||
-                server.maxmemory_policy == REDIS_MAXMEMORY_VOLATILE_LRU)
-            {
-                struct evictionPoolEntry *pool = db->eviction_pool;
-
-                while(bestkey == NULL) {
-                    evictionPoolPopulate(dict, db->dict, db->eviction_pool);
-                    /* Go backward from best to worst element to evict. */
-                    for (k = REDIS_EVICTION_POOL_SIZE-1; k >= 0; k--) {
-                        if (pool[k].key == NULL) continue;
-                        de = dictFind(dict,pool[k].key);
-
-                        /* Remove the entry from the pool. */
-                        sdsfree(pool[k].key);
-                        /* Shift all elements on its right to left. */
-                        memmove(pool+k,pool+k+1,
-                            sizeof(pool[0])*(REDIS_EVICTION_POOL_SIZE-k-1));
-                        /* Clear the element on the right which is empty
-                         * since we shifted one position to the left.  */
-                        pool[REDIS_EVICTION_POOL_SIZE-1].key = NULL;
-                        pool[REDIS_EVICTION_POOL_SIZE-1].idle = 0;
-
-                        /* If the key exists, is our pick. Otherwise it is
-                         * a ghost and we need to try the next element. */
-                        if (de) {
-                            bestkey = dictGetKey(de);
-                            break;
-                        } else {
-                            /* Ghost... */
-                            continue;
-                        }
+        /* volatile-lru, allkeys-lru, volatile-lfu, allkeys-lfu and
+         * volatile-ttl: sample every database into the shared pool and
+         * evict the best candidate, whatever database it belongs to. */
+        else {
+            struct evictionPoolEntry *pool = server.eviction_pool;
+
+            while(bestkey == NULL) {
+                unsigned long total_keys = 0, keys;
+
+                for (i = 0; i < server.dbnum; i++) {
+                    db = server.db+i;
+                    dict = allkeys ? db->dict : db->expires;
+                    if ((keys = dictSize(dict)) != 0) {
+                        evictionPoolPopulate(i, dict, db->dict, pool,
+                            server.stat_eviction_samples);
+                        total_keys += keys;
+                    }
+                }
+                if (!total_keys) break; /* No keys to evict. */
+
+                /* Go backward from best to worst element to evict. */
+                for (k = REDIS_EVICTION_POOL_SIZE-1; k >= 0; k--) {
+                    if (pool[k].key == NULL) continue;
+                    bestdbid = pool[k].dbid;
+                    db = server.db+bestdbid;
+                    de = dictFind(allkeys ? db->dict : db->expires,
+                                  pool[k].key);
+
+                    /* Remove the entry from the pool. */
+                    sdsfree(pool[k].key);
+                    /* Shift all elements on its right to left. */
+                    memmove(pool+k,pool+k+1,
+                        sizeof(pool[0])*(REDIS_EVICTION_POOL_SIZE-k-1));
+                    /* Clear the element on the right which is empty
+                     * since we shifted one position to the left.  */
+                    pool[REDIS_EVICTION_POOL_SIZE-1].key = NULL;
+                    pool[REDIS_EVICTION_POOL_SIZE-1].idle = 0;
+
+                    /* If the key exists, is our pick. Otherwise it is
+                     * a ghost and we need to try the next element. */
+                    if (de) {
+                        bestkey = dictGetKey(de);
+                        break;
+                    } else {
+                        /* Ghost... */
+                        continue;
                     }
                 }
             }
+        }
 
-            /* volatile-ttl */
-            else if (server.maxmemory_policy == REDIS_MAXMEMORY_VOLATILE_TTL) {
-                for (k = 0; k < server.maxmemory_samples; k++) {
-                    sds thiskey;
-                    long thisval;
+        /* Finally remove the selected key. */
+        if (bestkey) {
+            long long delta;
+            robj *keyobj, *val;
 
-                    de = dictGetRandomKey(dict);
-                    thiskey = dictGetKey(de);
-                    thisval = (long) dictGetVal(de);
-
-                    /* Expire sooner (minor expire unix timestamp) is better
-                     * candidate for deletion */
-                    if (bestkey == NULL || thisval < bestval) {
-                        bestkey = thiskey;
-                        bestval = thisval;
-                    }
-                }
+            db = server.db+bestdbid;
+
+            /* Account the idle time (or the access frequency with the LFU
+             * policies) of the evicted key, so that the quality of the
+             * sampling can be checked in INFO. */
+            val = dictFetchValue(db->dict,bestkey);
+            if (REDIS_MAXMEMORY_IS_LFU(server.maxmemory_policy)) {
+                server.stat_evicted_freq += LFUDecrAndReturn(val);
+                server.stat_evicted_lfu_keys++;
+            } else {
+                server.stat_evicted_idle += estimateObjectIdleTime(val)/1000;
             }
 
-            /* Finally remove the selected key. */
-            if (bestkey) {
-                long long delta;
-
-                robj *keyobj = createStringObject(bestkey,sdslen(bestkey));
-                propagateExpire(db,keyobj);
-                /* We compute the amount of memory freed by dbDelete() alone.
-                 * It is possible that actually the memory needed to propagate
-                 * the DEL in AOF and replication link is greater than the one
-                 * we are freeing removing the key, but we can't account for
-                 * that otherwise we would never exit the loop.
-                 *
-                 * AOF and Output buffer memory will be freed eventually so
-                 * we only care about memory used by the key space. */
-                delta = (long long) zmalloc_used_memory();
-                latencyStartMonitor(eviction_latency);
+            keyobj = createStringObject(bestkey,sdslen(bestkey));
+            propagateExpire(db,keyobj);
+            /* We compute the amount of memory freed by dbDelete() alone.
+             * It is possible that actually the memory needed to propagate
+             * the DEL in AOF and replication link is greater than the one
+             * we are freeing removing the key, but we can't account for
+             * that otherwise we would never exit the loop.
+             *
+             * AOF and Output buffer memory will be freed eventually so
+             * we only care about memory used by the key space.
+             *
+             * When the value is freed in background the memory is not
+             * released yet, but the estimate of its size is added to the
+             * pending memory, so it is accounted as freed as well. */
+            delta = (long long) zmalloc_used_memory() -
+                    (long long) lazyfreeGetPendingMemory();
+            latencyStartMonitor(eviction_latency);
+            if (server.lazyfree_lazy_eviction)
+                dbAsyncDelete(db,keyobj);
+            else
                 dbDelete(db,keyobj);
-                latencyEndMonitor(eviction_latency);
-                latencyAddSampleIfNeeded("eviction-del",eviction_latency);
-                latencyRemoveNestedEvent(latency,eviction_latency);
-                delta -= (long long) zmalloc_used_memory();
-                mem_freed += delta;
-                server.stat_evictedkeys++;
-                notifyKeyspaceEvent(REDIS_NOTIFY_EVICTED, "evicted",
-                    keyobj, db->id);
-                decrRefCount(keyobj);
-                keys_freed++;
-
-                /* When the memory to free starts to be big enough, we may
-                 * start spending so much time here that is impossible to
-                 * deliver data to the slaves fast enough, so we force the
-                 * transmission here inside the loop. */
-                if (slaves) flushSlavesOutputBuffers();
-            }
-        }
-        if (!keys_freed) {
+            latencyEndMonitor(eviction_latency);
+            latencyAddSampleIfNeeded("eviction-del",eviction_latency);
+            latencyRemoveNestedEvent(latency,eviction_latency);
+            delta -= (long long) zmalloc_used_memory() -
+                     (long long) lazyfreeGetPendingMemory();
+            mem_freed += delta;
+            server.stat_evictedkeys++;
+            notifyKeyspaceEvent(REDIS_NOTIFY_EVICTED, "evicted",
+                keyobj, db->id);
+            decrRefCount(keyobj);
+
+            /* When the memory to free starts to be big enough, we may
+             * start spending so much time here that is impossible to
+             * deliver data to the slaves fast enough, so we force the
+             * transmission here inside the loop. */
+            if (slaves) flushSlavesOutputBuffers();
+        } else {
             latencyEndMonitor(latency);
             latencyAddSampleIfNeeded("eviction-cycle",latency);
             return REDIS_ERR; /* nothing to free... */
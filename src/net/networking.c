@@ -29,16 +29,24 @@
 
 #include "redis.h"
 #include <sys/uio.h>
+#include <poll.h>
 #include <math.h>
 
-static void setProtocolError(redisClient *c, int pos);
+#ifndef IOV_MAX
+#define IOV_MAX 1024
+#endif
+
+static void setProtocolError(redisClient *c, size_t pos);
+static int deferProtocolError(redisClient *c, size_t pos);
+static int ioThreadsRunning(void);
+static int postponeClientRead(redisClient *c);
 
 /* To evaluate the output buffer size of a client we need to get size of
  * allocated objects, however we can't used zmalloc_size() directly on sds
  * strings because of the trick they use to work (the header is before the
  * returned pointer), so we use this helper function. */
 size_t zmalloc_size_sds(sds s) {
-    return zmalloc_size(s-sizeof(struct sdshdr));
+    return zmalloc_size(sdsAllocPtr(s));
 }
 
 /* Return the amount of memory used by the sds string at object->ptr
@@ -61,41 +69,167 @@ int listMatchObjects(void *a, void *b) {
     return equalStringObjects(a,b);
 }
 
-redisClient *createClient(int fd) {
-    redisClient *c = zmalloc(sizeof(redisClient));
+/* ==========================================================================
+ * Client pool
+ *
+ * The clients released by freeClient() are kept in a pool of up to
+ * client-pool-size entries instead of being freed, together with their query
+ * buffer, their argv array and argument objects (see freeClientArgv()) and
+ * their lists and dictionaries, emptied. allocClient() takes the clients
+ * from the pool, so that short lived connections, doing a few commands
+ * each, don't churn the allocator.
+ *
+ * The accept threads allocate clients as well, so the pool is protected by
+ * a mutex. It is never contended in practice.
+ * ========================================================================== */
+
+static redisClient **client_pool = NULL;
+static int client_pool_len = 0;     /* Clients in the pool. */
+static int client_pool_alloc = 0;   /* Slots allocated in client_pool. */
+static pthread_mutex_t client_pool_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+/* Return a client from the pool, or NULL if the pool is empty. */
+static redisClient *getPooledClient(void) {
+    redisClient *c = NULL;
+
+    pthread_mutex_lock(&client_pool_mutex);
+    if (client_pool_len) {
+        c = client_pool[--client_pool_len];
+        server.stat_client_pool_hits++;
+    } else {
+        server.stat_client_pool_misses++;
+    }
+    pthread_mutex_unlock(&client_pool_mutex);
+    return c;
+}
+
+/* Release the client structure and the memory it owns. */
+static void freeClientStructure(redisClient *c) {
+    sdsfree(c->querybuf);
+    dictRelease(c->bpop.keys);
+    listRelease(c->watched_keys);
+    dictRelease(c->pubsub_channels);
+    listRelease(c->pubsub_patterns);
+    listRelease(c->reply);
+    freeClientArgvCache(c);
+    zfree(c->argv);
+    zfree(c->buf);
+    zfree(c);
+}
+
+/* Called by freeClient() after the client was unlinked from the server
+ * state. If there is room in the pool the client is added to it and 1 is
+ * returned, otherwise 0 is returned and the caller should free the client.
+ *
+ * The client lists are already empty at this point, the dictionaries are
+ * emptied here to release their hash tables. */
+static int releaseClientToPool(redisClient *c) {
+    int pooled = 0;
+
+    /* Unlocked check: at worst we reset a client that we'll free. */
+    if (client_pool_len >= server.client_pool_size) return 0;
+
+    if (sdsAllocSize(c->querybuf) > REDIS_IOBUF_LEN*2) {
+        sdsfree(c->querybuf);
+        c->querybuf = sdsempty();
+    } else {
+        sdsclear(c->querybuf);
+    }
+    dictEmpty(c->bpop.keys,NULL);
+    dictEmpty(c->pubsub_channels,NULL);
+    if (c->argv_len > REDIS_ARGV_REUSE_MAX) {
+        zfree(c->argv);
+        c->argv = NULL;
+        c->argv_len = 0;
+    }
+
+    pthread_mutex_lock(&client_pool_mutex);
+    if (client_pool_len < server.client_pool_size) {
+        if (client_pool_len == client_pool_alloc) {
+            client_pool_alloc = server.client_pool_size;
+            client_pool = zrealloc(client_pool,
+                sizeof(redisClient*)*client_pool_alloc);
+        }
+        client_pool[client_pool_len++] = c;
+        pooled = 1;
+    }
+    pthread_mutex_unlock(&client_pool_mutex);
+    return pooled;
+}
+
+/* Free the pooled clients in excess of client-pool-size. Called when the
+ * pool size is changed with CONFIG SET. */
+void trimClientPool(void) {
+    pthread_mutex_lock(&client_pool_mutex);
+    while (client_pool_len > server.client_pool_size)
+        freeClientStructure(client_pool[--client_pool_len]);
+    pthread_mutex_unlock(&client_pool_mutex);
+}
+
+/* Return the number of clients in the pool, for INFO. */
+int pooledClientsCount(void) {
+    int count;
+
+    pthread_mutex_lock(&client_pool_mutex);
+    count = client_pool_len;
+    pthread_mutex_unlock(&client_pool_mutex);
+    return count;
+}
+
+/* Allocate and initialize a new client for the socket 'fd', setting the
+ * socket options, without registering it anywhere in the server state:
+ * this only allocates memory and reads the configuration, so it can be
+ * called by the accept threads as well. A connected client must be passed
+ * to linkClient() by the main thread before it is used.
+ *
+ * The client is taken from the client pool when possible, in that case the
+ * query buffer, the argv array and the lists and dictionaries of the client
+ * are already allocated and empty. */
+static redisClient *allocClient(int fd) {
+    redisClient *c = getPooledClient();
 
-    /* passing -1 as fd it is possible to create a non connected client.
-     * This is useful since all the Redis commands needs to be executed
-     * in the context of a client. When commands are executed in other
-     * contexts (for instance a Lua script) we need a non connected client. */
     if (fd != -1) {
         anetNonBlock(NULL,fd);
         anetEnableTcpNoDelay(NULL,fd);
         if (server.tcpkeepalive)
             anetKeepAlive(NULL,fd,server.tcpkeepalive);
-        if (aeCreateFileEvent(server.el,fd,AE_READABLE,
-            readQueryFromClient, c) == AE_ERR)
-        {
-            close(fd);
-            zfree(c);
-            return NULL;
-        }
+    }
+
+    if (c == NULL) {
+        c = zmalloc(sizeof(redisClient));
+        c->buf_size = REDIS_REPLY_CHUNK_BYTES;
+        c->buf = zmalloc(c->buf_size);
+        c->querybuf = sdsempty();
+        c->argv_len = 0;
+        c->argv = NULL;
+        memset(c->argv_cache,0,sizeof(c->argv_cache));
+        c->reply = listCreate();
+        listSetFreeMethod(c->reply,decrRefCountVoid);
+        listSetDupMethod(c->reply,dupClientReplyValue);
+        c->bpop.keys = dictCreate(&setDictType,NULL);
+        c->watched_keys = listCreate();
+        c->pubsub_channels = dictCreate(&setDictType,NULL);
+        c->pubsub_patterns = listCreate();
+        listSetFreeMethod(c->pubsub_patterns,decrRefCountVoid);
+        listSetMatchMethod(c->pubsub_patterns,listMatchObjects);
     }
 
     selectDb(c,0);
-    c->id = server.next_client_id++;
+    c->id = 0;
     c->fd = fd;
     c->name = NULL;
     c->bufpos = 0;
-    c->querybuf = sdsempty();
+    c->buf_peak = 0;
+    c->buf_peak_time = server.unixtime;
+    c->qb_pos = 0;
     c->querybuf_peak = 0;
     c->reqtype = 0;
     c->argc = 0;
-    c->argv = NULL;
     c->cmd = c->lastcmd = NULL;
     c->multibulklen = 0;
     c->bulklen = -1;
     c->sentlen = 0;
+    c->sentnodes = 0;
     c->flags = 0;
     c->ctime = c->lastinteraction = server.unixtime;
     c->authenticated = 0;
@@ -106,45 +240,66 @@ redisClient *createClient(int fd) {
     c->repl_ack_time = 0;
     c->slave_listening_port = 0;
     c->slave_capa = SLAVE_CAPA_NONE;
-    c->reply = listCreate();
     c->reply_bytes = 0;
     c->obuf_soft_limit_reached_time = 0;
-    listSetFreeMethod(c->reply,decrRefCountVoid);
-    listSetDupMethod(c->reply,dupClientReplyValue);
     c->btype = REDIS_BLOCKED_NONE;
     c->bpop.timeout = 0;
-    c->bpop.keys = dictCreate(&setDictType,NULL);
     c->bpop.target = NULL;
     c->bpop.numreplicas = 0;
     c->bpop.reploffset = 0;
     c->woff = 0;
-    c->watched_keys = listCreate();
-    c->pubsub_channels = dictCreate(&setDictType,NULL);
-    c->pubsub_patterns = listCreate();
     c->peerid = NULL;
-    listSetFreeMethod(c->pubsub_patterns,decrRefCountVoid);
-    listSetMatchMethod(c->pubsub_patterns,listMatchObjects);
-    if (fd != -1) listAddNodeTail(server.clients,c);
     initClientMultiState(c);
     return c;
 }
 
+/* Register a connected client created with allocClient() in the server
+ * state, and install its read handler. On error the client is freed and
+ * REDIS_ERR is returned. */
+static int linkClient(redisClient *c) {
+    c->id = server.next_client_id++;
+    listAddNodeTail(server.clients,c);
+    if (aeCreateFileEvent(server.el,c->fd,AE_READABLE,
+        readQueryFromClient, c) == AE_ERR)
+    {
+        freeClient(c);
+        return REDIS_ERR;
+    }
+    return REDIS_OK;
+}
+
+redisClient *createClient(int fd) {
+    redisClient *c = allocClient(fd);
+
+    /* passing -1 as fd it is possible to create a non connected client.
+     * This is useful since all the Redis commands needs to be executed
+     * in the context of a client. When commands are executed in other
+     * contexts (for instance a Lua script) we need a non connected client. */
+    if (fd == -1) {
+        c->id = server.next_client_id++;
+    } else if (linkClient(c) == REDIS_ERR) {
+        return NULL;
+    }
+    return c;
+}
+
 /* This function is called every time we are going to transmit new data
  * to the client. The behavior is the following:
  *
  * If the client should receive new data (normal clients will) the function
- * returns REDIS_OK, and make sure to install the write handler in our event
- * loop so that when the socket is writable new data gets written.
+ * returns REDIS_OK, and make sure to put the client in the list of clients
+ * with pending writes, so that before re-entering the event loop the
+ * beforeSleep() function will try to write the output buffers directly to
+ * the socket, and only install the write handler if needed.
  *
  * If the client should not receive new data, because it is a fake client
- * (used to load AOF in memory), a master or because the setup of the write
- * handler failed, the function returns REDIS_ERR.
+ * (used to load AOF in memory) or a master, the function returns REDIS_ERR.
  *
- * The function may return REDIS_OK without actually installing the write
- * event handler in the following cases:
+ * The function may return REDIS_OK without actually queueing the client
+ * in the following cases:
  *
- * 1) The event handler should already be installed since the output buffer
- *    already contained something.
+ * 1) The client is already queued, or the event handler should already be
+ *    installed since the output buffer already contained something.
  * 2) The client is a slave but not yet online, so we want to just accumulate
  *    writes in the buffer but not actually sending them yet.
  *
@@ -163,39 +318,47 @@ int prepareClientToWrite(redisClient *c) {
 
     if (c->fd <= 0) return REDIS_ERR; /* Fake client for AOF loading. */
 
-    /* Only install the handler if not already installed and, in case of
-     * slaves, if the client can actually receive writes. */
-    if (c->bufpos == 0 && listLength(c->reply) == 0 &&
+    /* Schedule the client to write the output buffers to the socket only
+     * if not already done and, for slaves, if the slave can actually
+     * receive writes at this stage. */
+    if (!clientHasPendingReplies(c) &&
+        !(c->flags & REDIS_PENDING_WRITE) &&
         (c->replstate == REDIS_REPL_NONE ||
          (c->replstate == REDIS_REPL_ONLINE && !c->repl_put_online_on_ack)))
     {
-        /* Try to install the write handler. */
-        if (aeCreateFileEvent(server.el, c->fd, AE_WRITABLE,
-                sendReplyToClient, c) == AE_ERR)
-        {
-            freeClientAsync(c);
-            return REDIS_ERR;
-        }
+        /* Here instead of installing the write handler, we just flag the
+         * client and put it into a list of clients that have something
+         * to write to the socket. This way before re-entering the event
+         * loop, we can try to directly write to the client sockets avoiding
+         * a system call. We'll only really install the write handler if
+         * we'll not be able to write the whole reply at once. */
+        c->flags |= REDIS_PENDING_WRITE;
+        listAddNodeHead(server.clients_pending_write,c);
     }
 
     /* Authorize the caller to queue in the output buffer of this client. */
     return REDIS_OK;
 }
 
-/* Create a duplicate of the last object in the reply list when
- * it is not exclusively owned by the reply list. */
-robj *dupLastObjectIfNeeded(list *reply) {
-    robj *new, *cur;
-    listNode *ln;
-    redisAssert(listLength(reply) > 0);
-    ln = listLast(reply);
-    cur = listNodeValue(ln);
-    if (cur->refcount > 1) {
-        new = dupStringObject(cur);
-        decrRefCount(cur);
-        listNodeValue(ln) = new;
-    }
-    return listNodeValue(ln);
+/* Return true if 'len' bytes can be appended to the object 'tail', the last
+ * one of a reply list. Objects also referenced elsewhere, like values of the
+ * keyspace or replies shared among slaves, are never copied just to append
+ * data to them: a new node is added instead, which does not cost additional
+ * syscalls since the reply list is sent with writev(2). */
+static int replyTailHasRoom(robj *tail, size_t len) {
+    return tail->ptr != NULL &&
+           tail->encoding == REDIS_ENCODING_RAW &&
+           tail->refcount == 1 &&
+           sdslen(tail->ptr)+len <= REDIS_REPLY_CHUNK_BYTES;
+}
+
+/* Return true if a string value of 'len' bytes should be sent by reference:
+ * the reply list holds a reference to the object, and the value is sent
+ * directly from its memory, instead of being copied into the output
+ * buffers. See the reply-zero-copy-threshold option. */
+static int replyIsZeroCopy(size_t len) {
+    return server.reply_zero_copy_threshold &&
+           len >= server.reply_zero_copy_threshold;
 }
 
 /* -----------------------------------------------------------------------------
@@ -203,7 +366,7 @@ robj *dupLastObjectIfNeeded(list *reply) {
  * -------------------------------------------------------------------------- */
 
 int _addReplyToBuffer(redisClient *c, char *s, size_t len) {
-    size_t available = sizeof(c->buf)-c->bufpos;
+    size_t available = c->buf_size-c->bufpos;
 
     if (c->flags & REDIS_CLOSE_AFTER_REPLY) return REDIS_OK;
 
@@ -211,6 +374,12 @@ int _addReplyToBuffer(redisClient *c, char *s, size_t len) {
      * add anything more to the static buffer. */
     if (listLength(c->reply) > 0) return REDIS_ERR;
 
+    /* Remember how big the buffer should be to hold this reply as well,
+     * so that clientsCron() can resize it. */
+    if (c->bufpos+len > (size_t)c->buf_peak)
+        c->buf_peak = c->bufpos+len > REDIS_REPLY_BUF_MAX_BYTES ?
+                      REDIS_REPLY_BUF_MAX_BYTES : c->bufpos+len;
+
     /* Check that the buffer has enough space available for this string. */
     if (len > available) return REDIS_ERR;
 
@@ -220,32 +389,37 @@ int _addReplyToBuffer(redisClient *c, char *s, size_t len) {
 }
 
 void _addReplyObjectToList(redisClient *c, robj *o) {
+    size_t len = sdslen(o->ptr);
+    int zerocopy = replyIsZeroCopy(len);
     robj *tail;
 
     if (c->flags & REDIS_CLOSE_AFTER_REPLY) return;
 
-    if (listLength(c->reply) == 0) {
-        incrRefCount(o);
-        listAddNodeTail(c->reply,o);
-        c->reply_bytes += getStringObjectSdsUsedMemory(o);
-    } else {
+    if (!zerocopy && listLength(c->reply) > 0) {
         tail = listNodeValue(listLast(c->reply));
 
         /* Append to this object when possible. */
-        if (tail->ptr != NULL &&
-            tail->encoding == REDIS_ENCODING_RAW &&
-            sdslen(tail->ptr)+sdslen(o->ptr) <= REDIS_REPLY_CHUNK_BYTES)
-        {
+        if (replyTailHasRoom(tail,len)) {
             c->reply_bytes -= zmalloc_size_sds(tail->ptr);
-            tail = dupLastObjectIfNeeded(c->reply);
-            tail->ptr = sdscatlen(tail->ptr,o->ptr,sdslen(o->ptr));
+            tail->ptr = sdscatlen(tail->ptr,o->ptr,len);
             c->reply_bytes += zmalloc_size_sds(tail->ptr);
-        } else {
-            incrRefCount(o);
-            listAddNodeTail(c->reply,o);
-            c->reply_bytes += getStringObjectSdsUsedMemory(o);
+            asyncCloseClientOnOutputBufferLimitReached(c);
+            return;
         }
     }
+
+    /* Big objects are referenced by the reply list and sent directly from
+     * their memory, small ones are copied into a new node where the
+     * next replies can be appended. Objects that would not fit a reply
+     * chunk anyway are never copied. */
+    if (zerocopy || len > REDIS_REPLY_CHUNK_BYTES) {
+        incrRefCount(o);
+        if (zerocopy) server.stat_zero_copy_reply_bytes += len;
+    } else {
+        o = createRawStringObject(o->ptr,len);
+    }
+    listAddNodeTail(c->reply,o);
+    c->reply_bytes += getStringObjectSdsUsedMemory(o);
     asyncCloseClientOnOutputBufferLimitReached(c);
 }
 
@@ -266,11 +440,8 @@ void _addReplySdsToList(redisClient *c, sds s) {
         tail = listNodeValue(listLast(c->reply));
 
         /* Append to this object when possible. */
-        if (tail->ptr != NULL && tail->encoding == REDIS_ENCODING_RAW &&
-            sdslen(tail->ptr)+sdslen(s) <= REDIS_REPLY_CHUNK_BYTES)
-        {
+        if (replyTailHasRoom(tail,sdslen(s))) {
             c->reply_bytes -= zmalloc_size_sds(tail->ptr);
-            tail = dupLastObjectIfNeeded(c->reply);
             tail->ptr = sdscatlen(tail->ptr,s,sdslen(s));
             c->reply_bytes += zmalloc_size_sds(tail->ptr);
             sdsfree(s);
@@ -288,7 +459,7 @@ void _addReplyStringToList(redisClient *c, char *s, size_t len) {
     if (c->flags & REDIS_CLOSE_AFTER_REPLY) return;
 
     if (listLength(c->reply) == 0) {
-        robj *o = createStringObject(s,len);
+        robj *o = createRawStringObject(s,len);
 
         listAddNodeTail(c->reply,o);
         c->reply_bytes += getStringObjectSdsUsedMemory(o);
@@ -296,15 +467,12 @@ void _addReplyStringToList(redisClient *c, char *s, size_t len) {
         tail = listNodeValue(listLast(c->reply));
 
         /* Append to this object when possible. */
-        if (tail->ptr != NULL && tail->encoding == REDIS_ENCODING_RAW &&
-            sdslen(tail->ptr)+len <= REDIS_REPLY_CHUNK_BYTES)
-        {
+        if (replyTailHasRoom(tail,len)) {
             c->reply_bytes -= zmalloc_size_sds(tail->ptr);
-            tail = dupLastObjectIfNeeded(c->reply);
             tail->ptr = sdscatlen(tail->ptr,s,len);
             c->reply_bytes += zmalloc_size_sds(tail->ptr);
         } else {
-            robj *o = createStringObject(s,len);
+            robj *o = createRawStringObject(s,len);
 
             listAddNodeTail(c->reply,o);
             c->reply_bytes += getStringObjectSdsUsedMemory(o);
@@ -329,13 +497,15 @@ void addReply(redisClient *c, robj *obj) {
      * we'll be able to send the object to the client without
      * messing with its page. */
     if (sdsEncodedObject(obj)) {
-        if (_addReplyToBuffer(c,obj->ptr,sdslen(obj->ptr)) != REDIS_OK)
+        /* Values sent by reference skip the static buffer as well. */
+        if (replyIsZeroCopy(sdslen(obj->ptr)) ||
+            _addReplyToBuffer(c,obj->ptr,sdslen(obj->ptr)) != REDIS_OK)
             _addReplyObjectToList(c,obj);
     } else if (obj->encoding == REDIS_ENCODING_INT) {
         /* Optimization: if there is room in the static buffer for 32 bytes
          * (more than the max chars a 64 bit integer can take as string) we
          * avoid decoding the object and go for the lower level approach. */
-        if (listLength(c->reply) == 0 && (sizeof(c->buf) - c->bufpos) >= 32) {
+        if (listLength(c->reply) == 0 && (c->buf_size - c->bufpos) >= 32) {
             char buf[32];
             int len;
 
@@ -445,8 +615,15 @@ void setDeferredMultiBulkLength(redisClient *c, void *node, long length) {
     if (ln->next != NULL) {
         next = listNodeValue(ln->next);
 
-        /* Only glue when the next node is non-NULL (an sds in this case) */
-        if (next->ptr != NULL) {
+        /* Only glue when the next node is a small chunk owned by the reply
+         * list, that the length can be merged with. Values sent by
+         * reference (see reply-zero-copy-threshold) and big nodes are left
+         * in place, copying them would defeat the purpose. */
+        if (next->ptr != NULL &&
+            next->encoding == REDIS_ENCODING_RAW &&
+            next->refcount == 1 &&
+            replyTailHasRoom(len,sdslen(next->ptr)))
+        {
             c->reply_bytes -= zmalloc_size_sds(len->ptr);
             c->reply_bytes -= getStringObjectSdsUsedMemory(next);
             len->ptr = sdscatlen(len->ptr,next->ptr,sdslen(next->ptr));
@@ -576,21 +753,21 @@ void addReplyBulkLongLong(redisClient *c, long long ll) {
 void copyClientOutputBuffer(redisClient *dst, redisClient *src) {
     listRelease(dst->reply);
     dst->reply = listDup(src->reply);
+    if (dst->buf_size < src->bufpos) {
+        zfree(dst->buf);
+        dst->buf_size = src->buf_size;
+        dst->buf = zmalloc(dst->buf_size);
+    }
     memcpy(dst->buf,src->buf,src->bufpos);
     dst->bufpos = src->bufpos;
     dst->reply_bytes = src->reply_bytes;
 }
 
 #define MAX_ACCEPTS_PER_CALL 1000
-static void acceptCommonHandler(int fd, int flags) {
-    redisClient *c;
-    if ((c = createClient(fd)) == NULL) {
-        redisLog(REDIS_WARNING,
-            "Error registering fd event for the new client: %s (fd=%d)",
-            strerror(errno),fd);
-        close(fd); /* May be already closed, just ignore errors */
-        return;
-    }
+
+/* Called for every new client once it is linked to the server state:
+ * enforce maxclients and update the stats. */
+static void acceptClient(redisClient *c, int flags) {
     /* If maxclient directive is set and this is one client more... close the
      * connection. Note that we create the client instead to check before
      * for this condition, since now the socket is already set in non-blocking
@@ -610,6 +787,18 @@ static void acceptCommonHandler(int fd, int flags) {
     c->flags |= flags;
 }
 
+static void acceptCommonHandler(int fd, int flags) {
+    redisClient *c;
+    if ((c = createClient(fd)) == NULL) {
+        redisLog(REDIS_WARNING,
+            "Error registering fd event for the new client: %s (fd=%d)",
+            strerror(errno),fd);
+        close(fd); /* May be already closed, just ignore errors */
+        return;
+    }
+    acceptClient(c,flags);
+}
+
 void acceptTcpHandler(aeEventLoop *el, int fd, void *privdata, int mask) {
     int cport, cfd, max = MAX_ACCEPTS_PER_CALL;
     char cip[REDIS_IP_STR_LEN];
@@ -649,14 +838,42 @@ void acceptUnixHandler(aeEventLoop *el, int fd, void *privdata, int mask) {
     }
 }
 
+/* Release the arguments of the current command. The embedded string
+ * objects that the command did not retain anywhere (reference count of one)
+ * are not freed but kept in c->argv_cache, so that the arguments of the next
+ * command can be copied inside them, see createClientArgvObject(). Objects
+ * the command stored in the keyspace, like the value of SET, are released
+ * as usually and are now owned by the keyspace. */
 static void freeClientArgv(redisClient *c) {
     int j;
-    for (j = 0; j < c->argc; j++)
-        decrRefCount(c->argv[j]);
+    for (j = 0; j < c->argc; j++) {
+        robj *o = c->argv[j];
+
+        if (j < REDIS_ARGV_CACHE_SIZE && o->refcount == 1 &&
+            o->encoding == REDIS_ENCODING_EMBSTR)
+        {
+            if (c->argv_cache[j]) decrRefCount(c->argv_cache[j]);
+            c->argv_cache[j] = o;
+        } else {
+            decrRefCount(o);
+        }
+    }
     c->argc = 0;
     c->cmd = NULL;
 }
 
+/* Free the argument objects kept for recycling. Called when the client is
+ * freed or idle for some time. */
+void freeClientArgvCache(redisClient *c) {
+    int j;
+    for (j = 0; j < REDIS_ARGV_CACHE_SIZE; j++) {
+        if (c->argv_cache[j]) {
+            decrRefCount(c->argv_cache[j]);
+            c->argv_cache[j] = NULL;
+        }
+    }
+}
+
 /* Close all the slaves connections. This is useful in chained replication
  * when we resync with our own master and want to force all our slaves to
  * resync with us as well. */
@@ -696,23 +913,15 @@ void freeClient(redisClient *c) {
             replicationGetSlaveName(c));
     }
 
-    /* Free the query buffer */
-    sdsfree(c->querybuf);
-    c->querybuf = NULL;
-
     /* Deallocate structures used to block on blocking ops. */
     if (c->flags & REDIS_BLOCKED) unblockClient(c);
-    dictRelease(c->bpop.keys);
 
     /* UNWATCH all the keys */
     unwatchAllKeys(c);
-    listRelease(c->watched_keys);
 
     /* Unsubscribe from all the pubsub channels */
     pubsubUnsubscribeAllChannels(c,0);
     pubsubUnsubscribeAllPatterns(c,0);
-    dictRelease(c->pubsub_channels);
-    listRelease(c->pubsub_patterns);
 
     /* Close socket, unregister events, and remove list of replies and
      * accumulated arguments. */
@@ -721,7 +930,7 @@ void freeClient(redisClient *c) {
         aeDeleteFileEvent(server.el,c->fd,AE_WRITABLE);
         close(c->fd);
     }
-    listRelease(c->reply);
+    listEmpty(c->reply);
     freeClientArgv(c);
 
     /* Remove from the list of clients */
@@ -739,6 +948,19 @@ void freeClient(redisClient *c) {
         listDelNode(server.unblocked_clients,ln);
     }
 
+    /* Remove from the list of clients with pending writes, and from the
+     * list of clients with reads postponed to the I/O threads. */
+    if (c->flags & REDIS_PENDING_WRITE) {
+        ln = listSearchKey(server.clients_pending_write,c);
+        redisAssert(ln != NULL);
+        listDelNode(server.clients_pending_write,ln);
+    }
+    if (c->flags & REDIS_PENDING_READ) {
+        ln = listSearchKey(server.clients_pending_read,c);
+        redisAssert(ln != NULL);
+        listDelNode(server.clients_pending_read,ln);
+    }
+
     /* Master/slave cleanup Case 1:
      * we lost the connection with a slave. */
     if (c->flags & REDIS_SLAVE) {
@@ -771,12 +993,12 @@ void freeClient(redisClient *c) {
     }
 
     /* Release other dynamically allocated client structure fields,
-     * and finally release the client structure itself. */
+     * and finally release the client structure itself, unless it can be
+     * recycled by the client pool. */
     if (c->name) decrRefCount(c->name);
-    zfree(c->argv);
     freeClientMultiState(c);
     sdsfree(c->peerid);
-    zfree(c);
+    if (!releaseClientToPool(c)) freeClientStructure(c);
 }
 
 /* Schedule a client to free it at a safe time in the serverCron() function.
@@ -784,9 +1006,20 @@ void freeClient(redisClient *c) {
  * a context where calling freeClient() is not possible, because the client
  * should be valid for the continuation of the flow of the program. */
 void freeClientAsync(redisClient *c) {
+    /* This function may be called by the I/O threads as well, so the
+     * queue of clients to close is protected by a mutex while they are
+     * running. */
+    static pthread_mutex_t async_free_queue_mutex = PTHREAD_MUTEX_INITIALIZER;
+
     if (c->flags & REDIS_CLOSE_ASAP || c->flags & REDIS_LUA_CLIENT) return;
     c->flags |= REDIS_CLOSE_ASAP;
+    if (server.io_threads_num == 1) {
+        listAddNodeTail(server.clients_to_close,c);
+        return;
+    }
+    pthread_mutex_lock(&async_free_queue_mutex);
     listAddNodeTail(server.clients_to_close,c);
+    pthread_mutex_unlock(&async_free_queue_mutex);
 }
 
 void freeClientsInAsyncFreeQueue(void) {
@@ -800,50 +1033,96 @@ void freeClientsInAsyncFreeQueue(void) {
     }
 }
 
-void sendReplyToClient(aeEventLoop *el, int fd, void *privdata, int mask) {
-    redisClient *c = privdata;
-    int nwritten = 0, totwritten = 0, objlen;
-    size_t objmem;
+/* Return true if the specified client has pending replies in its output
+ * buffers. Reply nodes already sent but not yet released do not count. */
+int clientHasPendingReplies(redisClient *c) {
+    return c->bufpos || listLength(c->reply) > (unsigned long)c->sentnodes;
+}
+
+/* Write as much as possible of the client output buffers to the socket.
+ * Returns the number of bytes written, setting *err to the errno of the
+ * failed writev(2) if any, or to zero.
+ *
+ * The static buffer and the reply list nodes are gathered into a single
+ * writev(2) call of up to IOV_MAX segments, so that big replies made of
+ * many nodes, or of large objects referenced by the list, are transmitted
+ * with few syscalls and without copying them.
+ *
+ * Reply nodes that were fully transmitted are not removed from the list
+ * but just counted in c->sentnodes: this function may run in an I/O thread
+ * and the reply list may reference shared objects whose reference count
+ * can only be touched by the main thread. The caller should later call
+ * releaseSentReplies() from the main thread. */
+static ssize_t _writeToClient(int fd, redisClient *c, int *err) {
+    struct iovec iov[IOV_MAX];
+    ssize_t nwritten = 0, totwritten = 0;
+    listNode *ln = listFirst(c->reply);
+    size_t objlen;
     robj *o;
-    REDIS_NOTUSED(el);
-    REDIS_NOTUSED(mask);
 
-    while(c->bufpos > 0 || listLength(c->reply)) {
-        if (c->bufpos > 0) {
-            nwritten = write(fd,c->buf+c->sentlen,c->bufpos-c->sentlen);
-            if (nwritten <= 0) break;
-            c->sentlen += nwritten;
-            totwritten += nwritten;
+    while(c->bufpos > 0 || ln) {
+        listNode *next = ln;
+        size_t iovbytes = 0, offset = c->sentlen, left;
+        int iovcnt = 0;
 
-            /* If the buffer was sent, set bufpos to zero to continue with
-             * the remainder of the reply. */
-            if (c->sentlen == c->bufpos) {
-                c->bufpos = 0;
-                c->sentlen = 0;
-            }
-        } else {
-            o = listNodeValue(listFirst(c->reply));
+        /* Gather the unsent part of the static buffer, then the reply list
+         * nodes. Just the first segment may be partially sent already. */
+        if (c->bufpos > 0) {
+            iov[iovcnt].iov_base = c->buf+c->sentlen;
+            iov[iovcnt].iov_len = c->bufpos-c->sentlen;
+            iovbytes += iov[iovcnt++].iov_len;
+            offset = 0;
+        }
+        while(next && iovcnt < IOV_MAX &&
+              iovbytes < REDIS_MAX_WRITE_PER_EVENT)
+        {
+            o = listNodeValue(next);
             objlen = sdslen(o->ptr);
-            objmem = getStringObjectSdsUsedMemory(o);
-
-            if (objlen == 0) {
-                listDelNode(c->reply,listFirst(c->reply));
-                c->reply_bytes -= objmem;
-                continue;
+            if (objlen > offset) {
+                iov[iovcnt].iov_base = ((char*)o->ptr)+offset;
+                iov[iovcnt].iov_len = objlen-offset;
+                iovbytes += iov[iovcnt++].iov_len;
             }
+            offset = 0;
+            next = listNextNode(next);
+        }
 
-            nwritten = write(fd, ((char*)o->ptr)+c->sentlen,objlen-c->sentlen);
+        nwritten = 0;
+        if (iovcnt) {
+            nwritten = writev(fd,iov,iovcnt);
             if (nwritten <= 0) break;
-            c->sentlen += nwritten;
             totwritten += nwritten;
+        }
 
-            /* If we fully sent the object on head go to the next one */
-            if (c->sentlen == objlen) {
-                listDelNode(c->reply,listFirst(c->reply));
-                c->sentlen = 0;
-                c->reply_bytes -= objmem;
+        /* Advance the buffer and the list by the bytes written. Empty
+         * nodes are consumed as well. */
+        left = nwritten;
+        if (c->bufpos > 0) {
+            if (left < (size_t)(c->bufpos-c->sentlen)) {
+                c->sentlen += left;
+                break;
             }
+            left -= c->bufpos-c->sentlen;
+            c->bufpos = 0;
+            c->sentlen = 0;
         }
+        while(ln) {
+            o = listNodeValue(ln);
+            objlen = sdslen(o->ptr);
+            if (objlen-c->sentlen > left) {
+                c->sentlen += left;
+                break;
+            }
+            left -= objlen-c->sentlen;
+            c->sentlen = 0;
+            c->sentnodes++;
+            ln = listNextNode(ln);
+        }
+
+        /* The socket buffer is full: try again on the next writable
+         * event. */
+        if ((size_t)nwritten < iovbytes) break;
+
         /* Note that we avoid to send more than REDIS_MAX_WRITE_PER_EVENT
          * bytes, in a single threaded server it's a good idea to serve
          * other clients as well, even if a very large request comes from
@@ -852,21 +1131,11 @@ void sendReplyToClient(aeEventLoop *el, int fd, void *privdata, int mask) {
          *
          * However if we are over the maxmemory limit we ignore that and
          * just deliver as much data as it is possible to deliver. */
-        server.stat_net_output_bytes += totwritten;
         if (totwritten > REDIS_MAX_WRITE_PER_EVENT &&
             (server.maxmemory == 0 ||
              zmalloc_used_memory() < server.maxmemory)) break;
     }
-    if (nwritten == -1) {
-        if (errno == EAGAIN) {
-            nwritten = 0;
-        } else {
-            redisLog(REDIS_VERBOSE,
-                "Error writing to client: %s", strerror(errno));
-            freeClient(c);
-            return;
-        }
-    }
+    *err = (nwritten == -1 && errno != EAGAIN) ? errno : 0;
     if (totwritten > 0) {
         /* For clients representing masters we don't count sending data
          * as an interaction, since we always send REPLCONF ACK commands
@@ -874,13 +1143,83 @@ void sendReplyToClient(aeEventLoop *el, int fd, void *privdata, int mask) {
          * We just rely on data / pings received for timeout detection. */
         if (!(c->flags & REDIS_MASTER)) c->lastinteraction = server.unixtime;
     }
-    if (c->bufpos == 0 && listLength(c->reply) == 0) {
+    return totwritten;
+}
+
+/* Remove from the reply list the nodes _writeToClient() already sent. */
+static void releaseSentReplies(redisClient *c) {
+    while(c->sentnodes) {
+        listNode *ln = listFirst(c->reply);
+
+        c->reply_bytes -= getStringObjectSdsUsedMemory(listNodeValue(ln));
+        listDelNode(c->reply,ln);
+        c->sentnodes--;
+    }
+}
+
+/* Write data in output buffers to client. Return REDIS_OK if the client
+ * is still valid after the call, REDIS_ERR if it was freed. */
+int writeToClient(int fd, redisClient *c, int handler_installed) {
+    ssize_t totwritten;
+    int err;
+
+    totwritten = _writeToClient(fd,c,&err);
+    releaseSentReplies(c);
+    server.stat_net_output_bytes += totwritten;
+    if (err) {
+        redisLog(REDIS_VERBOSE,
+            "Error writing to client: %s", strerror(err));
+        freeClient(c);
+        return REDIS_ERR;
+    }
+    if (!clientHasPendingReplies(c)) {
         c->sentlen = 0;
-        aeDeleteFileEvent(server.el,c->fd,AE_WRITABLE);
+        if (handler_installed) aeDeleteFileEvent(server.el,c->fd,AE_WRITABLE);
 
         /* Close connection after entire reply has been sent. */
-        if (c->flags & REDIS_CLOSE_AFTER_REPLY) freeClient(c);
+        if (c->flags & REDIS_CLOSE_AFTER_REPLY) {
+            freeClient(c);
+            return REDIS_ERR;
+        }
+    }
+    return REDIS_OK;
+}
+
+/* Write event handler. Just send data to the client. */
+void sendReplyToClient(aeEventLoop *el, int fd, void *privdata, int mask) {
+    REDIS_NOTUSED(el);
+    REDIS_NOTUSED(mask);
+    writeToClient(fd,privdata,1);
+}
+
+/* This function is called just before entering the event loop, in the hope
+ * we can just write the replies to the client output buffer without any
+ * need to use a syscall in order to install the writable event handler,
+ * get it called, and so forth. */
+int handleClientsWithPendingWrites(void) {
+    listIter li;
+    listNode *ln;
+    int processed = listLength(server.clients_pending_write);
+
+    listRewind(server.clients_pending_write,&li);
+    while((ln = listNext(&li))) {
+        redisClient *c = listNodeValue(ln);
+        c->flags &= ~REDIS_PENDING_WRITE;
+        listDelNode(server.clients_pending_write,ln);
+
+        /* Try to write buffers to the client socket. */
+        if (writeToClient(c->fd,c,0) == REDIS_ERR) continue;
+
+        /* If there is nothing left, do nothing. Otherwise install
+         * the write handler. */
+        if (clientHasPendingReplies(c) &&
+            aeCreateFileEvent(server.el, c->fd, AE_WRITABLE,
+                sendReplyToClient, c) == AE_ERR)
+        {
+            freeClientAsync(c);
+        }
     }
+    return processed;
 }
 
 /* resetClient prepare the client to process the next command */
@@ -897,36 +1236,81 @@ void resetClient(redisClient *c) {
         c->flags &= (~REDIS_ASKING);
 }
 
+/* The parsing functions below don't remove the processed requests from the
+ * query buffer, they just advance c->qb_pos: the buffer is trimmed once by
+ * processInputBuffer() after all the pipelined commands it contains were
+ * processed, instead of moving the rest of the buffer after every command. */
+
+/* Make sure c->argv can hold 'argc' arguments. The array is reused from
+ * one command to the next, unless it is very large. */
+static void clientArgvMakeRoom(redisClient *c, int argc) {
+    if (c->argv_len >= argc && c->argv_len <= REDIS_ARGV_REUSE_MAX) return;
+    zfree(c->argv);
+    c->argv = zmalloc(sizeof(robj*)*argc);
+    c->argv_len = argc;
+}
+
+/* Create the object for the next argument of the multi bulk request being
+ * parsed. If the object used for the argument at the same position in the
+ * previous command was not retained by that command (see freeClientArgv())
+ * and the new argument fits, the object is overwritten instead of allocating
+ * a new one: commands that just read their arguments, like GET, EXISTS or
+ * HGET, don't allocate memory to parse the request.
+ *
+ * The sds header of the recycled object keeps its original size as its
+ * alloc field, so the object never grows past its allocation. */
+static robj *createClientArgvObject(redisClient *c, char *ptr, size_t len) {
+    robj *o = NULL;
+
+    if (c->argc < REDIS_ARGV_CACHE_SIZE) o = c->argv_cache[c->argc];
+    if (o) {
+        sds s = o->ptr;
+
+        if (len <= sdsalloc(s)) {
+            c->argv_cache[c->argc] = NULL;
+            memcpy(s,ptr,len);
+            s[len] = '\0';
+            sdssetlen(s,len);
+            o->lru = objectInitialLRU();
+            return o;
+        }
+    }
+    return createStringObject(ptr,len);
+}
+
 int processInlineBuffer(redisClient *c) {
-    char *newline;
-    int argc, j;
+    char *querybuf = c->querybuf+c->qb_pos, *newline;
+    size_t qblen = sdslen(c->querybuf)-c->qb_pos;
+    int argc, j, linefeed_chars = 1;
     sds *argv, aux;
     size_t querylen;
 
     /* Search for end of line */
-    newline = strchr(c->querybuf,'\n');
+    newline = memchr(querybuf,'\n',qblen);
 
     /* Nothing to do without a \r\n */
     if (newline == NULL) {
-        if (sdslen(c->querybuf) > REDIS_INLINE_MAX_SIZE) {
+        if (qblen > REDIS_INLINE_MAX_SIZE) {
             addReplyError(c,"Protocol error: too big inline request");
-            setProtocolError(c,0);
+            setProtocolError(c,c->qb_pos);
         }
         return REDIS_ERR;
     }
 
     /* Handle the \r\n case. */
-    if (newline && newline != c->querybuf && *(newline-1) == '\r')
+    if (newline != querybuf && *(newline-1) == '\r') {
         newline--;
+        linefeed_chars++;
+    }
 
     /* Split the input buffer up to the \r\n */
-    querylen = newline-(c->querybuf);
-    aux = sdsnewlen(c->querybuf,querylen);
+    querylen = newline-querybuf;
+    aux = sdsnewlen(querybuf,querylen);
     argv = sdssplitargs(aux,&argc);
     sdsfree(aux);
     if (argv == NULL) {
         addReplyError(c,"Protocol error: unbalanced quotes in request");
-        setProtocolError(c,0);
+        setProtocolError(c,c->qb_pos);
         return REDIS_ERR;
     }
 
@@ -936,14 +1320,11 @@ int processInlineBuffer(redisClient *c) {
     if (querylen == 0 && c->flags & REDIS_SLAVE)
         c->repl_ack_time = server.unixtime;
 
-    /* Leave data after the first line of the query in the buffer */
-    sdsrange(c->querybuf,querylen+2,-1);
+    /* Move the parsing position after the first line of the query */
+    c->qb_pos += querylen+linefeed_chars;
 
     /* Setup argv array on client structure */
-    if (argc) {
-        if (c->argv) zfree(c->argv);
-        c->argv = zmalloc(sizeof(robj*)*argc);
-    }
+    if (argc) clientArgvMakeRoom(c,argc);
 
     /* Create redis objects for all arguments. */
     for (c->argc = 0, j = 0; j < argc; j++) {
@@ -958,9 +1339,9 @@ int processInlineBuffer(redisClient *c) {
     return REDIS_OK;
 }
 
-/* Helper function. Trims query buffer to make the function that processes
- * multi bulk requests idempotent. */
-static void setProtocolError(redisClient *c, int pos) {
+/* Helper function. Skips the query buffer up to 'pos' to make the function
+ * that processes multi bulk requests idempotent. */
+static void setProtocolError(redisClient *c, size_t pos) {
     if (server.verbosity <= REDIS_VERBOSE) {
         sds client = catClientInfoString(sdsempty(),c);
         redisLog(REDIS_VERBOSE,
@@ -968,37 +1349,74 @@ static void setProtocolError(redisClient *c, int pos) {
         sdsfree(client);
     }
     c->flags |= REDIS_CLOSE_AFTER_REPLY;
-    sdsrange(c->querybuf,pos,-1);
+    c->qb_pos = pos;
+}
+
+/* Replies can only be emitted by the main thread, so when the parser runs
+ * in an I/O thread protocol errors are not reported: we just consume what
+ * was successfully parsed so far and stop. Once the client is back in the
+ * main thread processInputBuffer() will hit the same error again and report
+ * it as usual. Returns non zero if the error was deferred this way. */
+static int deferProtocolError(redisClient *c, size_t pos) {
+    if (!ioThreadsRunning()) return 0;
+    c->qb_pos = pos;
+    return 1;
+}
+
+/* Parse the number of a "*<count>\r\n" or "$<len>\r\n" line, where 'p'
+ * points just after the '*' or '$' prefix and 'end' to the end of the
+ * buffer. The digits are converted while looking for the CR, so that the
+ * line is scanned just once. The same strings accepted by string2ll() are
+ * accepted here, but numbers longer than 18 digits are always rejected:
+ * they are out of the range of valid lengths anyway.
+ *
+ * Returns 1 on success, setting *ll and *newline to the position of the CR,
+ * 0 if the line is not complete yet, and -1 if it is not a valid number. */
+static int parseProtocolLength(char *p, char *end, long long *ll,
+                               char **newline)
+{
+    char *digits;
+    unsigned long long v = 0;
+    int negative = 0;
+
+    if (p < end && *p == '-') {
+        negative = 1;
+        p++;
+    }
+    digits = p;
+    while (p < end && *p >= '0' && *p <= '9') {
+        if (p-digits == 18) return -1;
+        v = (v*10)+(*p-'0');
+        p++;
+    }
+    if (p == end) return 0;
+    if (*p != '\r' || p == digits) return -1;
+    /* Leading zeroes, and "-0", are not valid. */
+    if (digits[0] == '0' && (p-digits > 1 || negative)) return -1;
+    /* The buffer should also contain the \n. */
+    if (p+1 == end) return 0;
+
+    *ll = negative ? -((long long)v) : (long long)v;
+    *newline = p;
+    return 1;
 }
 
 int processMultibulkBuffer(redisClient *c) {
-    char *newline = NULL;
-    int pos = 0, ok;
+    char *newline = NULL, *end = c->querybuf+sdslen(c->querybuf);
+    size_t pos = c->qb_pos;
     long long ll;
+    int ok;
 
     if (c->multibulklen == 0) {
         /* The client should have been reset */
         redisAssertWithInfo(c,NULL,c->argc == 0);
 
         /* Multi bulk length cannot be read without a \r\n */
-        newline = strchr(c->querybuf,'\r');
-        if (newline == NULL) {
-            if (sdslen(c->querybuf) > REDIS_INLINE_MAX_SIZE) {
-                addReplyError(c,"Protocol error: too big mbulk count string");
-                setProtocolError(c,0);
-            }
-            return REDIS_ERR;
-        }
-
-        /* Buffer should also contain \n */
-        if (newline-(c->querybuf) > ((signed)sdslen(c->querybuf)-2))
-            return REDIS_ERR;
-
-        /* We know for sure there is a whole line since newline != NULL,
-         * so go ahead and find out the multi bulk length. */
-        redisAssertWithInfo(c,NULL,c->querybuf[0] == '*');
-        ok = string2ll(c->querybuf+1,newline-(c->querybuf+1),&ll);
-        if (!ok || ll > 1024*1024) {
+        redisAssertWithInfo(c,NULL,c->querybuf[pos] == '*');
+        ok = parseProtocolLength(c->querybuf+pos+1,end,&ll,&newline);
+        if (ok == 0) return REDIS_ERR;
+        if (ok == -1 || ll > 1024*1024) {
+            if (deferProtocolError(c,pos)) return REDIS_ERR;
             addReplyError(c,"Protocol error: invalid multibulk length");
             setProtocolError(c,pos);
             return REDIS_ERR;
@@ -1006,37 +1424,23 @@ int processMultibulkBuffer(redisClient *c) {
 
         pos = (newline-c->querybuf)+2;
         if (ll <= 0) {
-            sdsrange(c->querybuf,pos,-1);
+            c->qb_pos = pos;
             return REDIS_OK;
         }
 
         c->multibulklen = ll;
 
         /* Setup argv array on client structure */
-        if (c->argv) zfree(c->argv);
-        c->argv = zmalloc(sizeof(robj*)*c->multibulklen);
+        clientArgvMakeRoom(c,c->multibulklen);
     }
 
     redisAssertWithInfo(c,NULL,c->multibulklen > 0);
     while(c->multibulklen) {
         /* Read bulk length if unknown */
         if (c->bulklen == -1) {
-            newline = strchr(c->querybuf+pos,'\r');
-            if (newline == NULL) {
-                if (sdslen(c->querybuf) > REDIS_INLINE_MAX_SIZE) {
-                    addReplyError(c,
-                        "Protocol error: too big bulk count string");
-                    setProtocolError(c,0);
-                    return REDIS_ERR;
-                }
-                break;
-            }
-
-            /* Buffer should also contain \n */
-            if (newline-(c->querybuf) > ((signed)sdslen(c->querybuf)-2))
-                break;
-
+            if (c->querybuf+pos == end) break;
             if (c->querybuf[pos] != '$') {
+                if (deferProtocolError(c,pos)) return REDIS_ERR;
                 addReplyErrorFormat(c,
                     "Protocol error: expected '$', got '%c'",
                     c->querybuf[pos]);
@@ -1044,14 +1448,16 @@ int processMultibulkBuffer(redisClient *c) {
                 return REDIS_ERR;
             }
 
-            ok = string2ll(c->querybuf+pos+1,newline-(c->querybuf+pos+1),&ll);
-            if (!ok || ll < 0 || ll > 512*1024*1024) {
+            ok = parseProtocolLength(c->querybuf+pos+1,end,&ll,&newline);
+            if (ok == 0) break;
+            if (ok == -1 || ll < 0 || ll > server.proto_max_bulk_len) {
+                if (deferProtocolError(c,pos)) return REDIS_ERR;
                 addReplyError(c,"Protocol error: invalid bulk length");
                 setProtocolError(c,pos);
                 return REDIS_ERR;
             }
 
-            pos += newline-(c->querybuf+pos)+2;
+            pos = (newline-c->querybuf)+2;
             if (ll >= REDIS_MBULK_BIG_ARG) {
                 size_t qblen;
 
@@ -1062,16 +1468,19 @@ int processMultibulkBuffer(redisClient *c) {
                 sdsrange(c->querybuf,pos,-1);
                 pos = 0;
                 qblen = sdslen(c->querybuf);
+                end = c->querybuf+qblen;
                 /* Hint the sds library about the amount of bytes this string is
                  * going to contain. */
-                if (qblen < (size_t)ll+2)
+                if (qblen < (size_t)ll+2) {
                     c->querybuf = sdsMakeRoomFor(c->querybuf,ll+2-qblen);
+                    end = c->querybuf+qblen;
+                }
             }
             c->bulklen = ll;
         }
 
         /* Read bulk argument */
-        if (sdslen(c->querybuf)-pos < (unsigned)(c->bulklen+2)) {
+        if ((size_t)(end-(c->querybuf+pos)) < (size_t)(c->bulklen+2)) {
             /* Not enough data (+2 == trailing \r\n) */
             break;
         } else {
@@ -1089,9 +1498,11 @@ int processMultibulkBuffer(redisClient *c) {
                  * likely... */
                 c->querybuf = sdsMakeRoomFor(c->querybuf,c->bulklen+2);
                 pos = 0;
+                end = c->querybuf;
             } else {
-                c->argv[c->argc++] =
-                    createStringObject(c->querybuf+pos,c->bulklen);
+                c->argv[c->argc] =
+                    createClientArgvObject(c,c->querybuf+pos,c->bulklen);
+                c->argc++;
                 pos += c->bulklen+2;
             }
             c->bulklen = -1;
@@ -1099,8 +1510,8 @@ int processMultibulkBuffer(redisClient *c) {
         }
     }
 
-    /* Trim to pos */
-    if (pos) sdsrange(c->querybuf,pos,-1);
+    /* Move the parsing position after what was processed */
+    c->qb_pos = pos;
 
     /* We're done when c->multibulk == 0 */
     if (c->multibulklen == 0) return REDIS_OK;
@@ -1110,29 +1521,35 @@ int processMultibulkBuffer(redisClient *c) {
 }
 
 void processInputBuffer(redisClient *c) {
-    /* Keep processing while there is something in the input buffer */
-    while(sdslen(c->querybuf)) {
+    /* Keep processing while there is something in the input buffer, or
+     * a command already parsed by an I/O thread. */
+    while(c->qb_pos < sdslen(c->querybuf) ||
+          c->flags & REDIS_PENDING_COMMAND)
+    {
         /* Return if clients are paused. */
-        if (!(c->flags & REDIS_SLAVE) && clientsArePaused()) return;
+        if (!(c->flags & REDIS_SLAVE) && clientsArePaused()) break;
 
         /* Immediately abort if the client is in the middle of something. */
-        if (c->flags & REDIS_BLOCKED) return;
+        if (c->flags & REDIS_BLOCKED) break;
 
         /* REDIS_CLOSE_AFTER_REPLY closes the connection once the reply is
          * written to the client. Make sure to not let the reply grow after
          * this flag has been set (i.e. don't process more commands). */
-        if (c->flags & REDIS_CLOSE_AFTER_REPLY) return;
+        if (c->flags & REDIS_CLOSE_AFTER_REPLY) break;
 
         /* Determine request type when unknown. */
         if (!c->reqtype) {
-            if (c->querybuf[0] == '*') {
+            if (c->querybuf[c->qb_pos] == '*') {
                 c->reqtype = REDIS_REQ_MULTIBULK;
             } else {
                 c->reqtype = REDIS_REQ_INLINE;
             }
         }
 
-        if (c->reqtype == REDIS_REQ_INLINE) {
+        if (c->flags & REDIS_PENDING_COMMAND) {
+            /* Already parsed by an I/O thread, see ioThreadReadClient(). */
+            c->flags &= ~REDIS_PENDING_COMMAND;
+        } else if (c->reqtype == REDIS_REQ_INLINE) {
             if (processInlineBuffer(c) != REDIS_OK) break;
         } else if (c->reqtype == REDIS_REQ_MULTIBULK) {
             if (processMultibulkBuffer(c) != REDIS_OK) break;
@@ -1149,16 +1566,25 @@ void processInputBuffer(redisClient *c) {
                 resetClient(c);
         }
     }
+
+    /* Trim the query buffer just once, removing all the processed
+     * commands. */
+    if (c->qb_pos) {
+        sdsrange(c->querybuf,c->qb_pos,-1);
+        c->qb_pos = 0;
+    }
 }
 
-void readQueryFromClient(aeEventLoop *el, int fd, void *privdata, int mask) {
-    redisClient *c = (redisClient*) privdata;
+/* Read data from the client socket appending it to the query buffer,
+ * and account the bytes read in *netin. Returns REDIS_OK if new data is
+ * available for parsing. On errors, EOF, or when the query buffer grows
+ * too large, the client is freed (scheduled to be freed if we are in the
+ * context of the I/O threads) and REDIS_ERR is returned. REDIS_ERR is also
+ * returned if there was nothing to read. */
+static int readClientQueryBuffer(redisClient *c, long long *netin) {
     int nread, readlen;
     size_t qblen;
-    REDIS_NOTUSED(el);
-    REDIS_NOTUSED(mask);
 
-    server.current_client = c;
     readlen = REDIS_IOBUF_LEN;
     /* If this is a multi bulk request, and we are processing a bulk reply
      * that is large enough, try to maximize the probability that the query
@@ -1169,36 +1595,33 @@ void readQueryFromClient(aeEventLoop *el, int fd, void *privdata, int mask) {
     if (c->reqtype == REDIS_REQ_MULTIBULK && c->multibulklen && c->bulklen != -1
         && c->bulklen >= REDIS_MBULK_BIG_ARG)
     {
-        int remaining = (unsigned)(c->bulklen+2)-sdslen(c->querybuf);
+        ssize_t remaining = (size_t)(c->bulklen+2)-sdslen(c->querybuf);
 
-        if (remaining < readlen) readlen = remaining;
+        if (remaining > 0 && remaining < readlen) readlen = remaining;
     }
 
     qblen = sdslen(c->querybuf);
     if (c->querybuf_peak < qblen) c->querybuf_peak = qblen;
     c->querybuf = sdsMakeRoomFor(c->querybuf, readlen);
-    nread = read(fd, c->querybuf+qblen, readlen);
+    nread = read(c->fd, c->querybuf+qblen, readlen);
     if (nread == -1) {
         if (errno == EAGAIN) {
             nread = 0;
         } else {
             redisLog(REDIS_VERBOSE, "Reading from client: %s",strerror(errno));
-            freeClient(c);
-            return;
+            goto freeclient;
         }
     } else if (nread == 0) {
         redisLog(REDIS_VERBOSE, "Client closed connection");
-        freeClient(c);
-        return;
+        goto freeclient;
     }
     if (nread) {
         sdsIncrLen(c->querybuf,nread);
         c->lastinteraction = server.unixtime;
         if (c->flags & REDIS_MASTER) c->reploff += nread;
-        server.stat_net_input_bytes += nread;
+        *netin += nread;
     } else {
-        server.current_client = NULL;
-        return;
+        return REDIS_ERR;
     }
     if (sdslen(c->querybuf) > server.client_max_querybuf_len) {
         sds ci = catClientInfoString(sdsempty(),c), bytes = sdsempty();
@@ -1207,10 +1630,31 @@ void readQueryFromClient(aeEventLoop *el, int fd, void *privdata, int mask) {
         redisLog(REDIS_WARNING,"Closing client that reached max query buffer length: %s (qbuf initial bytes: %s)", ci, bytes);
         sdsfree(ci);
         sdsfree(bytes);
-        freeClient(c);
-        return;
+        goto freeclient;
     }
-    processInputBuffer(c);
+    return REDIS_OK;
+
+freeclient:
+    if (ioThreadsRunning())
+        freeClientAsync(c);
+    else
+        freeClient(c);
+    return REDIS_ERR;
+}
+
+void readQueryFromClient(aeEventLoop *el, int fd, void *privdata, int mask) {
+    redisClient *c = (redisClient*) privdata;
+    REDIS_NOTUSED(el);
+    REDIS_NOTUSED(fd);
+    REDIS_NOTUSED(mask);
+
+    /* Check if we want to read from the client later when exiting from
+     * the event loop. This is the case if threaded I/O is enabled. */
+    if (postponeClientRead(c)) return;
+
+    server.current_client = c;
+    if (readClientQueryBuffer(c,&server.stat_net_input_bytes) == REDIS_OK)
+        processInputBuffer(c);
     server.current_client = NULL;
 }
 
@@ -1317,7 +1761,7 @@ sds catClientInfoString(sds s, redisClient *client) {
     if (emask & AE_WRITABLE) *p++ = 'w';
     *p = '\0';
     return sdscatfmt(s,
-        "id=%U addr=%s fd=%i name=%s age=%I idle=%I flags=%s db=%i sub=%i psub=%i multi=%i qbuf=%U qbuf-free=%U obl=%U oll=%U omem=%U events=%s cmd=%s",
+        "id=%U addr=%s fd=%i name=%s age=%I idle=%I flags=%s db=%i sub=%i psub=%i multi=%i qbuf=%U qbuf-free=%U obl=%U oll=%U omem=%U rbs=%U events=%s cmd=%s",
         (unsigned long long) client->id,
         getClientPeerId(client),
         client->fd,
@@ -1329,11 +1773,12 @@ sds catClientInfoString(sds s, redisClient *client) {
         (int) dictSize(client->pubsub_channels),
         (int) listLength(client->pubsub_patterns),
         (client->flags & REDIS_MULTI) ? client->mstate.count : -1,
-        (unsigned long long) sdslen(client->querybuf),
+        (unsigned long long) sdslen(client->querybuf)-client->qb_pos,
         (unsigned long long) sdsavail(client->querybuf),
         (unsigned long long) client->bufpos,
         (unsigned long long) listLength(client->reply),
         (unsigned long long) getClientOutputBufferMemoryUsage(client),
+        (unsigned long long) client->buf_size,
         events,
         client->lastcmd ? client->lastcmd->name : "NULL");
 }
@@ -1521,6 +1966,7 @@ void rewriteClientCommandVector(redisClient *c, int argc, ...) {
     zfree(c->argv);
     /* Replace argv and argc with our new versions. */
     c->argv = argv;
+    c->argv_len = argc;
     c->argc = argc;
     c->cmd = lookupCommandOrOriginal(c->argv[0]->ptr);
     redisAssertWithInfo(c,NULL,c->cmd != NULL);
@@ -1550,6 +1996,12 @@ void rewriteClientCommandArgument(redisClient *c, int i, robj *newval) {
  * It is "virtual" since the reply output list may contain objects that
  * are shared and are not really using additional memory.
  *
+ * Values sent by reference (see reply-zero-copy-threshold) are counted
+ * with the full size of their allocation like any other reply object:
+ * the client keeps them alive until they are transmitted, even if the
+ * key is modified or deleted in the meantime, so they are subject to the
+ * output buffer limits as if they were copied.
+ *
  * The function returns the total sum of the length of all the objects
  * stored in the output list, plus the memory used to allocate every
  * list node. The static reply buffer is not taken into account since it
@@ -1671,13 +2123,14 @@ void flushSlavesOutputBuffers(void) {
          * case the writable event is never installed, since the purpose
          * of put_online_on_ack is to postpone the moment it is installed.
          * This is what we want since slaves in this state should not receive
-         * writes before the first ACK. */
+         * writes before the first ACK. Slaves that still have to install
+         * the writable event are flagged with REDIS_PENDING_WRITE. */
         events = aeGetFileEvents(server.el,slave->fd);
-        if (events & AE_WRITABLE &&
+        if ((events & AE_WRITABLE || slave->flags & REDIS_PENDING_WRITE) &&
             slave->replstate == REDIS_REPL_ONLINE &&
-            listLength(slave->reply))
+            clientHasPendingReplies(slave))
         {
-            sendReplyToClient(server.el,slave->fd,slave,0);
+            writeToClient(slave->fd,slave,0);
         }
     }
 }
@@ -1745,13 +2198,682 @@ int clientsArePaused(void) {
  * write, close sequence needed to serve a client.
  *
  * The function returns the total number of events processed. */
+static int processing_events_while_blocked = 0;
+
 int processEventsWhileBlocked(void) {
     int iterations = 4; /* See the function top-comment. */
     int count = 0;
+
+    /* Note: when we are processing events while blocked (for instance during
+     * busy Lua scripts) we don't want to postpone reads to the I/O threads,
+     * since beforeSleep() is not called in this context. */
+    processing_events_while_blocked++;
     while (iterations--) {
-        int events = aeProcessEvents(server.el, AE_FILE_EVENTS|AE_DONT_WAIT);
+        int events = 0;
+        events += aeProcessEvents(server.el, AE_FILE_EVENTS|AE_DONT_WAIT);
+        events += handleClientsWithPendingWrites();
         if (!events) break;
         count += events;
     }
+    processing_events_while_blocked--;
     return count;
 }
+
+/* ==========================================================================
+ * Threaded I/O
+ *
+ * When io-threads is greater than one, the main thread can use a pool of
+ * I/O threads in order to perform the read(2) and protocol parsing of client
+ * queries, and the write(2) of client replies. Commands are always executed
+ * by the main thread: the I/O threads only run while the main thread is
+ * waiting for them in beforeSleep(), and only touch the state of the clients
+ * they were assigned, with the exception of freeClientAsync() that is safe
+ * to call from the threads.
+ *
+ * The I/O threads are only activated when there are enough clients with
+ * pending writes, otherwise all the I/O is performed by the main thread
+ * as usual.
+ * ========================================================================== */
+
+#define IO_THREADS_OP_IDLE 0
+#define IO_THREADS_OP_READ 1
+#define IO_THREADS_OP_WRITE 2
+
+static pthread_t io_threads[REDIS_IO_THREADS_MAX_NUM];
+static pthread_mutex_t io_threads_mutex[REDIS_IO_THREADS_MAX_NUM];
+static list *io_threads_list[REDIS_IO_THREADS_MAX_NUM];
+static long long io_threads_net_input[REDIS_IO_THREADS_MAX_NUM];
+static long long io_threads_net_output[REDIS_IO_THREADS_MAX_NUM];
+static int io_threads_op = IO_THREADS_OP_IDLE;
+
+/* Number of clients assigned to every thread and yet to be processed.
+ * Setting it is what makes the thread start working, and the thread sets
+ * it back to zero once done: this is the only synchronization between the
+ * main thread and the I/O threads while active, so it is accessed with
+ * atomic operations that also act as full memory barriers. */
+static unsigned long io_threads_pending[REDIS_IO_THREADS_MAX_NUM];
+
+#if defined(__ATOMIC_RELAXED)
+#define getIOPendingCount(i) \
+    __atomic_load_n(&io_threads_pending[i],__ATOMIC_SEQ_CST)
+#define setIOPendingCount(i,count) \
+    __atomic_store_n(&io_threads_pending[i],count,__ATOMIC_SEQ_CST)
+#elif defined(HAVE_ATOMIC)
+#define getIOPendingCount(i) \
+    __sync_add_and_fetch(&io_threads_pending[i],0)
+#define setIOPendingCount(i,count) do { \
+    __sync_synchronize(); \
+    io_threads_pending[i] = (count); \
+    __sync_synchronize(); \
+} while(0)
+#else
+#define IO_THREADS_UNSUPPORTED
+#define getIOPendingCount(i) (io_threads_pending[i])
+#define setIOPendingCount(i,count) (io_threads_pending[i] = (count))
+#endif
+
+/* Return true if the I/O threads are processing clients right now. Note that
+ * during this time the main thread processes its share of clients as well,
+ * so this is the condition to check in order to know if it is safe to touch
+ * global state from the networking code. */
+static int ioThreadsRunning(void) {
+    return io_threads_op != IO_THREADS_OP_IDLE;
+}
+
+/* Read and parse the query of a client in the context of an I/O thread.
+ * At most one command is parsed, flagging the client with
+ * REDIS_PENDING_COMMAND, so that it will be executed by the main thread
+ * without parsing it again. Only the multi bulk protocol is handled here:
+ * inline commands and protocol errors are left to processInputBuffer(). */
+static void ioThreadReadClient(redisClient *c, long long *netin) {
+    if (readClientQueryBuffer(c,netin) == REDIS_ERR) return;
+
+    /* The previous command may still wait to be executed, see
+     * processInputBuffer(). */
+    if (c->flags & REDIS_PENDING_COMMAND) return;
+
+    /* Same checks performed by processInputBuffer(). Note that we can't
+     * call clientsArePaused() here as it has side effects. */
+    if (server.clients_paused) return;
+    if (c->flags & (REDIS_BLOCKED|REDIS_CLOSE_AFTER_REPLY)) return;
+    if (!c->reqtype && c->querybuf[c->qb_pos] == '*')
+        c->reqtype = REDIS_REQ_MULTIBULK;
+    if (c->reqtype != REDIS_REQ_MULTIBULK) return;
+    if (processMultibulkBuffer(c) == REDIS_OK)
+        c->flags |= REDIS_PENDING_COMMAND;
+}
+
+/* Write the output buffers of a client in the context of an I/O thread.
+ * The reply nodes sent are released by the main thread later. */
+static void ioThreadWriteClient(redisClient *c, long long *netout) {
+    int err;
+
+    *netout += _writeToClient(c->fd,c,&err);
+    if (err) {
+        redisLog(REDIS_VERBOSE,
+            "Error writing to client: %s", strerror(err));
+        freeClientAsync(c);
+    }
+}
+
+void *IOThreadMain(void *myid) {
+    /* The ID is the thread number (from 0 to server.io_threads_num-1), and is
+     * used by the thread to just manipulate a single sub-array of clients. */
+    long id = (unsigned long)myid;
+    sigset_t sigset;
+    listIter li;
+    listNode *ln;
+    int j;
+
+    /* Block SIGALRM so we are sure that only the main thread will
+     * receive the watchdog signal. */
+    sigemptyset(&sigset);
+    sigaddset(&sigset, SIGALRM);
+    if (pthread_sigmask(SIG_BLOCK, &sigset, NULL))
+        redisLog(REDIS_WARNING,
+            "Warning: can't mask SIGALRM in I/O thread: %s", strerror(errno));
+
+    while(1) {
+        /* Wait for start */
+        for (j = 0; j < 1000000; j++) {
+            if (getIOPendingCount(id) != 0) break;
+        }
+
+        /* Give the main thread a chance to stop this thread. */
+        if (getIOPendingCount(id) == 0) {
+            pthread_mutex_lock(&io_threads_mutex[id]);
+            pthread_mutex_unlock(&io_threads_mutex[id]);
+            continue;
+        }
+
+        /* Process: note that the main thread will never touch our list
+         * before we drop the pending count to 0. */
+        listRewind(io_threads_list[id],&li);
+        while((ln = listNext(&li))) {
+            redisClient *c = listNodeValue(ln);
+            if (io_threads_op == IO_THREADS_OP_WRITE) {
+                ioThreadWriteClient(c,&io_threads_net_output[id]);
+            } else if (io_threads_op == IO_THREADS_OP_READ) {
+                ioThreadReadClient(c,&io_threads_net_input[id]);
+            } else {
+                redisPanic("io_threads_op value is unknown");
+            }
+        }
+        while(listLength(io_threads_list[id]))
+            listDelNode(io_threads_list[id],listFirst(io_threads_list[id]));
+        setIOPendingCount(id, 0);
+    }
+}
+
+/* Initialize the data structures needed for threaded I/O. */
+void initThreadedIO(void) {
+    pthread_t tid;
+    int j;
+
+    server.io_threads_active = 0; /* We start with threads not active. */
+
+#ifdef IO_THREADS_UNSUPPORTED
+    if (server.io_threads_num > 1) {
+        redisLog(REDIS_WARNING,
+            "Threaded I/O is not supported on this platform: "
+            "ignoring io-threads %d", server.io_threads_num);
+        server.io_threads_num = 1;
+    }
+#endif
+
+    /* Don't spawn any thread if the user selected a single thread:
+     * we'll handle I/O directly from the main thread. */
+    if (server.io_threads_num == 1) return;
+
+    /* Spawn and initialize the I/O threads. */
+    for (j = 0; j < server.io_threads_num; j++) {
+        /* Things we do for all the threads including the main thread. */
+        io_threads_list[j] = listCreate();
+        io_threads_net_input[j] = 0;
+        io_threads_net_output[j] = 0;
+        if (j == 0) continue; /* Thread 0 is the main thread. */
+
+        /* Things we do only for the additional threads. */
+        pthread_mutex_init(&io_threads_mutex[j],NULL);
+        setIOPendingCount(j, 0);
+        pthread_mutex_lock(&io_threads_mutex[j]); /* Thread will be stopped. */
+        if (pthread_create(&tid,NULL,IOThreadMain,(void*)(long)j) != 0) {
+            redisLog(REDIS_WARNING,"Fatal: Can't initialize I/O threads.");
+            exit(1);
+        }
+        io_threads[j] = tid;
+    }
+}
+
+static void startThreadedIO(void) {
+    int j;
+
+    redisAssert(server.io_threads_active == 0);
+    for (j = 1; j < server.io_threads_num; j++)
+        pthread_mutex_unlock(&io_threads_mutex[j]);
+    server.io_threads_active = 1;
+}
+
+static void stopThreadedIO(void) {
+    int j;
+
+    /* We may have still clients with pending reads when this function
+     * is called: handle them before stopping the threads. */
+    handleClientsWithPendingReadsUsingThreads();
+    redisAssert(server.io_threads_active == 1);
+    for (j = 1; j < server.io_threads_num; j++)
+        pthread_mutex_lock(&io_threads_mutex[j]);
+    server.io_threads_active = 0;
+}
+
+/* This function checks if there are not enough pending clients to justify
+ * taking the I/O threads active: in that case I/O threads are stopped if
+ * currently active. We track the pending writes as a measure of clients
+ * we need to handle in parallel, however the I/O threading is disabled
+ * globally for reads as well if we have too little pending clients.
+ *
+ * The function returns 0 if the I/O threading should be used because there
+ * are enough active threads, otherwise 1 is returned and the I/O threads
+ * could be possibly stopped (if already active) as a side effect. */
+static int stopThreadedIOIfNeeded(void) {
+    int pending = listLength(server.clients_pending_write);
+
+    /* Return ASAP if I/O threads are disabled (single threaded mode). */
+    if (server.io_threads_num == 1) return 1;
+
+    if (pending < (server.io_threads_num*2)) {
+        if (server.io_threads_active) stopThreadedIO();
+        return 1;
+    } else {
+        return 0;
+    }
+}
+
+/* Assign the clients of 'clients' to the I/O threads in a round robin
+ * fashion, run 'op' on all of them, and wait for the threads to finish.
+ * The main thread processes the clients assigned to thread 0. */
+static void runIOThreads(list *clients, int op) {
+    listIter li;
+    listNode *ln;
+    int j, item_id = 0;
+
+    listRewind(clients,&li);
+    while((ln = listNext(&li))) {
+        redisClient *c = listNodeValue(ln);
+        listAddNodeTail(io_threads_list[item_id % server.io_threads_num],c);
+        item_id++;
+    }
+
+    /* Give the start condition to the waiting threads, by setting the
+     * start condition atomic var. */
+    io_threads_op = op;
+    for (j = 1; j < server.io_threads_num; j++) {
+        unsigned long count = listLength(io_threads_list[j]);
+        setIOPendingCount(j, count);
+    }
+
+    /* Also use the main thread to process a slice of clients. */
+    listRewind(io_threads_list[0],&li);
+    while((ln = listNext(&li))) {
+        redisClient *c = listNodeValue(ln);
+        if (op == IO_THREADS_OP_WRITE)
+            ioThreadWriteClient(c,&io_threads_net_output[0]);
+        else
+            ioThreadReadClient(c,&io_threads_net_input[0]);
+    }
+    while(listLength(io_threads_list[0]))
+        listDelNode(io_threads_list[0],listFirst(io_threads_list[0]));
+
+    /* Wait for all the other threads to end their work. */
+    while(1) {
+        unsigned long pending = 0;
+        for (j = 1; j < server.io_threads_num; j++)
+            pending += getIOPendingCount(j);
+        if (pending == 0) break;
+    }
+    io_threads_op = IO_THREADS_OP_IDLE;
+
+    /* Collect the network traffic stats of the threads. */
+    for (j = 0; j < server.io_threads_num; j++) {
+        server.stat_net_input_bytes += io_threads_net_input[j];
+        server.stat_net_output_bytes += io_threads_net_output[j];
+        io_threads_net_input[j] = 0;
+        io_threads_net_output[j] = 0;
+    }
+}
+
+/* Like handleClientsWithPendingWrites() but writing the output buffers of
+ * the clients using the I/O threads, when there are enough of them. */
+int handleClientsWithPendingWritesUsingThreads(void) {
+    listIter li;
+    listNode *ln;
+    int processed = listLength(server.clients_pending_write);
+
+    if (processed == 0) return 0; /* Return ASAP if there are no clients. */
+
+    /* If I/O threads are disabled or we have few clients to serve, don't
+     * use I/O threads, but the boring synchronous code. */
+    if (server.io_threads_num == 1 || stopThreadedIOIfNeeded())
+        return handleClientsWithPendingWrites();
+
+    /* Start threads if needed. */
+    if (!server.io_threads_active) startThreadedIO();
+
+    /* Remove the clients we are going to write to from the pending writes
+     * state. Clients scheduled to be closed don't need any write. Slaves
+     * are written by the main thread, like their reads are, since their
+     * output buffer is fed with the replication stream. */
+    listRewind(server.clients_pending_write,&li);
+    while((ln = listNext(&li))) {
+        redisClient *c = listNodeValue(ln);
+        c->flags &= ~REDIS_PENDING_WRITE;
+        if (c->flags & REDIS_CLOSE_ASAP) {
+            listDelNode(server.clients_pending_write,ln);
+        } else if (c->flags & REDIS_SLAVE) {
+            listDelNode(server.clients_pending_write,ln);
+            if (writeToClient(c->fd,c,0) == REDIS_ERR) continue;
+            if (clientHasPendingReplies(c) &&
+                aeCreateFileEvent(server.el, c->fd, AE_WRITABLE,
+                    sendReplyToClient, c) == AE_ERR)
+            {
+                freeClientAsync(c);
+            }
+        }
+    }
+
+    runIOThreads(server.clients_pending_write,IO_THREADS_OP_WRITE);
+
+    /* Release the reply nodes sent by the threads, and handle what the
+     * threads are not allowed to do: installing the write handler for
+     * clients with output still pending, and closing the clients that
+     * wanted to be closed after the reply. */
+    while(listLength(server.clients_pending_write)) {
+        redisClient *c;
+
+        ln = listFirst(server.clients_pending_write);
+        c = listNodeValue(ln);
+        listDelNode(server.clients_pending_write,ln);
+        releaseSentReplies(c);
+        if (c->flags & REDIS_CLOSE_ASAP) continue;
+
+        if (clientHasPendingReplies(c)) {
+            if (aeCreateFileEvent(server.el, c->fd, AE_WRITABLE,
+                    sendReplyToClient, c) == AE_ERR)
+            {
+                freeClientAsync(c);
+            }
+        } else {
+            c->sentlen = 0;
+            if (c->flags & REDIS_CLOSE_AFTER_REPLY) freeClient(c);
+        }
+    }
+    server.stat_io_writes_processed += processed;
+
+    /* Free ASAP the clients the threads failed to write to. */
+    freeClientsInAsyncFreeQueue();
+    return processed;
+}
+
+/* Return 1 if we want to handle the client read later using threaded I/O.
+ * This is called by the readable handler of the event loop. As a side
+ * effect of calling this function the client is put in the pending read
+ * clients and flagged as such. Masters and slaves are always served by
+ * the main thread. */
+static int postponeClientRead(redisClient *c) {
+    if (server.io_threads_active &&
+        !processing_events_while_blocked &&
+        !(c->flags & (REDIS_MASTER|REDIS_SLAVE|REDIS_PENDING_READ|
+                      REDIS_BLOCKED)))
+    {
+        c->flags |= REDIS_PENDING_READ;
+        listAddNodeHead(server.clients_pending_read,c);
+        return 1;
+    } else {
+        return 0;
+    }
+}
+
+/* When threaded I/O is active, readQueryFromClient() postpones the reads,
+ * that are performed here by the I/O threads before entering the event
+ * loop again. Then the main thread executes the commands the threads
+ * parsed, and processes the rest of the query buffers. */
+int handleClientsWithPendingReadsUsingThreads(void) {
+    listNode *ln;
+    int processed = listLength(server.clients_pending_read);
+
+    if (!server.io_threads_active || processed == 0) return 0;
+
+    runIOThreads(server.clients_pending_read,IO_THREADS_OP_READ);
+
+    /* Run the commands parsed by the threads, and process the remaining
+     * input of the clients as well. */
+    while(listLength(server.clients_pending_read)) {
+        redisClient *c;
+
+        ln = listFirst(server.clients_pending_read);
+        c = listNodeValue(ln);
+        c->flags &= ~REDIS_PENDING_READ;
+        listDelNode(server.clients_pending_read,ln);
+        if (c->flags & REDIS_CLOSE_ASAP) continue;
+
+        server.current_client = c;
+        processInputBuffer(c);
+        server.current_client = NULL;
+    }
+    server.stat_io_reads_processed += processed;
+
+    /* Free ASAP the clients that were closed or that errored while the
+     * threads were reading from them. */
+    freeClientsInAsyncFreeQueue();
+    return processed;
+}
+
+/* ==========================================================================
+ * Accept threads
+ *
+ * When accept-threads is greater than zero, every accept thread binds its
+ * own listening sockets to the same addresses of the main thread, using
+ * SO_REUSEPORT, so that the kernel balances the incoming connections among
+ * the main thread and the accept threads. The threads accept the new
+ * connections and create the clients with allocClient(), then pass them
+ * to the main thread, that just needs to link them to the server state.
+ *
+ * Every thread hands its clients to the main thread using a single
+ * producer / single consumer ring buffer, so no lock is needed, and a
+ * byte written to a pipe that the main thread listens to wakes it up.
+ * ========================================================================== */
+
+#define ACCEPT_QUEUE_LEN 1024 /* Must be a power of two. */
+
+typedef struct acceptThread {
+    pthread_t tid;
+    int running;                        /* Thread was started. */
+    int fd[REDIS_BINDADDR_MAX];         /* Listening sockets. */
+    int count;                          /* Number of listening sockets. */
+    redisClient *queue[ACCEPT_QUEUE_LEN]; /* New clients ring buffer. */
+    unsigned long head;                 /* Next client to link. */
+    unsigned long tail;                 /* Next free slot. */
+} acceptThread;
+
+static acceptThread *accept_threads;
+static int accept_threads_count = 0;
+static int accept_notify_pipe[2] = {-1,-1}; /* Wakes up the main thread. */
+static int accept_stop_pipe[2] = {-1,-1};   /* Readable once threads stop. */
+static int accept_threads_stop = 0;         /* Set once threads stop. */
+
+/* The head of the ring buffer is only written by the main thread, the tail
+ * only by the accept thread. The release / acquire semantics make sure the
+ * client pointer is visible before the index that publishes it. */
+#if defined(__ATOMIC_RELAXED)
+#define acceptQueueLoad(var) __atomic_load_n(&(var),__ATOMIC_ACQUIRE)
+#define acceptQueueStore(var,val) __atomic_store_n(&(var),val,__ATOMIC_RELEASE)
+#elif defined(HAVE_ATOMIC)
+#define acceptQueueLoad(var) __sync_add_and_fetch(&(var),0)
+#define acceptQueueStore(var,val) do { \
+    __sync_synchronize(); \
+    (var) = (val); \
+    __sync_synchronize(); \
+} while(0)
+#else
+#define ACCEPT_THREADS_UNSUPPORTED
+#define acceptQueueLoad(var) (var)
+#define acceptQueueStore(var,val) ((var) = (val))
+#endif
+
+/* Queue a new client for the main thread, waiting for room if the main
+ * thread is busy and the queue is full. Returns REDIS_ERR, without queueing
+ * the client, if the threads are stopped while waiting: the main thread is
+ * then waiting for us in stopAcceptThreads(), and won't drain the queue
+ * before we exit. */
+static int acceptThreadQueueClient(acceptThread *t, redisClient *c) {
+    unsigned long tail = t->tail;
+
+    while (tail - acceptQueueLoad(t->head) == ACCEPT_QUEUE_LEN) {
+        if (acceptQueueLoad(accept_threads_stop)) return REDIS_ERR;
+        usleep(1000);
+    }
+    t->queue[tail & (ACCEPT_QUEUE_LEN-1)] = c;
+    acceptQueueStore(t->tail,tail+1);
+    return REDIS_OK;
+}
+
+static void *acceptThreadMain(void *arg) {
+    acceptThread *t = arg;
+    struct pollfd pfd[REDIS_BINDADDR_MAX+1];
+    char cip[REDIS_IP_STR_LEN], neterr[ANET_ERR_LEN];
+    sigset_t sigset;
+    int j;
+
+    /* Block SIGALRM so we are sure that only the main thread will
+     * receive the watchdog signal. */
+    sigemptyset(&sigset);
+    sigaddset(&sigset, SIGALRM);
+    if (pthread_sigmask(SIG_BLOCK, &sigset, NULL))
+        redisLog(REDIS_WARNING,
+            "Warning: can't mask SIGALRM in accept thread: %s",
+            strerror(errno));
+
+    for (j = 0; j < t->count; j++) {
+        pfd[j].fd = t->fd[j];
+        pfd[j].events = POLLIN;
+    }
+    pfd[t->count].fd = accept_stop_pipe[0];
+    pfd[t->count].events = POLLIN;
+
+    while(1) {
+        int accepted = 0;
+
+        if (poll(pfd,t->count+1,-1) == -1) {
+            if (errno == EINTR) continue;
+            redisLog(REDIS_WARNING,"Accept thread poll: %s",strerror(errno));
+            return NULL;
+        }
+        if (pfd[t->count].revents) return NULL; /* Stop requested. */
+
+        for (j = 0; j < t->count; j++) {
+            int cport, cfd, max = MAX_ACCEPTS_PER_CALL;
+            redisClient *c;
+
+            if (!pfd[j].revents) continue;
+            while(max--) {
+                cfd = anetTcpAccept(neterr, t->fd[j], cip, sizeof(cip), &cport);
+                if (cfd == ANET_ERR) {
+                    if (errno != EWOULDBLOCK)
+                        redisLog(REDIS_WARNING,
+                            "Accepting client connection: %s", neterr);
+                    break;
+                }
+                redisLog(REDIS_VERBOSE,"Accepted %s:%d", cip, cport);
+                c = allocClient(cfd);
+                if (acceptThreadQueueClient(t,c) == REDIS_ERR) {
+                    /* Stop requested. */
+                    close(cfd);
+                    freeClientStructure(c);
+                    return NULL;
+                }
+                accepted++;
+            }
+        }
+        /* Wake up the main thread. If the pipe is full it will wake up
+         * anyway. */
+        if (accepted && write(accept_notify_pipe[1],"x",1) == -1) {
+            /* Nothing to do. */
+        }
+    }
+}
+
+/* Readable handler of the notification pipe: link to the server state the
+ * clients created by the accept threads. */
+static void acceptThreadsHandler(aeEventLoop *el, int fd, void *privdata, int mask) {
+    char buf[64];
+    int j;
+    REDIS_NOTUSED(el);
+    REDIS_NOTUSED(privdata);
+    REDIS_NOTUSED(mask);
+
+    /* Drain the pipe before checking the queues, so that clients queued
+     * after the check are signaled by a byte we did not read yet. */
+    while (read(fd,buf,sizeof(buf)) > 0);
+
+    for (j = 0; j < accept_threads_count; j++) {
+        acceptThread *t = accept_threads+j;
+        unsigned long head = t->head, tail = acceptQueueLoad(t->tail);
+
+        while (head != tail) {
+            redisClient *c = t->queue[head & (ACCEPT_QUEUE_LEN-1)];
+
+            head++;
+            if (linkClient(c) == REDIS_ERR) {
+                redisLog(REDIS_WARNING,
+                    "Error registering fd event for the new client: %s",
+                    strerror(errno));
+                continue;
+            }
+            server.stat_threaded_accepts++;
+            acceptClient(c,0);
+        }
+        acceptQueueStore(t->head,head);
+    }
+}
+
+/* Create the listening sockets of the accept threads and start them. This
+ * is called after the listening sockets of the main thread were created
+ * with SO_REUSEPORT. On errors the accept threads are disabled, and the
+ * main thread accepts all the connections as usual. */
+void initAcceptThreads(void) {
+    int j;
+
+    if (server.accept_threads_num == 0 || server.ipfd_count == 0) return;
+#ifdef ACCEPT_THREADS_UNSUPPORTED
+    redisLog(REDIS_WARNING,
+        "Accept threads are not supported on this platform: "
+        "ignoring accept-threads %d", server.accept_threads_num);
+    server.accept_threads_num = 0;
+    return;
+#endif
+
+    if (pipe(accept_notify_pipe) == -1 || pipe(accept_stop_pipe) == -1) {
+        redisLog(REDIS_WARNING,"Can't create the accept threads pipes: %s",
+            strerror(errno));
+        goto err;
+    }
+    anetNonBlock(NULL,accept_notify_pipe[0]);
+    anetNonBlock(NULL,accept_notify_pipe[1]);
+    if (aeCreateFileEvent(server.el,accept_notify_pipe[0],AE_READABLE,
+        acceptThreadsHandler,NULL) == AE_ERR) goto err;
+
+    accept_threads = zcalloc(sizeof(acceptThread)*server.accept_threads_num);
+    for (j = 0; j < server.accept_threads_num; j++) {
+        acceptThread *t = accept_threads+j;
+
+        accept_threads_count++;
+        if (listenToPort(server.port,t->fd,&t->count,1) == REDIS_ERR)
+            goto err;
+        if (pthread_create(&t->tid,NULL,acceptThreadMain,t) != 0) {
+            redisLog(REDIS_WARNING,"Can't create accept thread.");
+            goto err;
+        }
+        t->running = 1;
+    }
+    return;
+
+err:
+    redisLog(REDIS_WARNING,"Accept threads disabled.");
+    stopAcceptThreads();
+    closeAcceptThreadsSockets();
+    server.accept_threads_num = 0;
+}
+
+/* Stop the accept threads, and link the clients they already queued. */
+void stopAcceptThreads(void) {
+    int j;
+
+    if (accept_stop_pipe[1] == -1) return;
+    acceptQueueStore(accept_threads_stop,1);
+    if (write(accept_stop_pipe[1],"x",1) == -1) {
+        /* Nothing to do, the pipe can't be full. */
+    }
+    for (j = 0; j < accept_threads_count; j++) {
+        if (!accept_threads[j].running) continue;
+        pthread_join(accept_threads[j].tid,NULL);
+        accept_threads[j].running = 0;
+    }
+    if (accept_notify_pipe[0] != -1) {
+        aeDeleteFileEvent(server.el,accept_notify_pipe[0],AE_READABLE);
+        acceptThreadsHandler(server.el,accept_notify_pipe[0],NULL,0);
+    }
+}
+
+/* Close the listening sockets of the accept threads. Like the other
+ * listening sockets, this is also called by children after fork(), where
+ * the accept threads don't exist. */
+void closeAcceptThreadsSockets(void) {
+    int j, k;
+
+    for (j = 0; j < accept_threads_count; j++) {
+        acceptThread *t = accept_threads+j;
+
+        for (k = 0; k < t->count; k++) close(t->fd[k]);
+        t->count = 0;
+    }
+}
@@ -57,11 +57,13 @@ typedef long long mstime_t; /* millisecond time type. */
 #include "zmalloc.h" /* total memory usage aware version of malloc/free */
 #include "anet.h"    /* Networking the easy way */
 #include "ziplist.h" /* Compact list data structure */
+#include "listpack.h" /* Compact list data structure, no cascading updates */
 #include "intset.h"  /* Compact integer set structure */
 #include "version.h" /* Version macro */
 #include "util.h"    /* Misc functions useful in many places */
 #include "latency.h" /* Latency monitor API */
 #include "sparkline.h" /* ASII graphs API */
+#include "quicklist.h" /* Lists are encoded as linked lists of listpacks */
 
 /* Error codes */
 #define REDIS_OK                0
@@ -121,6 +123,13 @@ typedef long long mstime_t; /* millisecond time type. */
 #define REDIS_DEFAULT_AOF_NO_FSYNC_ON_REWRITE 0
 #define REDIS_DEFAULT_AOF_LOAD_TRUNCATED 1
 #define REDIS_DEFAULT_ACTIVE_REHASHING 1
+#define REDIS_DEFAULT_ACTIVE_DEFRAG 0
+#define REDIS_DEFAULT_ACTIVE_DEFRAG_IGNORE_BYTES (100<<20) /* 100mb */
+#define REDIS_DEFAULT_ACTIVE_DEFRAG_THRESHOLD_LOWER 10 /* Percentage. */
+#define REDIS_DEFAULT_ACTIVE_DEFRAG_THRESHOLD_UPPER 100 /* Percentage. */
+#define REDIS_DEFAULT_ACTIVE_DEFRAG_CYCLE_MIN 25 /* Percentage of CPU. */
+#define REDIS_DEFAULT_ACTIVE_DEFRAG_CYCLE_MAX 75 /* Percentage of CPU. */
+#define REDIS_DEFAULT_ACTIVE_DEFRAG_MAX_SCAN_FIELDS 1000 /* Elements. */
 #define REDIS_DEFAULT_AOF_REWRITE_INCREMENTAL_FSYNC 1
 #define REDIS_DEFAULT_MIN_SLAVES_TO_WRITE 0
 #define REDIS_DEFAULT_MIN_SLAVES_MAX_LAG 10
@@ -129,6 +138,12 @@ typedef long long mstime_t; /* millisecond time type. */
 #define REDIS_BINDADDR_MAX 16
 #define REDIS_MIN_RESERVED_FDS 32
 #define REDIS_DEFAULT_LATENCY_MONITOR_THRESHOLD 0
+#define REDIS_DEFAULT_IO_THREADS 1  /* 1 means no threaded I/O at all. */
+#define REDIS_IO_THREADS_MAX_NUM 128
+#define REDIS_DEFAULT_ACCEPT_THREADS 0
+#define REDIS_ACCEPT_THREADS_MAX_NUM 64
+#define REDIS_DEFAULT_REPLY_ZERO_COPY_THRESHOLD (1024*4)
+#define REDIS_DEFAULT_CLIENT_POOL_SIZE 64
 
 #define ACTIVE_EXPIRE_CYCLE_LOOKUPS_PER_LOOP 20 /* Loopkups per loop. */
 #define ACTIVE_EXPIRE_CYCLE_FAST_DURATION 1000 /* Microseconds */
@@ -145,10 +160,16 @@ typedef long long mstime_t; /* millisecond time type. */
 
 /* Protocol and I/O related defines */
 #define REDIS_MAX_QUERYBUF_LEN  (1024*1024*1024) /* 1GB max query buffer. */
+#define REDIS_DEFAULT_PROTO_MAX_BULK_LEN (512ll*1024*1024) /* Bulk request max size */
 #define REDIS_IOBUF_LEN         (1024*16)  /* Generic I/O buffer size */
 #define REDIS_REPLY_CHUNK_BYTES (16*1024) /* 16k output buffer */
+#define REDIS_REPLY_BUF_MIN_BYTES 1024    /* Min size of client->buf */
+#define REDIS_REPLY_BUF_MAX_BYTES (64*1024) /* Max size of client->buf */
+#define REDIS_REPLY_BUF_PEAK_PERIOD 2     /* Seconds of client->buf peak. */
 #define REDIS_INLINE_MAX_SIZE   (1024*64) /* Max size of inline reads */
 #define REDIS_MBULK_BIG_ARG     (1024*32)
+#define REDIS_ARGV_CACHE_SIZE   8 /* Argument objects recycled per client */
+#define REDIS_ARGV_REUSE_MAX    1024 /* Max argv array len kept per client */
 #define REDIS_LONGSTR_SIZE      21          /* Bytes needed for long -> str */
 #define REDIS_AOF_AUTOSYNC_BYTES (1024*1024*32) /* fdatasync every 32MB */
 /* When configuring the Redis eventloop, we setup it so that the total number
@@ -195,6 +216,9 @@ typedef long long mstime_t; /* millisecond time type. */
 #define REDIS_ENCODING_INTSET 6  /* Encoded as intset */
 #define REDIS_ENCODING_SKIPLIST 7  /* Encoded as skiplist */
 #define REDIS_ENCODING_EMBSTR 8  /* Embedded sds string encoding */
+#define REDIS_ENCODING_QUICKLIST 9 /* Encoded as linked list of listpacks */
+#define REDIS_ENCODING_LISTPACK 10 /* Encoded as a listpack */
+#define REDIS_ENCODING_BTREE 11  /* Encoded as B+tree */
 
 /* Defines related to the dump file format. To store 32 bits lengths for short
  * keys requires a lot of space, so we check the most significant 2 bits of
@@ -249,6 +273,11 @@ typedef long long mstime_t; /* millisecond time type. */
 #define REDIS_PRE_PSYNC (1<<16)   /* Instance don't understand PSYNC. */
 #define REDIS_READONLY (1<<17)    /* Cluster client is in read-only state. */
 #define REDIS_PUBSUB (1<<18)      /* Client is in Pub/Sub mode. */
+#define REDIS_PENDING_WRITE (1<<19) /* Client has output to send but a write
+                                       handler is yet not installed. */
+#define REDIS_PENDING_READ (1<<20)  /* Client read postponed to I/O threads. */
+#define REDIS_PENDING_COMMAND (1<<21) /* Command already parsed by an I/O
+                                         thread, ready to be executed. */
 
 /* Client block type (btype field in client structure)
  * if REDIS_BLOCKED flag is set. */
@@ -326,6 +355,12 @@ typedef long long mstime_t; /* millisecond time type. */
 #define ZSKIPLIST_MAXLEVEL 32 /* Should be enough for 2^32 elements */
 #define ZSKIPLIST_P 0.25      /* Skiplist P = 1/4 */
 
+/* Sorted set B+tree defines. 30 slots make a leaf fit a 512 bytes
+ * allocation and an inner node a 1024 bytes one. */
+#define ZBTREE_FANOUT 30
+#define ZBTREE_MIN_FILL (ZBTREE_FANOUT/3) /* Below this nodes are rebalanced. */
+#define ZBTREE_MAXHEIGHT 32   /* Enough for 2^64 elements at minimum fill. */
+
 /* Append only defines */
 #define AOF_FSYNC_NO 0
 #define AOF_FSYNC_ALWAYS 1
@@ -335,15 +370,34 @@ typedef long long mstime_t; /* millisecond time type. */
 /* Zip structure related defaults */
 #define REDIS_HASH_MAX_ZIPLIST_ENTRIES 512
 #define REDIS_HASH_MAX_ZIPLIST_VALUE 64
-#define REDIS_LIST_MAX_ZIPLIST_ENTRIES 512
-#define REDIS_LIST_MAX_ZIPLIST_VALUE 64
+#define REDIS_LIST_MAX_ZIPLIST_SIZE -2
+#define REDIS_LIST_COMPRESS_DEPTH 0
 #define REDIS_SET_MAX_INTSET_ENTRIES 512
 #define REDIS_ZSET_MAX_ZIPLIST_ENTRIES 128
 #define REDIS_ZSET_MAX_ZIPLIST_VALUE 64
+#define REDIS_DEFAULT_ZSET_USE_BTREE 0
 
 /* HyperLogLog defines */
 #define REDIS_DEFAULT_HLL_SPARSE_MAX_BYTES 3000
 
+/* Lazy freeing. Values made of more allocations than the threshold are
+ * released in background by UNLINK, and by eviction and expiration when
+ * lazyfree-lazy-eviction / lazyfree-lazy-expire are enabled. Objects may
+ * then be referenced by the main thread and by the background one at the
+ * same time, so lazy freeing is only supported if reference counting can
+ * be atomic. */
+#define REDIS_LAZYFREE_THRESHOLD 64
+#define REDIS_LAZYFREE_SIZE_SAMPLES 16 /* Elements sampled to estimate size. */
+#define REDIS_DEFAULT_LAZYFREE_LAZY_EVICTION 0
+#define REDIS_DEFAULT_LAZYFREE_LAZY_EXPIRE 0
+#if !defined(__ATOMIC_RELAXED) && !defined(HAVE_ATOMIC)
+#define LAZYFREE_UNSUPPORTED
+#endif
+
+/* Flags of emptyDb() */
+#define REDIS_EMPTYDB_NO_FLAGS 0      /* No flags. */
+#define REDIS_EMPTYDB_ASYNC (1<<0)    /* Free the data in background. */
+
 /* Sets operations codes */
 #define REDIS_OP_UNION 0
 #define REDIS_OP_DIFF 1
@@ -356,7 +410,18 @@ typedef long long mstime_t; /* millisecond time type. */
 #define REDIS_MAXMEMORY_ALLKEYS_LRU 3
 #define REDIS_MAXMEMORY_ALLKEYS_RANDOM 4
 #define REDIS_MAXMEMORY_NO_EVICTION 5
+#define REDIS_MAXMEMORY_VOLATILE_LFU 6
+#define REDIS_MAXMEMORY_ALLKEYS_LFU 7
 #define REDIS_DEFAULT_MAXMEMORY_POLICY REDIS_MAXMEMORY_NO_EVICTION
+#define REDIS_MAXMEMORY_IS_LFU(p) ((p) == REDIS_MAXMEMORY_VOLATILE_LFU || \
+                                   (p) == REDIS_MAXMEMORY_ALLKEYS_LFU)
+
+/* LFU policies reuse the 24 bits of the object lru field: the 16 most
+ * significant bits are the last decrement time in minutes, the 8 least
+ * significant bits are a logarithmic access counter. */
+#define REDIS_LFU_INIT_VAL 5
+#define REDIS_DEFAULT_LFU_LOG_FACTOR 10
+#define REDIS_DEFAULT_LFU_DECAY_TIME 1
 
 /* Scripting */
 #define REDIS_LUA_TIME_LIMIT 5000 /* milliseconds */
@@ -427,7 +492,8 @@ typedef long long mstime_t; /* millisecond time type. */
 typedef struct redisObject {
     unsigned type:4;
     unsigned encoding:4;
-    unsigned lru:REDIS_LRU_BITS; /* lru time (relative to server.lruclock) */
+    unsigned lru:REDIS_LRU_BITS; /* LRU time (relative to server.lruclock) or
+                                  * LFU data (see REDIS_LFU_INIT_VAL). */
     int refcount;
     void *ptr;
 } robj;
@@ -451,15 +517,20 @@ typedef struct redisObject {
 
 /* To improve the quality of the LRU approximation we take a set of keys
  * that are good candidate for eviction across freeMemoryIfNeeded() calls.
+ * A single pool is shared by all the databases, so that the best candidates
+ * are selected regardless of the database they live in.
  *
  * Entries inside the eviciton pool are taken ordered by idle time, putting
  * greater idle times to the right (ascending order).
  *
  * Empty entries have the key pointer set to NULL. */
 #define REDIS_EVICTION_POOL_SIZE 16
+#define REDIS_EVICTION_MAX_SAMPLES 64 /* Max keys sampled per DB at a time. */
 struct evictionPoolEntry {
-    unsigned long long idle;    /* Object idle time. */
+    unsigned long long idle;    /* Object idle time (inverse frequency for
+                                   LFU, inverse TTL for volatile-ttl). */
     sds key;                    /* Key name. */
+    int dbid;                   /* Key DB number. */
 };
 
 /* Redis database representation. There are multiple databases identified
@@ -471,7 +542,6 @@ typedef struct redisDb {
     dict *blocking_keys;        /* Keys with clients waiting for data (BLPOP) */
     dict *ready_keys;           /* Blocked keys that received a PUSH */
     dict *watched_keys;         /* WATCHED keys for MULTI/EXEC CAS */
-    struct evictionPoolEntry *eviction_pool;    /* Eviction pool of keys */
     int id;                     /* Database ID */
     long long avg_ttl;          /* Average TTL, just for stats */
 } redisDb;
@@ -533,9 +603,13 @@ typedef struct redisClient {
     int dictid;
     robj *name;             /* As set by CLIENT SETNAME */
     sds querybuf;
+    size_t qb_pos;          /* Parsing position in querybuf */
     size_t querybuf_peak;   /* Recent (100ms or more) peak of querybuf size */
     int argc;
+    int argv_len;           /* Size of the argv array, may be > argc. */
     robj **argv;
+    robj *argv_cache[REDIS_ARGV_CACHE_SIZE]; /* Arguments of the previous
+                               command to recycle, see freeClientArgv(). */
     struct redisCommand *cmd, *lastcmd;
     int reqtype;
     int multibulklen;       /* number of multi bulk arguments left to read */
@@ -544,6 +618,8 @@ typedef struct redisClient {
     unsigned long reply_bytes; /* Tot bytes of objects in reply list */
     int sentlen;            /* Amount of bytes already sent in the current
                                buffer or object being sent. */
+    int sentnodes;          /* Reply nodes sent but not yet released, see
+                               releaseSentReplies() in networking.c. */
     time_t ctime;           /* Client creation time */
     time_t lastinteraction; /* time of the last interaction, used for timeout */
     time_t obuf_soft_limit_reached_time;
@@ -575,7 +651,11 @@ typedef struct redisClient {
 
     /* Response buffer */
     int bufpos;
-    char buf[REDIS_REPLY_CHUNK_BYTES];
+    int buf_size;           /* Allocated size of buf. */
+    int buf_peak;           /* Recent peak of bytes wanted in buf, see
+                               clientsCronResizeOutputBuffer(). */
+    time_t buf_peak_time;   /* When buf_peak was last reset. */
+    char *buf;
 } redisClient;
 
 struct saveparam {
@@ -615,11 +695,58 @@ typedef struct zskiplist {
     int level;
 } zskiplist;
 
+/* Sorted sets can alternatively be indexed by a B+tree (zset-use-btree).
+ * Leaves store up to ZBTREE_FANOUT elements, with the scores packed in their
+ * own array so that lookups inside a node touch few cache lines, and are
+ * linked together for in order traversal. Inner nodes store the number of
+ * elements below every child, so ranks are computed while descending.
+ *
+ * In inner nodes score[i]/obj[i] (for i > 0) is the separator between
+ * child i-1 and child i: every element of child i-1 is smaller, and every
+ * element of child i is greater or equal. Separators own a reference to
+ * their object, so they stay valid after the element itself is deleted.
+ * Slot 0 of inner nodes is unused. */
+typedef struct zbtreeNode {
+    struct zbtreeNode *prev, *next; /* Sibling leaves (leaves only). */
+    unsigned int count;             /* Number of elements or children. */
+    double score[ZBTREE_FANOUT];
+    robj *obj[ZBTREE_FANOUT];
+    /* The following fields are only allocated for inner nodes. */
+    unsigned long size[ZBTREE_FANOUT];
+    struct zbtreeNode *child[ZBTREE_FANOUT];
+} zbtreeNode;
+
+typedef struct zbtree {
+    zbtreeNode *root;
+    zbtreeNode *head, *tail;    /* First and last leaf. */
+    unsigned long length;
+    int height;                 /* 1 when the root is a leaf. */
+} zbtree;
+
+/* Position of an element inside a B+tree: a leaf and an offset in it. */
+typedef struct zbtreePos {
+    zbtreeNode *node;
+    unsigned int idx;
+} zbtreePos;
+
+#define zbtPosScore(p) ((p)->node->score[(p)->idx])
+#define zbtPosObj(p) ((p)->node->obj[(p)->idx])
+
+/* Only one of 'zsl' and 'zbt' is used, according to the object encoding.
+ * The dictionary maps elements to their score. */
 typedef struct zset {
     dict *dict;
     zskiplist *zsl;
+    zbtree *zbt;
 } zset;
 
+/* Element of an array sorted by score and then lexicographically, used to
+ * bulk load the skiplist or the B+tree of a sorted set. */
+typedef struct zsetEntry {
+    double score;
+    robj *obj;
+} zsetEntry;
+
 typedef struct clientBufferLimitsConfig {
     unsigned long long hard_limit_bytes;
     unsigned long long soft_limit_bytes;
@@ -669,6 +796,9 @@ struct redisServer {
     pid_t pid;                  /* Main process pid. */
     char *configfile;           /* Absolute config file path, or NULL */
     int hz;                     /* serverCron() calls frequency in hertz */
+    int io_threads_num;         /* Number of I/O threads, main included. */
+    int io_threads_active;      /* Are the I/O threads currently active? */
+    int accept_threads_num;     /* Number of accept threads, 0 = disabled. */
     redisDb *db;
     dict *commands;             /* Command table */
     dict *orig_commands;        /* Command table before command renaming. */
@@ -676,6 +806,8 @@ struct redisServer {
     unsigned lruclock:REDIS_LRU_BITS; /* Clock for LRU eviction */
     int shutdown_asap;          /* SHUTDOWN needed ASAP */
     int activerehashing;        /* Incremental rehash in serverCron() */
+    int active_defrag_running;  /* CPU percentage used by the active defrag
+                                   scan in progress, 0 if not running. */
     char *requirepass;          /* Pass for AUTH command, or NULL */
     char *pidfile;              /* PID file path */
     int arch_bits;              /* 32 or 64 depending on sizeof(long) */
@@ -696,6 +828,8 @@ struct redisServer {
     int cfd_count;              /* Used slots in cfd[] */
     list *clients;              /* List of active clients */
     list *clients_to_close;     /* Clients to close asynchronously */
+    list *clients_pending_write; /* There is to write or install handler. */
+    list *clients_pending_read; /* Clients with reads postponed to threads. */
     list *slaves, *monitors;    /* List of slaves and MONITORs */
     redisClient *current_client; /* Current client, only used on crash report */
     int clients_paused;         /* True if clients are currently paused */
@@ -718,6 +852,10 @@ struct redisServer {
     long long stat_numconnections;  /* Number of connections received */
     long long stat_expiredkeys;     /* Number of expired keys */
     long long stat_evictedkeys;     /* Number of evicted keys (maxmemory) */
+    long long stat_evicted_idle;    /* Sum of idle seconds of evicted keys */
+    long long stat_evicted_freq;    /* Sum of LFU counters of evicted keys */
+    long long stat_evicted_lfu_keys;/* Keys evicted with an LFU policy */
+    int stat_eviction_samples;      /* Keys per DB sampled by last eviction */
     long long stat_keyspace_hits;   /* Number of successful lookups of keys */
     long long stat_keyspace_misses; /* Number of failed lookups of keys */
     size_t stat_peak_memory;        /* Max used memory record */
@@ -734,6 +872,16 @@ struct redisServer {
     size_t resident_set_size;       /* RSS sampled in serverCron(). */
     long long stat_net_input_bytes; /* Bytes read from network. */
     long long stat_net_output_bytes; /* Bytes written to network. */
+    long long stat_io_reads_processed; /* Reads handled by I/O threads. */
+    long long stat_io_writes_processed; /* Writes handled by I/O threads. */
+    long long stat_zero_copy_reply_bytes; /* Reply bytes sent by reference. */
+    long long stat_threaded_accepts; /* Connections accepted by threads. */
+    long long stat_client_pool_hits; /* Clients taken from the pool. */
+    long long stat_client_pool_misses; /* Clients allocated from scratch. */
+    long long stat_active_defrag_hits; /* Allocations moved by defrag. */
+    long long stat_active_defrag_misses; /* Allocations not worth moving. */
+    long long stat_active_defrag_key_hits; /* Keys with moved allocations. */
+    long long stat_active_defrag_key_misses; /* Keys scanned and untouched. */
     /* The following two are used to track instantaneous metrics, like
      * number of operations per second, network traffic. */
     struct {
@@ -747,10 +895,21 @@ struct redisServer {
     int maxidletime;                /* Client timeout in seconds */
     int tcpkeepalive;               /* Set SO_KEEPALIVE if non-zero. */
     int active_expire_enabled;      /* Can be disabled for testing purposes. */
+    int active_defrag_enabled;      /* Active defragmentation, see defrag.c */
+    size_t active_defrag_ignore_bytes; /* Min fragmentation to start defrag. */
+    int active_defrag_threshold_lower; /* Min fragmentation % to start. */
+    int active_defrag_threshold_upper; /* Fragmentation % for max effort. */
+    int active_defrag_cycle_min;    /* Min CPU % used by active defrag. */
+    int active_defrag_cycle_max;    /* Max CPU % used by active defrag. */
+    unsigned long active_defrag_max_scan_fields; /* Bigger values are
+                                   defragged across many cron calls. */
     size_t client_max_querybuf_len; /* Limit for client query buffer length */
+    long long proto_max_bulk_len;   /* Protocol bulk length maximum size. */
     int dbnum;                      /* Total number of configured DBs */
     int daemonize;                  /* True if running as a daemon */
     clientBufferLimitsConfig client_obuf_limits[REDIS_CLIENT_TYPE_COUNT];
+    size_t reply_zero_copy_threshold; /* Min size of values sent by reference */
+    int client_pool_size;           /* Max freed clients kept for reuse */
     /* AOF persistence */
     int aof_state;                  /* REDIS_AOF_(ON|OFF|WAIT_REWRITE) */
     int aof_fsync;                  /* Kind of fsync() policy */
@@ -865,6 +1024,11 @@ struct redisServer {
     unsigned long long maxmemory;   /* Max number of memory bytes to use */
     int maxmemory_policy;           /* Policy for key eviction */
     int maxmemory_samples;          /* Pricision of random sampling */
+    int lfu_log_factor;             /* LFU logarithmic counter factor. */
+    int lfu_decay_time;             /* LFU counter decay time in minutes. */
+    struct evictionPoolEntry *eviction_pool; /* Eviction pool of keys */
+    int lazyfree_lazy_eviction;     /* Free evicted values in background */
+    int lazyfree_lazy_expire;       /* Free expired values in background */
     /* Blocked clients */
     unsigned int bpop_blocked_clients; /* Number of clients blocked by lists */
     list *unblocked_clients; /* list of clients to unblock before next loop */
@@ -878,11 +1042,12 @@ struct redisServer {
     /* Zip structure config, see redis.conf for more information  */
     size_t hash_max_ziplist_entries;
     size_t hash_max_ziplist_value;
-    size_t list_max_ziplist_entries;
-    size_t list_max_ziplist_value;
+    int list_max_ziplist_size;
+    int list_compress_depth;
     size_t set_max_intset_entries;
     size_t zset_max_ziplist_entries;
     size_t zset_max_ziplist_value;
+    int zset_use_btree;     /* Index big sorted sets with a B+tree. */
     size_t hll_sparse_max_bytes;
     time_t unixtime;        /* Unix time sampled every cron cycle. */
     long long mstime;       /* Like 'unixtime' but with milliseconds resolution. */
@@ -971,15 +1136,13 @@ typedef struct {
     robj *subject;
     unsigned char encoding;
     unsigned char direction; /* Iteration direction */
-    unsigned char *zi;
-    listNode *ln;
+    quicklistIter *iter;
 } listTypeIterator;
 
 /* Structure for an entry while iterating over a list. */
 typedef struct {
     listTypeIterator *li;
-    unsigned char *zi;  /* Entry in ziplist */
-    listNode *ln;       /* Entry in linked list */
+    quicklistEntry entry; /* Entry in quicklist */
 } listTypeEntry;
 
 /* Structure to hold set iteration abstraction. */
@@ -1018,6 +1181,7 @@ extern dictType zsetDictType;
 extern dictType clusterNodesDictType;
 extern dictType clusterNodesBlackListDictType;
 extern dictType dbDictType;
+extern dictType keyptrDictType;
 extern dictType shaScriptObjectDictType;
 extern double R_Zero, R_PosInf, R_NegInf, R_Nan;
 extern dictType hashDictType;
@@ -1042,7 +1206,19 @@ void closeTimedoutClients(void);
 void freeClient(redisClient *c);
 void freeClientAsync(redisClient *c);
 void resetClient(redisClient *c);
+void freeClientArgvCache(redisClient *c);
+void trimClientPool(void);
+int pooledClientsCount(void);
 void sendReplyToClient(aeEventLoop *el, int fd, void *privdata, int mask);
+int writeToClient(int fd, redisClient *c, int handler_installed);
+int clientHasPendingReplies(redisClient *c);
+int handleClientsWithPendingWrites(void);
+int handleClientsWithPendingWritesUsingThreads(void);
+int handleClientsWithPendingReadsUsingThreads(void);
+void initThreadedIO(void);
+void initAcceptThreads(void);
+void stopAcceptThreads(void);
+void closeAcceptThreadsSockets(void);
 void *addDeferredMultiBulkLength(redisClient *c);
 void setDeferredMultiBulkLength(redisClient *c, void *node, long length);
 void processInputBuffer(redisClient *c);
@@ -1079,7 +1255,7 @@ int getClientTypeByName(char *name);
 char *getClientTypeName(int class);
 void flushSlavesOutputBuffers(void);
 void disconnectSlaves(void);
-int listenToPort(int port, int *fds, int *count);
+int listenToPort(int port, int *fds, int *count, int reuseport);
 void pauseClients(mstime_t duration);
 int clientsArePaused(void);
 int processEventsWhileBlocked(void);
@@ -1095,7 +1271,6 @@ void addReplyStatusFormat(redisClient *c, const char *fmt, ...);
 #endif
 
 /* List data type */
-void listTypeTryConversion(robj *subject, robj *value);
 void listTypePush(robj *subject, robj *value, int where);
 robj *listTypePop(robj *subject, int where);
 unsigned long listTypeLength(robj *subject);
@@ -1105,7 +1280,7 @@ int listTypeNext(listTypeIterator *li, listTypeEntry *entry);
 robj *listTypeGet(listTypeEntry *entry);
 void listTypeInsert(listTypeEntry *entry, robj *value, int where);
 int listTypeEqual(listTypeEntry *entry, robj *o);
-void listTypeDelete(listTypeEntry *entry);
+void listTypeDelete(listTypeIterator *iter, listTypeEntry *entry);
 void listTypeConvert(robj *subject, int enc);
 void unblockClientWaitingData(redisClient *c);
 void handleClientsBlockedOnLists(void);
@@ -1143,13 +1318,13 @@ robj *getDecodedObject(robj *o);
 size_t stringObjectLen(robj *o);
 robj *createStringObjectFromLongLong(long long value);
 robj *createStringObjectFromLongDouble(long double value, int humanfriendly);
-robj *createListObject(void);
+robj *createQuicklistObject(void);
 robj *createZiplistObject(void);
 robj *createSetObject(void);
 robj *createIntsetObject(void);
 robj *createHashObject(void);
 robj *createZsetObject(void);
-robj *createZsetZiplistObject(void);
+robj *createZsetListpackObject(void);
 int getLongFromObjectOrReply(redisClient *c, robj *o, long *target, const char *msg);
 int checkType(redisClient *c, robj *o, int type);
 int getLongLongFromObjectOrReply(redisClient *c, robj *o, long long *target, const char *msg);
@@ -1162,6 +1337,10 @@ int compareStringObjects(robj *a, robj *b);
 int collateStringObjects(robj *a, robj *b);
 int equalStringObjects(robj *a, robj *b);
 unsigned long long estimateObjectIdleTime(robj *o);
+unsigned int objectInitialLRU(void);
+void updateObjectLRU(robj *o);
+unsigned long LFUDecrAndReturn(robj *o);
+size_t objectComputeSize(robj *o, size_t samples);
 #define sdsEncodedObject(objptr) (objptr->encoding == REDIS_ENCODING_RAW || objptr->encoding == REDIS_ENCODING_EMBSTR)
 
 /* Synchronous I/O with timeout */
@@ -1230,6 +1409,7 @@ typedef struct {
 zskiplist *zslCreate(void);
 void zslFree(zskiplist *zsl);
 zskiplistNode *zslInsert(zskiplist *zsl, double score, robj *obj);
+zskiplist *zslCreateFromSorted(zsetEntry *ele, unsigned long len);
 unsigned char *zzlInsert(unsigned char *zl, robj *ele, double score);
 int zslDelete(zskiplist *zsl, double score, robj *obj);
 zskiplistNode *zslFirstInRange(zskiplist *zsl, zrangespec *range);
@@ -1240,6 +1420,22 @@ void zzlPrev(unsigned char *zl, unsigned char **eptr, unsigned char **sptr);
 unsigned int zsetLength(robj *zobj);
 void zsetConvert(robj *zobj, int encoding);
 unsigned long zslGetRank(zskiplist *zsl, double score, robj *o);
+zbtree *zbtCreate(void);
+void zbtFree(zbtree *zbt);
+void zbtInsert(zbtree *zbt, double score, robj *obj);
+zbtree *zbtCreateFromSorted(zsetEntry *ele, unsigned long len);
+int zbtDelete(zbtree *zbt, double score, robj *obj);
+unsigned long zbtGetRank(zbtree *zbt, double score, robj *obj);
+int zbtGetElementByRank(zbtree *zbt, unsigned long rank, zbtreePos *pos);
+int zbtFirst(zbtree *zbt, zbtreePos *pos);
+int zbtLast(zbtree *zbt, zbtreePos *pos);
+int zbtNext(zbtreePos *pos);
+int zbtPrev(zbtreePos *pos);
+int zsetIndexEncoding(void);
+void zsetIndexInsert(zset *zs, double score, robj *ele);
+int zsetIndexDelete(zset *zs, double score, robj *ele);
+void zsetIndexLoadSorted(zset *zs, zsetEntry *ele, unsigned long len);
+int zsetEntryCompare(const void *a, const void *b);
 
 /* Core functions */
 int freeMemoryIfNeeded(void);
@@ -1298,10 +1494,10 @@ unsigned long hashTypeLength(robj *o);
 hashTypeIterator *hashTypeInitIterator(robj *subject);
 void hashTypeReleaseIterator(hashTypeIterator *hi);
 int hashTypeNext(hashTypeIterator *hi);
-void hashTypeCurrentFromZiplist(hashTypeIterator *hi, int what,
-                                unsigned char **vstr,
-                                unsigned int *vlen,
-                                long long *vll);
+void hashTypeCurrentFromListpack(hashTypeIterator *hi, int what,
+                                 unsigned char **vstr,
+                                 unsigned int *vlen,
+                                 long long *vll);
 void hashTypeCurrentFromHashTable(hashTypeIterator *hi, int what, robj **dst);
 robj *hashTypeCurrentObject(hashTypeIterator *hi, int what);
 robj *hashTypeLookupWriteOrCreate(redisClient *c, robj *key);
@@ -1344,10 +1540,11 @@ int dbExists(redisDb *db, robj *key);
 robj *dbRandomKey(redisDb *db);
 int dbDelete(redisDb *db, robj *key);
 robj *dbUnshareStringValue(redisDb *db, robj *key, robj *o);
-long long emptyDb(void(callback)(void*));
+long long emptyDb(int flags, void(callback)(void*));
 int selectDb(redisClient *c, int id);
 void signalModifiedKey(redisDb *db, robj *key);
 void signalFlushedDb(int dbid);
+
 unsigned int getKeysInSlot(unsigned int hashslot, robj **keys, unsigned int count);
 unsigned int countKeysInSlot(unsigned int hashslot);
 unsigned int delKeysInSlot(unsigned int hashslot);
@@ -1355,11 +1552,27 @@ int verifyClusterConfigWithData(void);
 void scanGenericCommand(redisClient *c, robj *o, unsigned long cursor);
 int parseScanCursorOrReply(redisClient *c, robj *o, unsigned long *cursor);
 
+/* lazyfree.c -- Background freeing of keys and databases */
+int dbAsyncDelete(redisDb *db, robj *key);
+void emptyDbAsync(redisDb *db);
+size_t lazyfreeGetFreeEffort(robj *obj);
+unsigned long lazyfreeGetPendingObjectsCount(void);
+size_t lazyfreeGetPendingMemory(void);
+unsigned long lazyfreeGetFreedObjectsCount(void);
+void lazyfreeResetStats(void);
+void lazyfreeFreeObjectFromBioThread(robj *o, size_t size);
+void lazyfreeFreeDatabaseFromBioThread(dict *keys, dict *expires);
+
+/* defrag.c -- Active memory defragmentation */
+void activeDefragCycle(void);
+float getAllocatorFragmentation(size_t *out_frag_bytes);
+
 /* API to get key arguments from commands */
 int *getKeysFromCommand(struct redisCommand *cmd, robj **argv, int argc, int *numkeys);
 void getKeysFreeResult(int *result);
 int *zunionInterGetKeys(struct redisCommand *cmd,robj **argv, int argc, int *numkeys);
 int *evalGetKeys(struct redisCommand *cmd, robj **argv, int argc, int *numkeys);
+int *sintercardGetKeys(struct redisCommand *cmd, robj **argv, int argc, int *numkeys);
 int *sortGetKeys(struct redisCommand *cmd, robj **argv, int argc, int *numkeys);
 
 /* Cluster */
@@ -1405,6 +1618,7 @@ void setexCommand(redisClient *c);
 void psetexCommand(redisClient *c);
 void getCommand(redisClient *c);
 void delCommand(redisClient *c);
+void unlinkCommand(redisClient *c);
 void existsCommand(redisClient *c);
 void setbitCommand(redisClient *c);
 void getbitCommand(redisClient *c);
@@ -1450,6 +1664,7 @@ void spopCommand(redisClient *c);
 void srandmemberCommand(redisClient *c);
 void sinterCommand(redisClient *c);
 void sinterstoreCommand(redisClient *c);
+void sintercardCommand(redisClient *c);
 void sunionCommand(redisClient *c);
 void sunionstoreCommand(redisClient *c);
 void sdiffCommand(redisClient *c);
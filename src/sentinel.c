@@ -363,7 +363,10 @@ dictType instancesDictType = {
     NULL,                      /* val dup */
     dictSdsKeyCompare,         /* key compare */
     NULL,                      /* key destructor */
-    dictInstancesValDestructor /* val destructor */
+    dictInstancesValDestructor, /* val destructor */
+    0,                          /* open addressing */
+    NULL,                       /* key embed len */
+    NULL                        /* key embed */
 };
 
 /* Instance runid (sds) -> votes (long casted to void*)
@@ -376,7 +379,10 @@ dictType leaderVotesDictType = {
     NULL,                      /* val dup */
     dictSdsKeyCompare,         /* key compare */
     NULL,                      /* key destructor */
-    NULL                       /* val destructor */
+    NULL,                      /* val destructor */
+    0,                         /* open addressing */
+    NULL,                      /* key embed len */
+    NULL                       /* key embed */
 };
 
 /* =========================== Initialization =============================== */
@@ -58,6 +58,27 @@ list *listCreate(void)
     return list;
 }
 
+/* Remove all the elements from the list without destroying the list
+ * itself.
+ *
+ * This function can't fail. */
+void listEmpty(list *list)
+{
+    unsigned long len;
+    listNode *current, *next;
+
+    current = list->head;
+    len = list->len;
+    while(len--) {
+        next = current->next;
+        if (list->free) list->free(current->value);
+        zfree(current);
+        current = next;
+    }
+    list->head = list->tail = NULL;
+    list->len = 0;
+}
+
 /* Free the whole list.
  *
  * This function can't fail. */
@@ -66,17 +87,7 @@ list *listCreate(void)
 
 void listRelease(list *list)
 {
-    unsigned long len;
-    listNode *current, *next;  // 预定义两个链表结点
-
-    current = list->head; // 将头结点赋值给current，表示释放从头结点开始
-    len = list->len; // 将链表长度赋值给len
-    while(len--) { // 循环逐个释放链表中的结点
-        next = current->next; // 指向下一个
-        if (list->free) list->free(current->value); // 调用函数指针free，前面listCreate函数中会给函数指针free指定一个函数，这里直接调用，就是如果定义了话，不是null，就会调用自己的free函数来释放，将链表节点的value传进来。
-        zfree(current); // 调用zmalloc.c zmalloc.h 中定义的zfree来释放，并不是free
-        current = next; // 结合next＝current->next 来实现循环
-    }
+    listEmpty(list); // 先释放所有结点，见listEmpty
     zfree(list); // 在释放了所有链表结点以后，再释放链表，同样是调用zfree
 }
 
@@ -81,6 +81,7 @@ typedef struct list {
 list *listCreate(void); // 定义一个指针函数，创建一个新的链表，返回的指针类型就是前面定义的list
 			// 也就是返回新建链表的在内存中的地址
 void listRelease(list *list); // 释放链表的函数
+void listEmpty(list *list); // 释放所有结点，保留链表本身
 list *listAddNodeHead(list *list, void *value); // 指针函数，增加链表头节点
 list *listAddNodeTail(list *list, void *value); // 指针函数，增加链表尾节点
 list *listInsertNode(list *list, listNode *old_node, void *value, int after); // 指针函数，向链表中增加节点，返回最新的链表结构。
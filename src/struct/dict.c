@@ -3,7 +3,8 @@
  * This file implements in memory hash tables with insert/del/replace/find/
  * get-random-element operations. Hash tables will auto resize if needed
  * tables of power of two in size are used, collisions are handled by
- * chaining. See the source code for more information... :)
+ * chaining, or by linear probing for dict types asking for open addressing.
+ * See the source code for more information... :)
  *
  * Copyright (c) 2006-2012, Salvatore Sanfilippo <antirez at gmail dot com>
  * All rights reserved.
@@ -65,11 +66,25 @@
 static int dict_can_resize = 1;
 static unsigned int dict_force_resize_ratio = 5;
 
+/* Open addressing tables can't hold more elements than slots, and probing
+ * gets slow as they fill up, so they grow when 3/4 of the slots are used.
+ * When resizing is disabled they are allowed to reach 15/16 before being
+ * forced to grow anyway. */
+#define DICT_OA_FILL_NUM 3
+#define DICT_OA_FILL_DEN 4
+#define DICT_OA_FORCE_FILL_NUM 15
+#define DICT_OA_FORCE_FILL_DEN 16
+
+/* Entries of open addressing tables are never chained, so they are
+ * allocated without the 'next' pointer, that must never be accessed. */
+#define DICT_OA_ENTRY_SIZE offsetof(dictEntry,next)
+
 /* -------------------------- private prototypes ---------------------------- */
 /*一些私有方法*/
 static int _dictExpandIfNeeded(dict *ht);
 static unsigned long _dictNextPower(unsigned long size);
-static int _dictKeyIndex(dict *ht, const void *key);
+static int _dictKeyIndex(dict *ht, const void *key, unsigned int *hash);
+static void _dictSlotRemove(dictht *ht, unsigned long idx);
 static int _dictInit(dict *ht, dictType *type, void *privDataPtr);
 
 /* -------------------------- hash functions -------------------------------- */
@@ -183,6 +198,7 @@ unsigned int dictGenCaseHashFunction(const unsigned char *buf, int len) {
 static void _dictReset(dictht *ht)
 {
     ht->table = NULL; // 没有为hash table分配空间
+    ht->slots = NULL;
     ht->size = 0;
     ht->sizemask = 0;
     ht->used = 0;
@@ -239,25 +255,37 @@ int dictResize(dict *d)
 int dictExpand(dict *d, unsigned long size)
 {
     dictht n; /* the new hash table */
-    unsigned long realsize = _dictNextPower(size); // 参考_dictNextPower 定义，根据传入的size确定realsize值
+    unsigned long realsize;
 
     /* the size is invalid if it is smaller than the number of
      * elements already inside the hash table */
     if (dictIsRehashing(d) || d->ht[0].used > size)
         return DICT_ERR;
 
+    /* Open addressing tables need some free slots to hold 'size' elements
+     * without exceeding their fill ratio. */
+    if (dictIsOpenAddressing(d))
+        size += size*(DICT_OA_FILL_DEN-DICT_OA_FILL_NUM)/DICT_OA_FILL_NUM;
+    realsize = _dictNextPower(size); // 参考_dictNextPower 定义，根据传入的size确定realsize值
+
     /* Rehashing to the same table size is not useful. */
     if (realsize == d->ht[0].size) return DICT_ERR;
 
     /* Allocate the new hash table and initialize all pointers to NULL */
     n.size = realsize;
     n.sizemask = realsize-1;  // hashtable是一个指针数组，sizemask 也就是索引值，实际上对应的就是数组的下标，从0开始，所以减1
-    n.table = zcalloc(realsize*sizeof(dictEntry*)); // 实际分配空间 就是 realsize * 每个字典节点的大小
+    if (dictIsOpenAddressing(d)) {
+        n.table = NULL;
+        n.slots = zcalloc(realsize*sizeof(dictSlot));
+    } else {
+        n.table = zcalloc(realsize*sizeof(dictEntry*)); // 实际分配空间 就是 realsize * 每个字典节点的大小
+        n.slots = NULL;
+    }
     n.used = 0;
 
     /* Is this the first initialization? If so it's not really a rehashing
      * we just set the first hash table so that it can accept keys. */
-    if (d->ht[0].table == NULL) {
+    if (d->ht[0].size == 0) {
         d->ht[0] = n;
         return DICT_OK;
     }
@@ -299,6 +327,29 @@ int dictRehash(dict *d, int n) {
 	// 
 	assert(d->ht[0].size > (unsigned long)d->rehashidx); //  ???
 
+        if (dictIsOpenAddressing(d)) {
+            dictSlot *s;
+            unsigned long idx;
+
+            while((s = &d->ht[0].slots[d->rehashidx])->entry == NULL) {
+                d->rehashidx++;
+                if (--empty_visits == 0) return 1;
+            }
+
+            /* Move a single element. The stored hash gives its slot in the
+             * new table without hashing the key again. Removing it from
+             * the old table may shift the next element of the run into
+             * this slot, so rehashidx is not advanced here: the empty
+             * slots are skipped by the loop above. */
+            idx = s->hash & d->ht[1].sizemask;
+            while (d->ht[1].slots[idx].entry)
+                idx = (idx+1) & d->ht[1].sizemask;
+            d->ht[1].slots[idx] = *s;
+            d->ht[1].used++;
+            _dictSlotRemove(&d->ht[0],d->rehashidx);
+            continue;
+        }
+
         while(d->ht[0].table[d->rehashidx] == NULL) {
             d->rehashidx++;
             if (--empty_visits == 0) return 1;
@@ -331,6 +382,7 @@ int dictRehash(dict *d, int n) {
     * 知道ht[0]迁移完，就是used ＝＝ 0*/
     if (d->ht[0].used == 0) {
         zfree(d->ht[0].table);
+        zfree(d->ht[0].slots);
         d->ht[0] = d->ht[1]; // 将ht[1] 赋给ht[0]
         _dictReset(&d->ht[1]);
         d->rehashidx = -1;  // 关闭rehash
@@ -375,6 +427,24 @@ static void _dictRehashStep(dict *d) {
     if (d->iterators == 0) dictRehash(d,1);
 }
 
+/* Allocate a new entry for 'key' and set its key. Types embedding their
+ * keys get the copy of the key in the same allocation, after the entry,
+ * so finding a key only touches the entry and not another allocation. */
+static dictEntry *_dictEntryCreate(dict *d, void *key) {
+    size_t size = dictIsOpenAddressing(d) ? DICT_OA_ENTRY_SIZE :
+                                            sizeof(dictEntry);
+    dictEntry *entry;
+
+    if (d->type->keyEmbed) {
+        entry = zmalloc(size+d->type->keyEmbedLen(key));
+        entry->key = d->type->keyEmbed((char*)entry+size,key);
+    } else {
+        entry = zmalloc(size);
+        dictSetKey(d, entry, key);
+    }
+    return entry;
+}
+
 /* Add an element to the target hash table */
 /* 前面提到，创建字典的流程 dictCreate--> _dictInit --> _dictReset ，这些操作后，并没有
 *  给hash table分配空间
@@ -410,6 +480,7 @@ int dictAdd(dict *d, void *key, void *val)
 dictEntry *dictAddRaw(dict *d, void *key)
 {
     int index;
+    unsigned int h;
     dictEntry *entry;
     dictht *ht;
 
@@ -417,18 +488,20 @@ dictEntry *dictAddRaw(dict *d, void *key)
 
     /* Get the index of the new element, or -1 if
      * the element already exists. */
-    if ((index = _dictKeyIndex(d, key)) == -1)
+    if ((index = _dictKeyIndex(d, key, &h)) == -1)
         return NULL;
 
     /* Allocate the memory and store the new entry */
     ht = dictIsRehashing(d) ? &d->ht[1] : &d->ht[0];
-    entry = zmalloc(sizeof(*entry));
-    entry->next = ht->table[index];
-    ht->table[index] = entry;
+    entry = _dictEntryCreate(d, key);
+    if (dictIsOpenAddressing(d)) {
+        ht->slots[index].entry = entry;
+        ht->slots[index].hash = h;
+    } else {
+        entry->next = ht->table[index];
+        ht->table[index] = entry;
+    }
     ht->used++;
-
-    /* Set the hash entry fields. */
-    dictSetKey(d, entry, key);
     return entry;
 }
 
@@ -450,8 +523,9 @@ int dictReplace(dict *d, void *key, void *val)
      * to do that in this order, as the value may just be exactly the same
      * as the previous one. In this context, think to reference counting,
      * you want to increment (set), and then decrement (free), and not the
-     * reverse. */
-    auxentry = *entry;
+     * reverse. Only the value is copied: open addressing entries have
+     * no 'next' field. */
+    auxentry.v = entry->v;
     dictSetVal(d, entry, val);
     dictFreeVal(d, &auxentry);
     return 0;
@@ -482,6 +556,26 @@ static int dictGenericDelete(dict *d, const void *key, int nofree)
 
     for (table = 0; table <= 1; table++) {
         idx = h & d->ht[table].sizemask;
+        if (dictIsOpenAddressing(d)) {
+            dictht *ht = &d->ht[table];
+
+            while ((he = ht->slots[idx].entry) != NULL) {
+                if (ht->slots[idx].hash == h &&
+                    dictCompareKeys(d, key, he->key))
+                {
+                    _dictSlotRemove(ht, idx);
+                    if (!nofree) {
+                        dictFreeKey(d, he);
+                        dictFreeVal(d, he);
+                    }
+                    zfree(he);
+                    return DICT_OK;
+                }
+                idx = (idx+1) & ht->sizemask;
+            }
+            if (!dictIsRehashing(d)) break;
+            continue;
+        }
         he = d->ht[table].table[idx];
         prevHe = NULL;
         while(he) {
@@ -525,6 +619,14 @@ int _dictClear(dict *d, dictht *ht, void(callback)(void *)) {
 
         if (callback && (i & 65535) == 0) callback(d->privdata);
 
+        if (ht->slots) {
+            if ((he = ht->slots[i].entry) == NULL) continue;
+            dictFreeKey(d, he);
+            dictFreeVal(d, he);
+            zfree(he);
+            ht->used--;
+            continue;
+        }
         if ((he = ht->table[i]) == NULL) continue;
         while(he) {
             nextHe = he->next;
@@ -537,6 +639,7 @@ int _dictClear(dict *d, dictht *ht, void(callback)(void *)) {
     }
     /* Free the table and the allocated cache structure */
     zfree(ht->table);
+    zfree(ht->slots);
     /* Re-initialize the table */
     _dictReset(ht);
     return DICT_OK; /* never fails */
@@ -560,6 +663,18 @@ dictEntry *dictFind(dict *d, const void *key)
     h = dictHashKey(d, key);
     for (table = 0; table <= 1; table++) {
         idx = h & d->ht[table].sizemask;
+        if (dictIsOpenAddressing(d)) {
+            dictSlot *slots = d->ht[table].slots;
+
+            /* Only entries with the same hash are dereferenced. */
+            while ((he = slots[idx].entry) != NULL) {
+                if (slots[idx].hash == h && dictCompareKeys(d, key, he->key))
+                    return he;
+                idx = (idx+1) & d->ht[table].sizemask;
+            }
+            if (!dictIsRehashing(d)) return NULL;
+            continue;
+        }
         he = d->ht[table].table[idx];
         while(he) {
             if (dictCompareKeys(d, key, he->key))
@@ -588,10 +703,10 @@ long long dictFingerprint(dict *d) {
     long long integers[6], hash = 0;
     int j;
 
-    integers[0] = (long) d->ht[0].table;
+    integers[0] = (long) d->ht[0].table ^ (long) d->ht[0].slots;
     integers[1] = d->ht[0].size;
     integers[2] = d->ht[0].used;
-    integers[3] = (long) d->ht[1].table;
+    integers[3] = (long) d->ht[1].table ^ (long) d->ht[1].slots;
     integers[4] = d->ht[1].size;
     integers[5] = d->ht[1].used;
 
@@ -623,6 +738,7 @@ dictIterator *dictGetIterator(dict *d)
     iter->d = d;
     iter->table = 0;
     iter->index = -1;
+    iter->pos = 0;
     iter->safe = 0;
     iter->entry = NULL;
     iter->nextEntry = NULL;
@@ -636,8 +752,58 @@ dictIterator *dictGetSafeIterator(dict *d) {
     return i;
 }
 
+/* dictNext() for open addressing dicts. Elements are returned bucket after
+ * bucket, where the bucket of an element is its home slot, like dictScan()
+ * does: removing an element moves back the following ones of its run, but
+ * never changes their home slot, so the iterator user can still delete the
+ * returned entry without elements being missed or returned twice. */
+static dictEntry *_dictNextOpenAddressing(dictIterator *iter)
+{
+    while (1) {
+        dictht *ht = &iter->d->ht[iter->table];
+        dictSlot *s;
+
+        if (iter->entry == NULL) {
+            if (iter->index == -1 && iter->table == 0) {
+                if (iter->safe)
+                    iter->d->iterators++;
+                else
+                    iter->fingerprint = dictFingerprint(iter->d);
+            }
+            iter->index++;
+            if (iter->index >= (long) ht->size) {
+                if (dictIsRehashing(iter->d) && iter->table == 0) {
+                    iter->table++;
+                    iter->index = 0;
+                    ht = &iter->d->ht[1];
+                } else {
+                    break;
+                }
+            }
+            iter->pos = iter->index;
+        } else if (ht->slots[iter->pos].entry == iter->entry) {
+            /* Otherwise the entry was deleted, and the next element of the
+             * run, if any, was moved in its slot. */
+            iter->pos = (iter->pos+1) & ht->sizemask;
+        }
+
+        /* Return the next element of the run having its home here. */
+        while ((s = &ht->slots[iter->pos])->entry != NULL) {
+            if ((s->hash & ht->sizemask) == (unsigned long) iter->index) {
+                iter->entry = s->entry;
+                return iter->entry;
+            }
+            iter->pos = (iter->pos+1) & ht->sizemask;
+        }
+        iter->entry = NULL;
+    }
+    return NULL;
+}
+
 dictEntry *dictNext(dictIterator *iter)
 {
+    if (dictIsOpenAddressing(iter->d)) return _dictNextOpenAddressing(iter);
+
     while (1) {
         if (iter->entry == NULL) {
             dictht *ht = &iter->d->ht[iter->table];
@@ -682,6 +848,12 @@ void dictReleaseIterator(dictIterator *iter)
     zfree(iter);
 }
 
+/* Return the first element stored at 'idx' in the table: the head of the
+ * chain, or the slot occupant for open addressing tables. */
+static dictEntry *_dictTableEntry(dictht *ht, unsigned long idx) {
+    return ht->slots ? ht->slots[idx].entry : ht->table[idx];
+}
+
 /* Return a random entry from the hash table. Useful to
  * implement randomized algorithms */
 dictEntry *dictGetRandomKey(dict *d)
@@ -699,16 +871,19 @@ dictEntry *dictGetRandomKey(dict *d)
             h = d->rehashidx + (random() % (d->ht[0].size +
                                             d->ht[1].size -
                                             d->rehashidx));
-            he = (h >= d->ht[0].size) ? d->ht[1].table[h - d->ht[0].size] :
-                                      d->ht[0].table[h];
+            he = (h >= d->ht[0].size) ?
+                 _dictTableEntry(&d->ht[1],h - d->ht[0].size) :
+                 _dictTableEntry(&d->ht[0],h);
         } while(he == NULL);
     } else {
         do {
             h = random() & d->ht[0].sizemask;
-            he = d->ht[0].table[h];
+            he = _dictTableEntry(&d->ht[0],h);
         } while(he == NULL);
     }
 
+    if (dictIsOpenAddressing(d)) return he;
+
     /* Now we found a non empty bucket, but it is a linked
      * list and we need to get a random element from the list.
      * The only sane way to do so is counting the elements and
@@ -786,7 +961,7 @@ unsigned int dictGetSomeKeys(dict *d, dictEntry **des, unsigned int count) {
                 continue;
             }
             if (i >= d->ht[j].size) continue; /* Out of range for this table. */
-            dictEntry *he = d->ht[j].table[i];
+            dictEntry *he = _dictTableEntry(&d->ht[j],i);
 
             /* Count contiguous empty buckets, and jump to other
              * locations if they reach 'count' (with a minimum of 5). */
@@ -803,7 +978,7 @@ unsigned int dictGetSomeKeys(dict *d, dictEntry **des, unsigned int count) {
                      * empty while iterating. */
                     *des = he;
                     des++;
-                    he = he->next;
+                    he = dictIsOpenAddressing(d) ? NULL : he->next;
                     stored++;
                     if (stored == count) return stored;
                 }
@@ -909,14 +1084,57 @@ static unsigned long rev(unsigned long v) {
  *    we are sure we don't miss keys moving during rehashing.
  * 3) The reverse cursor is somewhat hard to understand at first, but this
  *    comment is supposed to help.
+ *
+ * OPEN ADDRESSING
+ *
+ * Open addressing tables don't have chains, but the cursor still iterates
+ * buckets, not slots: the bucket of an element is its home slot, that is
+ * the bitwise AND between its hash and the mask, exactly as above. Linear
+ * probing stores every element of a bucket in the run of used slots that
+ * starts at its home slot, so scanning a bucket means walking that run
+ * and emitting the elements whose home slot is the cursor. Elements move
+ * inside a run when others are deleted, but never change bucket, so all
+ * the guarantees above still hold.
  */
-unsigned long dictScan(dict *d,
-                       unsigned long v,
-                       dictScanFunction *fn,
-                       void *privdata)
+
+/* Call 'fn' for every element of the bucket 'idx' of the table 'ht'. If
+ * 'defragfn' is not NULL it is called instead, and the entry it returns,
+ * if any, replaces the old one in the table. */
+static void _dictScanBucket(dict *d, dictht *ht, unsigned long idx,
+                            dictScanFunction *fn,
+                            dictDefragFunction *defragfn, void *privdata)
+{
+    dictEntry *de, *newde, **deref;
+
+    if (dictIsOpenAddressing(d)) {
+        unsigned long pos = idx;
+
+        while ((de = ht->slots[pos].entry) != NULL) {
+            if ((ht->slots[pos].hash & ht->sizemask) == idx) {
+                if (!defragfn)
+                    fn(privdata, de);
+                else if ((newde = defragfn(privdata, de)) != NULL)
+                    ht->slots[pos].entry = newde;
+            }
+            pos = (pos+1) & ht->sizemask;
+        }
+        return;
+    }
+
+    deref = &ht->table[idx];
+    while ((de = *deref) != NULL) {
+        if (!defragfn)
+            fn(privdata, de);
+        else if ((newde = defragfn(privdata, de)) != NULL)
+            *deref = de = newde;
+        deref = &de->next;
+    }
+}
+
+static unsigned long _dictScan(dict *d, unsigned long v, dictScanFunction *fn,
+                               dictDefragFunction *defragfn, void *privdata)
 {
     dictht *t0, *t1;
-    const dictEntry *de;
     unsigned long m0, m1;
 
     if (dictSize(d) == 0) return 0;
@@ -926,11 +1144,7 @@ unsigned long dictScan(dict *d,
         m0 = t0->sizemask;
 
         /* Emit entries at cursor */
-        de = t0->table[v & m0];
-        while (de) {
-            fn(privdata, de);
-            de = de->next;
-        }
+        _dictScanBucket(d, t0, v & m0, fn, defragfn, privdata);
 
     } else {
         t0 = &d->ht[0];
@@ -946,21 +1160,13 @@ unsigned long dictScan(dict *d,
         m1 = t1->sizemask;
 
         /* Emit entries at cursor */
-        de = t0->table[v & m0];
-        while (de) {
-            fn(privdata, de);
-            de = de->next;
-        }
+        _dictScanBucket(d, t0, v & m0, fn, defragfn, privdata);
 
         /* Iterate over indices in larger table that are the expansion
          * of the index pointed to by the cursor in the smaller table */
         do {
             /* Emit entries at cursor */
-            de = t1->table[v & m1];
-            while (de) {
-                fn(privdata, de);
-                de = de->next;
-            }
+            _dictScanBucket(d, t1, v & m1, fn, defragfn, privdata);
 
             /* Increment bits not covered by the smaller mask */
             v = (((v | m0) + 1) & ~m0) | (v & m0);
@@ -981,17 +1187,69 @@ unsigned long dictScan(dict *d,
     return v;
 }
 
+unsigned long dictScan(dict *d,
+                       unsigned long v,
+                       dictScanFunction *fn,
+                       void *privdata)
+{
+    return _dictScan(d, v, fn, NULL, privdata);
+}
+
+/* Like dictScan(), but 'fn' may move the entries it is called with to new
+ * allocations, returning the new entry (or NULL if it did not move it) that
+ * is stored in the table in place of the old one. This is used by the
+ * active defragmentation. */
+unsigned long dictScanDefrag(dict *d,
+                             unsigned long v,
+                             dictDefragFunction *fn,
+                             void *privdata)
+{
+    return _dictScan(d, v, NULL, fn, privdata);
+}
+
 /* ------------------------- private functions ------------------------------ */
 
+/* Return true if adding one more element to the open addressing table
+ * 'ht' would exceed the fill ratio num/den. */
+static int _dictOverFill(dictht *ht, unsigned long num, unsigned long den) {
+    return (ht->used+1)*den > ht->size*num;
+}
+
 /* Expand the hash table if needed */
 static int _dictExpandIfNeeded(dict *d)
 {
-    /* Incremental rehashing already in progress. Return. */
-    if (dictIsRehashing(d)) return DICT_OK;
+    /* Incremental rehashing already in progress. Return.
+     *
+     * An open addressing table always needs free slots: if the new table
+     * fills up before all the elements were moved into it, we finish the
+     * rehashing now so that the table can grow again. This is not possible
+     * while safe iterators are running, but a table at least twice as big
+     * as the number of elements it had when the rehashing started fills up
+     * only if a lot of elements are added without ever rehashing. */
+    if (dictIsRehashing(d)) {
+        if (!dictIsOpenAddressing(d) ||
+            !_dictOverFill(&d->ht[1],DICT_OA_FORCE_FILL_NUM,
+                                     DICT_OA_FORCE_FILL_DEN)) return DICT_OK;
+        assert(d->iterators == 0);
+        while(dictRehash(d,100));
+    }
 
     /* If the hash table is empty expand it to the initial size. */
     if (d->ht[0].size == 0) return dictExpand(d, DICT_HT_INITIAL_SIZE);
 
+    /* Open addressing tables grow when they reach their fill ratio, or the
+     * higher forced one when resizing is disabled. */
+    if (dictIsOpenAddressing(d)) {
+        if (_dictOverFill(&d->ht[0],DICT_OA_FILL_NUM,DICT_OA_FILL_DEN) &&
+            (dict_can_resize ||
+             _dictOverFill(&d->ht[0],DICT_OA_FORCE_FILL_NUM,
+                                     DICT_OA_FORCE_FILL_DEN)))
+        {
+            return dictExpand(d, d->ht[0].used*2);
+        }
+        return DICT_OK;
+    }
+
     /* If we reached the 1:1 ratio, and we are allowed to resize the hash
      * table (global setting) or we should avoid it but the ratio between
      * elements/buckets is over the "safe" threshold, we resize doubling
@@ -1020,12 +1278,13 @@ static unsigned long _dictNextPower(unsigned long size)
 }
 
 /* Returns the index of a free slot that can be populated with
- * a hash entry for the given 'key'.
+ * a hash entry for the given 'key', and stores the hash of the key
+ * in '*hash'.
  * If the key already exists, -1 is returned.
  *
  * Note that if we are in the process of rehashing the hash table, the
  * index is always returned in the context of the second (new) hash table. */
-static int _dictKeyIndex(dict *d, const void *key)
+static int _dictKeyIndex(dict *d, const void *key, unsigned int *hash)
 {
     unsigned int h, idx, table;
     dictEntry *he;
@@ -1035,8 +1294,22 @@ static int _dictKeyIndex(dict *d, const void *key)
         return -1;
     /* Compute the key hash value */
     h = dictHashKey(d, key);
+    *hash = h;
     for (table = 0; table <= 1; table++) {
         idx = h & d->ht[table].sizemask;
+        if (dictIsOpenAddressing(d)) {
+            dictSlot *slots = d->ht[table].slots;
+
+            /* Walk the run up to the first free slot, which is where the
+             * key is stored if it is not found. */
+            while ((he = slots[idx].entry) != NULL) {
+                if (slots[idx].hash == h && dictCompareKeys(d, key, he->key))
+                    return -1;
+                idx = (idx+1) & d->ht[table].sizemask;
+            }
+            if (!dictIsRehashing(d)) break;
+            continue;
+        }
         /* Search if this slot does not already contain the given key */
         he = d->ht[table].table[idx];
         while(he) {
@@ -1049,6 +1322,27 @@ static int _dictKeyIndex(dict *d, const void *key)
     return idx;
 }
 
+/* Remove the element at 'idx' from the open addressing table 'ht'. The
+ * following elements of the run are moved back into the hole when it lies
+ * between their home slot and their current slot, otherwise they would no
+ * longer be reachable from their home slot. This keeps runs free of holes
+ * without tombstones, so lookups never walk over deleted slots. */
+static void _dictSlotRemove(dictht *ht, unsigned long idx) {
+    unsigned long j = idx, home;
+
+    while(1) {
+        j = (j+1) & ht->sizemask;
+        if (ht->slots[j].entry == NULL) break;
+        home = ht->slots[j].hash & ht->sizemask;
+        if (((j-home) & ht->sizemask) >= ((j-idx) & ht->sizemask)) {
+            ht->slots[idx] = ht->slots[j];
+            idx = j;
+        }
+    }
+    ht->slots[idx].entry = NULL;
+    ht->used--;
+}
+
 void dictEmpty(dict *d, void(callback)(void*)) {
     _dictClear(d,&d->ht[0],callback);
     _dictClear(d,&d->ht[1],callback);
@@ -1163,7 +1457,10 @@ dictType dictTypeHeapStringCopyKey = {
     NULL,                          /* val dup */
     _dictStringCopyHTKeyCompare,   /* key compare */
     _dictStringDestructor,         /* key destructor */
-    NULL                           /* val destructor */
+    NULL,                          /* val destructor */
+    0,                             /* open addressing */
+    NULL,                          /* key embed len */
+    NULL                           /* key embed */
 };
 
 /* This is like StringCopy but does not auto-duplicate the key.
@@ -1174,7 +1471,10 @@ dictType dictTypeHeapStrings = {
     NULL,                          /* val dup */
     _dictStringCopyHTKeyCompare,   /* key compare */
     _dictStringDestructor,         /* key destructor */
-    NULL                           /* val destructor */
+    NULL,                          /* val destructor */
+    0,                             /* open addressing */
+    NULL,                          /* key embed len */
+    NULL                           /* key embed */
 };
 
 /* This is like StringCopy but also automatically handle dynamic
@@ -1186,5 +1486,175 @@ dictType dictTypeHeapStringCopyKeyValue = {
     _dictStringCopyHTKeyCompare,   /* key compare */
     _dictStringDestructor,         /* key destructor */
     _dictStringDestructor,         /* val destructor */
+    0,                             /* open addressing */
+    NULL,                          /* key embed len */
+    NULL                           /* key embed */
 };
 #endif
+
+#ifdef DICT_BENCHMARK_MAIN
+/* Compare the chained and the open addressing tables on sds keys, like the
+ * ones of the Redis keyspace. Build from the src directory with:
+ *
+ * cc -O2 -DDICT_BENCHMARK_MAIN -I. -Icompatible -Istruct \
+ *    struct/dict.c struct/sds.c wrapper/zmalloc.c -o dict-benchmark
+ *
+ * and run with the number of keys as argument, for example:
+ *
+ * ./dict-benchmark 1000000 10000000 100000000
+ *
+ * The modes run one after the other, each one using 55 to 75 bytes per key
+ * depending on the mode and on the fill of the table: 100 million keys need
+ * about 8GB of memory. */
+#include "sds.h"
+
+void _redisAssert(char *estr, char *file, int line) {
+    fprintf(stderr,"=== ASSERTION FAILED === %s:%d '%s'\n",file,line,estr);
+    abort();
+}
+
+static long long ustime(void) {
+    struct timeval tv;
+
+    gettimeofday(&tv,NULL);
+    return ((long long)tv.tv_sec)*1000000+tv.tv_usec;
+}
+
+static unsigned int benchHash(const void *key) {
+    return dictGenHashFunction(key,sdslen((sds)key));
+}
+
+static int benchKeyCompare(void *privdata, const void *key1,
+        const void *key2)
+{
+    DICT_NOTUSED(privdata);
+
+    if (sdslen((sds)key1) != sdslen((sds)key2)) return 0;
+    return memcmp(key1,key2,sdslen((sds)key1)) == 0;
+}
+
+static void benchKeyDestructor(void *privdata, void *key) {
+    DICT_NOTUSED(privdata);
+
+    sdsfree(key);
+}
+
+static size_t benchKeyEmbedLen(const void *key) {
+    size_t len = sdslen((sds)key);
+    return sdsHdrSize(sdsReqType(len))+len+1;
+}
+
+static void *benchKeyEmbed(void *buf, const void *key) {
+    size_t len = sdslen((sds)key);
+    return sdsnewat(buf,sdsReqType(len),key,len);
+}
+
+static dictType benchChainedType = {
+    benchHash, NULL, NULL, benchKeyCompare, benchKeyDestructor, NULL, 0,
+    NULL, NULL
+};
+
+static dictType benchOpenAddressingType = {
+    benchHash, NULL, NULL, benchKeyCompare, benchKeyDestructor, NULL, 1,
+    NULL, NULL
+};
+
+static dictType benchEmbeddedType = {
+    benchHash, NULL, NULL, benchKeyCompare, NULL, NULL, 1,
+    benchKeyEmbedLen, benchKeyEmbed
+};
+
+/* Set 'key' to the decimal representation of 'value' without allocating,
+ * so that lookups time the hash table and not the formatting. */
+static sds benchKey(sds key, long value) {
+    char buf[32], *p = buf+sizeof(buf);
+    unsigned long v = value < 0 ? -value : value;
+
+    do {
+        *--p = '0'+(v%10);
+        v /= 10;
+    } while(v);
+    if (value < 0) *--p = '-';
+    return sdscpylen(key,p,buf+sizeof(buf)-p);
+}
+
+static void benchScanCallback(void *privdata, const dictEntry *de) {
+    DICT_NOTUSED(de);
+
+    (*(long*)privdata)++;
+}
+
+#define bench(name,count,code) do { \
+    long long start = ustime(); \
+    code; \
+    long long elapsed = ustime()-start; \
+    printf("  %-16s %8.2f Mops/sec (%lld ms)\n", name, \
+        (double)(count)/(elapsed ? elapsed : 1), elapsed/1000); \
+} while(0)
+
+static void benchType(dictType *type, const char *name, long count) {
+    size_t mem = zmalloc_used_memory();
+    dict *d = dictCreate(type,NULL);
+    sds key = sdsMakeRoomFor(sdsempty(),32);
+    long j, found = 0, scanned = 0;
+    unsigned long cursor = 0;
+
+    printf("%s, %ld keys:\n", name, count);
+    bench("add",count,
+        for (j = 0; j < count; j++) {
+            key = benchKey(key,j);
+            int retval = dictAdd(d,type->keyEmbed ? key : sdsdup(key),NULL);
+            assert(retval == DICT_OK);
+        });
+    while (dictIsRehashing(d)) dictRehashMilliseconds(d,100);
+    printf("  memory           %.2f bytes/key (%lu slots)\n",
+        (double)(zmalloc_used_memory()-mem)/count, dictSlots(d));
+
+    bench("find random",count,
+        for (j = 0; j < count; j++) {
+            key = benchKey(key,random() % count);
+            found += dictFind(d,key) != NULL;
+        });
+    assert(found == count);
+
+    bench("find missing",count,
+        for (j = 0; j < count; j++) {
+            key = benchKey(key,-j-1);
+            found -= dictFind(d,key) == NULL;
+        });
+    assert(found == 0);
+
+    bench("scan",count,
+        do {
+            cursor = dictScan(d,cursor,benchScanCallback,&scanned);
+        } while (cursor);
+        );
+    assert(scanned == count);
+
+    bench("delete",count,
+        for (j = 0; j < count; j++) {
+            key = benchKey(key,j);
+            int retval = dictDelete(d,key);
+            assert(retval == DICT_OK);
+        });
+    dictRelease(d);
+    sdsfree(key);
+}
+
+int main(int argc, char **argv) {
+    int j;
+
+    if (argc == 1) {
+        printf("Usage: %s <keys> [<keys> ...]\n", argv[0]);
+        return 1;
+    }
+    for (j = 1; j < argc; j++) {
+        long count = strtol(argv[j],NULL,10);
+
+        benchType(&benchChainedType,"chaining",count);
+        benchType(&benchOpenAddressingType,"open addressing",count);
+        benchType(&benchEmbeddedType,"open addressing, embedded keys",count);
+    }
+    return 0;
+}
+#endif
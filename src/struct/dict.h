@@ -41,6 +41,7 @@
 *  利用哈希表 里的next，形成链表，来解决字典中的键冲突问题*/
 
 #include <stdint.h>
+#include <stddef.h>
 
 #ifndef __DICT_H
 #define __DICT_H
@@ -73,8 +74,26 @@ typedef struct dictType {
     int (*keyCompare)(void *privdata, const void *key1, const void *key2);
     void (*keyDestructor)(void *privdata, void *key);
     void (*valDestructor)(void *privdata, void *obj);
+    int openAddressing; /* Use linear probing instead of chaining. */
+    /* Optional: keys are copied inside the entry allocation, right after
+     * the entry. keyEmbedLen() returns the bytes needed by the copy of a
+     * key, keyEmbed() writes it at 'buf' and returns the key to store.
+     * Embedded keys are freed with their entry, so these types have no
+     * keyDup and keyDestructor. */
+    size_t (*keyEmbedLen)(const void *key);
+    void *(*keyEmbed)(void *buf, const void *key);
 } dictType;
 
+/* Slot of an open addressing hash table. The full hash of the key is kept
+ * next to the entry pointer, so probing only dereferences the entries
+ * having the same hash of the key we look for, and the home slot of an
+ * element is known without hashing its key again (rehashing, deletion
+ * and scanning rely on it). */
+typedef struct dictSlot {
+    dictEntry *entry; /* NULL if the slot is free. */
+    unsigned int hash;
+} dictSlot;
+
 /* This is our hash table structure. Every dictionary has two of this as we
  * implement incremental rehashing, for the old to the new table. */
 
@@ -85,6 +104,7 @@ typedef struct dictht {
     unsigned long size; // 哈希表大小，也就是哈希节点数量
     unsigned long sizemask; // mask 码，用以地址索引计算
     unsigned long used; // 哈希表size使用量，哈希节点的使用量
+    dictSlot *slots; /* Used instead of 'table' by open addressing dicts. */
 } dictht;
 
 /*字典*/
@@ -109,6 +129,7 @@ typedef struct dictIterator {
     dict *d; // 字典
     long index;
     int table, safe;
+    long pos; /* Slot of 'entry' in open addressing dicts. */
     dictEntry *entry, *nextEntry; // 哈希表节点指针，和指向下一个节点的指针
     /* unsafe iterator fingerprint for misuse detection. */
     long long fingerprint;
@@ -119,6 +140,9 @@ typedef struct dictIterator {
 
 // 字典扫描方法
 typedef void (dictScanFunction)(void *privdata, const dictEntry *de);
+/* Like dictScanFunction, but may move the entry: the new one is returned,
+ * or NULL if the entry was not moved. See dictScanDefrag(). */
+typedef dictEntry *(dictDefragFunction)(void *privdata, dictEntry *de);
 
 /* This is the initial size of every hash table */
 #define DICT_HT_INITIAL_SIZE     4  
@@ -182,6 +206,7 @@ typedef void (dictScanFunction)(void *privdata, const dictEntry *de);
 #define dictSize(d) ((d)->ht[0].used+(d)->ht[1].used)
 // 初始化rehash标志，为  －1 ，置为0表示开始rehash
 #define dictIsRehashing(d) ((d)->rehashidx != -1)
+#define dictIsOpenAddressing(d) ((d)->type->openAddressing)
 
 /* API */
 // 字典创建，传入type和privadata  返回一个字典
@@ -217,7 +242,7 @@ dictEntry *dictNext(dictIterator *iter);
 // 释放迭代器
 void dictReleaseIterator(dictIterator *iter);
 // 返回一个字典的随机的dictEntry
-dictEntry *dictGetRandomKey(dictw *d);
+dictEntry *dictGetRandomKey(dict *d);
 //
 unsigned int dictGetSomeKeys(dict *d, dictEntry **des, unsigned int count);
 //打印字典的状态，分两部分 _dictPrintStatsHt 和 是否正在rehash的判断
@@ -242,6 +267,7 @@ void dictSetHashFunctionSeed(unsigned int initval);
 unsigned int dictGetHashFunctionSeed(void);
 // 定义字典扫描
 unsigned long dictScan(dict *d, unsigned long v, dictScanFunction *fn, void *privdata);
+unsigned long dictScanDefrag(dict *d, unsigned long v, dictDefragFunction *fn, void *privdata);
 
 /* Hash table types */ 
 extern dictType dictTypeHeapStringCopyKey;
@@ -0,0 +1,1042 @@
+/* Listpack -- A lists of strings serialization format
+ *
+ * A listpack is a compact, single allocation encoding of a list of strings
+ * and integers, used as a replacement of the ziplist. The layout is:
+ *
+ * <tot-bytes> <num-elements> <element-1> ... <element-N> <listpack-end-byte>
+ *
+ * <tot-bytes> is a 32 bit unsigned integer holding the total size of the
+ * listpack, <num-elements> a 16 bit unsigned integer with the number of
+ * elements (65535 means "unknown, count them"). Both are little endian.
+ * The end byte is 0xFF.
+ *
+ * Every element is stored as:
+ *
+ * <encoding-type><element-data><element-tot-len>
+ *
+ * The encoding type (and string length, when the element is a string) comes
+ * first, then the string or integer payload. <element-tot-len> is the size
+ * of the first two parts, stored in 1 to 5 bytes using 7 bits per byte so
+ * that it can be parsed right to left, which is how backward traversal
+ * finds the start of the previous element.
+ *
+ * Unlike the ziplist, an element never stores anything about its
+ * neighbours: the ziplist "prevlen" field is what makes an insertion
+ * cascade into updates of all the following entries when a length crosses
+ * the 254 bytes boundary. In a listpack every insertion or deletion is a
+ * single memmove().
+ *
+ * Encodings of the first byte:
+ *
+ * 0xxxxxxx                        7 bit unsigned integer (0 - 127).
+ * 10xxxxxx <string>               string of up to 63 bytes.
+ * 110xxxxx yyyyyyyy               13 bit signed integer.
+ * 1110xxxx yyyyyyyy <string>      string of up to 4095 bytes.
+ * 11110000 <4 bytes len> <string> larger strings.
+ * 11110001 <2 bytes>              16 bit signed integer.
+ * 11110010 <3 bytes>              24 bit signed integer.
+ * 11110011 <4 bytes>              32 bit signed integer.
+ * 11110100 <8 bytes>              64 bit signed integer.
+ * 11111111                        end of listpack.
+ *
+ * Copyright (c) 2017, Salvatore Sanfilippo <antirez at gmail dot com>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *   * Redistributions of source code must retain the above copyright notice,
+ *     this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *   * Neither the name of Redis nor the names of its contributors may be used
+ *     to endorse or promote products derived from this software without
+ *     specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <stdint.h>
+#include <limits.h>
+#include <string.h>
+
+#include "listpack.h"
+#include "zmalloc.h"
+#include "util.h"
+#include "redisassert.h"
+
+#define LP_HDR_SIZE 6       /* 32 bit total len + 16 bit number of elements. */
+#define LP_HDR_NUMELE_UNKNOWN UINT16_MAX
+#define LP_MAX_INT_ENCODING_LEN 9
+#define LP_MAX_BACKLEN_SIZE 5
+#define LP_ENCODING_INT 0
+#define LP_ENCODING_STRING 1
+
+#define LP_ENCODING_7BIT_UINT 0
+#define LP_ENCODING_7BIT_UINT_MASK 0x80
+#define LP_ENCODING_IS_7BIT_UINT(byte) (((byte)&LP_ENCODING_7BIT_UINT_MASK)==LP_ENCODING_7BIT_UINT)
+
+#define LP_ENCODING_6BIT_STR 0x80
+#define LP_ENCODING_6BIT_STR_MASK 0xC0
+#define LP_ENCODING_IS_6BIT_STR(byte) (((byte)&LP_ENCODING_6BIT_STR_MASK)==LP_ENCODING_6BIT_STR)
+
+#define LP_ENCODING_13BIT_INT 0xC0
+#define LP_ENCODING_13BIT_INT_MASK 0xE0
+#define LP_ENCODING_IS_13BIT_INT(byte) (((byte)&LP_ENCODING_13BIT_INT_MASK)==LP_ENCODING_13BIT_INT)
+
+#define LP_ENCODING_12BIT_STR 0xE0
+#define LP_ENCODING_12BIT_STR_MASK 0xF0
+#define LP_ENCODING_IS_12BIT_STR(byte) (((byte)&LP_ENCODING_12BIT_STR_MASK)==LP_ENCODING_12BIT_STR)
+
+#define LP_ENCODING_16BIT_INT 0xF1
+#define LP_ENCODING_24BIT_INT 0xF2
+#define LP_ENCODING_32BIT_INT 0xF3
+#define LP_ENCODING_64BIT_INT 0xF4
+#define LP_ENCODING_32BIT_STR 0xF0
+
+#define LP_EOF 0xFF
+
+#define LP_ENCODING_6BIT_STR_LEN(p) ((p)[0] & 0x3F)
+#define LP_ENCODING_12BIT_STR_LEN(p) ((((p)[0] & 0xF) << 8) | (p)[1])
+#define LP_ENCODING_32BIT_STR_LEN(p) (((uint32_t)(p)[1]<<0) | \
+                                      ((uint32_t)(p)[2]<<8) | \
+                                      ((uint32_t)(p)[3]<<16) | \
+                                      ((uint32_t)(p)[4]<<24))
+
+#define lpGetTotalBytes(p)           (((uint32_t)(p)[0]<<0) | \
+                                      ((uint32_t)(p)[1]<<8) | \
+                                      ((uint32_t)(p)[2]<<16) | \
+                                      ((uint32_t)(p)[3]<<24))
+
+#define lpGetNumElements(p)          (((uint32_t)(p)[4]<<0) | \
+                                      ((uint32_t)(p)[5]<<8))
+#define lpSetTotalBytes(p,v) do { \
+    (p)[0] = (v)&0xff; \
+    (p)[1] = ((v)>>8)&0xff; \
+    (p)[2] = ((v)>>16)&0xff; \
+    (p)[3] = ((v)>>24)&0xff; \
+} while(0)
+
+#define lpSetNumElements(p,v) do { \
+    (p)[4] = (v)&0xff; \
+    (p)[5] = ((v)>>8)&0xff; \
+} while(0)
+
+/*-----------------------------------------------------------------------------
+ * Encoding and decoding of single elements
+ *----------------------------------------------------------------------------*/
+
+/* Create a new, empty listpack.
+ * On success the new listpack is returned, otherwise an error is returned. */
+unsigned char *lpNew(void) {
+    unsigned char *lp = zmalloc(LP_HDR_SIZE+1);
+    lpSetTotalBytes(lp,LP_HDR_SIZE+1);
+    lpSetNumElements(lp,0);
+    lp[LP_HDR_SIZE] = LP_EOF;
+    return lp;
+}
+
+/* Free the specified listpack. */
+void lpFree(unsigned char *lp) {
+    zfree(lp);
+}
+
+/* Given an element 'ele' of size 'size', determine if the element can be
+ * represented inside the listpack encoded as integer, and returns
+ * LP_ENCODING_INT if so. Otherwise returns LP_ENCODING_STRING if no integer
+ * encoding is possible.
+ *
+ * If the LP_ENCODING_INT is returned, the function stores the integer encoded
+ * representation of the element in the 'intenc' buffer.
+ *
+ * Regardless of the returned encoding, 'enclen' is populated by reference to
+ * the number of bytes that the string or integer encoded element will require
+ * in order to be represented. */
+static int lpEncodeGetType(unsigned char *ele, uint32_t size,
+                           unsigned char *intenc, uint64_t *enclen) {
+    long long v;
+
+    if (size <= 20 && string2ll((char*)ele,size,&v)) {
+        if (v >= 0 && v <= 127) {
+            /* Single byte 0-127 integer. */
+            intenc[0] = v;
+            *enclen = 1;
+        } else if (v >= -4096 && v <= 4095) {
+            /* 13 bit integer. */
+            if (v < 0) v = ((int64_t)1<<13)+v;
+            intenc[0] = (v>>8)|LP_ENCODING_13BIT_INT;
+            intenc[1] = v&0xff;
+            *enclen = 2;
+        } else if (v >= -32768 && v <= 32767) {
+            /* 16 bit integer. */
+            if (v < 0) v = ((int64_t)1<<16)+v;
+            intenc[0] = LP_ENCODING_16BIT_INT;
+            intenc[1] = v&0xff;
+            intenc[2] = v>>8;
+            *enclen = 3;
+        } else if (v >= -8388608 && v <= 8388607) {
+            /* 24 bit integer. */
+            if (v < 0) v = ((int64_t)1<<24)+v;
+            intenc[0] = LP_ENCODING_24BIT_INT;
+            intenc[1] = v&0xff;
+            intenc[2] = (v>>8)&0xff;
+            intenc[3] = v>>16;
+            *enclen = 4;
+        } else if (v >= -2147483648LL && v <= 2147483647LL) {
+            /* 32 bit integer. */
+            if (v < 0) v = ((int64_t)1<<32)+v;
+            intenc[0] = LP_ENCODING_32BIT_INT;
+            intenc[1] = v&0xff;
+            intenc[2] = (v>>8)&0xff;
+            intenc[3] = (v>>16)&0xff;
+            intenc[4] = v>>24;
+            *enclen = 5;
+        } else {
+            /* 64 bit integer. */
+            uint64_t uv = v;
+            intenc[0] = LP_ENCODING_64BIT_INT;
+            intenc[1] = uv&0xff;
+            intenc[2] = (uv>>8)&0xff;
+            intenc[3] = (uv>>16)&0xff;
+            intenc[4] = (uv>>24)&0xff;
+            intenc[5] = (uv>>32)&0xff;
+            intenc[6] = (uv>>40)&0xff;
+            intenc[7] = (uv>>48)&0xff;
+            intenc[8] = uv>>56;
+            *enclen = 9;
+        }
+        return LP_ENCODING_INT;
+    } else {
+        if (size < 64) *enclen = 1+size;
+        else if (size < 4096) *enclen = 2+size;
+        else *enclen = 5+(uint64_t)size;
+        return LP_ENCODING_STRING;
+    }
+}
+
+/* Store a reverse-encoded variable length field, representing the length
+ * of the previous element of size 'l', in the target buffer 'buf'.
+ * The function returns the number of bytes used to encode it, from
+ * 1 to 5. If 'buf' is NULL the function just returns the number of bytes
+ * needed in order to encode the backlen. */
+static unsigned long lpEncodeBacklen(unsigned char *buf, uint64_t l) {
+    if (l <= 127) {
+        if (buf) buf[0] = l;
+        return 1;
+    } else if (l < 16383) {
+        if (buf) {
+            buf[0] = l>>7;
+            buf[1] = (l&127)|128;
+        }
+        return 2;
+    } else if (l < 2097151) {
+        if (buf) {
+            buf[0] = l>>14;
+            buf[1] = ((l>>7)&127)|128;
+            buf[2] = (l&127)|128;
+        }
+        return 3;
+    } else if (l < 268435455) {
+        if (buf) {
+            buf[0] = l>>21;
+            buf[1] = ((l>>14)&127)|128;
+            buf[2] = ((l>>7)&127)|128;
+            buf[3] = (l&127)|128;
+        }
+        return 4;
+    } else {
+        if (buf) {
+            buf[0] = l>>28;
+            buf[1] = ((l>>21)&127)|128;
+            buf[2] = ((l>>14)&127)|128;
+            buf[3] = ((l>>7)&127)|128;
+            buf[4] = (l&127)|128;
+        }
+        return 5;
+    }
+}
+
+/* Decode the backlen and returns it. If the encoding looks invalid (more than
+ * 5 bytes are used), UINT64_MAX is returned to report the problem. */
+static uint64_t lpDecodeBacklen(unsigned char *p) {
+    uint64_t val = 0;
+    uint64_t shift = 0;
+    do {
+        val |= (uint64_t)(p[0] & 127) << shift;
+        if (!(p[0] & 128)) break;
+        shift += 7;
+        p--;
+        if (shift > 28) return UINT64_MAX;
+    } while (1);
+    return val;
+}
+
+/* Encode the string element pointed by 's' of size 'len' in the target
+ * buffer 's'. The function should be called with 'buf' having always enough
+ * space for encoding the string. This is done by calling lpEncodeGetType()
+ * before calling this function. */
+static void lpEncodeString(unsigned char *buf, unsigned char *s, uint32_t len) {
+    if (len < 64) {
+        buf[0] = len | LP_ENCODING_6BIT_STR;
+        memcpy(buf+1,s,len);
+    } else if (len < 4096) {
+        buf[0] = (len >> 8) | LP_ENCODING_12BIT_STR;
+        buf[1] = len & 0xff;
+        memcpy(buf+2,s,len);
+    } else {
+        buf[0] = LP_ENCODING_32BIT_STR;
+        buf[1] = len & 0xff;
+        buf[2] = (len >> 8) & 0xff;
+        buf[3] = (len >> 16) & 0xff;
+        buf[4] = (len >> 24) & 0xff;
+        memcpy(buf+5,s,len);
+    }
+}
+
+/* Return the encoded length of the listpack element pointed by 'p'.
+ * This includes the encoding byte, length bytes, and the element data itself,
+ * but not the backlen. */
+static uint32_t lpCurrentEncodedSize(unsigned char *p) {
+    if (LP_ENCODING_IS_7BIT_UINT(p[0])) return 1;
+    if (LP_ENCODING_IS_6BIT_STR(p[0])) return 1+LP_ENCODING_6BIT_STR_LEN(p);
+    if (LP_ENCODING_IS_13BIT_INT(p[0])) return 2;
+    if (LP_ENCODING_IS_12BIT_STR(p[0])) return 2+LP_ENCODING_12BIT_STR_LEN(p);
+    switch (p[0]) {
+    case LP_ENCODING_16BIT_INT: return 3;
+    case LP_ENCODING_24BIT_INT: return 4;
+    case LP_ENCODING_32BIT_INT: return 5;
+    case LP_ENCODING_64BIT_INT: return 9;
+    case LP_ENCODING_32BIT_STR: return 5+LP_ENCODING_32BIT_STR_LEN(p);
+    case LP_EOF: return 1;
+    }
+    assert(NULL); /* Invalid listpack encoding. */
+    return 0;
+}
+
+/* Return the number of bytes an element holding a string of 'slen' bytes
+ * takes in a listpack, including its backlen. Integer-like strings may end
+ * up encoded in fewer bytes, so this is an upper bound. */
+size_t lpEntrySizeString(size_t slen) {
+    uint64_t enclen;
+
+    if (slen < 64) enclen = 1+slen;
+    else if (slen < 4096) enclen = 2+slen;
+    else enclen = 5+slen;
+    return enclen+lpEncodeBacklen(NULL,enclen);
+}
+
+/*-----------------------------------------------------------------------------
+ * Navigation
+ *----------------------------------------------------------------------------*/
+
+/* Skip the current entry returning the next. It is invalid to call this
+ * function if the current element is the EOF element at the end of the
+ * listpack, however, while this function is used to implement lpNext(),
+ * it does not return NULL when the EOF element is encountered. */
+static unsigned char *lpSkip(unsigned char *p) {
+    unsigned long entrylen = lpCurrentEncodedSize(p);
+    entrylen += lpEncodeBacklen(NULL,entrylen);
+    p += entrylen;
+    return p;
+}
+
+/* If 'p' points to an element of the listpack, calling lpNext() will return
+ * the pointer to the next element (the one on the right), or NULL if 'p'
+ * already pointed to the last element of the listpack. */
+unsigned char *lpNext(unsigned char *lp, unsigned char *p) {
+    ((void) lp); /* Unused, kept for symmetry with lpPrev(). */
+    p = lpSkip(p);
+    if (p[0] == LP_EOF) return NULL;
+    return p;
+}
+
+/* If 'p' points to an element of the listpack, calling lpPrev() will return
+ * the pointer to the previous element (the one on the left), or NULL if 'p'
+ * already pointed to the first element of the listpack. */
+unsigned char *lpPrev(unsigned char *lp, unsigned char *p) {
+    uint64_t prevlen;
+
+    if (p-lp == LP_HDR_SIZE) return NULL;
+    p--; /* Seek the first backlen byte of the last element. */
+    prevlen = lpDecodeBacklen(p);
+    prevlen += lpEncodeBacklen(NULL,prevlen);
+    p -= prevlen-1; /* Seek the first byte of the previous entry. */
+    return p;
+}
+
+/* Return a pointer to the first element of the listpack, or NULL if the
+ * listpack has no elements. */
+unsigned char *lpFirst(unsigned char *lp) {
+    unsigned char *p = lp + LP_HDR_SIZE; /* Skip the header. */
+    if (p[0] == LP_EOF) return NULL;
+    return p;
+}
+
+/* Return a pointer to the last element of the listpack, or NULL if the
+ * listpack has no elements. */
+unsigned char *lpLast(unsigned char *lp) {
+    unsigned char *p = lp+lpGetTotalBytes(lp)-1; /* Seek EOF element. */
+    return lpPrev(lp,p); /* Will return NULL if EOF is the only element. */
+}
+
+/* Return the number of elements inside the listpack. This function attempts
+ * to use the cached value when within range, otherwise a full scan is
+ * needed. As a side effect of calling this function, the listpack header
+ * could be modified, because if the count is found to be already within
+ * the 'numele' header field range, the new value is set. */
+unsigned long lpLength(unsigned char *lp) {
+    uint32_t numele = lpGetNumElements(lp);
+    unsigned long count = 0;
+    unsigned char *p;
+
+    if (numele != LP_HDR_NUMELE_UNKNOWN) return numele;
+
+    /* Too many elements inside the listpack. We need to scan in order
+     * to get the total number. */
+    p = lpFirst(lp);
+    while (p) {
+        count++;
+        p = lpNext(lp,p);
+    }
+
+    /* If the count is again within range of the header numele field,
+     * set it. */
+    if (count < LP_HDR_NUMELE_UNKNOWN) lpSetNumElements(lp,count);
+    return count;
+}
+
+/* Return the total number of bytes the listpack is composed of. */
+size_t lpBytes(unsigned char *lp) {
+    return lpGetTotalBytes(lp);
+}
+
+/* Seek the specified element and returns the pointer to the seeked element.
+ * Positive indexes specify the zero-based element to seek from the head to
+ * the tail, negative indexes specify elements starting from the tail, where
+ * -1 means the last element, -2 the penultimate and so forth. If the index
+ * is out of range, NULL is returned. */
+unsigned char *lpSeek(unsigned char *lp, long index) {
+    int forward = 1; /* Seek forward by default. */
+    unsigned char *ele;
+
+    /* We want to seek from left to right or the other way around
+     * depending on the listpack length and the element position.
+     * However if the listpack length cannot be obtained in constant time,
+     * we always seek from left to right. */
+    uint32_t numele = lpGetNumElements(lp);
+    if (numele != LP_HDR_NUMELE_UNKNOWN) {
+        if (index < 0) index = (long)numele+index;
+        if (index < 0) return NULL; /* Index still < 0 means out of range. */
+        if (index >= (long)numele) return NULL; /* Out of range the other side. */
+        /* We want to scan right-to-left if the element we are looking for
+         * is past the half of the listpack. */
+        if (index > (long)numele/2) {
+            forward = 0;
+            /* Right to left scanning always expects a negative index. Convert
+             * our index to negative form. */
+            index -= numele;
+        }
+    } else {
+        /* If the listpack length is unspecified, for negative indexes we
+         * want to always scan right-to-left. */
+        if (index < 0) forward = 0;
+    }
+
+    /* Forward and backward scanning is trivially based on lpNext()/lpPrev(). */
+    if (forward) {
+        ele = lpFirst(lp);
+        while (index > 0 && ele) {
+            ele = lpNext(lp,ele);
+            index--;
+        }
+    } else {
+        ele = lpLast(lp);
+        while (index < -1 && ele) {
+            ele = lpPrev(lp,ele);
+            index++;
+        }
+    }
+    return ele;
+}
+
+/*-----------------------------------------------------------------------------
+ * Access
+ *----------------------------------------------------------------------------*/
+
+/* Get the element pointed by 'p' with the same semantics as ziplistGet():
+ * strings are returned in '*sval' and '*slen', integers in '*lval' with
+ * '*sval' set to NULL. Returns 0 if 'p' is NULL or points to the end of
+ * the listpack, otherwise 1. */
+int lpGet(unsigned char *p, unsigned char **sval, unsigned int *slen,
+          long long *lval) {
+    int64_t val;
+    uint64_t uval, negstart, negmax;
+
+    if (p == NULL || p[0] == LP_EOF) return 0;
+    if (sval) *sval = NULL;
+
+    if (LP_ENCODING_IS_7BIT_UINT(p[0])) {
+        negstart = UINT64_MAX; /* 7 bit ints are always positive. */
+        negmax = 0;
+        uval = p[0] & 0x7f;
+    } else if (LP_ENCODING_IS_6BIT_STR(p[0])) {
+        *slen = LP_ENCODING_6BIT_STR_LEN(p);
+        *sval = p+1;
+        return 1;
+    } else if (LP_ENCODING_IS_13BIT_INT(p[0])) {
+        uval = ((p[0]&0x1f)<<8) | p[1];
+        negstart = (uint64_t)1<<12;
+        negmax = 8191;
+    } else if (p[0] == LP_ENCODING_16BIT_INT) {
+        uval = (uint64_t)p[1] |
+               (uint64_t)p[2]<<8;
+        negstart = (uint64_t)1<<15;
+        negmax = UINT16_MAX;
+    } else if (p[0] == LP_ENCODING_24BIT_INT) {
+        uval = (uint64_t)p[1] |
+               (uint64_t)p[2]<<8 |
+               (uint64_t)p[3]<<16;
+        negstart = (uint64_t)1<<23;
+        negmax = UINT32_MAX>>8;
+    } else if (p[0] == LP_ENCODING_32BIT_INT) {
+        uval = (uint64_t)p[1] |
+               (uint64_t)p[2]<<8 |
+               (uint64_t)p[3]<<16 |
+               (uint64_t)p[4]<<24;
+        negstart = (uint64_t)1<<31;
+        negmax = UINT32_MAX;
+    } else if (p[0] == LP_ENCODING_64BIT_INT) {
+        uval = (uint64_t)p[1] |
+               (uint64_t)p[2]<<8 |
+               (uint64_t)p[3]<<16 |
+               (uint64_t)p[4]<<24 |
+               (uint64_t)p[5]<<32 |
+               (uint64_t)p[6]<<40 |
+               (uint64_t)p[7]<<48 |
+               (uint64_t)p[8]<<56;
+        negstart = (uint64_t)1<<63;
+        negmax = UINT64_MAX;
+    } else if (LP_ENCODING_IS_12BIT_STR(p[0])) {
+        *slen = LP_ENCODING_12BIT_STR_LEN(p);
+        *sval = p+2;
+        return 1;
+    } else if (p[0] == LP_ENCODING_32BIT_STR) {
+        *slen = LP_ENCODING_32BIT_STR_LEN(p);
+        *sval = p+5;
+        return 1;
+    } else {
+        assert(NULL); /* Invalid listpack encoding. */
+        return 0;
+    }
+
+    /* We reach this code path only for integer encodings.
+     * Convert the unsigned value to the signed one using two's complement
+     * rule. */
+    if (uval >= negstart) {
+        /* This three steps conversion should avoid undefined behaviors
+         * in the unsigned -> signed conversion. */
+        uval = negmax-uval;
+        val = uval;
+        val = -val-1;
+    } else {
+        val = uval;
+    }
+    if (lval) *lval = val;
+    return 1;
+}
+
+/* Compare the element pointed by 'p' with the string 's' of 'slen' bytes.
+ * Return 1 if equal. */
+int lpCompare(unsigned char *p, unsigned char *s, unsigned int slen) {
+    unsigned char *vstr;
+    unsigned int vlen;
+    long long vll, sll;
+
+    if (!lpGet(p,&vstr,&vlen,&vll)) return 0;
+    if (vstr) return vlen == slen && memcmp(vstr,s,slen) == 0;
+    /* Integers are only stored for strings that string2ll() accepts, so
+     * a string that doesn't convert can't be equal. */
+    if (slen > 20 || !string2ll((char*)s,slen,&sll)) return 0;
+    return vll == sll;
+}
+
+/* Find pointer to the entry equal to the specified entry, starting at 'p'.
+ * Skip 'skip' entries between every comparison, so for a listpack of
+ * field/value pairs a 'skip' of 1 only looks at the fields.
+ * Returns NULL when the field could not be found. */
+unsigned char *lpFind(unsigned char *lp, unsigned char *p, unsigned char *s,
+                      unsigned int slen, unsigned int skip) {
+    int skipcnt = 0;
+    int sencoding = -1; /* -1: unknown, 0: not an integer, 1: integer. */
+    long long sll = 0;
+    unsigned char *vstr;
+    unsigned int vlen;
+    long long vll;
+
+    while (p) {
+        if (skipcnt == 0) {
+            lpGet(p,&vstr,&vlen,&vll);
+            if (vstr) {
+                if (vlen == slen && memcmp(vstr,s,slen) == 0) return p;
+            } else {
+                /* Convert the searched string to an integer only once. */
+                if (sencoding == -1)
+                    sencoding = slen <= 20 && string2ll((char*)s,slen,&sll);
+                if (sencoding == 1 && vll == sll) return p;
+            }
+            /* Reset skip count */
+            skipcnt = skip;
+        } else {
+            /* Skip entry */
+            skipcnt--;
+        }
+        p = lpNext(lp,p);
+    }
+    return NULL;
+}
+
+/*-----------------------------------------------------------------------------
+ * Modification
+ *----------------------------------------------------------------------------*/
+
+/* Insert, delete or replace the specified element 's' of length 'slen' at
+ * the specified position 'p', with 'p' being a listpack element pointer
+ * obtained with lpFirst(), lpLast(), lpNext(), lpPrev() or lpSeek().
+ *
+ * The element is inserted before, after, or replaces the element pointed
+ * by 'p' depending on the 'where' argument, that can be LP_BEFORE, LP_AFTER
+ * or LP_REPLACE.
+ *
+ * If 's' is set to NULL, the function removes the element pointed by 'p'
+ * instead of inserting one.
+ *
+ * Returns the listpack, that may have been reallocated. If 'newp' is not
+ * NULL, it is set to the address of the element just added, so that it
+ * will be possible to continue an interation with lpNext() and lpPrev().
+ * For deletion operations 'newp' is set to the next element, on the right
+ * of the deleted one, or to NULL if the deleted element was the last one. */
+unsigned char *lpInsert(unsigned char *lp, unsigned char *s, uint32_t slen,
+                        unsigned char *p, int where, unsigned char **newp) {
+    unsigned char intenc[LP_MAX_INT_ENCODING_LEN];
+    unsigned char backlen[LP_MAX_BACKLEN_SIZE];
+    uint64_t enclen; /* The length of the encoded element. */
+    unsigned long poff, backlen_size;
+    uint64_t old_listpack_bytes, new_listpack_bytes;
+    uint32_t replaced_len = 0;
+    unsigned char *dst;
+    int enctype;
+
+    /* An element pointer set to NULL means deletion, which is conceptually
+     * replacing the element with a zero-length element. So whatever we
+     * get passed as 'where', set it to LP_REPLACE. */
+    if (s == NULL) where = LP_REPLACE;
+
+    /* If we need to insert after the current element, we just jump to the
+     * next element (that could be the EOF one) and handle the case of
+     * inserting before. So the function will actually deal with just two
+     * cases: LP_BEFORE and LP_REPLACE. */
+    if (where == LP_AFTER) {
+        p = lpSkip(p);
+        where = LP_BEFORE;
+    }
+
+    /* Store the offset of the element 'p', so that we can obtain its
+     * address again after a reallocation. */
+    poff = p-lp;
+
+    /* Calling lpEncodeGetType() results into the encoded version of the
+     * element to be stored into 'intenc' in case it is representable as
+     * an integer: in that case, the function returns LP_ENCODING_INT.
+     * Otherwise if LP_ENCODING_STRING is returned, we'll have to call
+     * lpEncodeString() to actually write the encoded string on place later.
+     *
+     * Whatever the returned encoding is, 'enclen' is populated with the
+     * length of the encoded element. */
+    if (s) {
+        enctype = lpEncodeGetType(s,slen,intenc,&enclen);
+    } else {
+        enctype = -1;
+        enclen = 0;
+    }
+
+    /* We need to also encode the backward-parsable length of the element
+     * and append it to the end: this allows to traverse the listpack from
+     * the end to the start. */
+    backlen_size = s ? lpEncodeBacklen(backlen,enclen) : 0;
+    old_listpack_bytes = lpGetTotalBytes(lp);
+    if (where == LP_REPLACE) {
+        replaced_len = lpCurrentEncodedSize(p);
+        replaced_len += lpEncodeBacklen(NULL,replaced_len);
+    }
+
+    new_listpack_bytes = old_listpack_bytes + enclen + backlen_size
+                         - replaced_len;
+    if (new_listpack_bytes > UINT32_MAX) return NULL;
+
+    /* We now need to reallocate in order to make space or shrink the
+     * allocation (in case 'where' value is LP_REPLACE and the new element is
+     * smaller). However we do that before memmoving the memory to
+     * make room for the new element if the final allocation will get
+     * larger, or we do it after if the final allocation will get smaller. */
+    dst = lp + poff; /* May be updated after reallocation. */
+
+    /* Realloc before: we need more room. */
+    if (new_listpack_bytes > old_listpack_bytes) {
+        lp = zrealloc(lp,new_listpack_bytes);
+        dst = lp + poff;
+    }
+
+    /* Setup the listpack relocating the elements to make the exact room
+     * we need to store the new one. */
+    if (where == LP_BEFORE) {
+        memmove(dst+enclen+backlen_size,dst,old_listpack_bytes-poff);
+    } else { /* LP_REPLACE. */
+        long lendiff = (enclen+backlen_size)-replaced_len;
+        memmove(dst+replaced_len+lendiff,
+                dst+replaced_len,
+                old_listpack_bytes-poff-replaced_len);
+    }
+
+    /* Realloc after: we need to free space. */
+    if (new_listpack_bytes < old_listpack_bytes) {
+        lp = zrealloc(lp,new_listpack_bytes);
+        dst = lp + poff;
+    }
+
+    /* Store the entry. */
+    if (newp) {
+        *newp = dst;
+        /* In case of deletion, set 'newp' to NULL if the next element is
+         * the EOF element. */
+        if (!s && dst[0] == LP_EOF) *newp = NULL;
+    }
+    if (s) {
+        if (enctype == LP_ENCODING_INT) {
+            memcpy(dst,intenc,enclen);
+        } else {
+            lpEncodeString(dst,s,slen);
+        }
+        dst += enclen;
+        memcpy(dst,backlen,backlen_size);
+        dst += backlen_size;
+    }
+
+    /* Update header. */
+    if (where != LP_REPLACE || s == NULL) {
+        uint32_t num_elements = lpGetNumElements(lp);
+        if (num_elements != LP_HDR_NUMELE_UNKNOWN) {
+            if (s)
+                lpSetNumElements(lp,num_elements+1);
+            else
+                lpSetNumElements(lp,num_elements-1);
+        }
+    }
+    lpSetTotalBytes(lp,new_listpack_bytes);
+    return lp;
+}
+
+/* Append the specified element 's' of length 'slen' at the end of the
+ * listpack. It is implemented in terms of lpInsert(), so the return value is
+ * the same as lpInsert(). */
+unsigned char *lpAppend(unsigned char *lp, unsigned char *s, uint32_t slen) {
+    uint64_t listpack_bytes = lpGetTotalBytes(lp);
+    unsigned char *eofptr = lp + listpack_bytes - 1;
+    return lpInsert(lp,s,slen,eofptr,LP_BEFORE,NULL);
+}
+
+/* Prepend the specified element 's' of length 'slen' at the beginning of
+ * the listpack. */
+unsigned char *lpPrepend(unsigned char *lp, unsigned char *s, uint32_t slen) {
+    unsigned char *p = lpFirst(lp);
+    if (!p) return lpAppend(lp,s,slen);
+    return lpInsert(lp,s,slen,p,LP_BEFORE,NULL);
+}
+
+/* Replace the element at '*p' with 's', updating '*p' so that it points
+ * to the new element. */
+unsigned char *lpReplace(unsigned char *lp, unsigned char **p,
+                         unsigned char *s, uint32_t slen) {
+    return lpInsert(lp,s,slen,*p,LP_REPLACE,p);
+}
+
+/* Remove the element pointed by 'p', and return the resulting listpack.
+ * If 'newp' is not NULL, the next element pointer (to the right of the
+ * deleted one) is returned by reference. If the deleted element was the
+ * last one, '*newp' is set to NULL. */
+unsigned char *lpDelete(unsigned char *lp, unsigned char *p,
+                        unsigned char **newp) {
+    return lpInsert(lp,NULL,0,p,LP_REPLACE,newp);
+}
+
+/* Delete a range of 'num' entries starting at the element pointed by '*p'.
+ * Deleting more elements than available stops at the end of the listpack.
+ * On return '*p' points to the element following the deleted range, or is
+ * NULL if the range reached the end of the listpack. */
+unsigned char *lpDeleteRangeWithEntry(unsigned char *lp, unsigned char **p,
+                                      unsigned long num) {
+    size_t bytes = lpBytes(lp);
+    unsigned long deleted = 0;
+    unsigned char *eofptr = lp + bytes - 1;
+    unsigned char *first, *tail;
+    size_t poff;
+    uint32_t numele;
+
+    if (num == 0) return lp; /* Nothing to delete, return ASAP. */
+
+    first = tail = *p;
+    /* Find the next entry to the last entry that needs to be deleted. */
+    while (num--) {
+        deleted++;
+        tail = lpSkip(tail);
+        if (tail[0] == LP_EOF) break;
+    }
+
+    /* Store the offset of the element 'first', so that we can obtain its
+     * address again after a reallocation. */
+    poff = first-lp;
+
+    /* Move tail to the front of the listpack */
+    memmove(first, tail, eofptr - tail + 1);
+    lpSetTotalBytes(lp, bytes - (tail - first));
+    numele = lpGetNumElements(lp);
+    if (numele != LP_HDR_NUMELE_UNKNOWN)
+        lpSetNumElements(lp, numele-deleted);
+    lp = zrealloc(lp,bytes - (tail - first));
+
+    /* Store the entry. */
+    *p = lp+poff;
+    if ((*p)[0] == LP_EOF) *p = NULL;
+    return lp;
+}
+
+/* Delete a range of 'num' entries from the listpack, starting at the
+ * element at 'index' (negative indexes count from the tail, like in
+ * lpSeek()). Deleting more elements than available stops at the end of
+ * the listpack. */
+unsigned char *lpDeleteRange(unsigned char *lp, long index,
+                             unsigned long num) {
+    unsigned char *p = lpSeek(lp,index);
+
+    if (p == NULL || num == 0) return lp;
+    return lpDeleteRangeWithEntry(lp,&p,num);
+}
+
+/* Append all the elements of listpack 'second' to the listpack 'first'.
+ * Since listpack elements don't reference their neighbours, this is a
+ * plain concatenation of the two element areas.
+ *
+ * Returns the merged listpack, 'second' is freed. */
+unsigned char *lpMerge(unsigned char *first, unsigned char *second) {
+    size_t first_bytes = lpBytes(first);
+    size_t second_bytes = lpBytes(second);
+    unsigned long first_len = lpGetNumElements(first);
+    unsigned long second_len = lpGetNumElements(second);
+    size_t second_data = second_bytes - LP_HDR_SIZE - 1;
+    size_t lpbytes = first_bytes + second_data;
+    unsigned long lplength;
+
+    first = zrealloc(first,lpbytes);
+    /* Overwrite the EOF byte of 'first' with the elements of 'second',
+     * and copy the EOF byte of 'second' as well. */
+    memcpy(first+first_bytes-1,second+LP_HDR_SIZE,second_data+1);
+
+    if (first_len == LP_HDR_NUMELE_UNKNOWN ||
+        second_len == LP_HDR_NUMELE_UNKNOWN) {
+        lplength = LP_HDR_NUMELE_UNKNOWN;
+    } else {
+        lplength = first_len + second_len;
+        if (lplength > LP_HDR_NUMELE_UNKNOWN)
+            lplength = LP_HDR_NUMELE_UNKNOWN;
+    }
+    lpSetNumElements(first,lplength);
+    lpSetTotalBytes(first,lpbytes);
+    zfree(second);
+    return first;
+}
+
+#ifdef LISTPACK_TEST_MAIN
+#include <stdio.h>
+#include <stdlib.h>
+
+/* Check that every element of 'lp' matches the 'len' strings in 'ref',
+ * walking forward, backward and by index. Returns the number of errors. */
+static int checkAgainst(unsigned char *lp, char **ref, long len) {
+    unsigned char *p, *vstr;
+    unsigned int vlen;
+    long long vll;
+    long i;
+    int err = 0;
+    char buf[32];
+
+    if (lpLength(lp) != (unsigned long)len) err++;
+    for (i = 0, p = lpFirst(lp); p; p = lpNext(lp,p), i++) {
+        lpGet(p,&vstr,&vlen,&vll);
+        if (!vstr) {
+            vlen = ll2string(buf,sizeof(buf),vll);
+            vstr = (unsigned char*)buf;
+        }
+        if (i >= len || vlen != strlen(ref[i]) || memcmp(vstr,ref[i],vlen))
+            err++;
+        if (!lpCompare(p,(unsigned char*)ref[i],strlen(ref[i]))) err++;
+    }
+    if (i != len) err++;
+    for (i = len-1, p = lpLast(lp); p; p = lpPrev(lp,p), i--) {
+        if (i < 0 || !lpCompare(p,(unsigned char*)ref[i],strlen(ref[i])))
+            err++;
+    }
+    if (i != -1) err++;
+    for (i = 0; i < len; i++) {
+        if (!lpCompare(lpSeek(lp,i),(unsigned char*)ref[i],strlen(ref[i])))
+            err++;
+        if (!lpCompare(lpSeek(lp,i-len),(unsigned char*)ref[i],
+                       strlen(ref[i])))
+            err++;
+    }
+    if (lpSeek(lp,len) || lpSeek(lp,-len-1)) err++;
+    return err;
+}
+
+/* Random value: integers of every encoding size, and strings crossing
+ * the 63 / 4095 bytes string header and 127 bytes backlen boundaries. */
+static char *randomValue(void) {
+    static const long long ints[] = {0, 127, 128, -1, 4095, -4096, 4096,
+        32767, -32768, 8388607, -8388608, 2147483647LL, -2147483648LL,
+        9223372036854775807LL, -9223372036854775807LL-1};
+    int sizes[] = {0, 1, 62, 63, 64, 125, 126, 127, 128, 253, 254, 255,
+                   4094, 4095, 4096, 5000};
+    char *v;
+
+    if (rand() % 3 == 0) {
+        char buf[32];
+        long long n = rand() % 2 ? ints[rand() % 15] :
+                                   (long long)rand() - RAND_MAX/2;
+        ll2string(buf,sizeof(buf),n);
+        return zstrdup(buf);
+    } else {
+        int l = sizes[rand() % 16], j;
+        v = zmalloc(l+1);
+        for (j = 0; j < l; j++) v[j] = 'a' + rand() % 26;
+        v[l] = '\0';
+        return v;
+    }
+}
+
+int main(int argc, char **argv) {
+    unsigned int seed = argc > 1 ? atoi(argv[1]) : 1234;
+    unsigned char *lp = lpNew(), *p;
+    char *ref[1024];
+    long len = 0, j;
+    int step, err = 0;
+
+    srand(seed);
+    for (step = 0; step < 20000; step++) {
+        int op = rand() % 11;
+        char *v = randomValue();
+        long idx = len ? rand() % len : 0;
+
+        /* Grow the list most of the time. */
+        if (op >= 8) op = rand() % 3;
+        if (len >= 300 && op < 3) op = 3 + rand() % 5;
+        if (len == 0) op = 0;
+        if (op == 0) {
+            lp = lpAppend(lp,(unsigned char*)v,strlen(v));
+            ref[len++] = v;
+        } else if (op == 1) {
+            lp = lpPrepend(lp,(unsigned char*)v,strlen(v));
+            memmove(ref+1,ref,len*sizeof(char*));
+            ref[0] = v;
+            len++;
+        } else if (op == 2) {
+            int after = rand() % 2;
+            p = lpSeek(lp,idx);
+            lp = lpInsert(lp,(unsigned char*)v,strlen(v),p,
+                          after ? LP_AFTER : LP_BEFORE,&p);
+            if (!lpCompare(p,(unsigned char*)v,strlen(v))) err++;
+            if (after) idx++;
+            memmove(ref+idx+1,ref+idx,(len-idx)*sizeof(char*));
+            ref[idx] = v;
+            len++;
+        } else if (op == 3) {
+            p = lpSeek(lp,idx);
+            lp = lpReplace(lp,&p,(unsigned char*)v,strlen(v));
+            if (!lpCompare(p,(unsigned char*)v,strlen(v))) err++;
+            zfree(ref[idx]);
+            ref[idx] = v;
+        } else if (op == 4) {
+            p = lpSeek(lp,idx);
+            lp = lpDelete(lp,p,&p);
+            if ((idx == len-1) != (p == NULL)) err++;
+            zfree(ref[idx]);
+            memmove(ref+idx,ref+idx+1,(len-idx-1)*sizeof(char*));
+            len--;
+            zfree(v);
+        } else if (op == 5) {
+            long count = rand() % 4 + 1;
+            lp = lpDeleteRange(lp,rand() % 2 ? idx : idx-len,count);
+            if (idx+count > len) count = len-idx;
+            for (j = idx; j < idx+count; j++) zfree(ref[j]);
+            memmove(ref+idx,ref+idx+count,(len-idx-count)*sizeof(char*));
+            len -= count;
+            zfree(v);
+        } else if (op == 6) {
+            /* Split at 'idx' and merge back. */
+            unsigned char *second = lpNew();
+            for (p = lpSeek(lp,idx); p; p = lpNext(lp,p)) {
+                unsigned char *vstr;
+                unsigned int vlen;
+                long long vll;
+                char buf[32];
+                lpGet(p,&vstr,&vlen,&vll);
+                if (!vstr) {
+                    vlen = ll2string(buf,sizeof(buf),vll);
+                    vstr = (unsigned char*)buf;
+                }
+                second = lpAppend(second,vstr,vlen);
+            }
+            lp = lpDeleteRange(lp,idx,len);
+            lp = lpMerge(lp,second);
+            zfree(v);
+        } else {
+            p = lpFind(lp,lpFirst(lp),(unsigned char*)ref[idx],
+                       strlen(ref[idx]),0);
+            for (j = 0; j < len; j++) if (!strcmp(ref[j],ref[idx])) break;
+            if (p != lpSeek(lp,j)) err++;
+            zfree(v);
+        }
+        if (step % 499 == 0) err += checkAgainst(lp,ref,len);
+    }
+    err += checkAgainst(lp,ref,len);
+    printf("%ld entries, %zu bytes, %d errors\n", len, lpBytes(lp), err);
+    for (j = 0; j < len; j++) zfree(ref[j]);
+    lpFree(lp);
+
+    /* Past 65535 elements the header count is unknown and lpLength()
+     * has to count, until the list shrinks back into range. */
+    lp = lpNew();
+    for (j = 0; j < 70000; j++) {
+        char buf[32];
+        int l = ll2string(buf,sizeof(buf),j);
+        lp = lpAppend(lp,(unsigned char*)buf,l);
+    }
+    if (lpLength(lp) != 70000) err++;
+    if (!lpCompare(lpSeek(lp,-1),(unsigned char*)"69999",5)) err++;
+    if (!lpCompare(lpSeek(lp,65600),(unsigned char*)"65600",5)) err++;
+    lp = lpDeleteRange(lp,-10000,10000);
+    if (lpLength(lp) != 60000) err++;
+    if (!lpCompare(lpLast(lp),(unsigned char*)"59999",5)) err++;
+    lpFree(lp);
+    printf("large listpack: %d errors\n", err);
+    return err ? 1 : 0;
+}
+#endif
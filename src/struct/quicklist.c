@@ -0,0 +1,1555 @@
+/* quicklist.c - A doubly linked list of listpacks
+ *
+ * A quicklist is a linked list whose nodes each hold a listpack with a
+ * bounded number of entries (or a bounded byte size). It keeps the memory
+ * efficiency of the listpack, since small values are stored back to back
+ * without per-element pointers or robj headers, while push and pop at both
+ * ends stay O(1) and no single reallocation ever has to move the whole list.
+ *
+ * Optionally, every node but the 'compress' nodes at each end of the list is
+ * stored LZF compressed. Nodes are decompressed on demand when an operation
+ * needs to look inside them, and compressed again as soon as it is done.
+ *
+ * Copyright (c) 2009-2015, Salvatore Sanfilippo <antirez at gmail dot com>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *   * Redistributions of source code must retain the above copyright notice,
+ *     this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *   * Neither the name of Redis nor the names of its contributors may be used
+ *     to endorse or promote products derived from this software without
+ *     specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <string.h> /* for memcpy */
+#include "quicklist.h"
+#include "zmalloc.h"
+#include "ziplist.h" /* for loading lists saved as ziplists */
+#include "listpack.h"
+#include "util.h" /* for ll2string */
+#include "lzf.h"
+#include "redisassert.h"
+
+/* Optimization levels for size-based filling: a fill of -1 caps every node
+ * at 4 kb, -2 at 8 kb, and so on up to -5 (64 kb). */
+static const size_t optimization_level[] = {4096, 8192, 16384, 32768, 65536};
+
+/* Maximum size in bytes of any multi-element listpack.
+ * Larger values will live in their own isolated listpacks. */
+#define SIZE_SAFETY_LIMIT 8192
+
+/* Maximum fill factor (entries per node) accepted by quicklistSetFill(). */
+#define FILL_MAX (1 << 15)
+
+/* Maximum compress depth accepted by quicklistSetCompressDepth(). */
+#define COMPRESS_MAX (1 << 16)
+
+/* Minimum listpack size in bytes for attempting compression. */
+#define MIN_COMPRESS_BYTES 48
+
+/* Minimum size reduction in bytes to store compressed quicklistNode data.
+ * This also prevents us from storing compression if the compression
+ * resulted in a larger size than the original data. */
+#define MIN_COMPRESS_IMPROVE 8
+
+#define sizeMeetsSafetyLimit(sz) ((sz) <= SIZE_SAFETY_LIMIT)
+
+#define quicklistNodeUpdateSz(node)                                            \
+    do {                                                                       \
+        (node)->sz = lpBytes((node)->entry);                                   \
+    } while (0)
+
+/* Simple way to give quicklistEntry structs default values with one call. */
+#define initEntry(e)                                                           \
+    do {                                                                       \
+        (e)->zi = (e)->value = NULL;                                           \
+        (e)->longval = -123456789;                                             \
+        (e)->quicklist = NULL;                                                 \
+        (e)->node = NULL;                                                      \
+        (e)->offset = 123456789;                                               \
+        (e)->sz = 0;                                                           \
+    } while (0)
+
+/*-----------------------------------------------------------------------------
+ * Creation and destruction
+ *----------------------------------------------------------------------------*/
+
+/* Create a new quicklist.
+ * Free with quicklistRelease(). */
+quicklist *quicklistCreate(void) {
+    struct quicklist *quicklist;
+
+    quicklist = zmalloc(sizeof(*quicklist));
+    quicklist->head = quicklist->tail = NULL;
+    quicklist->len = 0;
+    quicklist->count = 0;
+    quicklist->compress = 0;
+    quicklist->fill = -2;
+    return quicklist;
+}
+
+/* Set the number of nodes at each end of the list that are never
+ * compressed. 0 disables compression. */
+void quicklistSetCompressDepth(quicklist *quicklist, int compress) {
+    if (compress > COMPRESS_MAX) {
+        compress = COMPRESS_MAX;
+    } else if (compress < 0) {
+        compress = 0;
+    }
+    quicklist->compress = compress;
+}
+
+/* Set the fill factor, clamping it to the supported range. */
+void quicklistSetFill(quicklist *quicklist, int fill) {
+    if (fill > FILL_MAX) {
+        fill = FILL_MAX;
+    } else if (fill < -5) {
+        fill = -5;
+    }
+    quicklist->fill = fill;
+}
+
+void quicklistSetOptions(quicklist *quicklist, int fill, int depth) {
+    quicklistSetFill(quicklist, fill);
+    quicklistSetCompressDepth(quicklist, depth);
+}
+
+/* Create a new quicklist with some default parameters. */
+quicklist *quicklistNew(int fill, int compress) {
+    quicklist *quicklist = quicklistCreate();
+    quicklistSetOptions(quicklist, fill, compress);
+    return quicklist;
+}
+
+static quicklistNode *quicklistCreateNode(void) {
+    quicklistNode *node;
+    node = zmalloc(sizeof(*node));
+    node->entry = NULL;
+    node->count = 0;
+    node->sz = 0;
+    node->next = node->prev = NULL;
+    node->encoding = QUICKLIST_NODE_ENCODING_RAW;
+    node->recompress = 0;
+    node->extra = 0;
+    return node;
+}
+
+/* Return cached quicklist count */
+unsigned long quicklistCount(const quicklist *ql) { return ql->count; }
+
+/* Free entire quicklist. */
+void quicklistRelease(quicklist *quicklist) {
+    unsigned long len;
+    quicklistNode *current, *next;
+
+    current = quicklist->head;
+    len = quicklist->len;
+    while (len--) {
+        next = current->next;
+
+        zfree(current->entry);
+        quicklist->count -= current->count;
+
+        zfree(current);
+
+        quicklist->len--;
+        current = next;
+    }
+    zfree(quicklist);
+}
+
+/*-----------------------------------------------------------------------------
+ * Node compression
+ *----------------------------------------------------------------------------*/
+
+/* Compress the listpack in 'node' and update encoding details.
+ * Returns 1 if listpack compressed successfully.
+ * Returns 0 if compression failed or if listpack too small to compress. */
+static int __quicklistCompressNode(quicklistNode *node) {
+    quicklistLZF *lzf;
+
+    /* Don't bother compressing small values */
+    if (node->sz < MIN_COMPRESS_BYTES)
+        return 0;
+
+    lzf = zmalloc(sizeof(*lzf) + node->sz);
+
+    /* Cancel if compression fails or doesn't compress small enough */
+    if (((lzf->sz = lzf_compress(node->entry, node->sz, lzf->compressed,
+                                 node->sz)) == 0) ||
+        lzf->sz + MIN_COMPRESS_IMPROVE >= node->sz) {
+        /* lzf_compress aborts/rejects compression if value not compressable. */
+        zfree(lzf);
+        return 0;
+    }
+    lzf = zrealloc(lzf, sizeof(*lzf) + lzf->sz);
+    zfree(node->entry);
+    node->entry = (unsigned char *)lzf;
+    node->encoding = QUICKLIST_NODE_ENCODING_LZF;
+    node->recompress = 0;
+    return 1;
+}
+
+/* Compress only uncompressed nodes. */
+#define quicklistCompressNode(_node)                                           \
+    do {                                                                       \
+        if ((_node) && (_node)->encoding == QUICKLIST_NODE_ENCODING_RAW) {     \
+            __quicklistCompressNode((_node));                                  \
+        }                                                                      \
+    } while (0)
+
+/* Uncompress the listpack in 'node' and update encoding details.
+ * Returns 1 on successful decode, 0 on failure to decode. */
+static int __quicklistDecompressNode(quicklistNode *node) {
+    void *decompressed = zmalloc(node->sz);
+    quicklistLZF *lzf = (quicklistLZF *)node->entry;
+
+    if (lzf_decompress(lzf->compressed, lzf->sz, decompressed, node->sz) == 0) {
+        /* Someone requested decompress, but we can't decompress.  Not good. */
+        zfree(decompressed);
+        return 0;
+    }
+    zfree(lzf);
+    node->entry = decompressed;
+    node->encoding = QUICKLIST_NODE_ENCODING_RAW;
+    return 1;
+}
+
+/* Decompress only compressed nodes. */
+#define quicklistDecompressNode(_node)                                         \
+    do {                                                                       \
+        if ((_node) && (_node)->encoding == QUICKLIST_NODE_ENCODING_LZF) {     \
+            __quicklistDecompressNode((_node));                                \
+        }                                                                      \
+    } while (0)
+
+/* Force node to not be immediately re-compresable */
+#define quicklistDecompressNodeForUse(_node)                                   \
+    do {                                                                       \
+        if ((_node) && (_node)->encoding == QUICKLIST_NODE_ENCODING_LZF) {     \
+            __quicklistDecompressNode((_node));                                \
+            (_node)->recompress = 1;                                           \
+        }                                                                      \
+    } while (0)
+
+/* Extract the raw LZF data from this quicklistNode.
+ * Pointer to LZF data is assigned to '*data'.
+ * Return value is the length of compressed LZF data. */
+size_t quicklistGetLzf(const quicklistNode *node, void **data) {
+    quicklistLZF *lzf = (quicklistLZF *)node->entry;
+    *data = lzf->compressed;
+    return lzf->sz;
+}
+
+#define quicklistAllowsCompression(_ql) ((_ql)->compress != 0)
+
+/* Force 'quicklist' to meet compression guidelines set by compress depth.
+ * The only way to guarantee interior nodes get compressed is to iterate
+ * to our "interior" compress depth then compress the next node we find.
+ * If compress depth covers the entire list, every node ends up
+ * uncompressed: the end nodes must always be plain listpacks since push
+ * and pop access them directly. */
+static void __quicklistCompress(const quicklist *quicklist,
+                                quicklistNode *node) {
+    quicklistNode *forward, *reverse;
+    unsigned int depth = 0;
+    int in_depth = 0;
+
+    if (!quicklistAllowsCompression(quicklist))
+        return;
+
+    /* Iterate until we reach compress depth for both sides of the list.
+     * The walk stops as soon as the two sides meet, so we can skip
+     * explicit null checks below (an empty list has forward == reverse). */
+    forward = quicklist->head;
+    reverse = quicklist->tail;
+    while (depth++ < quicklist->compress) {
+        quicklistDecompressNode(forward);
+        quicklistDecompressNode(reverse);
+        if (forward) forward->recompress = 0;
+        if (reverse) reverse->recompress = 0;
+
+        if (forward == node || reverse == node)
+            in_depth = 1;
+
+        /* We passed into the compress depth of the opposite side of the
+         * list, so there is nothing to compress and we can exit. */
+        if (forward == reverse || forward->next == reverse)
+            return;
+
+        forward = forward->next;
+        reverse = reverse->prev;
+    }
+
+    if (!in_depth)
+        quicklistCompressNode(node);
+
+    /* At this point, forward and reverse are one node beyond depth */
+    quicklistCompressNode(forward);
+    quicklistCompressNode(reverse);
+}
+
+/* Compress 'node' again if it was only decompressed for usage, otherwise
+ * re-apply the compress depth rules around it. */
+#define quicklistCompress(_ql, _node)                                          \
+    do {                                                                       \
+        if ((_node)->recompress)                                               \
+            quicklistCompressNode((_node));                                    \
+        else                                                                   \
+            __quicklistCompress((_ql), (_node));                               \
+    } while (0)
+
+/* If we previously used quicklistDecompressNodeForUse(), just recompress. */
+#define quicklistRecompressOnly(_node)                                         \
+    do {                                                                       \
+        if ((_node)->recompress)                                               \
+            quicklistCompressNode((_node));                                    \
+    } while (0)
+
+/*-----------------------------------------------------------------------------
+ * Node linking
+ *----------------------------------------------------------------------------*/
+
+/* Insert 'new_node' after 'old_node' if 'after' is 1.
+ * Insert 'new_node' before 'old_node' if 'after' is 0. */
+static void __quicklistInsertNode(quicklist *quicklist,
+                                  quicklistNode *old_node,
+                                  quicklistNode *new_node, int after) {
+    if (after) {
+        new_node->prev = old_node;
+        if (old_node) {
+            new_node->next = old_node->next;
+            if (old_node->next)
+                old_node->next->prev = new_node;
+            old_node->next = new_node;
+        }
+        if (quicklist->tail == old_node)
+            quicklist->tail = new_node;
+    } else {
+        new_node->next = old_node;
+        if (old_node) {
+            new_node->prev = old_node->prev;
+            if (old_node->prev)
+                old_node->prev->next = new_node;
+            old_node->prev = new_node;
+        }
+        if (quicklist->head == old_node)
+            quicklist->head = new_node;
+    }
+    /* If this insert creates the only element so far, initialize head/tail. */
+    if (quicklist->len == 0) {
+        quicklist->head = quicklist->tail = new_node;
+    }
+    /* Update len first, so in __quicklistCompress we know exactly len */
+    quicklist->len++;
+
+    if (old_node)
+        quicklistCompress(quicklist, old_node);
+    quicklistCompress(quicklist, new_node);
+}
+
+/* Wrappers for node inserting around existing node. */
+static void _quicklistInsertNodeBefore(quicklist *quicklist,
+                                       quicklistNode *old_node,
+                                       quicklistNode *new_node) {
+    __quicklistInsertNode(quicklist, old_node, new_node, 0);
+}
+
+static void _quicklistInsertNodeAfter(quicklist *quicklist,
+                                      quicklistNode *old_node,
+                                      quicklistNode *new_node) {
+    __quicklistInsertNode(quicklist, old_node, new_node, 1);
+}
+
+/*-----------------------------------------------------------------------------
+ * Fill policy
+ *----------------------------------------------------------------------------*/
+
+static int
+_quicklistNodeSizeMeetsOptimizationRequirement(const size_t sz,
+                                               const int fill) {
+    size_t offset;
+
+    if (fill >= 0)
+        return 0;
+
+    offset = (-fill) - 1;
+    if (offset < (sizeof(optimization_level) / sizeof(*optimization_level))) {
+        if (sz <= optimization_level[offset]) {
+            return 1;
+        } else {
+            return 0;
+        }
+    } else {
+        return 0;
+    }
+}
+
+/* Return 1 if a value of 'sz' bytes can be added to 'node' without
+ * violating the fill factor, 0 if a new node is needed. */
+static int _quicklistNodeAllowInsert(const quicklistNode *node, const int fill,
+                                     const size_t sz) {
+    size_t new_sz;
+
+    if (!node)
+        return 0;
+
+    /* new_sz overestimates if 'sz' encodes to an integer type */
+    new_sz = node->sz + lpEntrySizeString(sz);
+    if (_quicklistNodeSizeMeetsOptimizationRequirement(new_sz, fill))
+        return 1;
+    else if (!sizeMeetsSafetyLimit(new_sz))
+        return 0;
+    else if ((int)node->count < fill)
+        return 1;
+    else
+        return 0;
+}
+
+/* Return 1 if nodes 'a' and 'b' together still fit in a single node. */
+static int _quicklistNodeAllowMerge(const quicklistNode *a,
+                                    const quicklistNode *b,
+                                    const int fill) {
+    unsigned int merge_sz;
+
+    if (!a || !b)
+        return 0;
+
+    /* approximate merged listpack size (- 7 to remove one listpack
+     * header/trailer) */
+    merge_sz = a->sz + b->sz - 7;
+    if (_quicklistNodeSizeMeetsOptimizationRequirement(merge_sz, fill))
+        return 1;
+    else if (!sizeMeetsSafetyLimit(merge_sz))
+        return 0;
+    else if ((int)(a->count + b->count) <= fill)
+        return 1;
+    else
+        return 0;
+}
+
+/*-----------------------------------------------------------------------------
+ * Push
+ *----------------------------------------------------------------------------*/
+
+/* Add new entry to head node of quicklist.
+ *
+ * Returns 0 if used existing head.
+ * Returns 1 if new head created. */
+int quicklistPushHead(quicklist *quicklist, void *value, size_t sz) {
+    quicklistNode *orig_head = quicklist->head;
+
+    if (_quicklistNodeAllowInsert(quicklist->head, quicklist->fill, sz)) {
+        quicklist->head->entry = lpPrepend(quicklist->head->entry, value, sz);
+        quicklistNodeUpdateSz(quicklist->head);
+    } else {
+        quicklistNode *node = quicklistCreateNode();
+        node->entry = lpPrepend(lpNew(), value, sz);
+
+        quicklistNodeUpdateSz(node);
+        _quicklistInsertNodeBefore(quicklist, quicklist->head, node);
+    }
+    quicklist->count++;
+    quicklist->head->count++;
+    return (orig_head != quicklist->head);
+}
+
+/* Add new entry to tail node of quicklist.
+ *
+ * Returns 0 if used existing tail.
+ * Returns 1 if new tail created. */
+int quicklistPushTail(quicklist *quicklist, void *value, size_t sz) {
+    quicklistNode *orig_tail = quicklist->tail;
+
+    if (_quicklistNodeAllowInsert(quicklist->tail, quicklist->fill, sz)) {
+        quicklist->tail->entry = lpAppend(quicklist->tail->entry, value, sz);
+        quicklistNodeUpdateSz(quicklist->tail);
+    } else {
+        quicklistNode *node = quicklistCreateNode();
+        node->entry = lpAppend(lpNew(), value, sz);
+
+        quicklistNodeUpdateSz(node);
+        _quicklistInsertNodeAfter(quicklist, quicklist->tail, node);
+    }
+    quicklist->count++;
+    quicklist->tail->count++;
+    return (orig_tail != quicklist->tail);
+}
+
+/* Wrapper to allow argument-based switching between HEAD/TAIL pop */
+void quicklistPush(quicklist *quicklist, void *value, const size_t sz,
+                   int where) {
+    if (where == QUICKLIST_HEAD) {
+        quicklistPushHead(quicklist, value, sz);
+    } else if (where == QUICKLIST_TAIL) {
+        quicklistPushTail(quicklist, value, sz);
+    }
+}
+
+/* Create new node consisting of a pre-formed listpack.
+ * Used for loading RDBs where entire listpacks have been stored
+ * to be retrieved later. The listpack is owned by the quicklist afterwards. */
+void quicklistAppendListpack(quicklist *quicklist, unsigned char *lp) {
+    quicklistNode *node = quicklistCreateNode();
+
+    node->entry = lp;
+    node->count = lpLength(node->entry);
+    node->sz = lpBytes(lp);
+
+    _quicklistInsertNodeAfter(quicklist, quicklist->tail, node);
+    quicklist->count += node->count;
+}
+
+/* Append all values of ziplist 'zl' individually into 'quicklist'.
+ *
+ * This allows us to restore lists saved as ziplists by older RDB versions
+ * into quicklists of listpacks.
+ *
+ * Returns 'quicklist' argument. Frees passed-in ziplist 'zl' */
+quicklist *quicklistAppendValuesFromZiplist(quicklist *quicklist,
+                                            unsigned char *zl) {
+    unsigned char *value;
+    unsigned int sz;
+    long long longval;
+    char longstr[32] = {0};
+
+    unsigned char *p = ziplistIndex(zl, 0);
+    while (ziplistGet(p, &value, &sz, &longval)) {
+        if (!value) {
+            /* Write the longval as a string so we can re-add it */
+            sz = ll2string(longstr, sizeof(longstr), longval);
+            value = (unsigned char *)longstr;
+        }
+        quicklistPushTail(quicklist, value, sz);
+        p = ziplistNext(zl, p);
+    }
+    zfree(zl);
+    return quicklist;
+}
+
+/* Create new (potentially multi-node) quicklist from a single existing
+ * ziplist.
+ *
+ * Returns new quicklist.  Frees passed-in ziplist 'zl'. */
+quicklist *quicklistCreateFromZiplist(int fill, int compress,
+                                      unsigned char *zl) {
+    return quicklistAppendValuesFromZiplist(quicklistNew(fill, compress), zl);
+}
+
+/*-----------------------------------------------------------------------------
+ * Delete
+ *----------------------------------------------------------------------------*/
+
+static void __quicklistDelNode(quicklist *quicklist, quicklistNode *node) {
+    if (node->next)
+        node->next->prev = node->prev;
+    if (node->prev)
+        node->prev->next = node->next;
+
+    if (node == quicklist->tail)
+        quicklist->tail = node->prev;
+
+    if (node == quicklist->head)
+        quicklist->head = node->next;
+
+    /* Update len first, so in __quicklistCompress we know exactly len */
+    quicklist->len--;
+    quicklist->count -= node->count;
+
+    /* If we deleted a node within our compress depth, we
+     * now have compressed nodes needing to be decompressed. */
+    __quicklistCompress(quicklist, NULL);
+
+    zfree(node->entry);
+    zfree(node);
+}
+
+#define quicklistDeleteIfEmpty(ql, n)                                          \
+    do {                                                                       \
+        if ((n)->count == 0) {                                                 \
+            __quicklistDelNode((ql), (n));                                     \
+            (n) = NULL;                                                        \
+        }                                                                      \
+    } while (0)
+
+/* Delete one entry from list given the node for the entry and a pointer
+ * to the entry in the node.
+ *
+ * Note: quicklistDelIndex() *requires* uncompressed nodes because you
+ *       already had to get *p from an uncompressed node somewhere.
+ *
+ * Returns 1 if the entire node was deleted, 0 if node still exists.
+ * Also updates in/out param 'p' with the next offset in the listpack. */
+static int quicklistDelIndex(quicklist *quicklist, quicklistNode *node,
+                             unsigned char **p) {
+    int gone = 0;
+
+    node->entry = lpDelete(node->entry, *p, p);
+    node->count--;
+    if (node->count == 0) {
+        gone = 1;
+        __quicklistDelNode(quicklist, node);
+    } else {
+        quicklistNodeUpdateSz(node);
+    }
+    quicklist->count--;
+    /* If we deleted the node, the original node is no longer valid */
+    return gone ? 1 : 0;
+}
+
+/* Delete one element represented by 'entry'
+ *
+ * 'entry' stores enough metadata to delete the proper position in
+ * the correct listpack in the correct quicklist node. */
+void quicklistDelEntry(quicklistIter *iter, quicklistEntry *entry) {
+    quicklistNode *prev = entry->node->prev;
+    quicklistNode *next = entry->node->next;
+    int deleted_node = quicklistDelIndex((quicklist *)entry->quicklist,
+                                         entry->node, &entry->zi);
+
+    /* after delete, the zi is now invalid for any future usage. */
+    iter->zi = NULL;
+
+    /* If current node is deleted, we must update iterator node and offset. */
+    if (deleted_node) {
+        if (iter->direction == AL_START_HEAD) {
+            iter->current = next;
+            iter->offset = 0;
+        } else if (iter->direction == AL_START_TAIL) {
+            iter->current = prev;
+            iter->offset = -1;
+        }
+    }
+    /* else if (!deleted_node), no changes needed.
+     * The existing iter->offset already addresses the next entry to visit:
+     *   - head to tail: [1, 2, 3] => delete offset 1 => [1, 3], and the
+     *     next element is still at offset 1.
+     *   - tail to head: offsets are negative and count from the end, so the
+     *     entries already visited (and their offsets) did not move.
+     * If we deleted the last element of the node, the next call into
+     * quicklistNext() will jump to the next node. */
+}
+
+/* Delete a range of elements from the quicklist.
+ *
+ * elements may span across multiple quicklistNodes, so we
+ * have to be careful about tracking where we start and end.
+ *
+ * Returns 1 if entries were deleted, 0 if nothing was deleted. */
+int quicklistDelRange(quicklist *quicklist, const long start,
+                      const long count) {
+    unsigned long extent;
+    quicklistEntry entry;
+    quicklistNode *node;
+
+    if (count <= 0)
+        return 0;
+
+    extent = count; /* range is inclusive of start position */
+
+    if (start >= 0 && extent > (quicklist->count - start)) {
+        /* if requesting delete more elements than exist, limit to list size. */
+        extent = quicklist->count - start;
+    } else if (start < 0 && extent > (unsigned long)(-start)) {
+        /* else, if at negative offset, limit max size to rest of list. */
+        extent = -start; /* c.f. LREM -29 29; just delete until end. */
+    }
+
+    if (!quicklistIndex(quicklist, start, &entry))
+        return 0;
+
+    node = entry.node;
+
+    /* iterate over next nodes until everything is deleted. */
+    while (extent) {
+        quicklistNode *next = node->next;
+
+        unsigned long del;
+        int delete_entire_node = 0;
+        if (entry.offset == 0 && extent >= node->count) {
+            /* If we are deleting more than the count of this node, we
+             * can just delete the entire node without listpack math. */
+            delete_entire_node = 1;
+            del = node->count;
+        } else if (entry.offset >= 0 && extent + entry.offset >= node->count) {
+            /* If deleting more nodes after this one, calculate delete based
+             * on size of current node. */
+            del = node->count - entry.offset;
+        } else if (entry.offset < 0) {
+            /* If offset is negative, we are in the first run of this loop
+             * and we are deleting the entire range
+             * from this start offset to end of list.  Since the negative
+             * offset is the number of elements until the tail of the list,
+             * just use it directly as the deletion count. */
+            del = -entry.offset;
+
+            /* If the positive offset is greater than the remaining extent,
+             * we only delete the remaining extent, not the entire offset. */
+            if (del > extent)
+                del = extent;
+        } else {
+            /* else, we are deleting less than the extent of this node, so
+             * use extent directly. */
+            del = extent;
+        }
+
+        if (delete_entire_node) {
+            __quicklistDelNode(quicklist, node);
+        } else {
+            quicklistDecompressNodeForUse(node);
+            node->entry = lpDeleteRange(node->entry, entry.offset, del);
+            quicklistNodeUpdateSz(node);
+            node->count -= del;
+            quicklist->count -= del;
+            quicklistDeleteIfEmpty(quicklist, node);
+            if (node)
+                quicklistRecompressOnly(node);
+        }
+
+        extent -= del;
+
+        node = next;
+
+        entry.offset = 0;
+    }
+    return 1;
+}
+
+/*-----------------------------------------------------------------------------
+ * Insert and replace
+ *----------------------------------------------------------------------------*/
+
+/* Replace quicklist entry at offset 'index' by 'data' with length 'sz'.
+ *
+ * Returns 1 if replace happened.
+ * Returns 0 if replace failed and no changes happened. */
+int quicklistReplaceAtIndex(quicklist *quicklist, long index, void *data,
+                            int sz) {
+    quicklistEntry entry;
+    if (quicklistIndex(quicklist, index, &entry)) {
+        entry.node->entry = lpReplace(entry.node->entry, &entry.zi, data, sz);
+        quicklistNodeUpdateSz(entry.node);
+        quicklistCompress(quicklist, entry.node);
+        return 1;
+    } else {
+        return 0;
+    }
+}
+
+/* Move every entry of node 'b' to the tail of node 'a', then delete 'b'.
+ * 'a' must be the node right before 'b'. Both nodes are decompressed first,
+ * and the surviving node is compressed again according to the list depth.
+ *
+ * Returns the surviving node 'a'. */
+static quicklistNode *_quicklistListpackMerge(quicklist *quicklist,
+                                              quicklistNode *a,
+                                              quicklistNode *b) {
+    quicklistDecompressNode(a);
+    quicklistDecompressNode(b);
+
+    /* lpMerge() frees the second listpack. */
+    a->entry = lpMerge(a->entry, b->entry);
+    b->entry = NULL;
+    a->count += b->count;
+    quicklistNodeUpdateSz(a);
+    /* Don't let 'a' be recompressed blindly if it is now an end node. */
+    a->recompress = 0;
+
+    /* The entries now belong to 'a': don't subtract them from the total
+     * when releasing 'b'. */
+    b->count = 0;
+    __quicklistDelNode(quicklist, b);
+    quicklistCompress(quicklist, a);
+    return a;
+}
+
+/* Attempt to merge listpacks within two nodes on either side of 'center'.
+ *
+ * Attempts to merge:
+ *   - (center->prev->prev, center->prev)
+ *   - (center->next, center->next->next)
+ *   - (center->prev, center)
+ *   - (center, center->next)
+ */
+static void _quicklistMergeNodes(quicklist *quicklist, quicklistNode *center) {
+    int fill = quicklist->fill;
+    quicklistNode *prev, *prev_prev, *next, *next_next, *target;
+    prev = prev_prev = next = next_next = target = NULL;
+
+    if (center->prev) {
+        prev = center->prev;
+        if (center->prev->prev)
+            prev_prev = center->prev->prev;
+    }
+
+    if (center->next) {
+        next = center->next;
+        if (center->next->next)
+            next_next = center->next->next;
+    }
+
+    /* Try to merge prev_prev and prev */
+    if (_quicklistNodeAllowMerge(prev, prev_prev, fill)) {
+        _quicklistListpackMerge(quicklist, prev_prev, prev);
+        prev_prev = prev = NULL; /* they could have moved, invalidate them. */
+    }
+
+    /* Try to merge next and next_next */
+    if (_quicklistNodeAllowMerge(next, next_next, fill)) {
+        _quicklistListpackMerge(quicklist, next, next_next);
+        next = next_next = NULL; /* they could have moved, invalidate them. */
+    }
+
+    /* Try to merge center node and previous node */
+    if (_quicklistNodeAllowMerge(center, center->prev, fill)) {
+        target = _quicklistListpackMerge(quicklist, center->prev, center);
+        center = NULL; /* center could have been deleted, invalidate it. */
+    } else {
+        /* else, we didn't merge here, but target needs to be valid below. */
+        target = center;
+    }
+
+    /* Use result of center merge (or original) to merge with next node. */
+    if (_quicklistNodeAllowMerge(target, target->next, fill)) {
+        _quicklistListpackMerge(quicklist, target, target->next);
+    }
+}
+
+/* Split 'node' into two parts, parameterized by 'offset' and 'after'.
+ *
+ * The 'after' argument controls which quicklistNode gets returned.
+ * If 'after'==1, returned node has elements after 'offset'.
+ *                input node keeps elements up to 'offset', including 'offset'.
+ * If 'after'==0, returned node has elements up to 'offset', including 'offset'.
+ *                input node keeps elements after 'offset'.
+ *
+ * 'node' must be uncompressed. The returned node is not linked into the
+ * quicklist yet. */
+static quicklistNode *_quicklistSplitNode(quicklistNode *node, int offset,
+                                          int after) {
+    size_t zl_sz = node->sz;
+    int orig_start, orig_extent, new_start, new_extent;
+    quicklistNode *new_node = quicklistCreateNode();
+
+    /* Offsets coming from a tail-to-head lookup are negative. */
+    if (offset < 0) offset += node->count;
+
+    new_node->entry = zmalloc(zl_sz);
+
+    /* Copy original listpack so we can split it */
+    memcpy(new_node->entry, node->entry, zl_sz);
+
+    /* -1 here means "continue deleting until the list ends" */
+    orig_start = after ? offset + 1 : 0;
+    orig_extent = after ? -1 : offset;
+    new_start = after ? 0 : offset;
+    new_extent = after ? offset + 1 : -1;
+
+    node->entry = lpDeleteRange(node->entry, orig_start, orig_extent);
+    node->count = lpLength(node->entry);
+    quicklistNodeUpdateSz(node);
+
+    new_node->entry = lpDeleteRange(new_node->entry, new_start, new_extent);
+    new_node->count = lpLength(new_node->entry);
+    quicklistNodeUpdateSz(new_node);
+
+    return new_node;
+}
+
+/* Insert a new entry before or after existing entry 'entry'.
+ *
+ * If after==1, the new value is inserted after 'entry', otherwise
+ * the new value is inserted before 'entry'.
+ *
+ * Every node touched here is compressed again before returning, since
+ * the iterator that produced 'entry' is reset by the callers. */
+static void _quicklistInsert(quicklist *quicklist, quicklistEntry *entry,
+                             void *value, const size_t sz, int after) {
+    int full = 0, at_tail = 0, at_head = 0, full_next = 0, full_prev = 0;
+    int fill = quicklist->fill;
+    quicklistNode *node = entry->node;
+    quicklistNode *new_node = NULL;
+
+    if (!node) {
+        /* we have no reference node, so let's create only node in the list */
+        new_node = quicklistCreateNode();
+        new_node->entry = lpPrepend(lpNew(), value, sz);
+        __quicklistInsertNode(quicklist, NULL, new_node, after);
+        new_node->count++;
+        quicklistNodeUpdateSz(new_node);
+        quicklist->count++;
+        return;
+    }
+
+    /* Populate accounting flags for easier boolean checks later */
+    if (!_quicklistNodeAllowInsert(node, fill, sz)) {
+        full = 1;
+    }
+
+    if (after && (entry->offset == (int)node->count - 1 ||
+                  entry->offset == -1)) {
+        at_tail = 1;
+        if (!_quicklistNodeAllowInsert(node->next, fill, sz)) {
+            full_next = 1;
+        }
+    }
+
+    if (!after && (entry->offset == 0 ||
+                   entry->offset == -(int)node->count)) {
+        at_head = 1;
+        if (!_quicklistNodeAllowInsert(node->prev, fill, sz)) {
+            full_prev = 1;
+        }
+    }
+
+    /* Now determine where and how to insert the new element */
+    if (!full && after) {
+        unsigned char *next;
+
+        quicklistDecompressNodeForUse(node);
+        next = lpNext(node->entry, entry->zi);
+        if (next == NULL) {
+            node->entry = lpAppend(node->entry, value, sz);
+        } else {
+            node->entry = lpInsert(node->entry, value, sz, next, LP_BEFORE,
+                                   NULL);
+        }
+        node->count++;
+        quicklistNodeUpdateSz(node);
+        quicklistRecompressOnly(node);
+    } else if (!full && !after) {
+        quicklistDecompressNodeForUse(node);
+        node->entry = lpInsert(node->entry, value, sz, entry->zi, LP_BEFORE,
+                               NULL);
+        node->count++;
+        quicklistNodeUpdateSz(node);
+        quicklistRecompressOnly(node);
+    } else if (full && at_tail && node->next && !full_next && after) {
+        /* If we are: at tail, next has free space, and inserting after:
+         *   - insert entry at head of next node. */
+        new_node = node->next;
+        quicklistDecompressNodeForUse(new_node);
+        new_node->entry = lpPrepend(new_node->entry, value, sz);
+        new_node->count++;
+        quicklistNodeUpdateSz(new_node);
+        quicklistRecompressOnly(new_node);
+        quicklistRecompressOnly(node);
+    } else if (full && at_head && node->prev && !full_prev && !after) {
+        /* If we are: at head, previous has free space, and inserting before:
+         *   - insert entry at tail of previous node. */
+        new_node = node->prev;
+        quicklistDecompressNodeForUse(new_node);
+        new_node->entry = lpAppend(new_node->entry, value, sz);
+        new_node->count++;
+        quicklistNodeUpdateSz(new_node);
+        quicklistRecompressOnly(new_node);
+        quicklistRecompressOnly(node);
+    } else if (full && ((at_tail && node->next && full_next && after) ||
+                        (at_head && node->prev && full_prev && !after))) {
+        /* If we are: full, and our prev/next is full, then:
+         *   - create new node and attach to quicklist */
+        new_node = quicklistCreateNode();
+        new_node->entry = lpPrepend(lpNew(), value, sz);
+        new_node->count++;
+        quicklistNodeUpdateSz(new_node);
+        __quicklistInsertNode(quicklist, node, new_node, after);
+    } else if (full) {
+        /* else, node is full we need to split it. */
+        /* covers both after and !after cases */
+        quicklistDecompressNodeForUse(node);
+        new_node = _quicklistSplitNode(node, entry->offset, after);
+        if (after)
+            new_node->entry = lpPrepend(new_node->entry, value, sz);
+        else
+            new_node->entry = lpAppend(new_node->entry, value, sz);
+        new_node->count++;
+        quicklistNodeUpdateSz(new_node);
+        __quicklistInsertNode(quicklist, node, new_node, after);
+        _quicklistMergeNodes(quicklist, node);
+    }
+
+    quicklist->count++;
+}
+
+/* Insert before/after the entry returned by 'iter'. Nodes may be split,
+ * merged or freed by the insertion, so the iterator is reset afterwards:
+ * the next quicklistNext() call returns 0 and releasing it is safe. */
+void quicklistInsertBefore(quicklistIter *iter, quicklistEntry *entry,
+                           void *value, const size_t sz) {
+    _quicklistInsert((quicklist *)iter->quicklist, entry, value, sz, 0);
+    iter->current = NULL;
+    iter->zi = NULL;
+}
+
+void quicklistInsertAfter(quicklistIter *iter, quicklistEntry *entry,
+                          void *value, const size_t sz) {
+    _quicklistInsert((quicklist *)iter->quicklist, entry, value, sz, 1);
+    iter->current = NULL;
+    iter->zi = NULL;
+}
+
+/*-----------------------------------------------------------------------------
+ * Iteration and lookup
+ *----------------------------------------------------------------------------*/
+
+/* Returns a quicklist iterator 'iter'. After the initialization every
+ * call to quicklistNext() will return the next element of the quicklist. */
+quicklistIter *quicklistGetIterator(const quicklist *quicklist, int direction) {
+    quicklistIter *iter;
+
+    iter = zmalloc(sizeof(*iter));
+
+    if (direction == AL_START_HEAD) {
+        iter->current = quicklist->head;
+        iter->offset = 0;
+    } else {
+        iter->current = quicklist->tail;
+        iter->offset = -1;
+    }
+
+    iter->direction = direction;
+    iter->quicklist = quicklist;
+
+    iter->zi = NULL;
+
+    return iter;
+}
+
+/* Initialize an iterator at a specific offset 'idx' and make the iterator
+ * return nodes in 'direction' direction.
+ *
+ * Returns NULL if 'idx' is out of range. */
+quicklistIter *quicklistGetIteratorAtIdx(const quicklist *quicklist,
+                                         const int direction,
+                                         const long long idx) {
+    quicklistEntry entry;
+
+    if (quicklistIndex(quicklist, idx, &entry)) {
+        quicklistIter *base = quicklistGetIterator(quicklist, direction);
+        base->zi = NULL;
+        base->current = entry.node;
+        base->offset = entry.offset;
+        return base;
+    } else {
+        return NULL;
+    }
+}
+
+/* Release iterator.
+ * If still have current node, then re-encode current node. */
+void quicklistReleaseIterator(quicklistIter *iter) {
+    if (iter->current)
+        quicklistCompress(iter->quicklist, iter->current);
+
+    zfree(iter);
+}
+
+/* Get next element in iterator.
+ *
+ * Note: You must NOT insert into the list while iterating over it.
+ * You *may* delete from the list while iterating using the
+ * quicklistDelEntry() function.
+ * If you insert into the quicklist while iterating, you should
+ * re-create the iterator after your addition.
+ *
+ * iter = quicklistGetIterator(quicklist,<direction>);
+ * quicklistEntry entry;
+ * while (quicklistNext(iter, &entry)) {
+ *     if (entry.value)
+ *          [[ use entry.value with entry.sz ]]
+ *     else
+ *          [[ use entry.longval ]]
+ * }
+ *
+ * Populates 'entry' with values for this iteration.
+ * Returns 0 when iteration is complete or if iteration not possible.
+ * If return value is 0, the contents of 'entry' are not valid. */
+int quicklistNext(quicklistIter *iter, quicklistEntry *entry) {
+    initEntry(entry);
+
+    if (!iter)
+        return 0;
+
+    entry->quicklist = iter->quicklist;
+    entry->node = iter->current;
+
+    if (!iter->current)
+        return 0;
+
+    if (!iter->zi) {
+        /* If !zi, use current index. */
+        quicklistDecompressNodeForUse(iter->current);
+        iter->zi = lpSeek(iter->current->entry, iter->offset);
+    } else {
+        /* else, use existing iterator offset and get prev/next as necessary. */
+        if (iter->direction == AL_START_HEAD) {
+            iter->zi = lpNext(iter->current->entry, iter->zi);
+            iter->offset += 1;
+        } else {
+            iter->zi = lpPrev(iter->current->entry, iter->zi);
+            iter->offset -= 1;
+        }
+    }
+
+    entry->zi = iter->zi;
+    entry->offset = iter->offset;
+
+    if (iter->zi) {
+        /* Populate value from existing listpack position */
+        lpGet(entry->zi, &entry->value, &entry->sz, &entry->longval);
+        return 1;
+    } else {
+        /* We ran out of listpack entries.
+         * Pick next node, update offset, then re-run retrieval. */
+        quicklistCompress(iter->quicklist, iter->current);
+        if (iter->direction == AL_START_HEAD) {
+            /* Forward traversal */
+            iter->current = iter->current->next;
+            iter->offset = 0;
+        } else {
+            /* Reverse traversal */
+            iter->current = iter->current->prev;
+            iter->offset = -1;
+        }
+        iter->zi = NULL;
+        return quicklistNext(iter, entry);
+    }
+}
+
+/* Duplicate the quicklist.
+ * On success a copy of the original quicklist is returned.
+ *
+ * The original quicklist both on success or error is never modified.
+ *
+ * Returns newly allocated quicklist. */
+quicklist *quicklistDup(quicklist *orig) {
+    quicklist *copy;
+    quicklistNode *current;
+
+    copy = quicklistNew(orig->fill, orig->compress);
+
+    for (current = orig->head; current; current = current->next) {
+        quicklistNode *node = quicklistCreateNode();
+
+        if (current->encoding == QUICKLIST_NODE_ENCODING_LZF) {
+            quicklistLZF *lzf = (quicklistLZF *)current->entry;
+            size_t lzf_sz = sizeof(*lzf) + lzf->sz;
+            node->entry = zmalloc(lzf_sz);
+            memcpy(node->entry, current->entry, lzf_sz);
+        } else {
+            node->entry = zmalloc(current->sz);
+            memcpy(node->entry, current->entry, current->sz);
+        }
+        node->encoding = current->encoding;
+
+        node->count = current->count;
+        copy->count += node->count;
+        node->sz = current->sz;
+
+        _quicklistInsertNodeAfter(copy, copy->tail, node);
+    }
+
+    /* copy->count must equal orig->count here */
+    return copy;
+}
+
+/* Populate 'entry' with the element at the specified zero-based index
+ * where 0 is the head, 1 is the element next to head
+ * and so on. Negative integers are used in order to count
+ * from the tail, -1 is the last element, -2 the penultimate
+ * and so on. If the index is out of range 0 is returned.
+ *
+ * The node holding the entry is left decompressed (marked for recompression)
+ * so 'entry' stays valid: callers modifying the node compress it afterwards.
+ *
+ * Returns 1 if element found
+ * Returns 0 if element not found */
+int quicklistIndex(const quicklist *quicklist, const long long idx,
+                   quicklistEntry *entry) {
+    quicklistNode *n;
+    unsigned long long accum = 0;
+    unsigned long long index;
+    int forward = idx < 0 ? 0 : 1; /* < 0 -> reverse, 0+ -> forward */
+
+    initEntry(entry);
+    entry->quicklist = quicklist;
+
+    if (!forward) {
+        index = (-idx) - 1;
+        n = quicklist->tail;
+    } else {
+        index = idx;
+        n = quicklist->head;
+    }
+
+    if (index >= quicklist->count)
+        return 0;
+
+    while (n) {
+        if ((accum + n->count) > index) {
+            break;
+        } else {
+            accum += n->count;
+            n = forward ? n->next : n->prev;
+        }
+    }
+
+    if (!n)
+        return 0;
+
+    entry->node = n;
+    if (forward) {
+        /* forward = normal head-to-tail offset. */
+        entry->offset = index - accum;
+    } else {
+        /* reverse = need negative offset for tail-to-head, so undo
+         * the result of the original if (index < 0) above. */
+        entry->offset = (-index) - 1 + accum;
+    }
+
+    quicklistDecompressNodeForUse(entry->node);
+    entry->zi = lpSeek(entry->node->entry, entry->offset);
+    lpGet(entry->zi, &entry->value, &entry->sz, &entry->longval);
+    return 1;
+}
+
+/*-----------------------------------------------------------------------------
+ * Pop
+ *----------------------------------------------------------------------------*/
+
+/* Pop from quicklist and return result in 'data' ptr.  Value of 'data'
+ * is the return value of 'saver' function pointer if the data is NOT a number.
+ *
+ * If the quicklist element is a long long, then the return value is returned in
+ * 'sval'.
+ *
+ * Return value of 0 means no elements available.
+ * Return value of 1 means check 'data' and 'sval' for values.
+ * If 'data' is set, use 'data' and 'sz'.  Otherwise, use 'sval'. */
+int quicklistPopCustom(quicklist *quicklist, int where, unsigned char **data,
+                       unsigned int *sz, long long *sval,
+                       void *(*saver)(unsigned char *data, unsigned int sz)) {
+    unsigned char *p;
+    unsigned char *vstr;
+    unsigned int vlen;
+    long long vlong;
+    int pos = (where == QUICKLIST_HEAD) ? 0 : -1;
+    quicklistNode *node;
+
+    if (quicklist->count == 0)
+        return 0;
+
+    if (data)
+        *data = NULL;
+    if (sz)
+        *sz = 0;
+    if (sval)
+        *sval = -123456789;
+
+    if (where == QUICKLIST_HEAD && quicklist->head) {
+        node = quicklist->head;
+    } else if (where == QUICKLIST_TAIL && quicklist->tail) {
+        node = quicklist->tail;
+    } else {
+        return 0;
+    }
+
+    p = lpSeek(node->entry, pos);
+    if (lpGet(p, &vstr, &vlen, &vlong)) {
+        if (vstr) {
+            if (data)
+                *data = saver(vstr, vlen);
+            if (sz)
+                *sz = vlen;
+        } else {
+            if (data)
+                *data = NULL;
+            if (sval)
+                *sval = vlong;
+        }
+        quicklistDelIndex(quicklist, node, &p);
+        return 1;
+    }
+    return 0;
+}
+
+/* Return a malloc'd copy of data passed in */
+static void *_quicklistSaver(unsigned char *data, unsigned int sz) {
+    unsigned char *vstr;
+    if (data) {
+        vstr = zmalloc(sz);
+        memcpy(vstr, data, sz);
+        return vstr;
+    }
+    return NULL;
+}
+
+/* Default pop function
+ *
+ * Returns malloc'd value from quicklist */
+int quicklistPop(quicklist *quicklist, int where, unsigned char **data,
+                 unsigned int *sz, long long *slong) {
+    unsigned char *vstr;
+    unsigned int vlen;
+    long long vlong;
+    int ret;
+
+    if (quicklist->count == 0)
+        return 0;
+    ret = quicklistPopCustom(quicklist, where, &vstr, &vlen, &vlong,
+                             _quicklistSaver);
+    if (data)
+        *data = vstr;
+    if (slong)
+        *slong = vlong;
+    if (sz)
+        *sz = vlen;
+    return ret;
+}
+
+/* Compare the entry at 'p1' (pointing into a node listpack) with the
+ * string 'p2' of 'p2_len' bytes. Returns 1 if equal. */
+int quicklistCompare(unsigned char *p1, unsigned char *p2, int p2_len) {
+    return lpCompare(p1, p2, p2_len);
+}
+
+#ifdef QUICKLIST_TEST_MAIN
+#include <stdio.h>
+#include <stdlib.h>
+
+/* Cross check every element of 'ql' against the reference array 'ref'
+ * (of 'len' strings), from both directions and by index, and verify the
+ * node accounting and that the 'compress' nodes at each end are plain
+ * listpacks. Returns the number of errors found, '*compressed' is set to
+ * the number of LZF nodes seen before the check. */
+static int checkAgainst(quicklist *ql, char **ref, long len,
+                        unsigned int *compressed) {
+    quicklistIter *iter;
+    quicklistEntry entry;
+    quicklistNode *node;
+    unsigned long total = 0;
+    unsigned int nodes = 0;
+    long i;
+    int err = 0;
+    char buf[32];
+
+    *compressed = 0;
+    for (node = ql->head; node; node = node->next) {
+        if (quicklistNodeIsCompressed(node)) {
+            quicklistLZF *lzf = (quicklistLZF *)node->entry;
+            unsigned char *zl = zmalloc(node->sz);
+            if (lzf_decompress(lzf->compressed, lzf->sz, zl, node->sz) !=
+                node->sz || lpLength(zl) != node->count)
+                err++;
+            zfree(zl);
+            if (nodes < ql->compress || nodes >= ql->len - ql->compress)
+                err++;
+            (*compressed)++;
+        } else {
+            if (node->count != lpLength(node->entry)) err++;
+            if (node->sz != lpBytes(node->entry)) err++;
+        }
+        if (node->count == 0) err++;
+        if (node->next && node->next->prev != node) err++;
+        total += node->count;
+        nodes++;
+    }
+    if (total != ql->count || nodes != ql->len || ql->count != (unsigned long)len)
+        err++;
+
+    iter = quicklistGetIterator(ql, AL_START_HEAD);
+    i = 0;
+    while (quicklistNext(iter, &entry)) {
+        const char *v = (char *)entry.value;
+        unsigned int vlen = entry.sz;
+        if (!v) {
+            vlen = ll2string(buf, sizeof(buf), entry.longval);
+            v = buf;
+        }
+        if (i >= len || strlen(ref[i]) != vlen || memcmp(ref[i], v, vlen))
+            err++;
+        i++;
+    }
+    quicklistReleaseIterator(iter);
+    if (i != len) err++;
+
+    iter = quicklistGetIterator(ql, AL_START_TAIL);
+    i = len - 1;
+    while (quicklistNext(iter, &entry)) {
+        if (i < 0 || !quicklistCompare(entry.zi, (unsigned char *)ref[i],
+                                       strlen(ref[i])))
+            err++;
+        i--;
+    }
+    quicklistReleaseIterator(iter);
+    if (i != -1) err++;
+
+    for (i = 0; i < len; i++) {
+        if (!quicklistIndex(ql, i, &entry) ||
+            !quicklistCompare(entry.zi, (unsigned char *)ref[i],
+                              strlen(ref[i])))
+            err++;
+        if (!quicklistIndex(ql, i - len, &entry) ||
+            !quicklistCompare(entry.zi, (unsigned char *)ref[i],
+                              strlen(ref[i])))
+            err++;
+    }
+    return err;
+}
+
+/* Random operations applied both to a quicklist and to a plain array of
+ * strings, comparing the two after every step. */
+int main(int argc, char **argv) {
+    int fills[] = {-5, -2, -1, 1, 2, 3, 8, 32};
+    int depths[] = {0, 1, 2, 4};
+    int ndepths = sizeof(depths) / sizeof(*depths);
+    int runs = ndepths * sizeof(fills) / sizeof(*fills);
+    int r, step, err = 0;
+    unsigned int seed = argc > 1 ? atoi(argv[1]) : 1234;
+
+    srand(seed);
+    for (r = 0; r < runs; r++) {
+        int fill = fills[r / ndepths], depth = depths[r % ndepths];
+        quicklist *ql = quicklistNew(fill, depth);
+        unsigned int compressed = 0, max_compressed = 0;
+        char *ref[2048];
+        long len = 0, j;
+
+        for (step = 0; step < 4000; step++) {
+            int op = rand() % 10;
+            char buf[64];
+            char *v;
+
+            if (rand() % 3 == 0)
+                snprintf(buf, sizeof(buf), "%d", rand() % 100000 - 50000);
+            else
+                snprintf(buf, sizeof(buf), "%.*s", rand() % 40 + 1,
+                         "abcdefghijklmnopqrstuvwxyz0123456789ABCDEFGH");
+            v = zstrdup(buf);
+
+            /* Grow the list most of the time so nodes fill up and split. */
+            if (op >= 7) op = rand() % 3;
+            if (len >= 2000 && op < 3) op = 3 + rand() % 4;
+            if (op == 0) {
+                quicklistPushHead(ql, v, strlen(v));
+                memmove(ref + 1, ref, len * sizeof(char *));
+                ref[0] = v;
+                len++;
+            } else if (op == 1) {
+                quicklistPushTail(ql, v, strlen(v));
+                ref[len++] = v;
+            } else if (op == 2 && len) {
+                quicklistEntry entry;
+                quicklistIter *iter;
+                long idx = rand() % len;
+                int after = rand() % 2;
+
+                iter = quicklistGetIteratorAtIdx(ql, AL_START_HEAD, idx);
+                quicklistNext(iter, &entry);
+                if (after) quicklistInsertAfter(iter, &entry, v, strlen(v));
+                else quicklistInsertBefore(iter, &entry, v, strlen(v));
+                quicklistReleaseIterator(iter);
+                if (after) idx++;
+                memmove(ref + idx + 1, ref + idx, (len - idx) * sizeof(char *));
+                ref[idx] = v;
+                len++;
+            } else if (op == 3 && len) {
+                unsigned char *data;
+                unsigned int sz;
+                long long lv;
+                int head = rand() % 2;
+
+                quicklistPop(ql, head ? QUICKLIST_HEAD : QUICKLIST_TAIL,
+                             &data, &sz, &lv);
+                zfree(data);
+                if (head) {
+                    zfree(ref[0]);
+                    memmove(ref, ref + 1, (len - 1) * sizeof(char *));
+                } else {
+                    zfree(ref[len - 1]);
+                }
+                len--;
+                zfree(v);
+            } else if (op == 4 && len) {
+                long start = rand() % len;
+                long count = rand() % 5 + 1;
+
+                if (start + count > len) count = len - start;
+                quicklistDelRange(ql, start, count);
+                for (j = start; j < start + count; j++) zfree(ref[j]);
+                memmove(ref + start, ref + start + count,
+                        (len - start - count) * sizeof(char *));
+                len -= count;
+                zfree(v);
+            } else if (op == 5 && len) {
+                long idx = rand() % len;
+
+                quicklistReplaceAtIndex(ql, idx, v, strlen(v));
+                zfree(ref[idx]);
+                ref[idx] = v;
+            } else if (op == 6 && len) {
+                /* Delete every entry of length 'dlen' while iterating. */
+                quicklistEntry entry;
+                quicklistIter *iter;
+                int head = rand() % 2;
+                unsigned int dlen = rand() % 3 + 1;
+                long k = 0;
+
+                iter = quicklistGetIterator(ql,
+                    head ? AL_START_HEAD : AL_START_TAIL);
+                while (quicklistNext(iter, &entry)) {
+                    unsigned int elen = entry.sz;
+                    if (!entry.value)
+                        elen = ll2string(buf, sizeof(buf), entry.longval);
+                    if (elen == dlen) quicklistDelEntry(iter, &entry);
+                }
+                quicklistReleaseIterator(iter);
+                for (j = 0; j < len; j++) {
+                    if (strlen(ref[j]) == dlen) zfree(ref[j]);
+                    else ref[k++] = ref[j];
+                }
+                len = k;
+                zfree(v);
+            } else {
+                zfree(v);
+            }
+            if (step % 97 == 0 || step == 3999) {
+                err += checkAgainst(ql, ref, len, &compressed);
+                if (compressed > max_compressed) max_compressed = compressed;
+            }
+            if (step == 2000) {
+                /* Exercise duplication of compressed lists too. */
+                quicklist *copy = quicklistDup(ql);
+                quicklistRelease(ql);
+                ql = copy;
+            }
+        }
+        /* With compression enabled, long lists must have LZF nodes
+         * (single entry nodes are too small to be worth compressing). */
+        if (depth && fill != 1 && ql->len > 16 && max_compressed == 0) err++;
+        printf("fill %d depth %d: %lu entries in %u nodes (up to %u "
+               "compressed), %d errors\n", fill, depth, ql->count, ql->len,
+               max_compressed, err);
+        for (j = 0; j < len; j++) zfree(ref[j]);
+        quicklistRelease(ql);
+    }
+    return err ? 1 : 0;
+}
+#endif
@@ -587,7 +587,53 @@ int qsortCompareSetsByRevCardinality(const void *s1, const void *s2) {
     return  (o2 ? setTypeSize(o2) : 0) - (o1 ? setTypeSize(o1) : 0);
 }
 
-void sinterGenericCommand(redisClient *c, robj **setkeys, unsigned long setnum, robj *dstkey) {
+/* Intersect sets that are all intset encoded. The sets must be sorted by
+ * cardinality, so that the intermediate results are as small as possible
+ * and the work stops as soon as one of them is empty. Returns a new intset
+ * with the result. */
+static intset *sinterIntsets(robj **sets, unsigned long setnum) {
+    intset *res, *tmp;
+    unsigned long j;
+
+    res = intsetIntersect(sets[0]->ptr,sets[setnum > 1 ? 1 : 0]->ptr);
+    for (j = 2; j < setnum && intsetLen(res); j++) {
+        tmp = intsetIntersect(res,sets[j]->ptr);
+        zfree(res);
+        res = tmp;
+    }
+    return res;
+}
+
+/* Return the cardinality of the intersection of sets that are all intset
+ * encoded, stopping as soon as it reaches 'limit' if not zero. Every element
+ * of the smallest set is searched in the other sets with intsetFindFrom(),
+ * keeping a cursor for each of them, so that no intermediate set is created
+ * and every set is visited only once. */
+static unsigned long sinterCardIntsets(robj **sets, unsigned long setnum, unsigned long limit) {
+    uint32_t *cursors = zcalloc(sizeof(uint32_t)*setnum);
+    intset *first = sets[0]->ptr;
+    uint32_t i, len = intsetLen(first);
+    unsigned long j, cardinality = 0;
+    int64_t value;
+
+    for (i = 0; i < len; i++) {
+        intsetGet(first,i,&value);
+        for (j = 1; j < setnum; j++) {
+            if (sets[j] == sets[0]) continue;
+            if (!intsetFindFrom(sets[j]->ptr,value,&cursors[j])) break;
+        }
+        if (j == setnum && ++cardinality == limit) break;
+    }
+    zfree(cursors);
+    return cardinality;
+}
+
+/* Implements SINTER, SINTERSTORE and SINTERCARD. When 'cardinality_only' is
+ * true only the size of the intersection is replied, and the search stops
+ * as soon as it reaches 'limit', unless it is zero. */
+void sinterGenericCommand(redisClient *c, robj **setkeys, unsigned long setnum,
+                          robj *dstkey, int cardinality_only, unsigned long limit)
+{
     robj **sets = zmalloc(sizeof(robj*)*setnum);
     setTypeIterator *si;
     robj *eleobj, *dstset = NULL;
@@ -608,6 +654,8 @@ void sinterGenericCommand(redisClient *c, robj **setkeys, unsigned long setnum,
                     server.dirty++;
                 }
                 addReply(c,shared.czero);
+            } else if (cardinality_only) {
+                addReply(c,shared.czero);
             } else {
                 addReply(c,shared.emptymultibulk);
             }
@@ -628,75 +676,101 @@ void sinterGenericCommand(redisClient *c, robj **setkeys, unsigned long setnum,
      * the intersection set size, so we use a trick, append an empty object
      * to the output list and save the pointer to later modify it with the
      * right length */
-    if (!dstkey) {
-        replylen = addDeferredMultiBulkLength(c);
-    } else {
+    if (dstkey) {
         /* If we have a target key where to store the resulting set
          * create this key with an empty set inside */
         dstset = createIntsetObject();
+    } else if (!cardinality_only) {
+        replylen = addDeferredMultiBulkLength(c);
     }
 
-    /* Iterate all the elements of the first (smallest) set, and test
-     * the element against all the other sets, if at least one set does
-     * not include the element it is discarded */
-    si = setTypeInitIterator(sets[0]);
-    while((encoding = setTypeNext(si,&eleobj,&intobj)) != -1) {
-        for (j = 1; j < setnum; j++) {
-            if (sets[j] == sets[0]) continue;
-            if (encoding == REDIS_ENCODING_INTSET) {
-                /* intset with intset is simple... and fast */
-                if (sets[j]->encoding == REDIS_ENCODING_INTSET &&
-                    !intsetFind((intset*)sets[j]->ptr,intobj))
-                {
-                    break;
-                /* in order to compare an integer with an object we
-                 * have to use the generic function, creating an object
-                 * for this */
-                } else if (sets[j]->encoding == REDIS_ENCODING_HT) {
-                    eleobj = createStringObjectFromLongLong(intobj);
-                    if (!setTypeIsMember(sets[j],eleobj)) {
+    /* When all the sets are intsets the intersection is computed on their
+     * sorted arrays, see sinterIntsets(). */
+    for (j = 0; j < setnum; j++)
+        if (sets[j]->encoding != REDIS_ENCODING_INTSET) break;
+    if (j == setnum && cardinality_only) {
+        cardinality = sinterCardIntsets(sets,setnum,limit);
+    } else if (j == setnum) {
+        intset *is = sinterIntsets(sets,setnum);
+
+        if (!dstkey) {
+            cardinality = intsetLen(is);
+            for (j = 0; j < cardinality; j++) {
+                intsetGet(is,j,&intobj);
+                addReplyBulkLongLong(c,intobj);
+            }
+            zfree(is);
+        } else {
+            zfree(dstset->ptr);
+            dstset->ptr = is;
+        }
+    } else {
+        /* Iterate all the elements of the first (smallest) set, and test
+         * the element against all the other sets, if at least one set does
+         * not include the element it is discarded */
+        si = setTypeInitIterator(sets[0]);
+        while((encoding = setTypeNext(si,&eleobj,&intobj)) != -1) {
+            for (j = 1; j < setnum; j++) {
+                if (sets[j] == sets[0]) continue;
+                if (encoding == REDIS_ENCODING_INTSET) {
+                    /* intset with intset is simple... and fast */
+                    if (sets[j]->encoding == REDIS_ENCODING_INTSET &&
+                        !intsetFind((intset*)sets[j]->ptr,intobj))
+                    {
+                        break;
+                    /* in order to compare an integer with an object we
+                     * have to use the generic function, creating an object
+                     * for this */
+                    } else if (sets[j]->encoding == REDIS_ENCODING_HT) {
+                        eleobj = createStringObjectFromLongLong(intobj);
+                        if (!setTypeIsMember(sets[j],eleobj)) {
+                            decrRefCount(eleobj);
+                            break;
+                        }
                         decrRefCount(eleobj);
+                    }
+                } else if (encoding == REDIS_ENCODING_HT) {
+                    /* Optimization... if the source object is integer
+                     * encoded AND the target set is an intset, we can get
+                     * a much faster path. */
+                    if (eleobj->encoding == REDIS_ENCODING_INT &&
+                        sets[j]->encoding == REDIS_ENCODING_INTSET &&
+                        !intsetFind((intset*)sets[j]->ptr,(long)eleobj->ptr))
+                    {
+                        break;
+                    /* else... object to object check is easy as we use the
+                     * type agnostic API here. */
+                    } else if (!setTypeIsMember(sets[j],eleobj)) {
                         break;
                     }
-                    decrRefCount(eleobj);
-                }
-            } else if (encoding == REDIS_ENCODING_HT) {
-                /* Optimization... if the source object is integer
-                 * encoded AND the target set is an intset, we can get
-                 * a much faster path. */
-                if (eleobj->encoding == REDIS_ENCODING_INT &&
-                    sets[j]->encoding == REDIS_ENCODING_INTSET &&
-                    !intsetFind((intset*)sets[j]->ptr,(long)eleobj->ptr))
-                {
-                    break;
-                /* else... object to object check is easy as we use the
-                 * type agnostic API here. */
-                } else if (!setTypeIsMember(sets[j],eleobj)) {
-                    break;
                 }
             }
-        }
 
-        /* Only take action when all sets contain the member */
-        if (j == setnum) {
-            if (!dstkey) {
-                if (encoding == REDIS_ENCODING_HT)
-                    addReplyBulk(c,eleobj);
-                else
-                    addReplyBulkLongLong(c,intobj);
-                cardinality++;
-            } else {
-                if (encoding == REDIS_ENCODING_INTSET) {
-                    eleobj = createStringObjectFromLongLong(intobj);
-                    setTypeAdd(dstset,eleobj);
-                    decrRefCount(eleobj);
+            /* Only take action when all sets contain the member */
+            if (j == setnum) {
+                if (cardinality_only) {
+                    cardinality++;
+                    /* Stop the search once the limit is reached. */
+                    if (limit && cardinality >= limit) break;
+                } else if (!dstkey) {
+                    if (encoding == REDIS_ENCODING_HT)
+                        addReplyBulk(c,eleobj);
+                    else
+                        addReplyBulkLongLong(c,intobj);
+                    cardinality++;
                 } else {
-                    setTypeAdd(dstset,eleobj);
+                    if (encoding == REDIS_ENCODING_INTSET) {
+                        eleobj = createStringObjectFromLongLong(intobj);
+                        setTypeAdd(dstset,eleobj);
+                        decrRefCount(eleobj);
+                    } else {
+                        setTypeAdd(dstset,eleobj);
+                    }
                 }
             }
         }
+        setTypeReleaseIterator(si);
     }
-    setTypeReleaseIterator(si);
 
     if (dstkey) {
         /* Store the resulting set into the target, if the intersection
@@ -716,6 +790,8 @@ void sinterGenericCommand(redisClient *c, robj **setkeys, unsigned long setnum,
         }
         signalModifiedKey(c->db,dstkey);
         server.dirty++;
+    } else if (cardinality_only) {
+        addReplyLongLong(c,cardinality);
     } else {
         setDeferredMultiBulkLength(c,replylen,cardinality);
     }
@@ -723,17 +799,79 @@ void sinterGenericCommand(redisClient *c, robj **setkeys, unsigned long setnum,
 }
 
 void sinterCommand(redisClient *c) {
-    sinterGenericCommand(c,c->argv+1,c->argc-1,NULL);
+    sinterGenericCommand(c,c->argv+1,c->argc-1,NULL,0,0);
 }
 
 void sinterstoreCommand(redisClient *c) {
-    sinterGenericCommand(c,c->argv+2,c->argc-2,c->argv[1]);
+    sinterGenericCommand(c,c->argv+2,c->argc-2,c->argv[1],0,0);
+}
+
+/* SINTERCARD numkeys key [key ...] [LIMIT limit] */
+void sintercardCommand(redisClient *c) {
+    long j, numkeys, limit = 0;
+
+    if (getLongFromObjectOrReply(c,c->argv[1],&numkeys,NULL) != REDIS_OK)
+        return;
+    if (numkeys < 1) {
+        addReplyError(c,"numkeys should be greater than 0");
+        return;
+    }
+    if (numkeys > c->argc-2) {
+        addReplyError(c,"Number of keys can't be greater than number of args");
+        return;
+    }
+
+    for (j = 2+numkeys; j < c->argc; j++) {
+        int moreargs = (c->argc-1)-j;
+
+        if (!strcasecmp(c->argv[j]->ptr,"limit") && moreargs) {
+            j++;
+            if (getLongFromObjectOrReply(c,c->argv[j],&limit,NULL) != REDIS_OK)
+                return;
+            if (limit < 0) {
+                addReplyError(c,"LIMIT can't be negative");
+                return;
+            }
+        } else {
+            addReply(c,shared.syntaxerr);
+            return;
+        }
+    }
+    sinterGenericCommand(c,c->argv+2,numkeys,NULL,1,limit);
 }
 
 #define REDIS_OP_UNION 0
 #define REDIS_OP_DIFF 1
 #define REDIS_OP_INTER 2
 
+/* Union or difference of sets that are all intset encoded, or missing. The
+ * result is a new intset: for the union it may need to be converted to a hash
+ * table if it gets bigger than set-max-intset-entries. */
+static intset *sunionDiffIntsets(robj **sets, int setnum, int op) {
+    intset *res, *tmp;
+    int j;
+
+    if (op == REDIS_OP_DIFF) {
+        if (!sets[0]) return intsetNew();
+        res = intsetDup(sets[0]->ptr);
+        for (j = 1; j < setnum && intsetLen(res); j++) {
+            if (!sets[j]) continue;
+            tmp = intsetDifference(res,sets[j]->ptr);
+            zfree(res);
+            res = tmp;
+        }
+    } else {
+        res = intsetNew();
+        for (j = 0; j < setnum; j++) {
+            if (!sets[j]) continue;
+            tmp = intsetUnion(res,sets[j]->ptr);
+            zfree(res);
+            res = tmp;
+        }
+    }
+    return res;
+}
+
 void sunionDiffGenericCommand(redisClient *c, robj **setkeys, int setnum, robj *dstkey, int op) {
     robj **sets = zmalloc(sizeof(robj*)*setnum);
     setTypeIterator *si;
@@ -794,7 +932,18 @@ void sunionDiffGenericCommand(redisClient *c, robj **setkeys, int setnum, robj *
      * this set object will be the resulting object to set into the target key*/
     dstset = createIntsetObject();
 
-    if (op == REDIS_OP_UNION) {
+    /* When all the sets are intsets the result is computed merging their
+     * sorted arrays, see sunionDiffIntsets(). */
+    for (j = 0; j < setnum; j++)
+        if (sets[j] && sets[j]->encoding != REDIS_ENCODING_INTSET) break;
+
+    if (j == setnum) {
+        zfree(dstset->ptr);
+        dstset->ptr = sunionDiffIntsets(sets,setnum,op);
+        cardinality = intsetLen(dstset->ptr);
+        if ((size_t)cardinality > server.set_max_intset_entries)
+            setTypeConvert(dstset,REDIS_ENCODING_HT);
+    } else if (op == REDIS_OP_UNION) {
         /* Union is trivial, just add every element of every set to the
          * temporary set. */
         for (j = 0; j < setnum; j++) {
@@ -38,7 +38,9 @@
  *
  * The elements are added to a hash table mapping Redis objects to scores.
  * At the same time the elements are added to a skip list mapping scores
- * to Redis objects (so objects are sorted by scores in this "view"). */
+ * to Redis objects (so objects are sorted by scores in this "view").
+ * Alternatively the skip list can be replaced by a B+tree, see the
+ * "B+tree sorted set index" section below. */
 
 /* This skiplist implementation is almost a C translation of the original
  * algorithm described by William Pugh in "Skip Lists: A Probabilistic
@@ -163,6 +165,46 @@ zskiplistNode *zslInsert(zskiplist *zsl, double score, robj *obj) {
     return x;
 }
 
+/* Create a skiplist holding the 'len' elements of 'ele', that must be already
+ * sorted by score and then lexicographically, without duplicates. Nodes are
+ * appended at the tail, so unlike repeated zslInsert() calls no search is
+ * needed and the whole list is built in O(N). The references to the
+ * elements are taken over by the skiplist. */
+zskiplist *zslCreateFromSorted(zsetEntry *ele, unsigned long len) {
+    zskiplist *zsl = zslCreate();
+    zskiplistNode *last[ZSKIPLIST_MAXLEVEL], *x;
+    unsigned long rank[ZSKIPLIST_MAXLEVEL], j;
+    int i, level;
+
+    /* last[i] is the last node at level i, and rank[i] its rank. */
+    for (i = 0; i < ZSKIPLIST_MAXLEVEL; i++) {
+        last[i] = zsl->header;
+        rank[i] = 0;
+    }
+    for (j = 0; j < len; j++) {
+        redisAssert(!isnan(ele[j].score));
+        level = zslRandomLevel();
+        if (level > zsl->level) zsl->level = level;
+        x = zslCreateNode(level,ele[j].score,ele[j].obj);
+        x->backward = j ? last[0] : NULL;
+        for (i = 0; i < level; i++) {
+            last[i]->level[i].forward = x;
+            last[i]->level[i].span = (j+1) - rank[i];
+            last[i] = x;
+            rank[i] = j+1;
+        }
+    }
+
+    /* The last node of every level spans up to the end of the list. */
+    for (i = 0; i < zsl->level; i++) {
+        last[i]->level[i].forward = NULL;
+        last[i]->level[i].span = len - rank[i];
+    }
+    zsl->tail = len ? last[0] : NULL;
+    zsl->length = len;
+    return zsl;
+}
+
 /* Internal function used by zslDelete, zslDeleteByScore and zslDeleteByRank */
 void zslDeleteNode(zskiplist *zsl, zskiplistNode *x, zskiplistNode **update) {
     int i;
@@ -629,7 +671,789 @@ zskiplistNode *zslLastInLexRange(zskiplist *zsl, zlexrangespec *range) {
 }
 
 /*-----------------------------------------------------------------------------
- * Ziplist-backed sorted set API
+ * B+tree sorted set index
+ *----------------------------------------------------------------------------*/
+
+/* The B+tree is an alternative to the skiplist to index big sorted sets,
+ * selected with the zset-use-btree option. Elements are ordered exactly
+ * like in the skiplist, by score and then lexicographically, and every
+ * operation is still O(log(N)). However many elements share the same node,
+ * so the index uses a fraction of the memory of the skiplist nodes, and a
+ * lookup misses the cache about once per tree level instead of once per
+ * skiplist hop.
+ *
+ * Ranks passed to and returned by this API are 1-based like the skiplist
+ * ones. Level 0 of the tree is the leaves level. */
+
+#define ZBTREE_LEAF_SIZE offsetof(zbtreeNode,size)
+
+static zbtreeNode *zbtCreateNode(int leaf) {
+    zbtreeNode *n = zmalloc(leaf ? ZBTREE_LEAF_SIZE : sizeof(zbtreeNode));
+    n->prev = n->next = NULL;
+    n->count = 0;
+    return n;
+}
+
+zbtree *zbtCreate(void) {
+    zbtree *zbt = zmalloc(sizeof(*zbt));
+
+    zbt->root = zbt->head = zbt->tail = zbtCreateNode(1);
+    zbt->length = 0;
+    zbt->height = 1;
+    return zbt;
+}
+
+/* Free the subtree rooted at 'n', found at the specified level. */
+static void zbtFreeNode(zbtreeNode *n, int level) {
+    unsigned int j;
+
+    for (j = 0; j < n->count; j++) {
+        if (level == 0) {
+            decrRefCount(n->obj[j]);
+        } else {
+            if (j) decrRefCount(n->obj[j]); /* Slot 0 has no separator. */
+            zbtFreeNode(n->child[j],level-1);
+        }
+    }
+    zfree(n);
+}
+
+void zbtFree(zbtree *zbt) {
+    zbtFreeNode(zbt->root,zbt->height-1);
+    zfree(zbt);
+}
+
+/* Compare the element or separator at slot 'j' of 'n' with score/obj.
+ * Returns a value <0, 0 or >0 when the slot is smaller, equal or greater. */
+static int zbtCompare(zbtreeNode *n, unsigned int j, double score, robj *obj) {
+    if (n->score[j] < score) return -1;
+    if (n->score[j] > score) return 1;
+    return compareStringObjects(n->obj[j],obj);
+}
+
+/* Return the child of the inner node 'n' that covers score/obj, that is the
+ * last one whose separator is smaller or equal to the element. */
+static unsigned int zbtChildIndex(zbtreeNode *n, double score, robj *obj) {
+    unsigned int lo = 1, hi = n->count, mid;
+
+    while (lo < hi) {
+        mid = (lo+hi)/2;
+        if (zbtCompare(n,mid,score,obj) <= 0)
+            lo = mid+1;
+        else
+            hi = mid;
+    }
+    return lo-1;
+}
+
+/* Return the slot of the first element of the leaf 'n' that is greater or
+ * equal to score/obj, or n->count if there is none. */
+static unsigned int zbtLeafIndex(zbtreeNode *n, double score, robj *obj) {
+    unsigned int lo = 0, hi = n->count, mid;
+
+    while (lo < hi) {
+        mid = (lo+hi)/2;
+        if (zbtCompare(n,mid,score,obj) < 0)
+            lo = mid+1;
+        else
+            hi = mid;
+    }
+    return lo;
+}
+
+/* Copy 'len' slots of 'src' starting at 'srcpos' to 'dst' at 'dstpos'. */
+static void zbtCopySlots(zbtreeNode *dst, unsigned int dstpos,
+                         zbtreeNode *src, unsigned int srcpos,
+                         unsigned int len, int leaf)
+{
+    memcpy(dst->score+dstpos,src->score+srcpos,len*sizeof(double));
+    memcpy(dst->obj+dstpos,src->obj+srcpos,len*sizeof(robj*));
+    if (!leaf) {
+        memcpy(dst->size+dstpos,src->size+srcpos,len*sizeof(unsigned long));
+        memcpy(dst->child+dstpos,src->child+srcpos,len*sizeof(zbtreeNode*));
+    }
+}
+
+/* Make room for 'len' slots at 'j' in the node 'n', shifting the following
+ * slots. The caller must make sure the node has enough free slots. */
+static void zbtOpenSlots(zbtreeNode *n, int leaf, unsigned int j, unsigned int len) {
+    unsigned int tail = n->count-j;
+
+    memmove(n->score+j+len,n->score+j,tail*sizeof(double));
+    memmove(n->obj+j+len,n->obj+j,tail*sizeof(robj*));
+    if (!leaf) {
+        memmove(n->size+j+len,n->size+j,tail*sizeof(unsigned long));
+        memmove(n->child+j+len,n->child+j,tail*sizeof(zbtreeNode*));
+    }
+    n->count += len;
+}
+
+/* Remove 'len' slots at 'j' from the node 'n'. The references owned by the
+ * removed slots are not released. */
+static void zbtCloseSlots(zbtreeNode *n, int leaf, unsigned int j, unsigned int len) {
+    unsigned int tail = n->count-j-len;
+
+    memmove(n->score+j,n->score+j+len,tail*sizeof(double));
+    memmove(n->obj+j,n->obj+j+len,tail*sizeof(robj*));
+    if (!leaf) {
+        memmove(n->size+j,n->size+j+len,tail*sizeof(unsigned long));
+        memmove(n->child+j,n->child+j+len,tail*sizeof(zbtreeNode*));
+    }
+    n->count -= len;
+}
+
+/* Return the number of elements below 'len' slots of 'n' starting at 'j'. */
+static unsigned long zbtSlotsSize(zbtreeNode *n, int leaf, unsigned int j, unsigned int len) {
+    unsigned long size = 0;
+
+    if (leaf) return len;
+    while (len--) size += n->size[j++];
+    return size;
+}
+
+/* Move the upper half of the node 'n' into a new node, that is returned. */
+static zbtreeNode *zbtSplitNode(zbtree *zbt, zbtreeNode *n, int leaf) {
+    zbtreeNode *right = zbtCreateNode(leaf);
+    unsigned int half = n->count/2;
+
+    zbtCopySlots(right,0,n,half,n->count-half,leaf);
+    right->count = n->count-half;
+    n->count = half;
+    if (leaf) {
+        right->prev = n;
+        right->next = n->next;
+        if (n->next)
+            n->next->prev = right;
+        else
+            zbt->tail = right;
+        n->next = right;
+    }
+    return right;
+}
+
+/* Insert a new element. Like zslInsert() the caller must make sure the
+ * element is not already inside, and the reference to 'obj' is taken over
+ * by the tree. */
+void zbtInsert(zbtree *zbt, double score, robj *obj) {
+    zbtreeNode *path[ZBTREE_MAXHEIGHT], *x, *dst, *right, *parent;
+    unsigned int slot[ZBTREE_MAXHEIGHT], j;
+    int level;
+
+    redisAssert(!isnan(score));
+
+    /* Descend to the leaf, accounting for the new element on the way. */
+    x = zbt->root;
+    for (level = zbt->height-1; level > 0; level--) {
+        j = zbtChildIndex(x,score,obj);
+        path[level] = x;
+        slot[level] = j;
+        x->size[j]++;
+        x = x->child[j];
+    }
+    zbt->length++;
+
+    /* Split the leaf if it is full, and insert in the right half. */
+    j = zbtLeafIndex(x,score,obj);
+    dst = x;
+    right = NULL;
+    if (x->count == ZBTREE_FANOUT) {
+        right = zbtSplitNode(zbt,x,1);
+        if (j >= x->count) {
+            dst = right;
+            j -= x->count;
+        }
+    }
+    zbtOpenSlots(dst,1,j,1);
+    dst->score[j] = score;
+    dst->obj[j] = obj;
+
+    /* Every split adds a child to the parent of the split node, right after
+     * it, which may in turn need to be split. The first slot of the new
+     * node provides the separator: leaves keep their element and the
+     * separator takes a new reference, inner nodes hand it over since
+     * their slot 0 is unused. */
+    for (level = 1; right != NULL; level++) {
+        zbtreeNode *child = right;
+        double sepscore = child->score[0];
+        robj *sepobj = child->obj[0];
+        unsigned long xsize = zbtSlotsSize(x,level == 1,0,x->count);
+        unsigned long rsize = zbtSlotsSize(child,level == 1,0,child->count);
+
+        if (level == 1)
+            incrRefCount(sepobj);
+        else
+            child->obj[0] = NULL;
+
+        if (level == zbt->height) {
+            /* The root itself was split: grow the tree by one level. */
+            parent = zbtCreateNode(0);
+            parent->count = 2;
+            parent->score[0] = 0;
+            parent->obj[0] = NULL;
+            parent->size[0] = xsize;
+            parent->child[0] = x;
+            parent->score[1] = sepscore;
+            parent->obj[1] = sepobj;
+            parent->size[1] = rsize;
+            parent->child[1] = child;
+            zbt->root = parent;
+            zbt->height++;
+            break;
+        }
+
+        parent = path[level];
+        j = slot[level];
+        parent->size[j] = xsize;
+        j++;
+        dst = parent;
+        right = NULL;
+        if (parent->count == ZBTREE_FANOUT) {
+            right = zbtSplitNode(zbt,parent,0);
+            if (j >= parent->count) {
+                dst = right;
+                j -= parent->count;
+            }
+        }
+        zbtOpenSlots(dst,0,j,1);
+        dst->score[j] = sepscore;
+        dst->obj[j] = sepobj;
+        dst->size[j] = rsize;
+        dst->child[j] = child;
+        x = parent;
+    }
+}
+
+/* Create a B+tree holding the 'len' elements of 'ele', that must be already
+ * sorted by score and then lexicographically, without duplicates. The tree
+ * is built bottom up one level at a time, spreading the slots evenly among
+ * the nodes of every level, so that all the nodes but the root are at least
+ * half full. The references to the elements are taken over by the tree. */
+zbtree *zbtCreateFromSorted(zsetEntry *ele, unsigned long len) {
+    zbtree *zbt;
+    zbtreeNode **nodes, *n, *prev = NULL;
+    unsigned long *first, count, parents, i, j, k;
+
+    if (len == 0) return zbtCreate();
+    zbt = zmalloc(sizeof(*zbt));
+    zbt->length = len;
+    zbt->height = 1;
+
+    /* nodes[] holds the nodes of the level being built, and first[] the
+     * index in 'ele' of the first element found below every node. */
+    count = (len+ZBTREE_FANOUT-1)/ZBTREE_FANOUT;
+    nodes = zmalloc(sizeof(zbtreeNode*)*count);
+    first = zmalloc(sizeof(unsigned long)*(count+1));
+    for (i = 0, k = 0; i < count; i++) {
+        n = zbtCreateNode(1);
+        n->count = len/count + (i < len%count);
+        first[i] = k;
+        for (j = 0; j < n->count; j++, k++) {
+            redisAssert(!isnan(ele[k].score));
+            n->score[j] = ele[k].score;
+            n->obj[j] = ele[k].obj;
+        }
+        n->prev = prev;
+        if (prev) prev->next = n;
+        prev = n;
+        nodes[i] = n;
+    }
+    first[count] = len;
+    zbt->head = nodes[0];
+    zbt->tail = nodes[count-1];
+
+    /* Every child but the first of an inner node needs a separator, that is
+     * a new reference to the first element below it. The arrays are reused
+     * in place, as parent 'i' is stored only after reading its children,
+     * found at index 'i' or after. */
+    while (count > 1) {
+        parents = (count+ZBTREE_FANOUT-1)/ZBTREE_FANOUT;
+        for (i = 0, k = 0; i < parents; i++) {
+            n = zbtCreateNode(0);
+            n->count = count/parents + (i < count%parents);
+            n->score[0] = 0;
+            n->obj[0] = NULL;
+            for (j = 0; j < n->count; j++, k++) {
+                if (j) {
+                    n->score[j] = ele[first[k]].score;
+                    n->obj[j] = ele[first[k]].obj;
+                    incrRefCount(n->obj[j]);
+                }
+                n->size[j] = first[k+1]-first[k];
+                n->child[j] = nodes[k];
+            }
+            first[i] = first[k-n->count];
+            nodes[i] = n;
+        }
+        first[parents] = len;
+        count = parents;
+        zbt->height++;
+    }
+    zbt->root = nodes[0];
+    zfree(nodes);
+    zfree(first);
+    return zbt;
+}
+
+/* Merge the child j+1 of the inner node 'parent' into the child j. */
+static void zbtMergeNodes(zbtree *zbt, zbtreeNode *parent, unsigned int j, int leaf) {
+    zbtreeNode *l = parent->child[j], *r = parent->child[j+1];
+
+    if (leaf) {
+        decrRefCount(parent->obj[j+1]);
+        l->next = r->next;
+        if (r->next)
+            r->next->prev = l;
+        else
+            zbt->tail = l;
+    } else {
+        /* The separator now separates the last child of 'l' from the
+         * first child of 'r'. */
+        r->score[0] = parent->score[j+1];
+        r->obj[0] = parent->obj[j+1];
+    }
+    zbtCopySlots(l,l->count,r,0,r->count,leaf);
+    l->count += r->count;
+    parent->size[j] += parent->size[j+1];
+    zbtCloseSlots(parent,0,j+1,1);
+    zfree(r);
+}
+
+/* Move slots between the children j and j+1 of the inner node 'parent' so
+ * that they end with the same number of slots. */
+static void zbtBalanceNodes(zbtreeNode *parent, unsigned int j, int leaf) {
+    zbtreeNode *l = parent->child[j], *r = parent->child[j+1];
+    unsigned int want = (l->count+r->count)/2, len;
+    unsigned long moved;
+    robj *oldsep = parent->obj[j+1];
+
+    /* In inner nodes the separator goes down to the unused slot 0 of 'r',
+     * so that every slot that moves carries its own separator. */
+    if (!leaf) {
+        r->score[0] = parent->score[j+1];
+        r->obj[0] = parent->obj[j+1];
+    }
+
+    if (l->count < want) {
+        /* Move the first slots of 'r' at the end of 'l'. */
+        len = want-l->count;
+        moved = zbtSlotsSize(r,leaf,0,len);
+        zbtCopySlots(l,l->count,r,0,len,leaf);
+        l->count += len;
+        zbtCloseSlots(r,leaf,0,len);
+        parent->size[j] += moved;
+        parent->size[j+1] -= moved;
+    } else {
+        /* Move the last slots of 'l' in front of 'r'. */
+        len = l->count-want;
+        moved = zbtSlotsSize(l,leaf,l->count-len,len);
+        zbtOpenSlots(r,leaf,0,len);
+        zbtCopySlots(r,0,l,l->count-len,len,leaf);
+        l->count -= len;
+        parent->size[j] -= moved;
+        parent->size[j+1] += moved;
+    }
+
+    /* The new first slot of 'r' provides the separator. */
+    parent->score[j+1] = r->score[0];
+    parent->obj[j+1] = r->obj[0];
+    if (leaf) {
+        incrRefCount(r->obj[0]);
+        decrRefCount(oldsep);
+    } else {
+        r->obj[0] = NULL;
+    }
+}
+
+/* Fix the tree after slots were removed from the leaf 'x'. Nodes with less
+ * than ZBTREE_MIN_FILL slots are merged with a sibling, or take slots from
+ * it when both don't fit a single node, and merges may propagate up to the
+ * root. 'path' and 'slot' are the inner nodes crossed to reach 'x' and the
+ * child followed in each of them. */
+static void zbtRebalance(zbtree *zbt, zbtreeNode **path, unsigned int *slot,
+                         zbtreeNode *x)
+{
+    zbtreeNode *parent;
+    unsigned int j;
+    int level;
+
+    for (level = 0; level < zbt->height-1; level++) {
+        if (x->count >= ZBTREE_MIN_FILL) return;
+
+        /* Pair the node with its left sibling if any, or the right one. */
+        parent = path[level+1];
+        j = slot[level+1];
+        if (j > 0) j--;
+        if (parent->child[j]->count+parent->child[j+1]->count <= ZBTREE_FANOUT) {
+            zbtMergeNodes(zbt,parent,j,level == 0);
+        } else {
+            zbtBalanceNodes(parent,j,level == 0);
+            return;
+        }
+        x = parent;
+    }
+
+    /* Drop the root when it is an inner node left with a single child. */
+    if (zbt->height > 1 && x->count == 1) {
+        zbt->root = x->child[0];
+        zbt->height--;
+        zfree(x);
+    }
+}
+
+/* Remove 'len' elements starting at slot 'j' of the leaf 'x', reached via
+ * 'path' and 'slot', see zbtRebalance(). When 'dict' is not NULL the
+ * elements are removed from it as well. */
+static void zbtRemoveFromLeaf(zbtree *zbt, zbtreeNode **path, unsigned int *slot,
+                              zbtreeNode *x, unsigned int j, unsigned int len,
+                              dict *dict)
+{
+    unsigned int k;
+    int level;
+
+    for (k = j; k < j+len; k++) {
+        if (dict) dictDelete(dict,x->obj[k]);
+        decrRefCount(x->obj[k]);
+    }
+    zbtCloseSlots(x,1,j,len);
+    for (level = 1; level < zbt->height; level++)
+        path[level]->size[slot[level]] -= len;
+    zbt->length -= len;
+    zbtRebalance(zbt,path,slot,x);
+}
+
+/* Delete an element with matching score/object from the tree.
+ * Returns 1 if the element was found and deleted, 0 otherwise. */
+int zbtDelete(zbtree *zbt, double score, robj *obj) {
+    zbtreeNode *path[ZBTREE_MAXHEIGHT], *x;
+    unsigned int slot[ZBTREE_MAXHEIGHT], j;
+    int level;
+
+    x = zbt->root;
+    for (level = zbt->height-1; level > 0; level--) {
+        j = zbtChildIndex(x,score,obj);
+        path[level] = x;
+        slot[level] = j;
+        x = x->child[j];
+    }
+    j = zbtLeafIndex(x,score,obj);
+    if (j == x->count || zbtCompare(x,j,score,obj) != 0) return 0;
+    zbtRemoveFromLeaf(zbt,path,slot,x,j,1,NULL);
+    return 1;
+}
+
+/* Descend to the element with the 0-based rank 'rank', that must exist.
+ * Returns its leaf and sets its slot in '*idx'. When 'path' is not NULL, it
+ * is filled with the inner nodes crossed, and 'slot' with the children
+ * followed. */
+static zbtreeNode *zbtSeekRank(zbtree *zbt, unsigned long rank,
+                               zbtreeNode **path, unsigned int *slot,
+                               unsigned int *idx)
+{
+    zbtreeNode *x = zbt->root;
+    unsigned int j;
+    int level;
+
+    for (level = zbt->height-1; level > 0; level--) {
+        for (j = 0; rank >= x->size[j]; j++) rank -= x->size[j];
+        if (path) {
+            path[level] = x;
+            slot[level] = j;
+        }
+        x = x->child[j];
+    }
+    *idx = rank;
+    return x;
+}
+
+/* Find the rank for an element by both score and key.
+ * Returns 0 when the element cannot be found, rank otherwise.
+ * Note that the rank is 1-based. */
+unsigned long zbtGetRank(zbtree *zbt, double score, robj *obj) {
+    zbtreeNode *x = zbt->root;
+    unsigned long rank = 0;
+    unsigned int j, k;
+    int level;
+
+    for (level = zbt->height-1; level > 0; level--) {
+        j = zbtChildIndex(x,score,obj);
+        for (k = 0; k < j; k++) rank += x->size[k];
+        x = x->child[j];
+    }
+    j = zbtLeafIndex(x,score,obj);
+    if (j == x->count || zbtCompare(x,j,score,obj) != 0) return 0;
+    return rank+j+1;
+}
+
+/* Set 'pos' to the element at the 1-based 'rank'. Returns 0 when the rank
+ * is out of range. */
+int zbtGetElementByRank(zbtree *zbt, unsigned long rank, zbtreePos *pos) {
+    if (rank == 0 || rank > zbt->length) return 0;
+    pos->node = zbtSeekRank(zbt,rank-1,NULL,NULL,&pos->idx);
+    return 1;
+}
+
+int zbtFirst(zbtree *zbt, zbtreePos *pos) {
+    if (zbt->length == 0) return 0;
+    pos->node = zbt->head;
+    pos->idx = 0;
+    return 1;
+}
+
+int zbtLast(zbtree *zbt, zbtreePos *pos) {
+    if (zbt->length == 0) return 0;
+    pos->node = zbt->tail;
+    pos->idx = zbt->tail->count-1;
+    return 1;
+}
+
+/* Move 'pos' to the next element. Returns 0 when there is none. */
+int zbtNext(zbtreePos *pos) {
+    if (++pos->idx < pos->node->count) return 1;
+    pos->node = pos->node->next;
+    pos->idx = 0;
+    return pos->node != NULL;
+}
+
+/* Move 'pos' to the previous element. Returns 0 when there is none. */
+int zbtPrev(zbtreePos *pos) {
+    if (pos->idx > 0) {
+        pos->idx--;
+        return 1;
+    }
+    pos->node = pos->node->prev;
+    if (pos->node == NULL) return 0;
+    pos->idx = pos->node->count-1;
+    return 1;
+}
+
+/* Move 'pos' 'n' elements forward, or backward when 'reverse' is true,
+ * crossing whole leaves at once. Returns 0 when moving past the end. */
+int zbtSkip(zbtreePos *pos, unsigned long n, int reverse) {
+    if (reverse) {
+        while (n > pos->idx) {
+            n -= pos->idx+1;
+            pos->node = pos->node->prev;
+            if (pos->node == NULL) return 0;
+            pos->idx = pos->node->count-1;
+        }
+        pos->idx -= n;
+    } else {
+        while (n >= pos->node->count-pos->idx) {
+            n -= pos->node->count-pos->idx;
+            pos->node = pos->node->next;
+            pos->idx = 0;
+            if (pos->node == NULL) return 0;
+        }
+        pos->idx += n;
+    }
+    return 1;
+}
+
+/* Range checks used to seek the tree, see zbtSeekFirst(). */
+typedef int (*zbtRangeCheck)(double score, robj *obj, void *range);
+
+static int zbtScoreGteMin(double score, robj *obj, void *range) {
+    REDIS_NOTUSED(obj);
+    return zslValueGteMin(score,range);
+}
+
+static int zbtScoreLteMax(double score, robj *obj, void *range) {
+    REDIS_NOTUSED(obj);
+    return zslValueLteMax(score,range);
+}
+
+static int zbtLexGteMin(double score, robj *obj, void *range) {
+    REDIS_NOTUSED(score);
+    return zslLexValueGteMin(obj,range);
+}
+
+static int zbtLexLteMax(double score, robj *obj, void *range) {
+    REDIS_NOTUSED(score);
+    return zslLexValueLteMax(obj,range);
+}
+
+/* Find the first element for which 'gte' is true, where 'gte' is false for
+ * some elements at the start of the tree and true for all the others.
+ * Returns 0 when there is no such element, otherwise 1, setting 'pos' and
+ * the 1-based 'rank' when they are not NULL. */
+static int zbtSeekFirst(zbtree *zbt, zbtRangeCheck gte, void *range,
+                        zbtreePos *pos, unsigned long *rank)
+{
+    zbtreeNode *x = zbt->root;
+    unsigned long traversed = 0;
+    unsigned int lo, hi, mid, j;
+    int level;
+
+    for (level = zbt->height-1; level > 0; level--) {
+        /* Follow the last child whose separator is before the range. */
+        lo = 1; hi = x->count;
+        while (lo < hi) {
+            mid = (lo+hi)/2;
+            if (!gte(x->score[mid],x->obj[mid],range))
+                lo = mid+1;
+            else
+                hi = mid;
+        }
+        for (j = 0; j < lo-1; j++) traversed += x->size[j];
+        x = x->child[lo-1];
+    }
+
+    lo = 0; hi = x->count;
+    while (lo < hi) {
+        mid = (lo+hi)/2;
+        if (!gte(x->score[mid],x->obj[mid],range))
+            lo = mid+1;
+        else
+            hi = mid;
+    }
+    traversed += lo;
+
+    /* When the whole leaf is before the range, the element we are looking
+     * for is the first of the next leaf: it comes after the separator that
+     * stopped the descent, that was not before the range. */
+    if (lo == x->count) {
+        x = x->next;
+        lo = 0;
+        if (x == NULL) return 0;
+    }
+    if (pos) {
+        pos->node = x;
+        pos->idx = lo;
+    }
+    if (rank) *rank = traversed+1;
+    return 1;
+}
+
+/* Find the last element for which 'lte' is true, where 'lte' is true for
+ * some elements at the start of the tree and false for all the others.
+ * Returns like zbtSeekFirst(). */
+static int zbtSeekLast(zbtree *zbt, zbtRangeCheck lte, void *range,
+                       zbtreePos *pos, unsigned long *rank)
+{
+    zbtreeNode *x = zbt->root;
+    unsigned long traversed = 0;
+    unsigned int lo, hi, mid, j;
+    int level;
+
+    for (level = zbt->height-1; level > 0; level--) {
+        /* Follow the last child whose separator is in range. */
+        lo = 1; hi = x->count;
+        while (lo < hi) {
+            mid = (lo+hi)/2;
+            if (lte(x->score[mid],x->obj[mid],range))
+                lo = mid+1;
+            else
+                hi = mid;
+        }
+        for (j = 0; j < lo-1; j++) traversed += x->size[j];
+        x = x->child[lo-1];
+    }
+
+    lo = 0; hi = x->count;
+    while (lo < hi) {
+        mid = (lo+hi)/2;
+        if (lte(x->score[mid],x->obj[mid],range))
+            lo = mid+1;
+        else
+            hi = mid;
+    }
+    traversed += lo;
+
+    /* When no element of the leaf is in range, the element we are looking
+     * for is the last of the previous leaf, that comes before the separator
+     * that stopped the descent. */
+    if (lo == 0) {
+        x = x->prev;
+        if (x == NULL) return 0;
+        lo = x->count;
+    }
+    if (pos) {
+        pos->node = x;
+        pos->idx = lo-1;
+    }
+    if (rank) *rank = traversed;
+    return 1;
+}
+
+/* Find the first element that is contained in the specified range.
+ * Returns 0 when no element is contained in the range, otherwise 1, setting
+ * 'pos' and the 1-based 'rank' when they are not NULL. */
+int zbtFirstInRange(zbtree *zbt, zrangespec *range, zbtreePos *pos, unsigned long *rank) {
+    zbtreePos p;
+
+    if (!zbtSeekFirst(zbt,zbtScoreGteMin,range,&p,rank)) return 0;
+    if (!zslValueLteMax(zbtPosScore(&p),range)) return 0;
+    if (pos) *pos = p;
+    return 1;
+}
+
+/* Find the last element that is contained in the specified range.
+ * Returns like zbtFirstInRange(). */
+int zbtLastInRange(zbtree *zbt, zrangespec *range, zbtreePos *pos, unsigned long *rank) {
+    zbtreePos p;
+
+    if (!zbtSeekLast(zbt,zbtScoreLteMax,range,&p,rank)) return 0;
+    if (!zslValueGteMin(zbtPosScore(&p),range)) return 0;
+    if (pos) *pos = p;
+    return 1;
+}
+
+/* Lexicographic range versions of zbtFirstInRange() and zbtLastInRange(). */
+int zbtFirstInLexRange(zbtree *zbt, zlexrangespec *range, zbtreePos *pos, unsigned long *rank) {
+    zbtreePos p;
+
+    if (!zbtSeekFirst(zbt,zbtLexGteMin,range,&p,rank)) return 0;
+    if (!zslLexValueLteMax(zbtPosObj(&p),range)) return 0;
+    if (pos) *pos = p;
+    return 1;
+}
+
+int zbtLastInLexRange(zbtree *zbt, zlexrangespec *range, zbtreePos *pos, unsigned long *rank) {
+    zbtreePos p;
+
+    if (!zbtSeekLast(zbt,zbtLexLteMax,range,&p,rank)) return 0;
+    if (!zslLexValueGteMin(zbtPosObj(&p),range)) return 0;
+    if (pos) *pos = p;
+    return 1;
+}
+
+/* Delete all the elements with rank between start and end from the tree,
+ * and from 'dict' as well. Start and end are inclusive and 1-based.
+ * Elements are removed a leaf at a time. */
+unsigned long zbtDeleteRangeByRank(zbtree *zbt, unsigned long start, unsigned long end, dict *dict) {
+    zbtreeNode *path[ZBTREE_MAXHEIGHT], *x;
+    unsigned int slot[ZBTREE_MAXHEIGHT], idx, len;
+    unsigned long removed = 0, todo = end-start+1;
+
+    while (todo) {
+        x = zbtSeekRank(zbt,start-1,path,slot,&idx);
+        len = x->count-idx;
+        if (len > todo) len = todo;
+        zbtRemoveFromLeaf(zbt,path,slot,x,idx,len,dict);
+        todo -= len;
+        removed += len;
+    }
+    return removed;
+}
+
+unsigned long zbtDeleteRangeByScore(zbtree *zbt, zrangespec *range, dict *dict) {
+    unsigned long start, end;
+
+    if (!zbtFirstInRange(zbt,range,NULL,&start)) return 0;
+    redisAssert(zbtLastInRange(zbt,range,NULL,&end));
+    return zbtDeleteRangeByRank(zbt,start,end,dict);
+}
+
+unsigned long zbtDeleteRangeByLex(zbtree *zbt, zlexrangespec *range, dict *dict) {
+    unsigned long start, end;
+
+    if (!zbtFirstInLexRange(zbt,range,NULL,&start)) return 0;
+    redisAssert(zbtLastInLexRange(zbt,range,NULL,&end));
+    return zbtDeleteRangeByRank(zbt,start,end,dict);
+}
+
+/*-----------------------------------------------------------------------------
+ * Listpack-backed sorted set API
  *----------------------------------------------------------------------------*/
 
 double zzlGetScore(unsigned char *sptr) {
@@ -640,7 +1464,7 @@ double zzlGetScore(unsigned char *sptr) {
     double score;
 
     redisAssert(sptr != NULL);
-    redisAssert(ziplistGet(sptr,&vstr,&vlen,&vlong));
+    redisAssert(lpGet(sptr,&vstr,&vlen,&vlong));
 
     if (vstr) {
         memcpy(buf,vstr,vlen);
@@ -653,16 +1477,16 @@ double zzlGetScore(unsigned char *sptr) {
     return score;
 }
 
-/* Return a ziplist element as a Redis string object.
+/* Return a listpack element as a Redis string object.
  * This simple abstraction can be used to simplifies some code at the
  * cost of some performance. */
-robj *ziplistGetObject(unsigned char *sptr) {
+robj *zzlGetObject(unsigned char *sptr) {
     unsigned char *vstr;
     unsigned int vlen;
     long long vlong;
 
     redisAssert(sptr != NULL);
-    redisAssert(ziplistGet(sptr,&vstr,&vlen,&vlong));
+    redisAssert(lpGet(sptr,&vstr,&vlen,&vlong));
 
     if (vstr) {
         return createStringObject((char*)vstr,vlen);
@@ -679,7 +1503,7 @@ int zzlCompareElements(unsigned char *eptr, unsigned char *cstr, unsigned int cl
     unsigned char vbuf[32];
     int minlen, cmp;
 
-    redisAssert(ziplistGet(eptr,&vstr,&vlen,&vlong));
+    redisAssert(lpGet(eptr,&vstr,&vlen,&vlong));
     if (vstr == NULL) {
         /* Store string representation of long long in buf. */
         vlen = ll2string((char*)vbuf,sizeof(vbuf),vlong);
@@ -693,7 +1517,7 @@ int zzlCompareElements(unsigned char *eptr, unsigned char *cstr, unsigned int cl
 }
 
 unsigned int zzlLength(unsigned char *zl) {
-    return ziplistLen(zl)/2;
+    return lpLength(zl)/2;
 }
 
 /* Move to next entry based on the values in eptr and sptr. Both are set to
@@ -702,9 +1526,9 @@ void zzlNext(unsigned char *zl, unsigned char **eptr, unsigned char **sptr) {
     unsigned char *_eptr, *_sptr;
     redisAssert(*eptr != NULL && *sptr != NULL);
 
-    _eptr = ziplistNext(zl,*sptr);
+    _eptr = lpNext(zl,*sptr);
     if (_eptr != NULL) {
-        _sptr = ziplistNext(zl,_eptr);
+        _sptr = lpNext(zl,_eptr);
         redisAssert(_sptr != NULL);
     } else {
         /* No next entry. */
@@ -721,9 +1545,9 @@ void zzlPrev(unsigned char *zl, unsigned char **eptr, unsigned char **sptr) {
     unsigned char *_eptr, *_sptr;
     redisAssert(*eptr != NULL && *sptr != NULL);
 
-    _sptr = ziplistPrev(zl,*eptr);
+    _sptr = lpPrev(zl,*eptr);
     if (_sptr != NULL) {
-        _eptr = ziplistPrev(zl,_sptr);
+        _eptr = lpPrev(zl,_sptr);
         redisAssert(_eptr != NULL);
     } else {
         /* No previous entry. */
@@ -745,13 +1569,13 @@ int zzlIsInRange(unsigned char *zl, zrangespec *range) {
             (range->min == range->max && (range->minex || range->maxex)))
         return 0;
 
-    p = ziplistIndex(zl,-1); /* Last score. */
+    p = lpSeek(zl,-1); /* Last score. */
     if (p == NULL) return 0; /* Empty sorted set */
     score = zzlGetScore(p);
     if (!zslValueGteMin(score,range))
         return 0;
 
-    p = ziplistIndex(zl,1); /* First score. */
+    p = lpSeek(zl,1); /* First score. */
     redisAssert(p != NULL);
     score = zzlGetScore(p);
     if (!zslValueLteMax(score,range))
@@ -763,14 +1587,14 @@ int zzlIsInRange(unsigned char *zl, zrangespec *range) {
 /* Find pointer to the first element contained in the specified range.
  * Returns NULL when no element is contained in the range. */
 unsigned char *zzlFirstInRange(unsigned char *zl, zrangespec *range) {
-    unsigned char *eptr = ziplistIndex(zl,0), *sptr;
+    unsigned char *eptr = lpSeek(zl,0), *sptr;
     double score;
 
     /* If everything is out of range, return early. */
     if (!zzlIsInRange(zl,range)) return NULL;
 
     while (eptr != NULL) {
-        sptr = ziplistNext(zl,eptr);
+        sptr = lpNext(zl,eptr);
         redisAssert(sptr != NULL);
 
         score = zzlGetScore(sptr);
@@ -782,7 +1606,7 @@ unsigned char *zzlFirstInRange(unsigned char *zl, zrangespec *range) {
         }
 
         /* Move to next element. */
-        eptr = ziplistNext(zl,sptr);
+        eptr = lpNext(zl,sptr);
     }
 
     return NULL;
@@ -791,14 +1615,14 @@ unsigned char *zzlFirstInRange(unsigned char *zl, zrangespec *range) {
 /* Find pointer to the last element contained in the specified range.
  * Returns NULL when no element is contained in the range. */
 unsigned char *zzlLastInRange(unsigned char *zl, zrangespec *range) {
-    unsigned char *eptr = ziplistIndex(zl,-2), *sptr;
+    unsigned char *eptr = lpSeek(zl,-2), *sptr;
     double score;
 
     /* If everything is out of range, return early. */
     if (!zzlIsInRange(zl,range)) return NULL;
 
     while (eptr != NULL) {
-        sptr = ziplistNext(zl,eptr);
+        sptr = lpNext(zl,eptr);
         redisAssert(sptr != NULL);
 
         score = zzlGetScore(sptr);
@@ -811,9 +1635,9 @@ unsigned char *zzlLastInRange(unsigned char *zl, zrangespec *range) {
 
         /* Move to previous element by moving to the score of previous element.
          * When this returns NULL, we know there also is no element. */
-        sptr = ziplistPrev(zl,eptr);
+        sptr = lpPrev(zl,eptr);
         if (sptr != NULL)
-            redisAssert((eptr = ziplistPrev(zl,sptr)) != NULL);
+            redisAssert((eptr = lpPrev(zl,sptr)) != NULL);
         else
             eptr = NULL;
     }
@@ -822,14 +1646,14 @@ unsigned char *zzlLastInRange(unsigned char *zl, zrangespec *range) {
 }
 
 static int zzlLexValueGteMin(unsigned char *p, zlexrangespec *spec) {
-    robj *value = ziplistGetObject(p);
+    robj *value = zzlGetObject(p);
     int res = zslLexValueGteMin(value,spec);
     decrRefCount(value);
     return res;
 }
 
 static int zzlLexValueLteMax(unsigned char *p, zlexrangespec *spec) {
-    robj *value = ziplistGetObject(p);
+    robj *value = zzlGetObject(p);
     int res = zslLexValueLteMax(value,spec);
     decrRefCount(value);
     return res;
@@ -846,12 +1670,12 @@ int zzlIsInLexRange(unsigned char *zl, zlexrangespec *range) {
             (range->minex || range->maxex)))
         return 0;
 
-    p = ziplistIndex(zl,-2); /* Last element. */
+    p = lpSeek(zl,-2); /* Last element. */
     if (p == NULL) return 0;
     if (!zzlLexValueGteMin(p,range))
         return 0;
 
-    p = ziplistIndex(zl,0); /* First element. */
+    p = lpSeek(zl,0); /* First element. */
     redisAssert(p != NULL);
     if (!zzlLexValueLteMax(p,range))
         return 0;
@@ -862,7 +1686,7 @@ int zzlIsInLexRange(unsigned char *zl, zlexrangespec *range) {
 /* Find pointer to the first element contained in the specified lex range.
  * Returns NULL when no element is contained in the range. */
 unsigned char *zzlFirstInLexRange(unsigned char *zl, zlexrangespec *range) {
-    unsigned char *eptr = ziplistIndex(zl,0), *sptr;
+    unsigned char *eptr = lpSeek(zl,0), *sptr;
 
     /* If everything is out of range, return early. */
     if (!zzlIsInLexRange(zl,range)) return NULL;
@@ -876,9 +1700,9 @@ unsigned char *zzlFirstInLexRange(unsigned char *zl, zlexrangespec *range) {
         }
 
         /* Move to next element. */
-        sptr = ziplistNext(zl,eptr); /* This element score. Skip it. */
+        sptr = lpNext(zl,eptr); /* This element score. Skip it. */
         redisAssert(sptr != NULL);
-        eptr = ziplistNext(zl,sptr); /* Next element. */
+        eptr = lpNext(zl,sptr); /* Next element. */
     }
 
     return NULL;
@@ -887,7 +1711,7 @@ unsigned char *zzlFirstInLexRange(unsigned char *zl, zlexrangespec *range) {
 /* Find pointer to the last element contained in the specified lex range.
  * Returns NULL when no element is contained in the range. */
 unsigned char *zzlLastInLexRange(unsigned char *zl, zlexrangespec *range) {
-    unsigned char *eptr = ziplistIndex(zl,-2), *sptr;
+    unsigned char *eptr = lpSeek(zl,-2), *sptr;
 
     /* If everything is out of range, return early. */
     if (!zzlIsInLexRange(zl,range)) return NULL;
@@ -902,9 +1726,9 @@ unsigned char *zzlLastInLexRange(unsigned char *zl, zlexrangespec *range) {
 
         /* Move to previous element by moving to the score of previous element.
          * When this returns NULL, we know there also is no element. */
-        sptr = ziplistPrev(zl,eptr);
+        sptr = lpPrev(zl,eptr);
         if (sptr != NULL)
-            redisAssert((eptr = ziplistPrev(zl,sptr)) != NULL);
+            redisAssert((eptr = lpPrev(zl,sptr)) != NULL);
         else
             eptr = NULL;
     }
@@ -913,14 +1737,14 @@ unsigned char *zzlLastInLexRange(unsigned char *zl, zlexrangespec *range) {
 }
 
 unsigned char *zzlFind(unsigned char *zl, robj *ele, double *score) {
-    unsigned char *eptr = ziplistIndex(zl,0), *sptr;
+    unsigned char *eptr = lpSeek(zl,0), *sptr;
 
     ele = getDecodedObject(ele);
     while (eptr != NULL) {
-        sptr = ziplistNext(zl,eptr);
+        sptr = lpNext(zl,eptr);
         redisAssertWithInfo(NULL,ele,sptr != NULL);
 
-        if (ziplistCompare(eptr,ele->ptr,sdslen(ele->ptr))) {
+        if (lpCompare(eptr,ele->ptr,sdslen(ele->ptr))) {
             /* Matching element, pull out score. */
             if (score != NULL) *score = zzlGetScore(sptr);
             decrRefCount(ele);
@@ -928,21 +1752,19 @@ unsigned char *zzlFind(unsigned char *zl, robj *ele, double *score) {
         }
 
         /* Move to next element. */
-        eptr = ziplistNext(zl,sptr);
+        eptr = lpNext(zl,sptr);
     }
 
     decrRefCount(ele);
     return NULL;
 }
 
-/* Delete (element,score) pair from ziplist. Use local copy of eptr because we
+/* Delete (element,score) pair from listpack. Use local copy of eptr because we
  * don't want to modify the one given as argument. */
 unsigned char *zzlDelete(unsigned char *zl, unsigned char *eptr) {
     unsigned char *p = eptr;
 
-    /* TODO: add function to ziplist API to delete N elements from offset. */
-    zl = ziplistDelete(zl,&p);
-    zl = ziplistDelete(zl,&p);
+    zl = lpDeleteRangeWithEntry(zl,&p,2);
     return zl;
 }
 
@@ -950,36 +1772,34 @@ unsigned char *zzlInsertAt(unsigned char *zl, unsigned char *eptr, robj *ele, do
     unsigned char *sptr;
     char scorebuf[128];
     int scorelen;
-    size_t offset;
 
     redisAssertWithInfo(NULL,ele,sdsEncodedObject(ele));
     scorelen = d2string(scorebuf,sizeof(scorebuf),score);
     if (eptr == NULL) {
-        zl = ziplistPush(zl,ele->ptr,sdslen(ele->ptr),ZIPLIST_TAIL);
-        zl = ziplistPush(zl,(unsigned char*)scorebuf,scorelen,ZIPLIST_TAIL);
+        zl = lpAppend(zl,ele->ptr,sdslen(ele->ptr));
+        zl = lpAppend(zl,(unsigned char*)scorebuf,scorelen);
     } else {
-        /* Keep offset relative to zl, as it might be re-allocated. */
-        offset = eptr-zl;
-        zl = ziplistInsert(zl,eptr,ele->ptr,sdslen(ele->ptr));
-        eptr = zl+offset;
+        /* lpInsert() returns the new element by reference, as the listpack
+         * might be re-allocated. */
+        zl = lpInsert(zl,ele->ptr,sdslen(ele->ptr),eptr,LP_BEFORE,&eptr);
 
         /* Insert score after the element. */
-        redisAssertWithInfo(NULL,ele,(sptr = ziplistNext(zl,eptr)) != NULL);
-        zl = ziplistInsert(zl,sptr,(unsigned char*)scorebuf,scorelen);
+        redisAssertWithInfo(NULL,ele,(sptr = lpNext(zl,eptr)) != NULL);
+        zl = lpInsert(zl,(unsigned char*)scorebuf,scorelen,sptr,LP_BEFORE,NULL);
     }
 
     return zl;
 }
 
-/* Insert (element,score) pair in ziplist. This function assumes the element is
+/* Insert (element,score) pair in listpack. This function assumes the element is
  * not yet present in the list. */
 unsigned char *zzlInsert(unsigned char *zl, robj *ele, double score) {
-    unsigned char *eptr = ziplistIndex(zl,0), *sptr;
+    unsigned char *eptr = lpSeek(zl,0), *sptr;
     double s;
 
     ele = getDecodedObject(ele);
     while (eptr != NULL) {
-        sptr = ziplistNext(zl,eptr);
+        sptr = lpNext(zl,eptr);
         redisAssertWithInfo(NULL,ele,sptr != NULL);
         s = zzlGetScore(sptr);
 
@@ -998,7 +1818,7 @@ unsigned char *zzlInsert(unsigned char *zl, robj *ele, double score) {
         }
 
         /* Move to next element. */
-        eptr = ziplistNext(zl,sptr);
+        eptr = lpNext(zl,sptr);
     }
 
     /* Push on tail of list when it was not yet inserted. */
@@ -1019,14 +1839,12 @@ unsigned char *zzlDeleteRangeByScore(unsigned char *zl, zrangespec *range, unsig
     eptr = zzlFirstInRange(zl,range);
     if (eptr == NULL) return zl;
 
-    /* When the tail of the ziplist is deleted, eptr will point to the sentinel
-     * byte and ziplistNext will return NULL. */
-    while ((sptr = ziplistNext(zl,eptr)) != NULL) {
+    /* When the tail of the listpack is deleted, eptr will be NULL. */
+    while (eptr && (sptr = lpNext(zl,eptr)) != NULL) {
         score = zzlGetScore(sptr);
         if (zslValueLteMax(score,range)) {
             /* Delete both the element and the score. */
-            zl = ziplistDelete(zl,&eptr);
-            zl = ziplistDelete(zl,&eptr);
+            zl = lpDeleteRangeWithEntry(zl,&eptr,2);
             num++;
         } else {
             /* No longer in range. */
@@ -1047,13 +1865,11 @@ unsigned char *zzlDeleteRangeByLex(unsigned char *zl, zlexrangespec *range, unsi
     eptr = zzlFirstInLexRange(zl,range);
     if (eptr == NULL) return zl;
 
-    /* When the tail of the ziplist is deleted, eptr will point to the sentinel
-     * byte and ziplistNext will return NULL. */
-    while ((sptr = ziplistNext(zl,eptr)) != NULL) {
+    /* When the tail of the listpack is deleted, eptr will be NULL. */
+    while (eptr && (sptr = lpNext(zl,eptr)) != NULL) {
         if (zzlLexValueLteMax(eptr,range)) {
             /* Delete both the element and the score. */
-            zl = ziplistDelete(zl,&eptr);
-            zl = ziplistDelete(zl,&eptr);
+            zl = lpDeleteRangeWithEntry(zl,&eptr,2);
             num++;
         } else {
             /* No longer in range. */
@@ -1070,7 +1886,7 @@ unsigned char *zzlDeleteRangeByLex(unsigned char *zl, zlexrangespec *range, unsi
 unsigned char *zzlDeleteRangeByRank(unsigned char *zl, unsigned int start, unsigned int end, unsigned long *deleted) {
     unsigned int num = (end-start)+1;
     if (deleted) *deleted = num;
-    zl = ziplistDeleteRange(zl,2*(start-1),2*num);
+    zl = lpDeleteRange(zl,2*(start-1),2*num);
     return zl;
 }
 
@@ -1080,68 +1896,128 @@ unsigned char *zzlDeleteRangeByRank(unsigned char *zl, unsigned int start, unsig
 
 unsigned int zsetLength(robj *zobj) {
     int length = -1;
-    if (zobj->encoding == REDIS_ENCODING_ZIPLIST) {
+    if (zobj->encoding == REDIS_ENCODING_LISTPACK) {
         length = zzlLength(zobj->ptr);
     } else if (zobj->encoding == REDIS_ENCODING_SKIPLIST) {
         length = ((zset*)zobj->ptr)->zsl->length;
+    } else if (zobj->encoding == REDIS_ENCODING_BTREE) {
+        length = ((zset*)zobj->ptr)->zbt->length;
     } else {
         redisPanic("Unknown sorted set encoding");
     }
     return length;
 }
 
+/* Return the encoding used for sorted sets too big for a listpack. */
+int zsetIndexEncoding(void) {
+    return server.zset_use_btree ? REDIS_ENCODING_BTREE : REDIS_ENCODING_SKIPLIST;
+}
+
+/* Insert an element in the skiplist or the B+tree of 'zs'. As with
+ * zslInsert() the reference to 'ele' is taken over by the index. */
+void zsetIndexInsert(zset *zs, double score, robj *ele) {
+    if (zs->zbt)
+        zbtInsert(zs->zbt,score,ele);
+    else
+        zslInsert(zs->zsl,score,ele);
+}
+
+/* Delete an element from the skiplist or the B+tree of 'zs'.
+ * Returns 1 if the element was found, 0 otherwise. */
+int zsetIndexDelete(zset *zs, double score, robj *ele) {
+    if (zs->zbt)
+        return zbtDelete(zs->zbt,score,ele);
+    else
+        return zslDelete(zs->zsl,score,ele);
+}
+
+/* Replace the empty skiplist or B+tree of 'zs' with one holding the 'len'
+ * elements of 'ele', sorted as by zsetEntryCompare(). The references to the
+ * elements are taken over by the index, while the dictionary is left to
+ * the caller. */
+void zsetIndexLoadSorted(zset *zs, zsetEntry *ele, unsigned long len) {
+    if (zs->zbt) {
+        redisAssert(zs->zbt->length == 0);
+        zbtFree(zs->zbt);
+        zs->zbt = zbtCreateFromSorted(ele,len);
+    } else {
+        redisAssert(zs->zsl->length == 0);
+        zslFree(zs->zsl);
+        zs->zsl = zslCreateFromSorted(ele,len);
+    }
+}
+
+/* qsort() comparator ordering zsetEntry structures like a sorted set. */
+int zsetEntryCompare(const void *a, const void *b) {
+    const zsetEntry *ea = a, *eb = b;
+
+    if (ea->score < eb->score) return -1;
+    if (ea->score > eb->score) return 1;
+    return compareStringObjects(ea->obj,eb->obj);
+}
+
 void zsetConvert(robj *zobj, int encoding) {
     zset *zs;
     zskiplistNode *node, *next;
+    dictEntry *de;
     robj *ele;
     double score;
 
     if (zobj->encoding == encoding) return;
-    if (zobj->encoding == REDIS_ENCODING_ZIPLIST) {
+    if (zobj->encoding == REDIS_ENCODING_LISTPACK) {
         unsigned char *zl = zobj->ptr;
         unsigned char *eptr, *sptr;
         unsigned char *vstr;
         unsigned int vlen;
         long long vlong;
 
-        if (encoding != REDIS_ENCODING_SKIPLIST)
+        if (encoding != REDIS_ENCODING_SKIPLIST &&
+            encoding != REDIS_ENCODING_BTREE)
             redisPanic("Unknown target encoding");
 
         zs = zmalloc(sizeof(*zs));
         zs->dict = dictCreate(&zsetDictType,NULL);
-        zs->zsl = zslCreate();
+        if (encoding == REDIS_ENCODING_BTREE) {
+            zs->zsl = NULL;
+            zs->zbt = zbtCreate();
+        } else {
+            zs->zsl = zslCreate();
+            zs->zbt = NULL;
+        }
 
-        eptr = ziplistIndex(zl,0);
+        eptr = lpSeek(zl,0);
         redisAssertWithInfo(NULL,zobj,eptr != NULL);
-        sptr = ziplistNext(zl,eptr);
+        sptr = lpNext(zl,eptr);
         redisAssertWithInfo(NULL,zobj,sptr != NULL);
 
         while (eptr != NULL) {
             score = zzlGetScore(sptr);
-            redisAssertWithInfo(NULL,zobj,ziplistGet(eptr,&vstr,&vlen,&vlong));
+            redisAssertWithInfo(NULL,zobj,lpGet(eptr,&vstr,&vlen,&vlong));
             if (vstr == NULL)
                 ele = createStringObjectFromLongLong(vlong);
             else
                 ele = createStringObject((char*)vstr,vlen);
 
             /* Has incremented refcount since it was just created. */
-            node = zslInsert(zs->zsl,score,ele);
-            redisAssertWithInfo(NULL,zobj,dictAdd(zs->dict,ele,&node->score) == DICT_OK);
+            zsetIndexInsert(zs,score,ele);
+            de = dictAddRaw(zs->dict,ele);
+            redisAssertWithInfo(NULL,zobj,de != NULL);
+            dictSetDoubleVal(de,score);
             incrRefCount(ele); /* Added to dictionary. */
             zzlNext(zl,&eptr,&sptr);
         }
 
         zfree(zobj->ptr);
         zobj->ptr = zs;
-        zobj->encoding = REDIS_ENCODING_SKIPLIST;
+        zobj->encoding = encoding;
     } else if (zobj->encoding == REDIS_ENCODING_SKIPLIST) {
-        unsigned char *zl = ziplistNew();
+        unsigned char *zl = lpNew();
 
-        if (encoding != REDIS_ENCODING_ZIPLIST)
+        if (encoding != REDIS_ENCODING_LISTPACK)
             redisPanic("Unknown target encoding");
 
         /* Approach similar to zslFree(), since we want to free the skiplist at
-         * the same time as creating the ziplist. */
+         * the same time as creating the listpack. */
         zs = zobj->ptr;
         dictRelease(zs->dict);
         node = zs->zsl->header->level[0].forward;
@@ -1160,7 +2036,29 @@ void zsetConvert(robj *zobj, int encoding) {
 
         zfree(zs);
         zobj->ptr = zl;
-        zobj->encoding = REDIS_ENCODING_ZIPLIST;
+        zobj->encoding = REDIS_ENCODING_LISTPACK;
+    } else if (zobj->encoding == REDIS_ENCODING_BTREE) {
+        unsigned char *zl = lpNew();
+        zbtreePos pos;
+        int more;
+
+        if (encoding != REDIS_ENCODING_LISTPACK)
+            redisPanic("Unknown target encoding");
+
+        zs = zobj->ptr;
+        dictRelease(zs->dict);
+        more = zbtFirst(zs->zbt,&pos);
+        while (more) {
+            ele = getDecodedObject(zbtPosObj(&pos));
+            zl = zzlInsertAt(zl,NULL,ele,zbtPosScore(&pos));
+            decrRefCount(ele);
+            more = zbtNext(&pos);
+        }
+        zbtFree(zs->zbt);
+
+        zfree(zs);
+        zobj->ptr = zl;
+        zobj->encoding = REDIS_ENCODING_LISTPACK;
     } else {
         redisPanic("Unknown sorted set encoding");
     }
@@ -1252,7 +2150,7 @@ void zaddGenericCommand(redisClient *c, int flags) {
         {
             zobj = createZsetObject();
         } else {
-            zobj = createZsetZiplistObject();
+            zobj = createZsetListpackObject();
         }
         dbAdd(c->db,key,zobj);
     } else {
@@ -1265,10 +2163,10 @@ void zaddGenericCommand(redisClient *c, int flags) {
     for (j = 0; j < elements; j++) {
         score = scores[j];
 
-        if (zobj->encoding == REDIS_ENCODING_ZIPLIST) {
+        if (zobj->encoding == REDIS_ENCODING_LISTPACK) {
             unsigned char *eptr;
 
-            /* Prefer non-encoded element when dealing with ziplists. */
+            /* Prefer non-encoded element when dealing with listpacks. */
             ele = c->argv[scoreidx+1+j*2];
             if ((eptr = zzlFind(zobj->ptr,ele,&curscore)) != NULL) {
                 if (nx) continue;
@@ -1293,16 +2191,17 @@ void zaddGenericCommand(redisClient *c, int flags) {
                  * becomes too long *before* executing zzlInsert. */
                 zobj->ptr = zzlInsert(zobj->ptr,ele,score);
                 if (zzlLength(zobj->ptr) > server.zset_max_ziplist_entries)
-                    zsetConvert(zobj,REDIS_ENCODING_SKIPLIST);
+                    zsetConvert(zobj,zsetIndexEncoding());
                 if (sdslen(ele->ptr) > server.zset_max_ziplist_value)
-                    zsetConvert(zobj,REDIS_ENCODING_SKIPLIST);
+                    zsetConvert(zobj,zsetIndexEncoding());
                 server.dirty++;
                 added++;
                 processed++;
             }
-        } else if (zobj->encoding == REDIS_ENCODING_SKIPLIST) {
+        } else if (zobj->encoding == REDIS_ENCODING_SKIPLIST ||
+                   zobj->encoding == REDIS_ENCODING_BTREE)
+        {
             zset *zs = zobj->ptr;
-            zskiplistNode *znode;
             dictEntry *de;
 
             ele = c->argv[scoreidx+1+j*2] =
@@ -1311,7 +2210,7 @@ void zaddGenericCommand(redisClient *c, int flags) {
             if (de != NULL) {
                 if (nx) continue;
                 curobj = dictGetKey(de);
-                curscore = *(double*)dictGetVal(de);
+                curscore = dictGetDoubleVal(de);
 
                 if (incr) {
                     score += curscore;
@@ -1327,18 +2226,20 @@ void zaddGenericCommand(redisClient *c, int flags) {
                  * delete the key object from the skiplist, since the
                  * dictionary still has a reference to it. */
                 if (score != curscore) {
-                    redisAssertWithInfo(c,curobj,zslDelete(zs->zsl,curscore,curobj));
-                    znode = zslInsert(zs->zsl,score,curobj);
-                    incrRefCount(curobj); /* Re-inserted in skiplist. */
-                    dictGetVal(de) = &znode->score; /* Update score ptr. */
+                    redisAssertWithInfo(c,curobj,zsetIndexDelete(zs,curscore,curobj));
+                    zsetIndexInsert(zs,score,curobj);
+                    incrRefCount(curobj); /* Re-inserted in the index. */
+                    dictSetDoubleVal(de,score); /* Update score. */
                     server.dirty++;
                     updated++;
                 }
                 processed++;
             } else if (!xx) {
-                znode = zslInsert(zs->zsl,score,ele);
-                incrRefCount(ele); /* Inserted in skiplist. */
-                redisAssertWithInfo(c,NULL,dictAdd(zs->dict,ele,&znode->score) == DICT_OK);
+                zsetIndexInsert(zs,score,ele);
+                incrRefCount(ele); /* Inserted in the index. */
+                de = dictAddRaw(zs->dict,ele);
+                redisAssertWithInfo(c,NULL,de != NULL);
+                dictSetDoubleVal(de,score);
                 incrRefCount(ele); /* Added to dictionary. */
                 server.dirty++;
                 added++;
@@ -1384,7 +2285,7 @@ void zremCommand(redisClient *c) {
     if ((zobj = lookupKeyWriteOrReply(c,key,shared.czero)) == NULL ||
         checkType(c,zobj,REDIS_ZSET)) return;
 
-    if (zobj->encoding == REDIS_ENCODING_ZIPLIST) {
+    if (zobj->encoding == REDIS_ENCODING_LISTPACK) {
         unsigned char *eptr;
 
         for (j = 2; j < c->argc; j++) {
@@ -1398,7 +2299,9 @@ void zremCommand(redisClient *c) {
                 }
             }
         }
-    } else if (zobj->encoding == REDIS_ENCODING_SKIPLIST) {
+    } else if (zobj->encoding == REDIS_ENCODING_SKIPLIST ||
+               zobj->encoding == REDIS_ENCODING_BTREE)
+    {
         zset *zs = zobj->ptr;
         dictEntry *de;
         double score;
@@ -1408,9 +2311,9 @@ void zremCommand(redisClient *c) {
             if (de != NULL) {
                 deleted++;
 
-                /* Delete from the skiplist */
-                score = *(double*)dictGetVal(de);
-                redisAssertWithInfo(c,c->argv[j],zslDelete(zs->zsl,score,c->argv[j]));
+                /* Delete from the skiplist or B+tree */
+                score = dictGetDoubleVal(de);
+                redisAssertWithInfo(c,c->argv[j],zsetIndexDelete(zs,score,c->argv[j]));
 
                 /* Delete from the hash table */
                 dictDelete(zs->dict,c->argv[j]);
@@ -1487,7 +2390,7 @@ void zremrangeGenericCommand(redisClient *c, int rangetype) {
     }
 
     /* Step 3: Perform the range deletion operation. */
-    if (zobj->encoding == REDIS_ENCODING_ZIPLIST) {
+    if (zobj->encoding == REDIS_ENCODING_LISTPACK) {
         switch(rangetype) {
         case ZRANGE_RANK:
             zobj->ptr = zzlDeleteRangeByRank(zobj->ptr,start+1,end+1,&deleted);
@@ -1521,6 +2424,24 @@ void zremrangeGenericCommand(redisClient *c, int rangetype) {
             dbDelete(c->db,key);
             keyremoved = 1;
         }
+    } else if (zobj->encoding == REDIS_ENCODING_BTREE) {
+        zset *zs = zobj->ptr;
+        switch(rangetype) {
+        case ZRANGE_RANK:
+            deleted = zbtDeleteRangeByRank(zs->zbt,start+1,end+1,zs->dict);
+            break;
+        case ZRANGE_SCORE:
+            deleted = zbtDeleteRangeByScore(zs->zbt,&range,zs->dict);
+            break;
+        case ZRANGE_LEX:
+            deleted = zbtDeleteRangeByLex(zs->zbt,&lexrange,zs->dict);
+            break;
+        }
+        if (htNeedsResize(zs->dict)) dictResize(zs->dict);
+        if (dictSize(zs->dict) == 0) {
+            dbDelete(c->db,key);
+            keyremoved = 1;
+        }
     } else {
         redisPanic("Unknown sorted set encoding");
     }
@@ -1582,6 +2503,11 @@ typedef struct {
                 zset *zs;
                 zskiplistNode *node;
             } sl;
+            struct {
+                zset *zs;
+                zbtreePos pos;
+                int valid;
+            } bt;
         } zset;
     } iter;
 } zsetopsrc;
@@ -1629,16 +2555,19 @@ void zuiInitIterator(zsetopsrc *op) {
         }
     } else if (op->type == REDIS_ZSET) {
         iterzset *it = &op->iter.zset;
-        if (op->encoding == REDIS_ENCODING_ZIPLIST) {
+        if (op->encoding == REDIS_ENCODING_LISTPACK) {
             it->zl.zl = op->subject->ptr;
-            it->zl.eptr = ziplistIndex(it->zl.zl,0);
+            it->zl.eptr = lpSeek(it->zl.zl,0);
             if (it->zl.eptr != NULL) {
-                it->zl.sptr = ziplistNext(it->zl.zl,it->zl.eptr);
+                it->zl.sptr = lpNext(it->zl.zl,it->zl.eptr);
                 redisAssert(it->zl.sptr != NULL);
             }
         } else if (op->encoding == REDIS_ENCODING_SKIPLIST) {
             it->sl.zs = op->subject->ptr;
             it->sl.node = it->sl.zs->zsl->header->level[0].forward;
+        } else if (op->encoding == REDIS_ENCODING_BTREE) {
+            it->bt.zs = op->subject->ptr;
+            it->bt.valid = zbtFirst(it->bt.zs->zbt,&it->bt.pos);
         } else {
             redisPanic("Unknown sorted set encoding");
         }
@@ -1662,9 +2591,11 @@ void zuiClearIterator(zsetopsrc *op) {
         }
     } else if (op->type == REDIS_ZSET) {
         iterzset *it = &op->iter.zset;
-        if (op->encoding == REDIS_ENCODING_ZIPLIST) {
+        if (op->encoding == REDIS_ENCODING_LISTPACK) {
             REDIS_NOTUSED(it); /* skip */
-        } else if (op->encoding == REDIS_ENCODING_SKIPLIST) {
+        } else if (op->encoding == REDIS_ENCODING_SKIPLIST ||
+                   op->encoding == REDIS_ENCODING_BTREE)
+        {
             REDIS_NOTUSED(it); /* skip */
         } else {
             redisPanic("Unknown sorted set encoding");
@@ -1688,11 +2619,14 @@ int zuiLength(zsetopsrc *op) {
             redisPanic("Unknown set encoding");
         }
     } else if (op->type == REDIS_ZSET) {
-        if (op->encoding == REDIS_ENCODING_ZIPLIST) {
+        if (op->encoding == REDIS_ENCODING_LISTPACK) {
             return zzlLength(op->subject->ptr);
         } else if (op->encoding == REDIS_ENCODING_SKIPLIST) {
             zset *zs = op->subject->ptr;
             return zs->zsl->length;
+        } else if (op->encoding == REDIS_ENCODING_BTREE) {
+            zset *zs = op->subject->ptr;
+            return zs->zbt->length;
         } else {
             redisPanic("Unknown sorted set encoding");
         }
@@ -1738,11 +2672,11 @@ int zuiNext(zsetopsrc *op, zsetopval *val) {
         }
     } else if (op->type == REDIS_ZSET) {
         iterzset *it = &op->iter.zset;
-        if (op->encoding == REDIS_ENCODING_ZIPLIST) {
+        if (op->encoding == REDIS_ENCODING_LISTPACK) {
             /* No need to check both, but better be explicit. */
             if (it->zl.eptr == NULL || it->zl.sptr == NULL)
                 return 0;
-            redisAssert(ziplistGet(it->zl.eptr,&val->estr,&val->elen,&val->ell));
+            redisAssert(lpGet(it->zl.eptr,&val->estr,&val->elen,&val->ell));
             val->score = zzlGetScore(it->zl.sptr);
 
             /* Move to next element. */
@@ -1755,6 +2689,14 @@ int zuiNext(zsetopsrc *op, zsetopval *val) {
 
             /* Move to next element. */
             it->sl.node = it->sl.node->level[0].forward;
+        } else if (op->encoding == REDIS_ENCODING_BTREE) {
+            if (!it->bt.valid)
+                return 0;
+            val->ele = zbtPosObj(&it->bt.pos);
+            val->score = zbtPosScore(&it->bt.pos);
+
+            /* Move to next element. */
+            it->bt.valid = zbtNext(&it->bt.pos);
         } else {
             redisPanic("Unknown sorted set encoding");
         }
@@ -1852,18 +2794,20 @@ int zuiFind(zsetopsrc *op, zsetopval *val, double *score) {
     } else if (op->type == REDIS_ZSET) {
         zuiObjectFromValue(val);
 
-        if (op->encoding == REDIS_ENCODING_ZIPLIST) {
+        if (op->encoding == REDIS_ENCODING_LISTPACK) {
             if (zzlFind(op->subject->ptr,val->ele,score) != NULL) {
                 /* Score is already set by zzlFind. */
                 return 1;
             } else {
                 return 0;
             }
-        } else if (op->encoding == REDIS_ENCODING_SKIPLIST) {
+        } else if (op->encoding == REDIS_ENCODING_SKIPLIST ||
+                   op->encoding == REDIS_ENCODING_BTREE)
+        {
             zset *zs = op->subject->ptr;
             dictEntry *de;
             if ((de = dictFind(zs->dict,val->ele)) != NULL) {
-                *score = *(double*)dictGetVal(de);
+                *score = dictGetDoubleVal(de);
                 return 1;
             } else {
                 return 0;
@@ -1902,6 +2846,75 @@ inline static void zunionInterAggregate(double *target, double val, int aggregat
     }
 }
 
+/* Runs shorter than this on average are not worth merging: the result of
+ * ZUNIONSTORE / ZINTERSTORE is sorted from scratch instead. */
+#define ZSET_MERGE_MIN_RUN 16
+
+/* A sorted run of a zsetEntry array, from 'pos' up to 'end' excluded. */
+typedef struct {
+    unsigned long pos, end;
+} zsetMergeRun;
+
+/* Restore the heap property of the 'len' runs of 'heap', ordered by their
+ * first element, starting from the run at 'i'. */
+static void zsetMergeSiftDown(zsetEntry *ele, zsetMergeRun *heap,
+                              unsigned long len, unsigned long i)
+{
+    zsetMergeRun run = heap[i];
+    unsigned long child;
+
+    while ((child = 2*i+1) < len) {
+        if (child+1 < len &&
+            zsetEntryCompare(ele+heap[child+1].pos,ele+heap[child].pos) < 0)
+                child++;
+        if (zsetEntryCompare(ele+heap[child].pos,ele+run.pos) >= 0) break;
+        heap[i] = heap[child];
+        i = child;
+    }
+    heap[i] = run;
+}
+
+/* Sort the 'len' elements of 'ele' as a sorted set. Every input of
+ * ZUNIONSTORE / ZINTERSTORE is visited in order, so the elements often come
+ * in a few long sorted runs: a single run is used as it is, a few runs are
+ * merged with a binary heap in O(N*log(runs)), and only short runs are
+ * sorted with qsort(). Returns the sorted array, that is either 'ele' or a
+ * new array, in which case 'ele' is freed. */
+static zsetEntry *zsetEntrySort(zsetEntry *ele, unsigned long len) {
+    zsetMergeRun *heap;
+    zsetEntry *dst;
+    unsigned long runs = 1, i, j;
+
+    for (i = 1; i < len; i++)
+        if (zsetEntryCompare(ele+i-1,ele+i) > 0) runs++;
+    if (runs == 1) return ele;
+    if (runs > len/ZSET_MERGE_MIN_RUN) {
+        qsort(ele,len,sizeof(zsetEntry),zsetEntryCompare);
+        return ele;
+    }
+
+    heap = zmalloc(sizeof(zsetMergeRun)*runs);
+    heap[0].pos = 0;
+    for (i = 1, j = 0; i < len; i++) {
+        if (zsetEntryCompare(ele+i-1,ele+i) > 0) {
+            heap[j++].end = i;
+            heap[j].pos = i;
+        }
+    }
+    heap[j].end = len;
+    for (i = runs/2; i-- > 0; ) zsetMergeSiftDown(ele,heap,runs,i);
+
+    dst = zmalloc(sizeof(zsetEntry)*len);
+    for (i = 0; i < len; i++) {
+        dst[i] = ele[heap[0].pos++];
+        if (heap[0].pos == heap[0].end) heap[0] = heap[--runs];
+        if (runs) zsetMergeSiftDown(ele,heap,runs,0);
+    }
+    zfree(heap);
+    zfree(ele);
+    return dst;
+}
+
 void zunionInterGenericCommand(redisClient *c, robj *dstkey, int op) {
     int i, j;
     long setnum;
@@ -1912,7 +2925,9 @@ void zunionInterGenericCommand(redisClient *c, robj *dstkey, int op) {
     unsigned int maxelelen = 0;
     robj *dstobj;
     zset *dstzset;
-    zskiplistNode *znode;
+    dictEntry *dstde;
+    zsetEntry *ele = NULL;
+    unsigned long len = 0, alloc, k;
     int touched = 0;
 
     /* expect setnum input keys to be given */
@@ -2003,6 +3018,7 @@ void zunionInterGenericCommand(redisClient *c, robj *dstkey, int op) {
         if (zuiLength(&src[0]) > 0) {
             /* Precondition: as src[0] is non-empty and the inputs are ordered
              * by size, all src[i > 0] are non-empty too. */
+            ele = zmalloc(sizeof(zsetEntry)*zuiLength(&src[0]));
             zuiInitIterator(&src[0]);
             while (zuiNext(&src[0],&zval)) {
                 double score, value;
@@ -2027,10 +3043,10 @@ void zunionInterGenericCommand(redisClient *c, robj *dstkey, int op) {
                 /* Only continue when present in every input. */
                 if (j == setnum) {
                     tmp = zuiObjectFromValue(&zval);
-                    znode = zslInsert(dstzset->zsl,score,tmp);
-                    incrRefCount(tmp); /* added to skiplist */
-                    dictAdd(dstzset->dict,tmp,&znode->score);
-                    incrRefCount(tmp); /* added to dictionary */
+                    ele[len].score = score;
+                    ele[len].obj = tmp;
+                    len++;
+                    incrRefCount(tmp); /* added to the array */
 
                     if (sdsEncodedObject(tmp)) {
                         if (sdslen(tmp->ptr) > maxelelen)
@@ -2042,18 +3058,18 @@ void zunionInterGenericCommand(redisClient *c, robj *dstkey, int op) {
         }
     } else if (op == REDIS_OP_UNION) {
         dict *accumulator = dictCreate(&setDictType,NULL);
-        dictIterator *di;
         dictEntry *de;
         double score;
 
-        if (setnum) {
-            /* Our union is at least as large as the largest set.
-             * Resize the dictionary ASAP to avoid useless rehashing. */
-            dictExpand(accumulator,zuiLength(&src[setnum-1]));
-        }
+        /* Our union is at least as large as the largest set.
+         * Resize the dictionary ASAP to avoid useless rehashing. */
+        alloc = zuiLength(&src[setnum-1]);
+        dictExpand(accumulator,alloc);
+        ele = zmalloc(sizeof(zsetEntry)*(alloc ? alloc : 1));
 
-        /* Step 1: Create a dictionary of elements -> aggregated-scores
-         * by iterating one sorted set after the other. */
+        /* Step 1: Create an array of elements and aggregated scores by
+         * iterating one sorted set after the other. The dictionary maps
+         * every element to its index in the array. */
         for (i = 0; i < setnum; i++) {
             if (zuiLength(&src[i]) == 0) continue;
 
@@ -2069,63 +3085,68 @@ void zunionInterGenericCommand(redisClient *c, robj *dstkey, int op) {
                 if (de == NULL) {
                     tmp = zuiObjectFromValue(&zval);
                     /* Remember the longest single element encountered,
-                     * to understand if it's possible to convert to ziplist
+                     * to understand if it's possible to convert to listpack
                      * at the end. */
                     if (sdsEncodedObject(tmp)) {
                         if (sdslen(tmp->ptr) > maxelelen)
                             maxelelen = sdslen(tmp->ptr);
                     }
                     /* Add the element with its initial score. */
+                    if (len == alloc) {
+                        alloc *= 2;
+                        ele = zrealloc(ele,sizeof(zsetEntry)*alloc);
+                    }
                     de = dictAddRaw(accumulator,tmp);
                     incrRefCount(tmp);
-                    dictSetDoubleVal(de,score);
+                    dictSetUnsignedIntegerVal(de,len);
+                    ele[len].score = score;
+                    ele[len].obj = tmp;
+                    len++;
+                    incrRefCount(tmp); /* added to the array */
                 } else {
                     /* Update the score with the score of the new instance
-                     * of the element found in the current sorted set.
-                     *
-                     * Here we access directly the dictEntry double
-                     * value inside the union as it is a big speedup
-                     * compared to using the getDouble/setDouble API. */
-                    zunionInterAggregate(&de->v.d,score,aggregate);
+                     * of the element found in the current sorted set. */
+                    k = dictGetUnsignedIntegerVal(de);
+                    zunionInterAggregate(&ele[k].score,score,aggregate);
                 }
             }
             zuiClearIterator(&src[i]);
         }
 
-        /* Step 2: convert the dictionary into the final sorted set. */
-        di = dictGetIterator(accumulator);
+        /* We can free the accumulator dictionary now. */
+        dictRelease(accumulator);
+    } else {
+        redisPanic("Unknown operator");
+    }
+
+    /* Build the resulting sorted set in bulk: sort the array, then load
+     * the index with it instead of inserting one element at a time. */
+    if (len) {
+        ele = zsetEntrySort(ele,len);
 
         /* We now are aware of the final size of the resulting sorted set,
          * let's resize the dictionary embedded inside the sorted set to the
          * right size, in order to save rehashing time. */
-        dictExpand(dstzset->dict,dictSize(accumulator));
-
-        while((de = dictNext(di)) != NULL) {
-            robj *ele = dictGetKey(de);
-            score = dictGetDoubleVal(de);
-            znode = zslInsert(dstzset->zsl,score,ele);
-            incrRefCount(ele); /* added to skiplist */
-            dictAdd(dstzset->dict,ele,&znode->score);
-            incrRefCount(ele); /* added to dictionary */
+        dictExpand(dstzset->dict,len);
+        for (k = 0; k < len; k++) {
+            dstde = dictAddRaw(dstzset->dict,ele[k].obj);
+            dictSetDoubleVal(dstde,ele[k].score);
+            incrRefCount(ele[k].obj); /* added to dictionary */
         }
-        dictReleaseIterator(di);
-
-        /* We can free the accumulator dictionary now. */
-        dictRelease(accumulator);
-    } else {
-        redisPanic("Unknown operator");
+        zsetIndexLoadSorted(dstzset,ele,len); /* array refs moved to index */
     }
+    zfree(ele);
 
     if (dbDelete(c->db,dstkey)) {
         signalModifiedKey(c->db,dstkey);
         touched = 1;
         server.dirty++;
     }
-    if (dstzset->zsl->length) {
-        /* Convert to ziplist when in limits. */
-        if (dstzset->zsl->length <= server.zset_max_ziplist_entries &&
+    if (zsetLength(dstobj)) {
+        /* Convert to listpack when in limits. */
+        if (zsetLength(dstobj) <= server.zset_max_ziplist_entries &&
             maxelelen <= server.zset_max_ziplist_value)
-                zsetConvert(dstobj,REDIS_ENCODING_ZIPLIST);
+                zsetConvert(dstobj,REDIS_ENCODING_LISTPACK);
 
         dbAdd(c->db,dstkey,dstobj);
         addReplyLongLong(c,zsetLength(dstobj));
@@ -2191,7 +3212,7 @@ void zrangeGenericCommand(redisClient *c, int reverse) {
     /* Return the result in form of a multi-bulk reply */
     addReplyMultiBulkLen(c, withscores ? (rangelen*2) : rangelen);
 
-    if (zobj->encoding == REDIS_ENCODING_ZIPLIST) {
+    if (zobj->encoding == REDIS_ENCODING_LISTPACK) {
         unsigned char *zl = zobj->ptr;
         unsigned char *eptr, *sptr;
         unsigned char *vstr;
@@ -2199,16 +3220,16 @@ void zrangeGenericCommand(redisClient *c, int reverse) {
         long long vlong;
 
         if (reverse)
-            eptr = ziplistIndex(zl,-2-(2*start));
+            eptr = lpSeek(zl,-2-(2*start));
         else
-            eptr = ziplistIndex(zl,2*start);
+            eptr = lpSeek(zl,2*start);
 
         redisAssertWithInfo(c,zobj,eptr != NULL);
-        sptr = ziplistNext(zl,eptr);
+        sptr = lpNext(zl,eptr);
 
         while (rangelen--) {
             redisAssertWithInfo(c,zobj,eptr != NULL && sptr != NULL);
-            redisAssertWithInfo(c,zobj,ziplistGet(eptr,&vstr,&vlen,&vlong));
+            redisAssertWithInfo(c,zobj,lpGet(eptr,&vstr,&vlen,&vlong));
             if (vstr == NULL)
                 addReplyBulkLongLong(c,vlong);
             else
@@ -2248,6 +3269,23 @@ void zrangeGenericCommand(redisClient *c, int reverse) {
                 addReplyDouble(c,ln->score);
             ln = reverse ? ln->backward : ln->level[0].forward;
         }
+    } else if (zobj->encoding == REDIS_ENCODING_BTREE) {
+        zset *zs = zobj->ptr;
+        zbtreePos pos;
+        int valid;
+
+        if (reverse)
+            valid = zbtGetElementByRank(zs->zbt,llen-start,&pos);
+        else
+            valid = zbtGetElementByRank(zs->zbt,start+1,&pos);
+
+        while(rangelen--) {
+            redisAssertWithInfo(c,zobj,valid);
+            addReplyBulk(c,zbtPosObj(&pos));
+            if (withscores)
+                addReplyDouble(c,zbtPosScore(&pos));
+            valid = reverse ? zbtPrev(&pos) : zbtNext(&pos);
+        }
     } else {
         redisPanic("Unknown sorted set encoding");
     }
@@ -2311,7 +3349,7 @@ void genericZrangebyscoreCommand(redisClient *c, int reverse) {
     if ((zobj = lookupKeyReadOrReply(c,key,shared.emptymultibulk)) == NULL ||
         checkType(c,zobj,REDIS_ZSET)) return;
 
-    if (zobj->encoding == REDIS_ENCODING_ZIPLIST) {
+    if (zobj->encoding == REDIS_ENCODING_LISTPACK) {
         unsigned char *zl = zobj->ptr;
         unsigned char *eptr, *sptr;
         unsigned char *vstr;
@@ -2334,7 +3372,7 @@ void genericZrangebyscoreCommand(redisClient *c, int reverse) {
 
         /* Get score pointer for the first element. */
         redisAssertWithInfo(c,zobj,eptr != NULL);
-        sptr = ziplistNext(zl,eptr);
+        sptr = lpNext(zl,eptr);
 
         /* We don't know in advance how many matching elements there are in the
          * list, so we push this object that will represent the multi-bulk
@@ -2361,8 +3399,8 @@ void genericZrangebyscoreCommand(redisClient *c, int reverse) {
                 if (!zslValueLteMax(score,&range)) break;
             }
 
-            /* We know the element exists, so ziplistGet should always succeed */
-            redisAssertWithInfo(c,zobj,ziplistGet(eptr,&vstr,&vlen,&vlong));
+            /* We know the element exists, so lpGet should always succeed */
+            redisAssertWithInfo(c,zobj,lpGet(eptr,&vstr,&vlen,&vlong));
 
             rangelen++;
             if (vstr == NULL) {
@@ -2437,6 +3475,57 @@ void genericZrangebyscoreCommand(redisClient *c, int reverse) {
                 ln = ln->level[0].forward;
             }
         }
+    } else if (zobj->encoding == REDIS_ENCODING_BTREE) {
+        zset *zs = zobj->ptr;
+        zbtreePos pos;
+        int valid;
+
+        /* If reversed, get the last element in range as starting point. */
+        if (reverse) {
+            valid = zbtLastInRange(zs->zbt,&range,&pos,NULL);
+        } else {
+            valid = zbtFirstInRange(zs->zbt,&range,&pos,NULL);
+        }
+
+        /* No "first" element in the specified interval. */
+        if (!valid) {
+            addReply(c, shared.emptymultibulk);
+            return;
+        }
+
+        /* We don't know in advance how many matching elements there are in the
+         * list, so we push this object that will represent the multi-bulk
+         * length in the output buffer, and will "fix" it later */
+        replylen = addDeferredMultiBulkLength(c);
+
+        /* If there is an offset, skip it a leaf at a time without checking
+         * the score, that is done in the next loop. A negative offset skips
+         * everything, as with the other encodings. */
+        if (offset < 0)
+            valid = 0;
+        else if (offset > 0)
+            valid = zbtSkip(&pos,offset,reverse);
+
+        while (valid && limit--) {
+            double score = zbtPosScore(&pos);
+
+            /* Abort when the element is no longer in range. */
+            if (reverse) {
+                if (!zslValueGteMin(score,&range)) break;
+            } else {
+                if (!zslValueLteMax(score,&range)) break;
+            }
+
+            rangelen++;
+            addReplyBulk(c,zbtPosObj(&pos));
+
+            if (withscores) {
+                addReplyDouble(c,score);
+            }
+
+            /* Move to next element */
+            valid = reverse ? zbtPrev(&pos) : zbtNext(&pos);
+        }
     } else {
         redisPanic("Unknown sorted set encoding");
     }
@@ -2472,7 +3561,7 @@ void zcountCommand(redisClient *c) {
     if ((zobj = lookupKeyReadOrReply(c, key, shared.czero)) == NULL ||
         checkType(c, zobj, REDIS_ZSET)) return;
 
-    if (zobj->encoding == REDIS_ENCODING_ZIPLIST) {
+    if (zobj->encoding == REDIS_ENCODING_LISTPACK) {
         unsigned char *zl = zobj->ptr;
         unsigned char *eptr, *sptr;
         double score;
@@ -2487,7 +3576,7 @@ void zcountCommand(redisClient *c) {
         }
 
         /* First element is in range */
-        sptr = ziplistNext(zl,eptr);
+        sptr = lpNext(zl,eptr);
         score = zzlGetScore(sptr);
         redisAssertWithInfo(c,zobj,zslValueLteMax(score,&range));
 
@@ -2526,6 +3615,14 @@ void zcountCommand(redisClient *c) {
                 count -= (zsl->length - rank);
             }
         }
+    } else if (zobj->encoding == REDIS_ENCODING_BTREE) {
+        zset *zs = zobj->ptr;
+        unsigned long first, last;
+
+        /* Both ranks are found while descending the tree. */
+        if (zbtFirstInRange(zs->zbt,&range,NULL,&first) &&
+            zbtLastInRange(zs->zbt,&range,NULL,&last))
+            count = last-first+1;
     } else {
         redisPanic("Unknown sorted set encoding");
     }
@@ -2553,7 +3650,7 @@ void zlexcountCommand(redisClient *c) {
         return;
     }
 
-    if (zobj->encoding == REDIS_ENCODING_ZIPLIST) {
+    if (zobj->encoding == REDIS_ENCODING_LISTPACK) {
         unsigned char *zl = zobj->ptr;
         unsigned char *eptr, *sptr;
 
@@ -2568,7 +3665,7 @@ void zlexcountCommand(redisClient *c) {
         }
 
         /* First element is in range */
-        sptr = ziplistNext(zl,eptr);
+        sptr = lpNext(zl,eptr);
         redisAssertWithInfo(c,zobj,zzlLexValueLteMax(eptr,&range));
 
         /* Iterate over elements in range */
@@ -2604,6 +3701,14 @@ void zlexcountCommand(redisClient *c) {
                 count -= (zsl->length - rank);
             }
         }
+    } else if (zobj->encoding == REDIS_ENCODING_BTREE) {
+        zset *zs = zobj->ptr;
+        unsigned long first, last;
+
+        /* Both ranks are found while descending the tree. */
+        if (zbtFirstInLexRange(zs->zbt,&range,NULL,&first) &&
+            zbtLastInLexRange(zs->zbt,&range,NULL,&last))
+            count = last-first+1;
     } else {
         redisPanic("Unknown sorted set encoding");
     }
@@ -2663,7 +3768,7 @@ void genericZrangebylexCommand(redisClient *c, int reverse) {
         return;
     }
 
-    if (zobj->encoding == REDIS_ENCODING_ZIPLIST) {
+    if (zobj->encoding == REDIS_ENCODING_LISTPACK) {
         unsigned char *zl = zobj->ptr;
         unsigned char *eptr, *sptr;
         unsigned char *vstr;
@@ -2686,7 +3791,7 @@ void genericZrangebylexCommand(redisClient *c, int reverse) {
 
         /* Get score pointer for the first element. */
         redisAssertWithInfo(c,zobj,eptr != NULL);
-        sptr = ziplistNext(zl,eptr);
+        sptr = lpNext(zl,eptr);
 
         /* We don't know in advance how many matching elements there are in the
          * list, so we push this object that will represent the multi-bulk
@@ -2711,9 +3816,9 @@ void genericZrangebylexCommand(redisClient *c, int reverse) {
                 if (!zzlLexValueLteMax(eptr,&range)) break;
             }
 
-            /* We know the element exists, so ziplistGet should always
+            /* We know the element exists, so lpGet should always
              * succeed. */
-            redisAssertWithInfo(c,zobj,ziplistGet(eptr,&vstr,&vlen,&vlong));
+            redisAssertWithInfo(c,zobj,lpGet(eptr,&vstr,&vlen,&vlong));
 
             rangelen++;
             if (vstr == NULL) {
@@ -2781,6 +3886,52 @@ void genericZrangebylexCommand(redisClient *c, int reverse) {
                 ln = ln->level[0].forward;
             }
         }
+    } else if (zobj->encoding == REDIS_ENCODING_BTREE) {
+        zset *zs = zobj->ptr;
+        zbtreePos pos;
+        int valid;
+
+        /* If reversed, get the last element in range as starting point. */
+        if (reverse) {
+            valid = zbtLastInLexRange(zs->zbt,&range,&pos,NULL);
+        } else {
+            valid = zbtFirstInLexRange(zs->zbt,&range,&pos,NULL);
+        }
+
+        /* No "first" element in the specified interval. */
+        if (!valid) {
+            addReply(c, shared.emptymultibulk);
+            zslFreeLexRange(&range);
+            return;
+        }
+
+        /* We don't know in advance how many matching elements there are in the
+         * list, so we push this object that will represent the multi-bulk
+         * length in the output buffer, and will "fix" it later */
+        replylen = addDeferredMultiBulkLength(c);
+
+        /* If there is an offset, skip it a leaf at a time without checking
+         * the range, that is done in the next loop. A negative offset skips
+         * everything, as with the other encodings. */
+        if (offset < 0)
+            valid = 0;
+        else if (offset > 0)
+            valid = zbtSkip(&pos,offset,reverse);
+
+        while (valid && limit--) {
+            /* Abort when the element is no longer in range. */
+            if (reverse) {
+                if (!zslLexValueGteMin(zbtPosObj(&pos),&range)) break;
+            } else {
+                if (!zslLexValueLteMax(zbtPosObj(&pos),&range)) break;
+            }
+
+            rangelen++;
+            addReplyBulk(c,zbtPosObj(&pos));
+
+            /* Move to next element */
+            valid = reverse ? zbtPrev(&pos) : zbtNext(&pos);
+        }
     } else {
         redisPanic("Unknown sorted set encoding");
     }
@@ -2815,19 +3966,21 @@ void zscoreCommand(redisClient *c) {
     if ((zobj = lookupKeyReadOrReply(c,key,shared.nullbulk)) == NULL ||
         checkType(c,zobj,REDIS_ZSET)) return;
 
-    if (zobj->encoding == REDIS_ENCODING_ZIPLIST) {
+    if (zobj->encoding == REDIS_ENCODING_LISTPACK) {
         if (zzlFind(zobj->ptr,c->argv[2],&score) != NULL)
             addReplyDouble(c,score);
         else
             addReply(c,shared.nullbulk);
-    } else if (zobj->encoding == REDIS_ENCODING_SKIPLIST) {
+    } else if (zobj->encoding == REDIS_ENCODING_SKIPLIST ||
+               zobj->encoding == REDIS_ENCODING_BTREE)
+    {
         zset *zs = zobj->ptr;
         dictEntry *de;
 
         c->argv[2] = tryObjectEncoding(c->argv[2]);
         de = dictFind(zs->dict,c->argv[2]);
         if (de != NULL) {
-            score = *(double*)dictGetVal(de);
+            score = dictGetDoubleVal(de);
             addReplyDouble(c,score);
         } else {
             addReply(c,shared.nullbulk);
@@ -2850,18 +4003,18 @@ void zrankGenericCommand(redisClient *c, int reverse) {
 
     redisAssertWithInfo(c,ele,sdsEncodedObject(ele));
 
-    if (zobj->encoding == REDIS_ENCODING_ZIPLIST) {
+    if (zobj->encoding == REDIS_ENCODING_LISTPACK) {
         unsigned char *zl = zobj->ptr;
         unsigned char *eptr, *sptr;
 
-        eptr = ziplistIndex(zl,0);
+        eptr = lpSeek(zl,0);
         redisAssertWithInfo(c,zobj,eptr != NULL);
-        sptr = ziplistNext(zl,eptr);
+        sptr = lpNext(zl,eptr);
         redisAssertWithInfo(c,zobj,sptr != NULL);
 
         rank = 1;
         while(eptr != NULL) {
-            if (ziplistCompare(eptr,ele->ptr,sdslen(ele->ptr)))
+            if (lpCompare(eptr,ele->ptr,sdslen(ele->ptr)))
                 break;
             rank++;
             zzlNext(zl,&eptr,&sptr);
@@ -2875,17 +4028,19 @@ void zrankGenericCommand(redisClient *c, int reverse) {
         } else {
             addReply(c,shared.nullbulk);
         }
-    } else if (zobj->encoding == REDIS_ENCODING_SKIPLIST) {
+    } else if (zobj->encoding == REDIS_ENCODING_SKIPLIST ||
+               zobj->encoding == REDIS_ENCODING_BTREE)
+    {
         zset *zs = zobj->ptr;
-        zskiplist *zsl = zs->zsl;
+        zskiplist *zsl = zs->zsl; /* NULL for B+trees. */
         dictEntry *de;
         double score;
 
         ele = c->argv[2] = tryObjectEncoding(c->argv[2]);
         de = dictFind(zs->dict,ele);
         if (de != NULL) {
-            score = *(double*)dictGetVal(de);
-            rank = zslGetRank(zsl,score,ele);
+            score = dictGetDoubleVal(de);
+            rank = zsl ? zslGetRank(zsl,score,ele) : zbtGetRank(zs->zbt,score,ele);
             redisAssertWithInfo(c,ele,rank); /* Existing elements always have a rank. */
             if (reverse)
                 addReplyLongLong(c,llen-rank);
@@ -53,6 +53,10 @@
 #define REDIS_SET_INTSET 11
 #define REDIS_ZSET_ZIPLIST 12
 #define REDIS_HASH_ZIPLIST 13
+#define REDIS_LIST_QUICKLIST 14
+#define REDIS_HASH_LISTPACK 16
+#define REDIS_ZSET_LISTPACK 17
+#define REDIS_LIST_QUICKLIST_2 18
 
 /* Objects encoding. Some kind of objects like Strings and Hashes can be
  * internally represented in multiple ways. The 'encoding' field of the object
@@ -139,7 +143,7 @@ typedef struct {
 static double R_Zero, R_PosInf, R_NegInf, R_Nan;
 
 #define MAX_TYPES_NUM 256
-#define MAX_TYPE_NAME_LEN 16
+#define MAX_TYPE_NAME_LEN 32
 /* store string types for output */
 static char types[MAX_TYPES_NUM][MAX_TYPE_NAME_LEN];
 
@@ -148,7 +152,8 @@ int checkType(unsigned char t) {
     /* In case a new object type is added, update the following
      * condition as necessary. */
     return
-        (t >= REDIS_HASH_ZIPMAP && t <= REDIS_HASH_ZIPLIST) ||
+        (t >= REDIS_HASH_ZIPMAP && t <= REDIS_LIST_QUICKLIST) ||
+        (t >= REDIS_HASH_LISTPACK && t <= REDIS_LIST_QUICKLIST_2) ||
         t <= REDIS_HASH ||
         t >= REDIS_EXPIRETIME_MS;
 }
@@ -182,7 +187,7 @@ int processHeader(void) {
     }
 
     dump_version = (int)strtol(buf + 5, NULL, 10);
-    if (dump_version < 1 || dump_version > 6) {
+    if (dump_version < 1 || dump_version > 8) {
         ERROR("Unknown RDB format version: %d\n", dump_version);
     }
     return dump_version;
@@ -418,6 +423,8 @@ int loadPair(entry *e) {
 
     uint32_t length = 0;
     if (e->type == REDIS_LIST ||
+        e->type == REDIS_LIST_QUICKLIST ||
+        e->type == REDIS_LIST_QUICKLIST_2 ||
         e->type == REDIS_SET  ||
         e->type == REDIS_ZSET ||
         e->type == REDIS_HASH) {
@@ -434,12 +441,16 @@ int loadPair(entry *e) {
     case REDIS_SET_INTSET:
     case REDIS_ZSET_ZIPLIST:
     case REDIS_HASH_ZIPLIST:
+    case REDIS_HASH_LISTPACK:
+    case REDIS_ZSET_LISTPACK:
         if (!processStringObject(NULL)) {
             SHIFT_ERROR(offset, "Error reading entry value");
             return 0;
         }
     break;
     case REDIS_LIST:
+    case REDIS_LIST_QUICKLIST:
+    case REDIS_LIST_QUICKLIST_2:
     case REDIS_SET:
         for (i = 0; i < length; i++) {
             offset = CURR_OFFSET;
@@ -751,6 +762,10 @@ int main(int argc, char **argv) {
     sprintf(types[REDIS_SET], "SET");
     sprintf(types[REDIS_ZSET], "ZSET");
     sprintf(types[REDIS_HASH], "HASH");
+    sprintf(types[REDIS_LIST_QUICKLIST], "LIST_QUICKLIST");
+    sprintf(types[REDIS_HASH_LISTPACK], "HASH_LISTPACK");
+    sprintf(types[REDIS_ZSET_LISTPACK], "ZSET_LISTPACK");
+    sprintf(types[REDIS_LIST_QUICKLIST_2], "LIST_QUICKLIST_2");
 
     /* Object types only used for dumping to disk */
     sprintf(types[REDIS_EXPIRETIME], "EXPIRETIME");
@@ -36,7 +36,7 @@
 
 /* This helper function used by GETBIT / SETBIT parses the bit offset argument
  * making sure an error is returned if it is negative or if it overflows
- * Redis 512 MB limit for the string value. */
+ * the proto-max-bulk-len limit for the string value. */
 static int getBitOffsetFromArgument(redisClient *c, robj *o, size_t *offset) {
     long long loffset;
     char *err = "bit offset is not an integer or out of range";
@@ -44,8 +44,9 @@ static int getBitOffsetFromArgument(redisClient *c, robj *o, size_t *offset) {
     if (getLongLongFromObjectOrReply(c,o,&loffset,err) != REDIS_OK)
         return REDIS_ERR;
 
-    /* Limit offset to 512MB in bytes */
-    if ((loffset < 0) || ((unsigned long long)loffset >> 3) >= (512*1024*1024))
+    /* Limit offset to proto-max-bulk-len (512MB by default) in bytes */
+    if ((loffset < 0) ||
+        ((unsigned long long)loffset >> 3) >= (unsigned long long)server.proto_max_bulk_len)
     {
         addReplyError(c,err);
         return REDIS_ERR;
@@ -196,12 +196,12 @@ struct commandHelp {
     0,
     "1.2.0" },
     { "FLUSHALL",
-    "-",
+    "[ASYNC]",
     "Remove all keys from all databases",
     9,
     "1.0.0" },
     { "FLUSHDB",
-    "-",
+    "[ASYNC]",
     "Remove all keys from the current database",
     9,
     "1.0.0" },
@@ -620,6 +620,11 @@ struct commandHelp {
     "Intersect multiple sets and store the resulting set in a key",
     3,
     "1.0.0" },
+    { "SINTERCARD",
+    "numkeys key [key ...] [LIMIT limit]",
+    "Return the number of elements in the intersection of multiple sets",
+    3,
+    "3.0.5" },
     { "SISMEMBER",
     "key member",
     "Determine if a given value is a member of a set",
@@ -710,6 +715,11 @@ struct commandHelp {
     "Determine the type stored at key",
     0,
     "1.0.0" },
+    { "UNLINK",
+    "key [key ...]",
+    "Delete a key asynchronously in another thread",
+    0,
+    "3.0.5" },
     { "UNSUBSCRIBE",
     "[channel [channel ...]]",
     "Stop listening for messages posted to the given channels",
@@ -1,16 +1,18 @@
 /* Background I/O service for Redis.
  *
  * This file implements operations that we need to perform in the background.
- * Currently there is only a single operation, that is a background close(2)
- * system call. This is needed as when the process is the last owner of a
- * reference to a file closing it means unlinking it, and the deletion of the
- * file is slow, blocking the server.
+ * Currently there are three operations:
+ *
+ * 1) A background close(2) system call. This is needed as when the process
+ *    is the last owner of a reference to a file closing it means unlinking
+ *    it, and the deletion of the file is slow, blocking the server.
+ * 2) A background fsync(2) of the AOF.
+ * 3) The release of the values deleted with UNLINK and of the databases
+ *    flushed with FLUSHDB / FLUSHALL ASYNC, see lazyfree.c.
  *
  * In the future we'll either continue implementing new things we need or
  * we'll switch to libeio. However there are probably long term uses for this
- * file as we may want to put here Redis specific background tasks (for instance
- * it is not impossible that we'll need a non blocking FLUSHDB/FLUSHALL
- * implementation).
+ * file as we may want to put here Redis specific background tasks.
  *
  * DESIGN
  * ------
@@ -176,6 +178,15 @@ void *bioProcessBackgroundJobs(void *arg) {
             close((long)job->arg1);
         } else if (type == REDIS_BIO_AOF_FSYNC) {
             aof_fsync((long)job->arg1);
+        } else if (type == REDIS_BIO_LAZY_FREE) {
+            /* A single object is passed as arg1, with the estimate of its
+             * size as arg2, while the dictionaries of a flushed database
+             * are passed as arg2 and arg3. */
+            if (job->arg1)
+                lazyfreeFreeObjectFromBioThread(job->arg1,
+                    (size_t)(uintptr_t)job->arg2);
+            else
+                lazyfreeFreeDatabaseFromBioThread(job->arg2,job->arg3);
         } else {
             redisPanic("Wrong job type in bioProcessBackgroundJobs().");
         }
@@ -35,20 +35,38 @@
 #include "zmalloc.h"
 #include "endianconv.h"
 
+/* The lookup and upgrade hot paths use SSE2 when the compiler targets it,
+ * that is always the case on x86_64. Comparing 64 bit integers requires
+ * SSE4.2, so INT64 intsets use the scalar code unless built with it. */
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+#if defined(__SSE4_2__)
+#include <nmmintrin.h>
+#endif
+
 /* Note that these encodings are ordered, so:
- * INTSET_ENC_INT16 < INTSET_ENC_INT32 < INTSET_ENC_INT64. */
+ * INTSET_ENC_INT8 < INTSET_ENC_INT16 < INTSET_ENC_INT32 < INTSET_ENC_INT64. */
+#define INTSET_ENC_INT8 (sizeof(int8_t))
 #define INTSET_ENC_INT16 (sizeof(int16_t))
 #define INTSET_ENC_INT32 (sizeof(int32_t))
 #define INTSET_ENC_INT64 (sizeof(int64_t))
 
+/* intsetSearch() uses a binary search only until the range of candidate
+ * elements fits in this many bytes, that is a cache line, and scans the
+ * range linearly after that, see intsetRank(). */
+#define INTSET_LINEAR_BYTES 64
+
 /* Return the required encoding for the provided value. */
 static uint8_t _intsetValueEncoding(int64_t v) {
     if (v < INT32_MIN || v > INT32_MAX)
         return INTSET_ENC_INT64;
     else if (v < INT16_MIN || v > INT16_MAX)
         return INTSET_ENC_INT32;
-    else
+    else if (v < INT8_MIN || v > INT8_MAX)
         return INTSET_ENC_INT16;
+    else
+        return INTSET_ENC_INT8;
 }
 
 /* Return the value at pos, given an encoding. */
@@ -65,10 +83,12 @@ static int64_t _intsetGetEncoded(intset *is, int pos, uint8_t enc) {
         memcpy(&v32,((int32_t*)is->contents)+pos,sizeof(v32));
         memrev32ifbe(&v32);
         return v32;
-    } else {
+    } else if (enc == INTSET_ENC_INT16) {
         memcpy(&v16,((int16_t*)is->contents)+pos,sizeof(v16));
         memrev16ifbe(&v16);
         return v16;
+    } else {
+        return is->contents[pos];
     }
 }
 
@@ -87,16 +107,18 @@ static void _intsetSet(intset *is, int pos, int64_t value) {
     } else if (encoding == INTSET_ENC_INT32) {
         ((int32_t*)is->contents)[pos] = value;
         memrev32ifbe(((int32_t*)is->contents)+pos);
-    } else {
+    } else if (encoding == INTSET_ENC_INT16) {
         ((int16_t*)is->contents)[pos] = value;
         memrev16ifbe(((int16_t*)is->contents)+pos);
+    } else {
+        is->contents[pos] = value;
     }
 }
 
 /* Create an empty intset. */
 intset *intsetNew(void) {
     intset *is = zmalloc(sizeof(intset));
-    is->encoding = intrev32ifbe(INTSET_ENC_INT16);
+    is->encoding = intrev32ifbe(INTSET_ENC_INT8);
     is->length = 0;
     return is;
 }
@@ -108,75 +130,180 @@ static intset *intsetResize(intset *is, uint32_t len) {
     return is;
 }
 
+/* Return how many of the 'count' elements starting at position 'from' are
+ * smaller than 'value'. Since the elements are sorted this is the offset,
+ * relative to 'from', of 'value' or of the position where it should be
+ * inserted. The value must be representable with the intset encoding.
+ *
+ * When SSE2 is available 16 bytes of elements are compared at once: the
+ * comparison mask is a run of ones for the elements smaller than 'value',
+ * so the first zero bit tells where the run ends. */
+#if defined(__SSE2__)
+#define INTSET_RANK_SSE(type,set1,cmpgt) do { \
+    const type *p = (const type*)is->contents+from; \
+    __m128i v = set1((type)value); \
+    for (; i+16/sizeof(type) <= count; i += 16/sizeof(type)) { \
+        __m128i x = _mm_loadu_si128((const __m128i*)(p+i)); \
+        unsigned int mask = _mm_movemask_epi8(cmpgt(v,x)); \
+        if (mask != 0xffff) return i+__builtin_ctz(~mask)/sizeof(type); \
+    } \
+} while(0)
+#endif
+
+static uint32_t intsetRank(intset *is, uint32_t from, uint32_t count, int64_t value) {
+    uint8_t enc = intrev32ifbe(is->encoding);
+    uint32_t i = 0;
+
+#if defined(__SSE2__)
+    if (enc == INTSET_ENC_INT8)
+        INTSET_RANK_SSE(int8_t,_mm_set1_epi8,_mm_cmpgt_epi8);
+    else if (enc == INTSET_ENC_INT16)
+        INTSET_RANK_SSE(int16_t,_mm_set1_epi16,_mm_cmpgt_epi16);
+    else if (enc == INTSET_ENC_INT32)
+        INTSET_RANK_SSE(int32_t,_mm_set1_epi32,_mm_cmpgt_epi32);
+#if defined(__SSE4_2__)
+    else
+        INTSET_RANK_SSE(int64_t,_mm_set1_epi64x,_mm_cmpgt_epi64);
+#endif
+#endif
+    while (i < count && _intsetGetEncoded(is,from+i,enc) < value) i++;
+    return i;
+}
+
+/* Search "value" among the elements in the range [min,max), knowing that
+ * the elements before 'min' are smaller and the ones from 'max' on are
+ * greater. Return 1 and set "pos" to its position if found, otherwise
+ * return 0 and set "pos" to the position where it can be inserted.
+ *
+ * The binary search stops as soon as the candidates fit in a cache line,
+ * then intsetRank() scans them: for small sets, like the ones using the
+ * INT8 encoding, this is often the only step. */
+static uint8_t _intsetSearchRange(intset *is, int64_t value, uint32_t min, uint32_t max, uint32_t *pos) {
+    uint8_t enc = intrev32ifbe(is->encoding);
+    uint32_t mid;
+    int64_t cur;
+
+    while((size_t)(max-min)*enc > INTSET_LINEAR_BYTES) {
+        mid = min+(max-min)/2;
+        cur = _intsetGet(is,mid);
+        if (value > cur) {
+            min = mid+1;
+        } else if (value < cur) {
+            max = mid;
+        } else {
+            if (pos) *pos = mid;
+            return 1;
+        }
+    }
+
+    mid = min+intsetRank(is,min,max-min,value);
+    if (pos) *pos = mid;
+    return mid < max && _intsetGet(is,mid) == value;
+}
+
 /* Search for the position of "value". Return 1 when the value was found and
  * sets "pos" to the position of the value within the intset. Return 0 when
  * the value is not present in the intset and sets "pos" to the position
  * where "value" can be inserted. */
 static uint8_t intsetSearch(intset *is, int64_t value, uint32_t *pos) {
-    int min = 0, max = intrev32ifbe(is->length)-1, mid = -1;
-    int64_t cur = -1;
+    uint32_t len = intrev32ifbe(is->length);
 
     /* The value can never be found when the set is empty */
-    if (intrev32ifbe(is->length) == 0) {
+    if (len == 0) {
         if (pos) *pos = 0;
         return 0;
     } else {
         /* Check for the case where we know we cannot find the value,
          * but do know the insert position. */
-        if (value > _intsetGet(is,intrev32ifbe(is->length)-1)) {
-            if (pos) *pos = intrev32ifbe(is->length);
+        if (value > _intsetGet(is,len-1)) {
+            if (pos) *pos = len;
             return 0;
         } else if (value < _intsetGet(is,0)) {
             if (pos) *pos = 0;
             return 0;
         }
     }
+    return _intsetSearchRange(is,value,0,len,pos);
+}
 
-    while(max >= min) {
-        mid = ((unsigned int)min + (unsigned int)max) >> 1;
-        cur = _intsetGet(is,mid);
-        if (value > cur) {
-            min = mid+1;
-        } else if (value < cur) {
-            max = mid-1;
-        } else {
-            break;
-        }
-    }
+#if defined(__SSE2__)
+/* Sign extend the elements of encoding 'enc' in 'x' to 'dstenc', storing
+ * them at 'dst'. Every step doubles the size of the elements, splitting
+ * the vector in two halves. */
+static void _intsetWidenVector(char *dst, __m128i x, uint8_t enc, uint8_t dstenc) {
+    __m128i sign, lo, hi;
 
-    if (value == cur) {
-        if (pos) *pos = mid;
-        return 1;
+    if (enc == dstenc) {
+        _mm_storeu_si128((__m128i*)dst,x);
+        return;
+    }
+    sign = _mm_setzero_si128();
+    if (enc == INTSET_ENC_INT8) {
+        sign = _mm_cmpgt_epi8(sign,x);
+        lo = _mm_unpacklo_epi8(x,sign);
+        hi = _mm_unpackhi_epi8(x,sign);
+    } else if (enc == INTSET_ENC_INT16) {
+        sign = _mm_cmpgt_epi16(sign,x);
+        lo = _mm_unpacklo_epi16(x,sign);
+        hi = _mm_unpackhi_epi16(x,sign);
     } else {
-        if (pos) *pos = min;
-        return 0;
+        sign = _mm_cmpgt_epi32(sign,x);
+        lo = _mm_unpacklo_epi32(x,sign);
+        hi = _mm_unpackhi_epi32(x,sign);
+    }
+    /* Every half holds 8/enc elements taking dstenc bytes each. */
+    _intsetWidenVector(dst,lo,enc*2,dstenc);
+    _intsetWidenVector(dst+8*dstenc/enc,hi,enc*2,dstenc);
+}
+#endif
+
+/* Copy 'count' elements of 'src' starting at position 'srcpos' into 'dst'
+ * starting at position 'dstpos'. The encoding of 'dst' must be the same
+ * or larger than the one of 'src': elements are converted as needed. */
+static void _intsetCopy(intset *dst, uint32_t dstpos, intset *src, uint32_t srcpos, uint32_t count) {
+    uint8_t srcenc = intrev32ifbe(src->encoding);
+    uint8_t dstenc = intrev32ifbe(dst->encoding);
+    char *d = (char*)dst->contents+(size_t)dstpos*dstenc;
+    const char *s = (const char*)src->contents+(size_t)srcpos*srcenc;
+    uint32_t i = 0;
+
+    if (srcenc == dstenc) {
+        memcpy(d,s,(size_t)count*srcenc);
+        return;
     }
+#if defined(__SSE2__)
+    for (; i+16/srcenc <= count; i += 16/srcenc) {
+        __m128i x = _mm_loadu_si128((const __m128i*)(s+(size_t)i*srcenc));
+        _intsetWidenVector(d+(size_t)i*dstenc,x,srcenc,dstenc);
+    }
+#endif
+    for (; i < count; i++)
+        _intsetSet(dst,dstpos+i,_intsetGetEncoded(src,srcpos+i,srcenc));
 }
 
-/* Upgrades the intset to a larger encoding and inserts the given integer. */
+/* Upgrades the intset to a larger encoding and inserts the given integer.
+ * The elements are converted into a new allocation, so that they can be
+ * processed front to back a vector at a time. */
 static intset *intsetUpgradeAndAdd(intset *is, int64_t value) {
-    uint8_t curenc = intrev32ifbe(is->encoding);
     uint8_t newenc = _intsetValueEncoding(value);
-    int length = intrev32ifbe(is->length);
+    uint32_t length = intrev32ifbe(is->length);
     int prepend = value < 0 ? 1 : 0;
+    intset *newis = zmalloc(sizeof(intset)+((size_t)length+1)*newenc);
 
-    /* First set new encoding and resize */
-    is->encoding = intrev32ifbe(newenc);
-    is = intsetResize(is,intrev32ifbe(is->length)+1);
+    newis->encoding = intrev32ifbe(newenc);
+    newis->length = intrev32ifbe(length+1);
 
-    /* Upgrade back-to-front so we don't overwrite values.
-     * Note that the "prepend" variable is used to make sure we have an empty
+    /* The "prepend" variable is used to make sure we have an empty
      * space at either the beginning or the end of the intset. */
-    while(length--)
-        _intsetSet(is,length+prepend,_intsetGetEncoded(is,length,curenc));
+    _intsetCopy(newis,prepend,is,0,length);
 
     /* Set the value at the beginning or the end. */
     if (prepend)
-        _intsetSet(is,0,value);
+        _intsetSet(newis,0,value);
     else
-        _intsetSet(is,intrev32ifbe(is->length),value);
-    is->length = intrev32ifbe(intrev32ifbe(is->length)+1);
-    return is;
+        _intsetSet(newis,length,value);
+    zfree(is);
+    return newis;
 }
 
 static void intsetMoveTail(intset *is, uint32_t from, uint32_t to) {
@@ -192,10 +319,13 @@ static void intsetMoveTail(intset *is, uint32_t from, uint32_t to) {
         src = (int32_t*)is->contents+from;
         dst = (int32_t*)is->contents+to;
         bytes *= sizeof(int32_t);
-    } else {
+    } else if (encoding == INTSET_ENC_INT16) {
         src = (int16_t*)is->contents+from;
         dst = (int16_t*)is->contents+to;
         bytes *= sizeof(int16_t);
+    } else {
+        src = is->contents+from;
+        dst = is->contents+to;
     }
     memmove(dst,src,bytes);
 }
@@ -256,6 +386,151 @@ uint8_t intsetFind(intset *is, int64_t value) {
     return valenc <= intrev32ifbe(is->encoding) && intsetSearch(is,value,NULL);
 }
 
+/* Like intsetFind(), but only the elements from position '*cursor' on are
+ * considered: all the elements before it must be smaller than 'value'.
+ * On return '*cursor' is set to the position of the value, or to the one
+ * where it would be inserted, so that searching a sequence of increasing
+ * values visits the set only once.
+ *
+ * The range containing the value is found galloping from the cursor, with
+ * a step that doubles at every probe, so the cost is logarithmic in the
+ * distance between the cursor and the value rather than in the set size. */
+uint8_t intsetFindFrom(intset *is, int64_t value, uint32_t *cursor) {
+    uint32_t len = intrev32ifbe(is->length);
+    uint32_t lo = *cursor;
+    uint64_t hi = lo, step = 1;
+
+    if (_intsetValueEncoding(value) > intrev32ifbe(is->encoding)) {
+        if (value > 0) *cursor = len;
+        return 0;
+    }
+    while (hi < len && _intsetGet(is,hi) < value) {
+        lo = hi+1;
+        hi += step;
+        step <<= 1;
+    }
+    /* The element at 'hi', if any, is not smaller than the value. */
+    return _intsetSearchRange(is,value,lo,hi < len ? hi+1 : len,cursor);
+}
+
+/* Return a new intset with the elements that are both in 'a' and 'b'.
+ *
+ * Every element of the smaller set is looked up in the bigger one starting
+ * from the position where the previous lookup stopped. Unless the bigger set
+ * is more than INTSET_GALLOP_RATIO times bigger, intsetRank() skips the
+ * elements between two lookups a vector at a time, scanning it once.
+ * Otherwise the lookups gallop with intsetFindFrom(), so that intersecting
+ * a small set with a big one costs O(small*log(big/small)). */
+#define INTSET_GALLOP_RATIO 128
+intset *intsetIntersect(intset *a, intset *b) {
+    intset *small = a, *big = b, *res;
+    uint32_t slen, blen, i, cursor = 0, n = 0;
+    uint8_t benc, resenc;
+    int gallop;
+
+    if (intrev32ifbe(a->length) > intrev32ifbe(b->length)) {
+        small = b;
+        big = a;
+    }
+    slen = intrev32ifbe(small->length);
+    blen = intrev32ifbe(big->length);
+    benc = intrev32ifbe(big->encoding);
+    gallop = (uint64_t)slen*INTSET_GALLOP_RATIO < blen;
+
+    /* Common elements fit the smaller of the two encodings. */
+    resenc = intrev32ifbe(small->encoding);
+    if (benc < resenc) resenc = benc;
+    res = zmalloc(sizeof(intset)+(size_t)slen*resenc);
+    res->encoding = intrev32ifbe(resenc);
+
+    for (i = 0; i < slen && cursor < blen; i++) {
+        int64_t value = _intsetGet(small,i);
+
+        if (gallop) {
+            if (intsetFindFrom(big,value,&cursor)) {
+                _intsetSet(res,n++,value);
+                cursor++;
+            }
+            continue;
+        }
+
+        /* Values out of the range of the bigger set encoding are either
+         * smaller or greater than all its elements. */
+        if (_intsetValueEncoding(value) > benc) {
+            if (value < 0) continue;
+            break;
+        }
+        cursor += intsetRank(big,cursor,blen-cursor,value);
+        if (cursor < blen && _intsetGet(big,cursor) == value) {
+            _intsetSet(res,n++,value);
+            cursor++;
+        }
+    }
+    res->length = intrev32ifbe(n);
+    return intsetResize(res,n);
+}
+
+/* Return a new intset with the elements that are in 'a' or in 'b', merging
+ * the two sorted arrays. */
+intset *intsetUnion(intset *a, intset *b) {
+    uint32_t alen = intrev32ifbe(a->length), blen = intrev32ifbe(b->length);
+    uint32_t i = 0, j = 0, n = 0;
+    uint8_t enc = intrev32ifbe(a->encoding);
+    intset *res;
+
+    if (intrev32ifbe(b->encoding) > enc) enc = intrev32ifbe(b->encoding);
+    res = zmalloc(sizeof(intset)+((size_t)alen+blen)*enc);
+    res->encoding = intrev32ifbe(enc);
+
+    while (i < alen && j < blen) {
+        int64_t va = _intsetGet(a,i), vb = _intsetGet(b,j);
+
+        if (va <= vb) {
+            _intsetSet(res,n++,va);
+            i++;
+            if (va == vb) j++;
+        } else {
+            _intsetSet(res,n++,vb);
+            j++;
+        }
+    }
+    /* At most one of the two sets has elements left. */
+    _intsetCopy(res,n,a,i,alen-i);
+    n += alen-i;
+    _intsetCopy(res,n,b,j,blen-j);
+    n += blen-j;
+    res->length = intrev32ifbe(n);
+    return intsetResize(res,n);
+}
+
+/* Return a new intset with the elements of 'a' that are not in 'b'. */
+intset *intsetDifference(intset *a, intset *b) {
+    uint32_t alen = intrev32ifbe(a->length), blen = intrev32ifbe(b->length);
+    uint32_t i, n = 0, cursor = 0;
+    intset *res = zmalloc(sizeof(intset)+(size_t)alen*intrev32ifbe(a->encoding));
+
+    res->encoding = a->encoding;
+    for (i = 0; i < alen && cursor < blen; i++) {
+        int64_t value = _intsetGet(a,i);
+
+        if (!intsetFindFrom(b,value,&cursor)) _intsetSet(res,n++,value);
+    }
+    /* The remaining elements are greater than all the elements of 'b'. */
+    _intsetCopy(res,n,a,i,alen-i);
+    n += alen-i;
+    res->length = intrev32ifbe(n);
+    return intsetResize(res,n);
+}
+
+/* Return a copy of the intset. */
+intset *intsetDup(intset *is) {
+    size_t len = intsetBlobLen(is);
+    intset *copy = zmalloc(len);
+
+    memcpy(copy,is,len);
+    return copy;
+}
+
 /* Return random member */
 int64_t intsetRandom(intset *is) {
     return _intsetGet(is,rand()%intrev32ifbe(is->length));
@@ -335,7 +610,10 @@ void checkConsistency(intset *is) {
     for (i = 0; i < (intrev32ifbe(is->length)-1); i++) {
         uint32_t encoding = intrev32ifbe(is->encoding);
 
-        if (encoding == INTSET_ENC_INT16) {
+        if (encoding == INTSET_ENC_INT8) {
+            int8_t *i8 = (int8_t*)is->contents;
+            assert(i8[i] < i8[i+1]);
+        } else if (encoding == INTSET_ENC_INT16) {
             int16_t *i16 = (int16_t*)is->contents;
             assert(i16[i] < i16[i+1]);
         } else if (encoding == INTSET_ENC_INT32) {
@@ -355,6 +633,10 @@ int main(int argc, char **argv) {
     sranddev();
 
     printf("Value encodings: "); {
+        assert(_intsetValueEncoding(-128) == INTSET_ENC_INT8);
+        assert(_intsetValueEncoding(+127) == INTSET_ENC_INT8);
+        assert(_intsetValueEncoding(-129) == INTSET_ENC_INT16);
+        assert(_intsetValueEncoding(+128) == INTSET_ENC_INT16);
         assert(_intsetValueEncoding(-32768) == INTSET_ENC_INT16);
         assert(_intsetValueEncoding(+32767) == INTSET_ENC_INT16);
         assert(_intsetValueEncoding(-32769) == INTSET_ENC_INT32);
@@ -389,22 +671,43 @@ int main(int argc, char **argv) {
         ok();
     }
 
+    printf("Upgrade from int8 to int16: "); {
+        is = intsetNew();
+        for (i = -100; i < 100; i += 3) is = intsetAdd(is,i,NULL);
+        assert(intrev32ifbe(is->encoding) == INTSET_ENC_INT8);
+        is = intsetAdd(is,1000,NULL);
+        assert(intrev32ifbe(is->encoding) == INTSET_ENC_INT16);
+        for (i = -100; i < 100; i += 3) assert(intsetFind(is,i));
+        assert(intsetFind(is,1000));
+        assert(!intsetFind(is,-99));
+        checkConsistency(is);
+
+        is = intsetNew();
+        for (i = -100; i < 100; i += 3) is = intsetAdd(is,i,NULL);
+        is = intsetAdd(is,-4294967295,NULL);
+        assert(intrev32ifbe(is->encoding) == INTSET_ENC_INT64);
+        assert(_intsetGet(is,0) == -4294967295);
+        for (i = -100; i < 100; i += 3) assert(intsetFind(is,i));
+        checkConsistency(is);
+        ok();
+    }
+
     printf("Upgrade from int16 to int32: "); {
         is = intsetNew();
-        is = intsetAdd(is,32,NULL);
+        is = intsetAdd(is,320,NULL);
         assert(intrev32ifbe(is->encoding) == INTSET_ENC_INT16);
         is = intsetAdd(is,65535,NULL);
         assert(intrev32ifbe(is->encoding) == INTSET_ENC_INT32);
-        assert(intsetFind(is,32));
+        assert(intsetFind(is,320));
         assert(intsetFind(is,65535));
         checkConsistency(is);
 
         is = intsetNew();
-        is = intsetAdd(is,32,NULL);
+        is = intsetAdd(is,320,NULL);
         assert(intrev32ifbe(is->encoding) == INTSET_ENC_INT16);
         is = intsetAdd(is,-65535,NULL);
         assert(intrev32ifbe(is->encoding) == INTSET_ENC_INT32);
-        assert(intsetFind(is,32));
+        assert(intsetFind(is,320));
         assert(intsetFind(is,-65535));
         checkConsistency(is);
         ok();
@@ -412,20 +715,20 @@ int main(int argc, char **argv) {
 
     printf("Upgrade from int16 to int64: "); {
         is = intsetNew();
-        is = intsetAdd(is,32,NULL);
+        is = intsetAdd(is,320,NULL);
         assert(intrev32ifbe(is->encoding) == INTSET_ENC_INT16);
         is = intsetAdd(is,4294967295,NULL);
         assert(intrev32ifbe(is->encoding) == INTSET_ENC_INT64);
-        assert(intsetFind(is,32));
+        assert(intsetFind(is,320));
         assert(intsetFind(is,4294967295));
         checkConsistency(is);
 
         is = intsetNew();
-        is = intsetAdd(is,32,NULL);
+        is = intsetAdd(is,320,NULL);
         assert(intrev32ifbe(is->encoding) == INTSET_ENC_INT16);
         is = intsetAdd(is,-4294967295,NULL);
         assert(intrev32ifbe(is->encoding) == INTSET_ENC_INT64);
-        assert(intsetFind(is,32));
+        assert(intsetFind(is,320));
         assert(intsetFind(is,-4294967295));
         checkConsistency(is);
         ok();
@@ -464,6 +767,33 @@ int main(int argc, char **argv) {
         printf("%ld lookups, %ld element set, %lldusec\n",num,size,usec()-start);
     }
 
+    printf("Intersection: "); {
+        intset *a = intsetNew(), *b = intsetNew(), *res;
+        int64_t v;
+
+        for (i = -2000; i < 2000; i++) {
+            if (i % 2 == 0) a = intsetAdd(a,i,NULL);
+            if (i % 3 == 0) b = intsetAdd(b,i,NULL);
+        }
+        b = intsetAdd(b,-4294967295,NULL);
+        b = intsetAdd(b,4294967295,NULL);
+        res = intsetIntersect(a,b);
+        assert(intrev32ifbe(res->encoding) == INTSET_ENC_INT16);
+        checkConsistency(res);
+        for (i = -2000; i < 2000; i++)
+            assert(intsetFind(res,i) == (i % 6 == 0));
+        assert(intrev32ifbe(res->length) == 4000/6+1);
+        zfree(res);
+
+        res = intsetIntersect(b,b);
+        assert(intrev32ifbe(res->length) == intrev32ifbe(b->length));
+        assert(intsetGet(res,0,&v) && v == -4294967295);
+        zfree(res);
+        zfree(a);
+        zfree(b);
+        ok();
+    }
+
     printf("Stress add+delete: "); {
         int i, v1, v2;
         is = intsetNew();
@@ -53,7 +53,10 @@ dictType latencyTimeSeriesDictType = {
     NULL,                       /* val dup */
     dictStringKeyCompare,       /* key compare */
     dictVanillaFree,            /* key destructor */
-    dictVanillaFree             /* val destructor */
+    dictVanillaFree,            /* val destructor */
+    0,                          /* open addressing */
+    NULL,                       /* key embed len */
+    NULL                        /* key embed */
 };
 
 /* ------------------------- Utility functions ------------------------------ */
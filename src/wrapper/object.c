@@ -43,8 +43,9 @@ robj *createObject(int type, void *ptr) {
     o->ptr = ptr;
     o->refcount = 1;
 
-    /* Set the LRU to the current lruclock (minutes resolution). */
-    o->lru = LRU_CLOCK();
+    /* Set the LRU to the current lruclock (minutes resolution), or the
+     * initial LFU counter if an LFU maxmemory policy is in use. */
+    o->lru = objectInitialLRU();
     return o;
 }
 
@@ -58,23 +59,13 @@ robj *createRawStringObject(char *ptr, size_t len) {
  * an object where the sds string is actually an unmodifiable string
  * allocated in the same chunk as the object itself. */
 robj *createEmbeddedStringObject(char *ptr, size_t len) {
-    robj *o = zmalloc(sizeof(robj)+sizeof(struct sdshdr)+len+1);
-    struct sdshdr *sh = (void*)(o+1);
+    robj *o = zmalloc(sizeof(robj)+sdsHdrSize(SDS_TYPE_8)+len+1);
 
     o->type = REDIS_STRING;
     o->encoding = REDIS_ENCODING_EMBSTR;
-    o->ptr = sh+1;
+    o->ptr = sdsnewat(o+1,SDS_TYPE_8,ptr,len);
     o->refcount = 1;
-    o->lru = LRU_CLOCK();
-
-    sh->len = len;
-    sh->free = 0;
-    if (ptr) {
-        memcpy(sh->buf,ptr,len);
-        sh->buf[len] = '\0';
-    } else {
-        memset(sh->buf,0,len+1);
-    }
+    o->lru = objectInitialLRU();
     return o;
 }
 
@@ -82,9 +73,10 @@ robj *createEmbeddedStringObject(char *ptr, size_t len) {
  * REIDS_ENCODING_EMBSTR_SIZE_LIMIT, otherwise the RAW encoding is
  * used.
  *
- * The current limit of 39 is chosen so that the biggest string object
- * we allocate as EMBSTR will still fit into the 64 byte arena of jemalloc. */
-#define REDIS_ENCODING_EMBSTR_SIZE_LIMIT 39
+ * The current limit of 44 is chosen so that the biggest string object
+ * we allocate as EMBSTR will still fit into the 64 byte arena of jemalloc:
+ * 16 bytes of robj, 3 bytes of sdshdr8, 44 bytes of string, null term. */
+#define REDIS_ENCODING_EMBSTR_SIZE_LIMIT 44
 robj *createStringObject(char *ptr, size_t len) {
     if (len <= REDIS_ENCODING_EMBSTR_SIZE_LIMIT)
         return createEmbeddedStringObject(ptr,len);
@@ -180,11 +172,10 @@ robj *dupStringObject(robj *o) {
     }
 }
 
-robj *createListObject(void) {
-    list *l = listCreate();
+robj *createQuicklistObject(void) {
+    quicklist *l = quicklistCreate();
     robj *o = createObject(REDIS_LIST,l);
-    listSetFreeMethod(l,decrRefCountVoid);
-    o->encoding = REDIS_ENCODING_LINKEDLIST;
+    o->encoding = REDIS_ENCODING_QUICKLIST;
     return o;
 }
 
@@ -210,9 +201,9 @@ robj *createIntsetObject(void) {
 }
 
 robj *createHashObject(void) {
-    unsigned char *zl = ziplistNew();
-    robj *o = createObject(REDIS_HASH, zl);
-    o->encoding = REDIS_ENCODING_ZIPLIST;
+    unsigned char *lp = lpNew();
+    robj *o = createObject(REDIS_HASH, lp);
+    o->encoding = REDIS_ENCODING_LISTPACK;
     return o;
 }
 
@@ -221,16 +212,22 @@ robj *createZsetObject(void) {
     robj *o;
 
     zs->dict = dictCreate(&zsetDictType,NULL);
-    zs->zsl = zslCreate();
+    if (server.zset_use_btree) {
+        zs->zsl = NULL;
+        zs->zbt = zbtCreate();
+    } else {
+        zs->zsl = zslCreate();
+        zs->zbt = NULL;
+    }
     o = createObject(REDIS_ZSET,zs);
-    o->encoding = REDIS_ENCODING_SKIPLIST;
+    o->encoding = zsetIndexEncoding();
     return o;
 }
 
-robj *createZsetZiplistObject(void) {
-    unsigned char *zl = ziplistNew();
-    robj *o = createObject(REDIS_ZSET,zl);
-    o->encoding = REDIS_ENCODING_ZIPLIST;
+robj *createZsetListpackObject(void) {
+    unsigned char *lp = lpNew();
+    robj *o = createObject(REDIS_ZSET,lp);
+    o->encoding = REDIS_ENCODING_LISTPACK;
     return o;
 }
 
@@ -242,11 +239,8 @@ void freeStringObject(robj *o) {
 
 void freeListObject(robj *o) {
     switch (o->encoding) {
-    case REDIS_ENCODING_LINKEDLIST:
-        listRelease((list*) o->ptr);
-        break;
-    case REDIS_ENCODING_ZIPLIST:
-        zfree(o->ptr);
+    case REDIS_ENCODING_QUICKLIST:
+        quicklistRelease(o->ptr);
         break;
     default:
         redisPanic("Unknown list encoding type");
@@ -275,7 +269,13 @@ void freeZsetObject(robj *o) {
         zslFree(zs->zsl);
         zfree(zs);
         break;
-    case REDIS_ENCODING_ZIPLIST:
+    case REDIS_ENCODING_BTREE:
+        zs = o->ptr;
+        dictRelease(zs->dict);
+        zbtFree(zs->zbt);
+        zfree(zs);
+        break;
+    case REDIS_ENCODING_LISTPACK:
         zfree(o->ptr);
         break;
     default:
@@ -288,7 +288,7 @@ void freeHashObject(robj *o) {
     case REDIS_ENCODING_HT:
         dictRelease((dict*) o->ptr);
         break;
-    case REDIS_ENCODING_ZIPLIST:
+    case REDIS_ENCODING_LISTPACK:
         zfree(o->ptr);
         break;
     default:
@@ -297,13 +297,34 @@ void freeHashObject(robj *o) {
     }
 }
 
+/* Objects can be referenced at the same time by the main thread and by the
+ * values released by the lazy free thread (see lazyfree.c), so reference
+ * counting uses atomic operations when lazy freeing is supported. */
+#if defined(__ATOMIC_RELAXED)
+#define refcountIncr(o) __atomic_add_fetch(&(o)->refcount,1,__ATOMIC_RELAXED)
+#define refcountDecr(o) __atomic_sub_fetch(&(o)->refcount,1,__ATOMIC_ACQ_REL)
+#define refcountGet(o) __atomic_load_n(&(o)->refcount,__ATOMIC_ACQUIRE)
+#elif defined(HAVE_ATOMIC)
+#define refcountIncr(o) __sync_add_and_fetch(&(o)->refcount,1)
+#define refcountDecr(o) __sync_sub_and_fetch(&(o)->refcount,1)
+#define refcountGet(o) __sync_add_and_fetch(&(o)->refcount,0)
+#else
+#define refcountIncr(o) (++(o)->refcount)
+#define refcountDecr(o) (--(o)->refcount)
+#define refcountGet(o) ((o)->refcount)
+#endif
+
 void incrRefCount(robj *o) {
-    o->refcount++;
+    refcountIncr(o);
 }
 
 void decrRefCount(robj *o) {
-    if (o->refcount <= 0) redisPanic("decrRefCount against refcount <= 0");
-    if (o->refcount == 1) {
+    int refcount = refcountGet(o);
+
+    if (refcount <= 0) redisPanic("decrRefCount against refcount <= 0");
+    /* When we own the only reference no other thread can access the object,
+     * so the atomic decrement is only needed for shared objects. */
+    if (refcount == 1 || refcountDecr(o) == 0) {
         switch(o->type) {
         case REDIS_STRING: freeStringObject(o); break;
         case REDIS_LIST: freeListObject(o); break;
@@ -313,8 +334,6 @@ void decrRefCount(robj *o) {
         default: redisPanic("Unknown object type"); break;
         }
         zfree(o);
-    } else {
-        o->refcount--;
     }
 }
 
@@ -393,7 +412,8 @@ robj *tryObjectEncoding(robj *o) {
          * algorithm to work well. */
         if ((server.maxmemory == 0 ||
              (server.maxmemory_policy != REDIS_MAXMEMORY_VOLATILE_LRU &&
-              server.maxmemory_policy != REDIS_MAXMEMORY_ALLKEYS_LRU)) &&
+              server.maxmemory_policy != REDIS_MAXMEMORY_ALLKEYS_LRU &&
+              !REDIS_MAXMEMORY_IS_LFU(server.maxmemory_policy))) &&
             value >= 0 &&
             value < REDIS_SHARED_INTEGERS)
         {
@@ -682,7 +702,10 @@ char *strEncoding(int encoding) {
     case REDIS_ENCODING_ZIPLIST: return "ziplist";
     case REDIS_ENCODING_INTSET: return "intset";
     case REDIS_ENCODING_SKIPLIST: return "skiplist";
+    case REDIS_ENCODING_BTREE: return "btree";
     case REDIS_ENCODING_EMBSTR: return "embstr";
+    case REDIS_ENCODING_QUICKLIST: return "quicklist";
+    case REDIS_ENCODING_LISTPACK: return "listpack";
     default: return "unknown";
     }
 }
@@ -699,6 +722,200 @@ unsigned long long estimateObjectIdleTime(robj *o) {
     }
 }
 
+/* ----------------------------------------------------------------------------
+ * LFU (Least Frequently Used) implementation.
+ *
+ * When an LFU maxmemory policy is used the 24 bits of the object lru field
+ * are split in two parts:
+ *
+ *           16 bits      8 bits
+ *      +----------------+--------+
+ *      + Last decr time | LOG_C  |
+ *      +----------------+--------+
+ *
+ * LOG_C is a logarithmic access counter: every access increments it with a
+ * probability that gets smaller as the counter grows, so that 8 bits are
+ * enough to tell apart keys accessed a few times from keys accessed millions
+ * of times. The increment probability is controlled by lfu-log-factor.
+ *
+ * The counter of a key that is no longer accessed is decremented by one for
+ * every lfu-decay-time minutes elapsed since the last decrement time, so that
+ * keys that were hot in the past can be eventually evicted. New objects
+ * start with a counter of REDIS_LFU_INIT_VAL so that they are not evicted
+ * before having a chance to accumulate accesses.
+ * -------------------------------------------------------------------------- */
+
+/* Return the current time in minutes, taking only the 16 least significant
+ * bits, as stored in the LFU last decrement time field. */
+static unsigned long LFUGetTimeInMinutes(void) {
+    return (server.unixtime/60) & 65535;
+}
+
+/* Given the last decrement time of an object, return the minutes elapsed
+ * since then, handling the wrap around of the 16 bits minutes clock. */
+static unsigned long LFUTimeElapsed(unsigned long ldt) {
+    unsigned long now = LFUGetTimeInMinutes();
+    if (now >= ldt) return now-ldt;
+    return 65535-ldt+now;
+}
+
+/* Logarithmically increment a counter: the greater the current value, the
+ * less likely it is that it gets incremented. Saturates at 255. */
+static uint8_t LFULogIncr(uint8_t counter) {
+    double r, p, baseval;
+
+    if (counter == 255) return 255;
+    r = (double)rand()/RAND_MAX;
+    baseval = counter - REDIS_LFU_INIT_VAL;
+    if (baseval < 0) baseval = 0;
+    p = 1.0/(baseval*server.lfu_log_factor+1);
+    if (r < p) counter++;
+    return counter;
+}
+
+/* Return the LFU counter of the object decremented by the number of decay
+ * periods elapsed since its last decrement time. The object itself is not
+ * modified: this is done by updateObjectLRU() when the key is accessed. */
+unsigned long LFUDecrAndReturn(robj *o) {
+    unsigned long ldt = o->lru >> 8;
+    unsigned long counter = o->lru & 255;
+    unsigned long num_periods = server.lfu_decay_time ?
+        LFUTimeElapsed(ldt) / server.lfu_decay_time : 0;
+
+    if (num_periods)
+        counter = (num_periods > counter) ? 0 : counter - num_periods;
+    return counter;
+}
+
+/* Return the initial value of the lru field of a new object, according to
+ * the maxmemory policy in use. */
+unsigned int objectInitialLRU(void) {
+    if (REDIS_MAXMEMORY_IS_LFU(server.maxmemory_policy))
+        return (LFUGetTimeInMinutes()<<8) | REDIS_LFU_INIT_VAL;
+    return LRU_CLOCK();
+}
+
+/* Update the lru field of an object that was just accessed: with an LFU
+ * policy the counter is decayed and then incremented, otherwise the access
+ * time is set to the current LRU clock. */
+void updateObjectLRU(robj *o) {
+    if (REDIS_MAXMEMORY_IS_LFU(server.maxmemory_policy)) {
+        uint8_t counter = LFUDecrAndReturn(o);
+
+        counter = LFULogIncr(counter);
+        o->lru = (LFUGetTimeInMinutes()<<8) | counter;
+    } else {
+        o->lru = LRU_CLOCK();
+    }
+}
+
+/* Return the memory allocated for the string object 'o', header included. */
+static size_t stringObjectAllocSize(robj *o) {
+    if (o->encoding == REDIS_ENCODING_RAW)
+        return zmalloc_size(o)+sdsAllocSize(o->ptr);
+    return zmalloc_size(o); /* Integers and embedded strings. */
+}
+
+/* Return an estimate of the memory used by the elements of the chained
+ * hash table 'd', sampling the first 'samples' entries and extrapolating
+ * to the whole table. Keys and values (if 'vals' is true) are string
+ * objects. */
+static size_t dictComputeSize(dict *d, size_t samples, int vals) {
+    size_t asize = zmalloc_size(d)+dictSlots(d)*sizeof(dictEntry*);
+    size_t elesize = 0, sampled = 0;
+    dictIterator *di;
+    dictEntry *de;
+
+    di = dictGetIterator(d);
+    while(sampled < samples && (de = dictNext(di)) != NULL) {
+        elesize += sizeof(dictEntry)+stringObjectAllocSize(dictGetKey(de));
+        if (vals) elesize += stringObjectAllocSize(dictGetVal(de));
+        sampled++;
+    }
+    dictReleaseIterator(di);
+    if (sampled) asize += (double)elesize/sampled*dictSize(d);
+    return asize;
+}
+
+/* Return an estimate of the memory used by the value 'o'. Aggregate values
+ * encoded as real data structures are not visited entirely: at most
+ * 'samples' elements (or quicklist nodes) are measured and their average
+ * size is extrapolated to the whole value, so the cost is bounded.
+ * Elements shared with other values are counted as well. */
+size_t objectComputeSize(robj *o, size_t samples) {
+    size_t asize = zmalloc_size(o), elesize = 0, sampled = 0;
+
+    if (o->type == REDIS_STRING) {
+        return stringObjectAllocSize(o);
+    } else if (o->type == REDIS_LIST) {
+        quicklist *ql = o->ptr;
+        quicklistNode *node = ql->head;
+
+        asize += zmalloc_size(ql);
+        while(node && sampled < samples) {
+            elesize += zmalloc_size(node)+zmalloc_size(node->entry);
+            node = node->next;
+            sampled++;
+        }
+        if (sampled) asize += (double)elesize/sampled*ql->len;
+    } else if (o->type == REDIS_SET) {
+        if (o->encoding == REDIS_ENCODING_INTSET)
+            asize += zmalloc_size(o->ptr);
+        else
+            asize += dictComputeSize(o->ptr,samples,0);
+    } else if (o->type == REDIS_ZSET) {
+        if (o->encoding == REDIS_ENCODING_LISTPACK) {
+            asize += zmalloc_size(o->ptr);
+        } else if (o->encoding == REDIS_ENCODING_SKIPLIST) {
+            zset *zs = o->ptr;
+            zskiplistNode *x = zs->zsl->header->level[0].forward;
+
+            asize += zmalloc_size(zs)+zmalloc_size(zs->zsl)+
+                     zmalloc_size(zs->zsl->header);
+            /* The elements are shared by the dictionary and the skiplist,
+             * so the dictionary is measured without them. */
+            asize += dictComputeSize(zs->dict,0,0)+
+                     dictSize(zs->dict)*sizeof(dictEntry);
+            while(x && sampled < samples) {
+                elesize += zmalloc_size(x)+stringObjectAllocSize(x->obj);
+                x = x->level[0].forward;
+                sampled++;
+            }
+            if (sampled) asize += (double)elesize/sampled*zs->zsl->length;
+        } else if (o->encoding == REDIS_ENCODING_BTREE) {
+            zset *zs = o->ptr;
+            zbtreeNode *leaf = zs->zbt->head;
+            size_t elements = 0;
+
+            asize += zmalloc_size(zs)+zmalloc_size(zs->zbt);
+            asize += dictComputeSize(zs->dict,0,0)+
+                     dictSize(zs->dict)*sizeof(dictEntry);
+            /* Inner nodes are few compared to leaves, and are ignored. */
+            while(leaf && sampled < samples) {
+                unsigned int j;
+
+                elesize += zmalloc_size(leaf);
+                for (j = 0; j < leaf->count; j++)
+                    elesize += stringObjectAllocSize(leaf->obj[j]);
+                elements += leaf->count;
+                leaf = leaf->next;
+                sampled++;
+            }
+            if (elements) asize += (double)elesize/elements*zs->zbt->length;
+        } else {
+            redisPanic("Unknown sorted set encoding");
+        }
+    } else if (o->type == REDIS_HASH) {
+        if (o->encoding == REDIS_ENCODING_LISTPACK)
+            asize += zmalloc_size(o->ptr);
+        else
+            asize += dictComputeSize(o->ptr,samples,1);
+    } else {
+        redisPanic("Unknown object type");
+    }
+    return asize;
+}
+
 /* This is a helper function for the OBJECT command. We need to lookup keys
  * without any modification of LRU or other parameters. */
 robj *objectCommandLookup(redisClient *c, robj *key) {
@@ -716,7 +933,7 @@ robj *objectCommandLookupOrReply(redisClient *c, robj *key, robj *reply) {
 }
 
 /* Object command allows to inspect the internals of an Redis Object.
- * Usage: OBJECT <refcount|encoding|idletime> <key> */
+ * Usage: OBJECT <refcount|encoding|idletime|freq> <key> */
 void objectCommand(redisClient *c) {
     robj *o;
 
@@ -731,9 +948,21 @@ void objectCommand(redisClient *c) {
     } else if (!strcasecmp(c->argv[1]->ptr,"idletime") && c->argc == 3) {
         if ((o = objectCommandLookupOrReply(c,c->argv[2],shared.nullbulk))
                 == NULL) return;
+        if (REDIS_MAXMEMORY_IS_LFU(server.maxmemory_policy)) {
+            addReplyError(c,"An LFU maxmemory policy is selected, idle time not tracked. Please note that when switching between policies at runtime LRU and LFU data will take some time to adjust.");
+            return;
+        }
         addReplyLongLong(c,estimateObjectIdleTime(o)/1000);
+    } else if (!strcasecmp(c->argv[1]->ptr,"freq") && c->argc == 3) {
+        if ((o = objectCommandLookupOrReply(c,c->argv[2],shared.nullbulk))
+                == NULL) return;
+        if (!REDIS_MAXMEMORY_IS_LFU(server.maxmemory_policy)) {
+            addReplyError(c,"An LFU maxmemory policy is not selected, access frequency not tracked. Please note that when switching between policies at runtime LRU and LFU data will take some time to adjust.");
+            return;
+        }
+        addReplyLongLong(c,LFUDecrAndReturn(o));
     } else {
-        addReplyError(c,"Syntax error. Try OBJECT (refcount|encoding|idletime)");
+        addReplyError(c,"Syntax error. Try OBJECT (refcount|encoding|idletime|freq)");
     }
 }
 
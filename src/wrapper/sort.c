@@ -220,7 +220,7 @@ void sortCommand(redisClient *c) {
     if (sortval)
         incrRefCount(sortval);
     else
-        sortval = createListObject();
+        sortval = createQuicklistObject();
 
     /* The SORT command has an SQL-alike syntax, parse it */
     while(j < c->argc) {
@@ -302,8 +302,9 @@ void sortCommand(redisClient *c) {
     }
 
     /* Destructively convert encoded sorted sets for SORT. */
-    if (sortval->type == REDIS_ZSET)
-        zsetConvert(sortval, REDIS_ENCODING_SKIPLIST);
+    if (sortval->type == REDIS_ZSET &&
+        sortval->encoding == REDIS_ENCODING_LISTPACK)
+        zsetConvert(sortval, zsetIndexEncoding());
 
     /* Objtain the length of the object to sort. */
     switch(sortval->type) {
@@ -363,6 +364,28 @@ void sortCommand(redisClient *c) {
             j++;
         }
         setTypeReleaseIterator(si);
+    } else if (sortval->type == REDIS_ZSET && dontsort &&
+               sortval->encoding == REDIS_ENCODING_BTREE) {
+        /* Same as below, for sorted sets indexed by a B+tree. */
+        zset *zs = sortval->ptr;
+        zbtreePos pos;
+        int valid, rangelen = vectorlen;
+
+        if (desc)
+            valid = zbtGetElementByRank(zs->zbt,zs->zbt->length-start,&pos);
+        else
+            valid = zbtGetElementByRank(zs->zbt,start+1,&pos);
+
+        while(rangelen--) {
+            redisAssertWithInfo(c,sortval,valid);
+            vector[j].obj = zbtPosObj(&pos);
+            vector[j].u.score = 0;
+            vector[j].u.cmpobj = NULL;
+            j++;
+            valid = desc ? zbtPrev(&pos) : zbtNext(&pos);
+        }
+        end -= start;
+        start = 0;
     } else if (sortval->type == REDIS_ZSET && dontsort) {
         /* Special handling for a sorted set, if 'dontsort' is true.
          * This makes sure we return elements in the sorted set original
@@ -509,7 +532,9 @@ void sortCommand(redisClient *c) {
             }
         }
     } else {
-        robj *sobj = createZiplistObject();
+        robj *sobj = createQuicklistObject();
+        quicklistSetOptions(sobj->ptr,server.list_max_ziplist_size,
+                            server.list_compress_depth);
 
         /* STORE option specified, set the sorting result as a List object */
         for (j = start; j <= end; j++) {
@@ -41,6 +41,7 @@ void zlibc_free(void *ptr) {
 
 #include <string.h>
 #include <pthread.h>
+#include <stdint.h>
 #include "config.h"
 #include "zmalloc.h"
 
@@ -218,6 +219,25 @@ char *zstrdup(const char *s) {
     return p;
 }
 
+#ifdef HAVE_DEFRAG
+/* Like zmalloc() and zfree(), but bypassing the thread cache of the
+ * allocator, so that the active defragmentation can move allocations out
+ * of sparse pages, see defrag.c. */
+void *zmalloc_no_tcache(size_t size) {
+    void *ptr = je_malloc_no_tcache(size);
+
+    if (!ptr) zmalloc_oom_handler(size);
+    update_zmalloc_stat_alloc(zmalloc_size(ptr));
+    return ptr;
+}
+
+void zfree_no_tcache(void *ptr) {
+    if (ptr == NULL) return;
+    update_zmalloc_stat_free(zmalloc_size(ptr));
+    je_free_no_tcache(ptr);
+}
+#endif
+
 size_t zmalloc_used_memory(void) {
     size_t um;
 
@@ -328,6 +348,29 @@ float zmalloc_get_fragmentation_ratio(size_t rss) {
     return (float)rss/zmalloc_used_memory();
 }
 
+/* Set 'allocated' to the bytes allocated by the application according to
+ * the allocator, and 'active' to the bytes of the pages holding them. The
+ * difference is the memory wasted because of the fragmentation inside the
+ * allocator, that the active defragmentation can reclaim, while the RSS
+ * also includes the pages not yet returned to the system.
+ *
+ * Returns 1 on success, 0 if the allocator does not provide the
+ * information. */
+int zmalloc_get_allocator_info(size_t *allocated, size_t *active) {
+#if defined(USE_JEMALLOC)
+    uint64_t epoch = 1;
+    size_t sz = sizeof(epoch);
+
+    /* Update the statistics cached by mallctl. */
+    je_mallctl("epoch",&epoch,&sz,&epoch,sz);
+    sz = sizeof(size_t);
+    if (je_mallctl("stats.allocated",allocated,&sz,NULL,0) == 0 &&
+        je_mallctl("stats.active",active,&sz,NULL,0) == 0) return 1;
+#endif
+    *allocated = *active = 0;
+    return 0;
+}
+
 /* Get the sum of the specified field (converted form kb to bytes) in
  * /proc/self/smaps. The field must be specified with trailing ":" as it
  * apperas in the smaps output.
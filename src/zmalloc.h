@@ -65,6 +65,11 @@
 #define ZMALLOC_LIB "libc"
 #endif
 
+/* Active defragmentation needs the allocation hints of our jemalloc. */
+#if defined(USE_JEMALLOC) && defined(JEMALLOC_FRAG_HINT)
+#define HAVE_DEFRAG
+#endif
+
 void *zmalloc(size_t size);
 void *zcalloc(size_t size);
 void *zrealloc(void *ptr, size_t size);
@@ -78,6 +83,12 @@ size_t zmalloc_get_rss(void);
 size_t zmalloc_get_private_dirty(void);
 size_t zmalloc_get_smap_bytes_by_field(char *field);
 void zlibc_free(void *ptr);
+int zmalloc_get_allocator_info(size_t *allocated, size_t *active);
+
+#ifdef HAVE_DEFRAG
+void *zmalloc_no_tcache(size_t size);
+void zfree_no_tcache(void *ptr);
+#endif
 
 #ifndef HAVE_MALLOC_SIZE
 size_t zmalloc_size(void *ptr);
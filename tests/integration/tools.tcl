@@ -0,0 +1,50 @@
+start_server {tags {"cli"}} {
+    # Run a command line tool and return its output. The tool is killed, and
+    # the test fails, if it does not exit in 10 seconds instead of hanging.
+    proc run_tool {args} {
+        set fd [open "|$args 2>@1" r]
+        fconfigure $fd -blocking 0 -translation binary
+        set out {}
+        set deadline [expr {[clock milliseconds]+10000}]
+        while {![eof $fd]} {
+            append out [read $fd]
+            if {[clock milliseconds] > $deadline} {
+                catch {exec kill -9 {*}[pid $fd]}
+                catch {close $fd}
+                fail "[lindex $args 0] did not exit"
+            }
+            after 10
+        }
+        append out [read $fd]
+        close $fd
+        set _ $out
+    }
+
+    proc cli {args} {
+        run_tool src/redis-cli -p [srv port] -n 9 {*}$args
+    }
+
+    test {redis-cli PING} {
+        cli ping
+    } "PONG\n"
+
+    test {redis-cli SET and GET} {
+        assert_equal "OK\n" [cli set key foo]
+        assert_equal foo [r get key]
+        cli get key
+    } "foo\n"
+
+    test {redis-cli GET of a big value} {
+        # Grows the buffers of hiredis through the bigger sds headers.
+        set val [string repeat x 100000]
+        r set bigkey $val
+        assert_equal "$val\n" [cli get bigkey]
+    }
+
+    test {redis-benchmark runs to completion} {
+        set out [run_tool src/redis-benchmark -p [srv port] \
+            -t ping,set,get -n 1000 -q]
+        assert_match {*SET: * requests per second*} $out
+        assert_match {*GET: * requests per second*} $out
+    }
+}
@@ -39,6 +39,7 @@ set ::all_tests {
     integration/rdb
     integration/convert-zipmap-hash-on-load
     integration/logging
+    integration/tools
     unit/pubsub
     unit/slowlog
     unit/scripting
@@ -49,6 +50,9 @@ set ::all_tests {
     unit/bitops
     unit/memefficiency
     unit/hyperloglog
+    unit/io-threads
+    unit/accept-threads
+    unit/lazyfree
 }
 # Index to the next test to run in the ::all_tests list.
 set ::next_test 0
@@ -0,0 +1,71 @@
+start_server {tags {"acceptthreads"} overrides {accept-threads 2}} {
+    test {Accept threads are reported in INFO} {
+        assert_equal 2 [s accept_threads]
+        lindex [r config get accept-threads] 1
+    } {2}
+
+    test {Clients accepted by the accept threads are served} {
+        set clients {}
+        for {set j 0} {$j < 64} {incr j} {
+            set rd [redis [srv 0 host] [srv 0 port]]
+            $rd select 9
+            $rd set key:$j $j
+            lappend clients $rd
+        }
+        set j 0
+        foreach rd $clients {
+            assert_equal $j [$rd get key:$j]
+            $rd close
+            incr j
+        }
+        assert {[s threaded_accepts] > 0}
+        r dbsize
+    } {64}
+
+    test {Accept threads can be configured only at startup} {
+        catch {r config set accept-threads 4} e
+        set e
+    } {*ERR*}
+}
+
+start_server {tags {"acceptthreads"} overrides {accept-threads 2 maxclients 10}} {
+    test {Maxclients is enforced with accept threads} {
+        set c 0
+        catch {
+            while {$c < 50} {
+                incr c
+                set rd [redis_deferring_client]
+                $rd ping
+                $rd read
+                after 100
+            }
+        } e
+        assert {$c > 8 && $c <= 10}
+        set e
+    } {*ERR max*reached*}
+}
+
+start_server {tags {"acceptthreads"} overrides {accept-threads 1 tcp-backlog 4096}} {
+    test {SHUTDOWN does not hang with a full accept queue} {
+        set pid [s process_id]
+        # The main thread sleeps while the accept thread fills its queue,
+        # then shuts down without linking the queued clients.
+        set fd [socket [srv 0 host] [srv 0 port]]
+        fconfigure $fd -translation binary
+        puts -nonewline $fd "DEBUG SLEEP 2\r\nSHUTDOWN NOSAVE\r\n"
+        flush $fd
+        # About half of the connections go to the accept thread. They are
+        # established by the kernel even if nobody accepts them.
+        set socks {}
+        for {set j 0} {$j < 3000} {incr j} {
+            lappend socks [socket [srv 0 host] [srv 0 port]]
+        }
+        wait_for_condition 100 100 {
+            [catch {exec kill -0 $pid}]
+        } else {
+            fail "The server did not exit"
+        }
+        close $fd
+        foreach s $socks {catch {close $s}}
+    }
+}
@@ -1,7 +1,7 @@
 start_server {tags {"introspection"}} {
     test {CLIENT LIST} {
         r client list
-    } {*addr=*:* fd=* age=* idle=* flags=N db=9 sub=0 psub=0 multi=-1 qbuf=0 qbuf-free=* obl=0 oll=0 omem=0 events=r cmd=client*}
+    } {*addr=*:* fd=* age=* idle=* flags=N db=9 sub=0 psub=0 multi=-1 qbuf=0 qbuf-free=* obl=0 oll=0 omem=0 rbs=* events=r cmd=client*}
 
     test {MONITOR can log executed commands} {
         set rd [redis_deferring_client]
@@ -56,4 +56,72 @@ start_server {tags {"introspection"}} {
             fail "Client still listed in CLIENT LIST after SETNAME."
         }
     }
+
+    test {Closed clients are recycled from the client pool} {
+        set rd [redis_deferring_client]
+        $rd client setname pooled
+        $rd read
+        $rd subscribe chan
+        $rd read
+        $rd close
+        wait_for_condition 50 100 {
+            [s pooled_clients] > 0
+        } else {
+            fail "Closed client was not added to the pool"
+        }
+        set hits [s client_pool_hits]
+        set rd [redis_deferring_client]
+        $rd client getname
+        assert_equal {} [$rd read]
+        $rd ping
+        assert_equal PONG [$rd read]
+        $rd close
+        assert {[s client_pool_hits] > $hits}
+        assert_equal 0 [s pubsub_channels]
+    }
+
+    test {Client reply buffer is resized by clientsCron} {
+        proc reply_buffer_size {name} {
+            foreach line [split [r client list] "\n"] {
+                if {[string match "*name=$name *" $line]} {
+                    regexp {rbs=([0-9]+)} $line - rbs
+                    return $rbs
+                }
+            }
+        }
+        r del biglist
+        for {set j 0} {$j < 2000} {incr j} {r rpush biglist xxxxxxxxxx}
+        set rd [redis_deferring_client]
+        $rd client setname rbsclient
+        $rd read
+        # An idle client buffer shrinks to the minimum size.
+        wait_for_condition 100 100 {
+            [reply_buffer_size rbsclient] == 1024
+        } else {
+            fail "Reply buffer of idle client was not shrunk"
+        }
+        # A client that keeps getting big replies gets a bigger buffer.
+        proc big_reply {rd} {
+            $rd lrange biglist 0 -1
+            llength [$rd read]
+        }
+        wait_for_condition 100 100 {
+            [big_reply $rd] == 2000 &&
+            [reply_buffer_size rbsclient] > 16384
+        } else {
+            fail "Reply buffer of client with big replies was not grown"
+        }
+        $rd close
+    }
+
+    test {CONFIG SET client-pool-size trims the pool} {
+        r config set client-pool-size 0
+        set misses [s client_pool_misses]
+        set rd [redis_deferring_client]
+        $rd ping
+        $rd read
+        $rd close
+        r config set client-pool-size 64
+        list [s pooled_clients] [expr {[s client_pool_misses]-$misses}]
+    } {0 1}
 }
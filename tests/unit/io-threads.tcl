@@ -0,0 +1,95 @@
+start_server {tags {"iothreads"} overrides {io-threads 4}} {
+    proc pipeline_clients {numclients numcmds {level 0}} {
+        set clients {}
+        for {set j 0} {$j < $numclients} {incr j} {
+            lappend clients [redis_deferring_client $level]
+        }
+        for {set i 0} {$i < $numcmds} {incr i} {
+            set j 0
+            foreach rd $clients {
+                $rd set key:$j:$i [string repeat x [expr {$i*100}]]
+                $rd get key:$j:$i
+                incr j
+            }
+        }
+        set j 0
+        foreach rd $clients {
+            for {set i 0} {$i < $numcmds} {incr i} {
+                assert_equal OK [$rd read]
+                assert_equal [string repeat x [expr {$i*100}]] [$rd read]
+            }
+            $rd close
+            incr j
+        }
+    }
+
+    test {I/O threads are reported in INFO} {
+        assert_equal 4 [s io_threads]
+        lindex [r config get io-threads] 1
+    } {4}
+
+    test {Pipelined SET/GET from many clients with I/O threads} {
+        pipeline_clients 32 200
+        assert {[s io_threaded_writes_processed] > 0}
+        assert {[s io_threaded_reads_processed] > 0}
+        r dbsize
+    } {6400}
+
+    test {Big replies are fully delivered with I/O threads} {
+        r del biglist
+        for {set i 0} {$i < 1000} {incr i} {
+            r rpush biglist [string repeat y 1000]
+        }
+        set clients {}
+        for {set j 0} {$j < 16} {incr j} {
+            set rd [redis_deferring_client]
+            $rd lrange biglist 0 -1
+            lappend clients $rd
+        }
+        foreach rd $clients {
+            assert_equal 1000 [llength [$rd read]]
+            $rd close
+        }
+    }
+
+    test {Protocol errors are reported with I/O threads} {
+        set clients {}
+        for {set j 0} {$j < 16} {incr j} {
+            set rd [redis_deferring_client]
+            $rd ping
+            lappend clients $rd
+        }
+        foreach rd $clients {
+            assert_equal PONG [$rd read]
+            $rd write "*3\r\n\$3\r\nSET\r\n\$1\r\nx\r\nfooz\r\n"
+            $rd flush
+        }
+        foreach rd $clients {
+            assert_error "*expected '$', got 'f'*" {$rd read}
+            $rd close
+        }
+    }
+
+    test {Slaves of a master with I/O threads receive all the writes} {
+        start_server {} {
+            set slave [srv 0 client]
+            $slave slaveof [srv -1 host] [srv -1 port]
+            wait_for_condition 50 100 {
+                [string match {*master_link_status:up*} [$slave info replication]]
+            } else {
+                fail "Slave did not connect to the master"
+            }
+            pipeline_clients 32 50 -1
+            wait_for_condition 50 100 {
+                [r -1 debug digest] eq [$slave debug digest]
+            } else {
+                fail "Master and slave have different digest"
+            }
+        }
+    }
+
+    test {I/O threads can be configured only at startup} {
+        catch {r config set io-threads 2} e
+        set e
+    } {*ERR*}
+}
@@ -0,0 +1,152 @@
+start_server {tags {"lazyfree"}} {
+    test {UNLINK can reclaim memory in background} {
+        set orig_mem [s used_memory]
+        set args {}
+        for {set i 0} {$i < 100000} {incr i} {
+            lappend args $i
+        }
+        r sadd myset {*}$args
+        assert {[r scard myset] == 100000}
+        set peak_mem [s used_memory]
+        assert {[r unlink myset] == 1}
+        assert {$peak_mem > $orig_mem+1000000}
+        wait_for_condition 50 100 {
+            [s used_memory] < $peak_mem &&
+            [s used_memory] < $orig_mem*2 &&
+            [s lazyfree_pending_objects] == 0
+        } else {
+            fail "Memory is not reclaimed by UNLINK"
+        }
+    }
+
+    test {UNLINK behaves like DEL for small and missing keys} {
+        r set foo bar
+        r sadd smallset a b c
+        assert_equal 2 [r unlink foo smallset nokey]
+        assert_equal 0 [r exists foo smallset]
+    }
+
+    test {UNLINK of a key sharing elements with another key} {
+        r del set1 set2 dst
+        set args {}
+        for {set i 0} {$i < 1000} {incr i} {
+            lappend args element:$i
+        }
+        r sadd set1 {*}$args
+        r sunionstore dst set1
+        r unlink set1
+        assert_equal 1000 [r scard dst]
+        assert_equal 1 [r sismember dst element:999]
+    }
+
+    test {FLUSHDB ASYNC can reclaim memory in background} {
+        set orig_mem [s used_memory]
+        set args {}
+        for {set i 0} {$i < 100000} {incr i} {
+            lappend args $i
+        }
+        r sadd myset {*}$args
+        assert {[r scard myset] == 100000}
+        set peak_mem [s used_memory]
+        r flushdb async
+        assert_equal 0 [r dbsize]
+        assert {$peak_mem > $orig_mem+1000000}
+        wait_for_condition 50 100 {
+            [s used_memory] < $peak_mem &&
+            [s used_memory] < $orig_mem*2 &&
+            [s lazyfree_pending_objects] == 0
+        } else {
+            fail "Memory is not reclaimed by FLUSHDB ASYNC"
+        }
+    }
+
+    test {FLUSHALL ASYNC empties all the databases} {
+        r select 10
+        r set foo bar
+        r select 9
+        r set foo bar
+        r flushall async
+        assert_equal 0 [r dbsize]
+        r select 10
+        set size [r dbsize]
+        r select 9
+        set size
+    } {0}
+
+    test {FLUSHDB / FLUSHALL reject unknown arguments} {
+        catch {r flushdb now} e
+        assert_match {*syntax*} $e
+        catch {r flushall async async} e
+        assert_match {*syntax*} $e
+    }
+
+    test {Expired keys are freed in background with lazyfree-lazy-expire} {
+        r flushdb
+        r config resetstat
+        r config set lazyfree-lazy-expire yes
+        set args {}
+        for {set i 0} {$i < 10000} {incr i} {
+            lappend args $i
+        }
+        r sadd myset {*}$args
+        r pexpire myset 100
+        wait_for_condition 50 100 {
+            [r exists myset] == 0 &&
+            [s lazyfree_pending_objects] == 0 &&
+            [s lazyfree_pending_memory] == 0
+        } else {
+            fail "Expired key not reclaimed in background"
+        }
+        # The value must have been released by the background thread, not
+        # by the main one.
+        assert_equal 1 [s lazyfreed_objects]
+        r config set lazyfree-lazy-expire no
+    } {OK}
+
+    test {Evicted keys are freed in background with lazyfree-lazy-eviction} {
+        r flushdb
+        r config resetstat
+        r config set lazyfree-lazy-eviction yes
+        r config set maxmemory-policy allkeys-random
+        set args {}
+        for {set i 0} {$i < 100000} {incr i} {
+            lappend args $i
+        }
+        for {set j 0} {$j < 10} {incr j} {
+            set before [s used_memory]
+            r sadd set:$j {*}$args
+            set setsize [expr {[s used_memory]-$before}]
+        }
+        set used [s used_memory]
+        # Keep the background thread busy with a bigger set, so that the
+        # evicted values are still queued behind it while the eviction loop
+        # runs, instead of being freed as soon as they are unlinked.
+        for {set j 0} {$j < 5} {incr j} {
+            set args {}
+            for {set i 0} {$i < 100000} {incr i} {
+                lappend args $j:$i
+            }
+            r sadd blocker {*}$args
+        }
+        r unlink blocker
+        # Go over the limit by two sets and a half: the memory queued for
+        # background freeing counts as freed, so eviction must stop after
+        # about three keys even if used_memory did not drop yet, and the
+        # following commands must not evict anything else.
+        r config set maxmemory [expr {$used-$setsize*5/2}]
+        set evicted [s evicted_keys]
+        assert {$evicted >= 3 && $evicted <= 5}
+        assert_equal [expr {10-$evicted}] [r dbsize]
+        assert_equal $evicted [s evicted_keys]
+        r config set maxmemory 0
+        wait_for_condition 50 100 {
+            [s lazyfree_pending_objects] == 0 &&
+            [s lazyfree_pending_memory] == 0
+        } else {
+            fail "Evicted keys not reclaimed in background"
+        }
+        assert_equal [expr {$evicted+1}] [s lazyfreed_objects]
+        r config set maxmemory-policy noeviction
+        r config set lazyfree-lazy-eviction no
+    } {OK}
+}
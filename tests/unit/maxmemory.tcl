@@ -23,8 +23,103 @@ start_server {tags {"maxmemory"}} {
         r config set maxmemory 0
     }
 
+    test "With maxmemory and LFU policy integers are not shared" {
+        r config set maxmemory 1073741824
+        r config set maxmemory-policy allkeys-lfu
+        r set a 1
+        r config set maxmemory-policy volatile-lfu
+        r set b 1
+        assert {[r object refcount a] == 1}
+        assert {[r object refcount b] == 1}
+        r config set maxmemory 0
+    }
+
+    test "OBJECT FREQ requires an LFU policy" {
+        r config set maxmemory-policy allkeys-lru
+        r set foo bar
+        assert_error {*LFU*} {r object freq foo}
+        r config set maxmemory-policy allkeys-lfu
+        assert_error {*LFU*} {r object idletime foo}
+    }
+
+    test "OBJECT FREQ grows with accesses" {
+        r config set maxmemory-policy allkeys-lfu
+        r config set lfu-log-factor 0
+        r set foo bar
+        set initial [r object freq foo]
+        for {set j 0} {$j < 100} {incr j} {r get foo}
+        assert {[r object freq foo] >= $initial+100}
+        r config set lfu-log-factor 10
+        r set cold bar
+        for {set j 0} {$j < 100} {incr j} {r get cold}
+        assert {[r object freq cold] < $initial+100}
+        r config set maxmemory-policy noeviction
+    }
+
+    test "maxmemory - allkeys-lfu retains frequently accessed keys" {
+        r flushall
+        r config set maxmemory-policy allkeys-lfu
+        r config set lfu-log-factor 1
+        for {set j 0} {$j < 10} {incr j} {
+            r set "hot:$j" x
+            for {set k 0} {$k < 50} {incr k} {r get "hot:$j"}
+        }
+        set used [s used_memory]
+        set limit [expr {$used+100*1024}]
+        r config set maxmemory $limit
+        # Write many keys that are never accessed again, forcing the
+        # eviction of most of them.
+        for {set j 0} {$j < 10000} {incr j} {
+            r set "cold:$j" x
+        }
+        assert {[s used_memory] < ($limit+4096)}
+        for {set j 0} {$j < 10} {incr j} {
+            assert {[r exists "hot:$j"]}
+        }
+        r config set maxmemory 0
+        r config set lfu-log-factor 10
+        r config set maxmemory-policy noeviction
+    }
+
+    test "maxmemory - the eviction pool is shared among databases" {
+        r flushall
+        r config set maxmemory-policy allkeys-lru
+        r config resetstat
+        r select 9
+        for {set j 0} {$j < 1000} {incr j} {
+            r set "old:$j" x
+        }
+        # Make sure the keys of DB 9 are idle for a while.
+        after 2000
+        r select 10
+        set used [s used_memory]
+        set limit [expr {$used+100*1024}]
+        r config set maxmemory $limit
+        set numkeys 0
+        while 1 {
+            r set "new:$numkeys" x
+            incr numkeys
+            if {[s used_memory]+4096 > $limit} break
+        }
+        for {set j 0} {$j < 300} {incr j} {
+            r set "new:$numkeys" x
+            incr numkeys
+        }
+        # Only the idle keys of DB 9 should have been evicted.
+        assert {[s evicted_keys] > 0}
+        assert {[s evicted_keys_avg_idle] >= 1}
+        assert {[s eviction_samples] >= 5}
+        assert_equal $numkeys [r dbsize]
+        r select 9
+        assert {[r dbsize] < 1000}
+        r config set maxmemory 0
+        r config set maxmemory-policy noeviction
+        r flushall
+    }
+
     foreach policy {
-        allkeys-random allkeys-lru volatile-lru volatile-random volatile-ttl
+        allkeys-random allkeys-lru allkeys-lfu volatile-lru volatile-lfu
+        volatile-random volatile-ttl
     } {
         test "maxmemory - is the memory limit honoured? (policy $policy)" {
             # make sure to start with a blank instance
@@ -56,7 +151,8 @@ start_server {tags {"maxmemory"}} {
     }
 
     foreach policy {
-        allkeys-random allkeys-lru volatile-lru volatile-random volatile-ttl
+        allkeys-random allkeys-lru allkeys-lfu volatile-lru volatile-lfu
+        volatile-random volatile-ttl
     } {
         test "maxmemory - only allkeys-* should remove non-volatile keys ($policy)" {
             # make sure to start with a blank instance
@@ -98,7 +194,7 @@ start_server {tags {"maxmemory"}} {
     }
 
     foreach policy {
-        volatile-lru volatile-random volatile-ttl
+        volatile-lru volatile-lfu volatile-random volatile-ttl
     } {
         test "maxmemory - policy $policy should only remove volatile keys." {
             # make sure to start with a blank instance
@@ -35,3 +35,91 @@ start_server {tags {"memefficiency"}} {
         }
     }
 }
+
+start_server {tags {"defrag"}} {
+    if {[string match {*jemalloc*} [s mem_allocator]]} {
+        test "Active defrag" {
+            r config set active-defrag-threshold-lower 5
+            r config set active-defrag-ignore-bytes 2mb
+            r debug populate 500000
+            # Evicting random keys leaves most of the pages half empty.
+            r config set maxmemory-policy allkeys-random
+            r config set maxmemory [expr {[s used_memory]/2}]
+            r set foo bar
+            r config set maxmemory 0
+            r config set maxmemory-policy noeviction
+            set frag [s allocator_frag_ratio]
+            assert {$frag >= 1.3}
+
+            r config set activedefrag yes
+            after 1500 ;# Fragmentation is checked once per second.
+            wait_for_condition 100 100 {
+                [s active_defrag_running] == 0
+            } else {
+                fail "Active defrag not started or not completed"
+            }
+            r config set activedefrag no
+            assert {[s active_defrag_hits] > 0}
+            assert {[s allocator_frag_ratio] < $frag}
+        }
+
+        test "Active defrag big keys" {
+            r flushall
+            r config resetstat
+            r config set active-defrag-max-scan-fields 1000
+            r config set active-defrag-cycle-min 10
+            r config set active-defrag-cycle-max 25
+            r config set list-max-ziplist-size 16
+            r config set hz 100
+            r config set latency-monitor-threshold 5
+            r latency reset
+
+            # Interleave the allocations of a big hash and a big list with
+            # the ones of small keys, then delete the small keys: the pages
+            # of the big values are left half empty.
+            set rd [redis_deferring_client]
+            set n 200000
+            for {set j 0} {$j < $n} {incr j} {
+                $rd hset bighash field:$j [string repeat x 20]
+                $rd rpush biglist [string repeat x 20]
+                $rd set key:$j [string repeat x 20]
+            }
+            for {set j 0} {$j < $n*3} {incr j} {
+                $rd read
+            }
+            for {set j 0} {$j < $n} {incr j} {
+                $rd del key:$j
+            }
+            for {set j 0} {$j < $n} {incr j} {
+                $rd read
+            }
+            $rd close
+            set digest [r debug digest]
+            set frag [s allocator_frag_ratio]
+            assert {$frag >= 1.3}
+
+            r config set activedefrag yes
+            after 1500 ;# Fragmentation is checked once per second.
+            wait_for_condition 100 100 {
+                [s active_defrag_running] == 0
+            } else {
+                fail "Active defrag not started or not completed"
+            }
+            r config set activedefrag no
+            assert {[s active_defrag_hits] > 0}
+            assert {[s allocator_frag_ratio] < $frag}
+            assert_equal $digest [r debug digest]
+
+            # With a 2.5ms time limit per cycle, no cycle should take long
+            # even if a single value has 200k elements.
+            set max_latency 0
+            foreach event [r latency latest] {
+                lassign $event eventname time latency max
+                if {$eventname eq "active-defrag-cycle"} {
+                    set max_latency $max
+                }
+            }
+            assert {$max_latency <= 30}
+        }
+    }
+}
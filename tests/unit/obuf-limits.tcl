@@ -70,4 +70,70 @@ start_server {tags {"obuf-limits"}} {
         assert {$omem >= 100000 && $time_elapsed < 6}
         $rd1 close
     }
+
+    test {Zero copy replies deliver the value as it was when queued} {
+        r config set reply-zero-copy-threshold 1024
+        set big [string repeat a 5000]
+        r set bigval $big
+        set rd1 [redis_deferring_client]
+        $rd1 get bigval
+        $rd1 append bigval b
+        $rd1 setrange bigval 0 c
+        $rd1 mget bigval bigval
+        assert_equal $big [$rd1 read]
+        assert_equal 5001 [$rd1 read]
+        assert_equal 5001 [$rd1 read]
+        set modified "c[string repeat a 4999]b"
+        assert_equal [list $modified $modified] [$rd1 read]
+        $rd1 close
+        assert {[s zero_copy_reply_bytes] >= 15000}
+    }
+
+    test {Zero copy replies work as first element of deferred multi bulks} {
+        r config set reply-zero-copy-threshold 1024
+        r del bighash
+        set expected {}
+        for {set j 0} {$j < 10} {incr j} {
+            set val [string repeat $j 3000]
+            r hset bighash field:$j $val
+            dict set expected field:$j $val
+        }
+        set before [s zero_copy_reply_bytes]
+        set reply [r hgetall bighash]
+        assert_equal [lsort [dict keys $expected]] [lsort [dict keys $reply]]
+        dict for {k v} $expected {
+            assert_equal $v [dict get $reply $k]
+        }
+        assert {[s zero_copy_reply_bytes] >= $before+30000}
+    }
+
+    test {Zero copy replies count toward the output buffer limits} {
+        r config set reply-zero-copy-threshold 1024
+        r config set client-output-buffer-limit {pubsub 100000 0 0}
+        set rd1 [redis_deferring_client]
+
+        $rd1 subscribe foo
+        set reply [$rd1 read]
+        assert {$reply eq "subscribe foo 1"}
+
+        set msg [string repeat x 4096]
+        set omem 0
+        while 1 {
+            r publish foo $msg
+            set clients [split [r client list] "\r\n"]
+            set c [split [lindex $clients 1] " "]
+            if {![regexp {omem=([0-9]+)} $c - omem]} break
+        }
+        assert {$omem >= 90000 && $omem < 200000}
+        $rd1 close
+    }
+
+    test {Zero copy replies can be disabled} {
+        r config set reply-zero-copy-threshold 0
+        set before [s zero_copy_reply_bytes]
+        r set bigval [string repeat a 5000]
+        assert_equal [string repeat a 5000] [r get bigval]
+        assert_equal $before [s zero_copy_reply_bytes]
+        lindex [r config get reply-zero-copy-threshold] 1
+    } {0}
 }
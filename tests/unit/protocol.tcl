@@ -55,6 +55,39 @@ start_server {tags {"protocol"}} {
         assert_error "*expected '$', got 'f'*" {r read}
     }
 
+    test "Multibulk payload length with leading zeroes" {
+        reconnect
+        r write "*3\r\n\$3\r\nSET\r\n\$01\r\nx\r\n"
+        r flush
+        assert_error "*invalid bulk length*" {r read}
+    }
+
+    test "Pipelined inline commands terminated by LF only" {
+        reconnect
+        r write "ping\nping\n"
+        r flush
+        assert_equal PONG [r read]
+        assert_equal PONG [r read]
+    }
+
+    test "Arguments recycled across commands don't alter stored values" {
+        r del k1 k2 mylist myset
+        set rd [redis_deferring_client]
+        $rd set k1 aaaaaaaaaa
+        $rd get k1
+        $rd set k2 b
+        $rd rpush mylist x yyyyyyyyyy
+        $rd sadd myset x zzzzzzzzzz
+        $rd get longer_key_name
+        $rd set k2 bbbbbbbbbbbbbbbb
+        set res {}
+        for {set j 0} {$j < 7} {incr j} {lappend res [$rd read]}
+        $rd close
+        assert_equal {OK aaaaaaaaaa OK 2 2 {} OK} $res
+        list [r get k1] [r get k2] [r lrange mylist 0 -1] \
+             [lsort [r smembers myset]]
+    } {aaaaaaaaaa bbbbbbbbbbbbbbbb {x yyyyyyyyyy} {x zzzzzzzzzz}}
+
     test "Generic wrong number of args" {
         reconnect
         assert_error "*wrong*arguments*ping*" {r ping x y z}
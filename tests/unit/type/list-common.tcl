@@ -1,5 +1,5 @@
-# We need a value larger than list-max-ziplist-value to make sure
-# the list has the right encoding when it is swapped in again.
+# A small value and a larger one, so that lists are tested both with
+# entries that pack densely into a node and with bigger entries.
 array set largevalue {}
 set largevalue(ziplist) "hello"
 set largevalue(linkedlist) [string repeat "hello" 4]
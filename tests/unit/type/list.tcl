@@ -1,8 +1,7 @@
 start_server {
     tags {"list"}
     overrides {
-        "list-max-ziplist-value" 16
-        "list-max-ziplist-entries" 256
+        "list-max-ziplist-size" 5
     }
 } {
     source "tests/unit/type/list-common.tcl"
@@ -19,7 +18,7 @@ start_server {
         assert_equal {} [r lindex myziplist2 3]
         assert_equal c [r rpop myziplist1]
         assert_equal a [r lpop myziplist1]
-        assert_encoding ziplist myziplist1
+        assert_encoding quicklist myziplist1
 
         # first rpush then lpush
         assert_equal 1 [r rpush myziplist2 a]
@@ -32,13 +31,13 @@ start_server {
         assert_equal {} [r lindex myziplist2 3]
         assert_equal a [r rpop myziplist2]
         assert_equal c [r lpop myziplist2]
-        assert_encoding ziplist myziplist2
+        assert_encoding quicklist myziplist2
     }
 
     test {LPUSH, RPUSH, LLENGTH, LINDEX, LPOP - regular list} {
         # first lpush then rpush
         assert_equal 1 [r lpush mylist1 $largevalue(linkedlist)]
-        assert_encoding linkedlist mylist1
+        assert_encoding quicklist mylist1
         assert_equal 2 [r rpush mylist1 b]
         assert_equal 3 [r rpush mylist1 c]
         assert_equal 3 [r llen mylist1]
@@ -51,7 +50,7 @@ start_server {
 
         # first rpush then lpush
         assert_equal 1 [r rpush mylist2 $largevalue(linkedlist)]
-        assert_encoding linkedlist mylist2
+        assert_encoding quicklist mylist2
         assert_equal 2 [r lpush mylist2 b]
         assert_equal 3 [r lpush mylist2 c]
         assert_equal 3 [r llen mylist2]
@@ -86,16 +85,110 @@ start_server {
         assert_equal 0 [r llen mylist2]
     }
 
+    proc list_nodes {key} {
+        regexp {ql_nodes:(\d+)} [r debug object $key] - nodes
+        return $nodes
+    }
+
+    test {List nodes are bounded by list-max-ziplist-size} {
+        # A positive fill caps the number of entries per node.
+        r del mylist
+        for {set i 0} {$i < 23} {incr i} { r rpush mylist $i }
+        assert_equal 5 [list_nodes mylist]
+        assert_encoding quicklist mylist
+
+        # A negative fill caps the size of every node (-2 is 8 kb).
+        r config set list-max-ziplist-size -2
+        r del mylist
+        for {set i 0} {$i < 1000} {incr i} {
+            r rpush mylist [string repeat x 100]
+        }
+        set nodes [list_nodes mylist]
+        r config set list-max-ziplist-size 5
+        assert {$nodes >= 12 && $nodes <= 14}
+        assert_equal 1000 [r llen mylist]
+    }
+
+    test {LINSERT into a full list node splits it} {
+        r del mylist
+        for {set i 0} {$i < 15} {incr i} { r rpush mylist $i }
+        assert_equal 3 [list_nodes mylist]
+        r linsert mylist after 7 x
+        assert_equal 4 [list_nodes mylist]
+        assert_equal {0 1 2 3 4 5 6 7 x 8 9 10 11 12 13 14} \
+            [r lrange mylist 0 -1]
+        r ltrim mylist 3 -3
+        assert_equal {3 4 5 6 7 x 8 9 10 11 12} [r lrange mylist 0 -1]
+        r debug reload
+        assert_equal {3 4 5 6 7 x 8 9 10 11 12} [r lrange mylist 0 -1]
+        assert_encoding quicklist mylist
+    }
+
+    proc list_compressed {key} {
+        regexp {ql_compressed:(\d+)} [r debug object $key] - compressed
+        return $compressed
+    }
+
+    test {Interior list nodes are compressed with list-compress-depth} {
+        r config set list-compress-depth 1
+        r del mylist
+        set model {}
+        for {set i 0} {$i < 100} {incr i} {
+            set v [string repeat "item:$i " 10]
+            r rpush mylist $v
+            lappend model $v
+        }
+        # 20 nodes: everything but the head and the tail is compressed.
+        assert_equal 20 [list_nodes mylist]
+        assert_equal 18 [list_compressed mylist]
+
+        # Access to the middle decompresses nodes only temporarily.
+        assert_equal [lindex $model 50] [r lindex mylist 50]
+        assert_equal [lindex $model 77] [r lindex mylist -23]
+        assert_equal [lrange $model 40 60] [r lrange mylist 40 60]
+        r lset mylist 42 foo
+        lset model 42 foo
+        assert_equal 18 [list_compressed mylist]
+        assert_equal $model [r lrange mylist 0 -1]
+
+        # Modifications in the middle keep the ends uncompressed.
+        r linsert mylist before [lindex $model 61] bar
+        set model [linsert $model 61 bar]
+        r lrem mylist 0 [lindex $model 30]
+        set model [lreplace $model 30 30]
+        r lpush mylist head
+        r rpop mylist
+        set model [lrange [linsert $model 0 head] 0 end-1]
+        assert_equal $model [r lrange mylist 0 -1]
+        assert {[list_compressed mylist] == [list_nodes mylist] - 2}
+
+        # Trimming down to the depth decompresses every node.
+        r ltrim mylist 0 5
+        assert_equal [lrange $model 0 5] [r lrange mylist 0 -1]
+        assert_equal 2 [list_nodes mylist]
+        assert_equal 0 [list_compressed mylist]
+
+        r ltrim mylist 1 0
+        for {set i 0} {$i < 100} {incr i} {
+            r rpush mylist [string repeat "item:$i " 10]
+        }
+        r debug reload
+        r config set list-compress-depth 0
+        assert_equal 18 [list_compressed mylist]
+        assert_equal [string repeat "item:99 " 10] [r lindex mylist -1]
+        assert_equal [string repeat "item:50 " 10] [r lindex mylist 50]
+    }
+
     proc create_ziplist {key entries} {
         r del $key
         foreach entry $entries { r rpush $key $entry }
-        assert_encoding ziplist $key
+        assert_encoding quicklist $key
     }
 
     proc create_linkedlist {key entries} {
         r del $key
         foreach entry $entries { r rpush $key $entry }
-        assert_encoding linkedlist $key
+        assert_encoding quicklist $key
     }
 
     foreach {type large} [array get largevalue] {
@@ -547,52 +640,52 @@ start_server {
         set e
     } {*ERR*syntax*error*}
 
-    test {LPUSHX, RPUSHX convert from ziplist to list} {
+    test {LPUSHX, RPUSHX with large values and full nodes} {
         set large $largevalue(linkedlist)
 
-        # convert when a large value is pushed
+        # push a large value
         create_ziplist xlist a
         assert_equal 2 [r rpushx xlist $large]
-        assert_encoding linkedlist xlist
+        assert_encoding quicklist xlist
         create_ziplist xlist a
         assert_equal 2 [r lpushx xlist $large]
-        assert_encoding linkedlist xlist
+        assert_encoding quicklist xlist
 
-        # convert when the length threshold is exceeded
+        # push past the end of a full node
         create_ziplist xlist [lrepeat 256 a]
         assert_equal 257 [r rpushx xlist b]
-        assert_encoding linkedlist xlist
+        assert_encoding quicklist xlist
         create_ziplist xlist [lrepeat 256 a]
         assert_equal 257 [r lpushx xlist b]
-        assert_encoding linkedlist xlist
+        assert_encoding quicklist xlist
     }
 
-    test {LINSERT convert from ziplist to list} {
+    test {LINSERT with large values and full nodes} {
         set large $largevalue(linkedlist)
 
-        # convert when a large value is inserted
+        # insert a large value
         create_ziplist xlist a
         assert_equal 2 [r linsert xlist before a $large]
-        assert_encoding linkedlist xlist
+        assert_encoding quicklist xlist
         create_ziplist xlist a
         assert_equal 2 [r linsert xlist after a $large]
-        assert_encoding linkedlist xlist
+        assert_encoding quicklist xlist
 
-        # convert when the length threshold is exceeded
+        # insert into a full node
         create_ziplist xlist [lrepeat 256 a]
         assert_equal 257 [r linsert xlist before a a]
-        assert_encoding linkedlist xlist
+        assert_encoding quicklist xlist
         create_ziplist xlist [lrepeat 256 a]
         assert_equal 257 [r linsert xlist after a a]
-        assert_encoding linkedlist xlist
+        assert_encoding quicklist xlist
 
-        # don't convert when the value could not be inserted
+        # nothing changes when the value could not be inserted
         create_ziplist xlist [lrepeat 256 a]
         assert_equal -1 [r linsert xlist before foo a]
-        assert_encoding ziplist xlist
+        assert_encoding quicklist xlist
         create_ziplist xlist [lrepeat 256 a]
         assert_equal -1 [r linsert xlist after foo a]
-        assert_encoding ziplist xlist
+        assert_encoding quicklist xlist
     }
 
     foreach {type num} {ziplist 250 linkedlist 500} {
@@ -618,18 +711,18 @@ start_server {
             for {set i 0} {$i < $num} {incr i} {
                 r rpush mylist $i
             }
-            assert_encoding $type mylist
+            assert_encoding quicklist mylist
             check_numbered_list_consistency mylist
         }
 
         test "LINDEX random access - $type" {
-            assert_encoding $type mylist
+            assert_encoding quicklist mylist
             check_random_access_consistency mylist
         }
 
         test "Check if list is still ok after a DEBUG RELOAD - $type" {
             r debug reload
-            assert_encoding $type mylist
+            assert_encoding quicklist mylist
             check_numbered_list_consistency mylist
             check_random_access_consistency mylist
         }
@@ -669,7 +762,7 @@ start_server {
             assert_equal c [r rpoplpush mylist1 mylist2]
             assert_equal "a $large" [r lrange mylist1 0 -1]
             assert_equal "c d" [r lrange mylist2 0 -1]
-            assert_encoding ziplist mylist2
+            assert_encoding quicklist mylist2
         }
 
         test "RPOPLPUSH with the same list as src and dst - $type" {
@@ -687,12 +780,7 @@ start_server {
                 assert_equal c [r rpoplpush srclist dstlist]
                 assert_equal "a b" [r lrange srclist 0 -1]
                 assert_equal "c $large $otherlarge" [r lrange dstlist 0 -1]
-
-                # When we rpoplpush'ed a large value, dstlist should be
-                # converted to the same encoding as srclist.
-                if {$type eq "linkedlist"} {
-                    assert_encoding linkedlist dstlist
-                }
+                assert_encoding quicklist dstlist
             }
         }
     }
@@ -753,7 +841,7 @@ start_server {
                 r lpush mylist $i
                 incr sum1 $i
             }
-            assert_encoding $type mylist
+            assert_encoding quicklist mylist
             set sum2 0
             for {set i 0} {$i < [expr $num/2]} {incr i} {
                 incr sum2 [r lpop mylist]
@@ -179,6 +179,18 @@ start_server {
             assert_equal [list 195 199 $large] [lsort [r sinter set1 set2 set3]]
         }
 
+        test "SINTERCARD with two sets - $type" {
+            assert_equal 6 [r sintercard 2 set1 set2]
+            assert_equal 6 [r sintercard 2 set1 set2 limit 0]
+            assert_equal 3 [r sintercard 2 set1 set2 limit 3]
+            assert_equal 6 [r sintercard 2 set1 set2 limit 10]
+        }
+
+        test "SINTERCARD against three sets - $type" {
+            assert_equal 3 [r sintercard 3 set1 set2 set3]
+            assert_equal 2 [r sintercard 3 set1 set2 set3 limit 2]
+        }
+
         test "SINTERSTORE with three sets - $type" {
             r sinterstore setres set1 set2 set3
             assert_equal [list 195 199 $large] [lsort [r smembers setres]]
@@ -273,6 +285,57 @@ start_server {
         lsort [r sinter set1 set2]
     } {1 2 3}
 
+    test "SINTERCARD against non existing key" {
+        r del set1
+        r sadd set2 1 2 3
+        assert_equal 0 [r sintercard 2 set1 set2]
+        assert_equal 0 [r sintercard 2 set2 set1 limit 1]
+    }
+
+    test "SINTERCARD against non-set should throw error" {
+        r set key1 x
+        assert_error "WRONGTYPE*" {r sintercard 2 set2 key1}
+    }
+
+    test "SINTERCARD with illegal arguments" {
+        assert_error "ERR*numkeys*" {r sintercard 0 set2}
+        assert_error "ERR*numkeys*" {r sintercard -1 set2}
+        assert_error "ERR*Number of keys*" {r sintercard 3 set2 set2}
+        assert_error "ERR*syntax*" {r sintercard 1 set2 foo}
+        assert_error "ERR*syntax*" {r sintercard 1 set2 limit}
+        assert_error "ERR*LIMIT*" {r sintercard 1 set2 limit -1}
+        assert_error "ERR*not an integer*" {r sintercard 1 set2 limit a}
+    }
+
+    test "SUNION, SDIFF and SINTER of intsets with different encodings" {
+        r del s1 s2 s3
+        r sadd s1 1 2 3 100 -100
+        r sadd s2 2 3 4 5000 -5000
+        r sadd s3 3 100 70000 -70000 5000000000
+        assert_encoding intset s1
+        assert_equal {-100 -5000 1 100 2 3 4 5000} [lsort [r sunion s1 s2]]
+        assert_equal {-100 1 100} [lsort [r sdiff s1 s2]]
+        assert_equal {-100 1} [lsort [r sdiff s1 s2 s3]]
+        assert_equal {3} [r sinter s1 s2 s3]
+        assert_equal 1 [r sintercard 3 s1 s2 s3]
+        assert_equal {100 3} [lsort [r sinter s1 s3]]
+        r sunionstore dst s1 s2 s3
+        assert_encoding intset dst
+        assert_equal 11 [r scard dst]
+    }
+
+    test "SUNIONSTORE of intsets converts a too big result" {
+        r del s1 s2 dst
+        r config set set-max-intset-entries 512
+        for {set i 0} {$i < 400} {incr i} {
+            r sadd s1 $i
+            r sadd s2 [expr {$i+400}]
+        }
+        r sunionstore dst s1 s2
+        assert_encoding hashtable dst
+        assert_equal 800 [r scard dst]
+    }
+
     test "SINTERSTORE against non existing keys should delete dstkey" {
         r set setres xxx
         assert_equal 0 [r sinterstore setres foo111 bar222]
@@ -7,12 +7,17 @@ start_server {tags {"zset"}} {
     }
 
     proc basics {encoding} {
-        if {$encoding == "ziplist"} {
+        if {$encoding == "listpack"} {
             r config set zset-max-ziplist-entries 128
             r config set zset-max-ziplist-value 64
         } elseif {$encoding == "skiplist"} {
             r config set zset-max-ziplist-entries 0
             r config set zset-max-ziplist-value 0
+            r config set zset-use-btree no
+        } elseif {$encoding == "btree"} {
+            r config set zset-max-ziplist-entries 0
+            r config set zset-max-ziplist-value 0
+            r config set zset-use-btree yes
         } else {
             puts "Unknown sorted set encoding"
             exit
@@ -644,8 +649,9 @@ start_server {tags {"zset"}} {
         }
     }
 
-    basics ziplist
+    basics listpack
     basics skiplist
+    basics btree
 
     test {ZINTERSTORE regression with two sets, intset+hashtable} {
         r del seta setb setc
@@ -660,7 +666,7 @@ start_server {tags {"zset"}} {
         r zrange out 0 -1 withscores
     } {neginf 0}
 
-    test {ZINTERSTORE #516 regression, mixed sets and ziplist zsets} {
+    test {ZINTERSTORE #516 regression, mixed sets and listpack zsets} {
         r sadd one 100 101 102 103
         r sadd two 100 200 201 202
         r zadd three 1 500 1 501 1 502 1 503 1 100
@@ -690,8 +696,33 @@ start_server {tags {"zset"}} {
         }
     }
 
+    foreach btree {no yes} {
+        test "ZUNIONSTORE/ZINTERSTORE build ordered big results - btree $btree" {
+            r config set zset-use-btree $btree
+            r del one two three dest
+            # Disjoint inputs are merged as sorted runs, while overlapping
+            # ones change the scores and need a full sort.
+            set expected {}
+            for {set j 0} {$j < 300} {incr j} {
+                r zadd one $j a:$j
+                r zadd two [expr {$j+0.5}] b:$j
+                r zadd three [expr {300-$j}] a:$j
+                lappend expected a:$j $j b:$j [expr {$j+0.5}]
+            }
+            assert_equal 600 [r zunionstore dest 2 one two]
+            assert_equal $expected [r zrange dest 0 -1 withscores]
+            assert_equal 599 [r zrank dest b:299]
+            assert_equal 300 [r zunionstore dest 2 one three]
+            assert_equal {a:0 300 a:99} [concat [r zrange dest 0 0 withscores] [r zrange dest -1 -1]]
+            assert_equal 300 [r zinterstore dest 2 three one weights 1 0]
+            assert_equal {a:299 a:0} [concat [r zrange dest 0 0] [r zrange dest -1 -1]]
+            assert_equal 0 [r zrank dest a:299]
+        }
+    }
+    r config set zset-use-btree no
+
     proc stressers {encoding} {
-        if {$encoding == "ziplist"} {
+        if {$encoding == "listpack"} {
             # Little extra to allow proper fuzzing in the sorting stresser
             r config set zset-max-ziplist-entries 256
             r config set zset-max-ziplist-value 64
@@ -699,6 +730,12 @@ start_server {tags {"zset"}} {
         } elseif {$encoding == "skiplist"} {
             r config set zset-max-ziplist-entries 0
             r config set zset-max-ziplist-value 0
+            r config set zset-use-btree no
+            if {$::accurate} {set elements 1000} else {set elements 100}
+        } elseif {$encoding == "btree"} {
+            r config set zset-max-ziplist-entries 0
+            r config set zset-max-ziplist-value 0
+            r config set zset-use-btree yes
             if {$::accurate} {set elements 1000} else {set elements 100}
         } else {
             puts "Unknown sorted set encoding"
@@ -1018,7 +1055,8 @@ start_server {tags {"zset"}} {
     }
 
     tags {"slow"} {
-        stressers ziplist
+        stressers listpack
         stressers skiplist
+        stressers btree
     }
 }